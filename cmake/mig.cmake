@@ -16,6 +16,9 @@ function(mig defFileName)
         if (NOT MIG_XTRACE_SUFFIX)
                 set (MIG_XTRACE_SUFFIX "XtraceMig.c")
         endif (NOT MIG_XTRACE_SUFFIX)
+        if (NOT MIG_XTRACE_INDEX_SUFFIX)
+                set (MIG_XTRACE_INDEX_SUFFIX "XtraceMig.index")
+        endif (NOT MIG_XTRACE_INDEX_SUFFIX)
 
         get_directory_property(DirDefs DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR} COMPILE_DEFINITIONS)
         get_directory_property(InclDirs DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR} INCLUDE_DIRECTORIES)
@@ -57,6 +60,7 @@ function(mig defFileName)
 			${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_SERVER_SOURCE_SUFFIX}
 			${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_SERVER_HEADER_SUFFIX}
 			${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_SUFFIX}
+			${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_INDEX_SUFFIX}
 			COMMAND
 				/bin/mkdir -p ${CMAKE_CURRENT_BINARY_DIR}/${dirName} \;
 				${MIG_EXECUTABLE}
@@ -67,11 +71,14 @@ function(mig defFileName)
 				-server ${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_SERVER_SOURCE_SUFFIX}
 				-sheader ${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_SERVER_HEADER_SUFFIX}
 				-xtracemig ${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_SUFFIX}
+				-xtracemigindex ${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_INDEX_SUFFIX}
+				-xtracemiglib lib${bareName}_xtrace_mig.dylib
 				${MIG_FLAGS}
 				${CMAKE_CURRENT_SOURCE_DIR}/${defFileName} \;
 				# this is so that the xtrace file is always produced so that the command is not constantly re-run
 				# for MIG definitions that produce no xtrace files
 				touch ${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_SUFFIX}
+				${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_INDEX_SUFFIX}
 			DEPENDS
 				migexe migcom
 		)
@@ -82,6 +89,29 @@ function(mig defFileName)
 				"-I" "${CMAKE_SOURCE_DIR}/src/xtrace/include"
 				"-Wno-extern-initializer")
 			install(TARGETS ${bareName}_xtrace_mig DESTINATION "libexec/darling/usr/lib/darling/xtrace-mig/")
+
+			set_property(GLOBAL APPEND PROPERTY XTRACE_MIG_TARGETS ${bareName}_xtrace_mig)
+			set_property(GLOBAL APPEND PROPERTY XTRACE_MIG_INDEX_FRAGMENTS
+				${CMAKE_CURRENT_BINARY_DIR}/${relativeName}${MIG_ARCH_SUFFIX}${MIG_XTRACE_INDEX_SUFFIX})
 		endif (NOT TARGET ${bareName}_xtrace_mig AND NOT MIG_NO_XTRACE)
 	endforeach()
 endfunction(mig)
+
+# Combines the index entries of all the xtrace MIG libraries built so far into a single file,
+# which xtrace reads at startup to find out which library to load for a given message ID
+# (instead of loading all of them). Must be called after all the calls to mig().
+function(xtrace_mig_index)
+	get_property(targets GLOBAL PROPERTY XTRACE_MIG_TARGETS)
+	get_property(fragments GLOBAL PROPERTY XTRACE_MIG_INDEX_FRAGMENTS)
+
+	add_custom_target(xtrace_mig_index ALL
+		COMMAND cat ${fragments} > ${CMAKE_BINARY_DIR}/xtrace-mig.index
+		BYPRODUCTS ${CMAKE_BINARY_DIR}/xtrace-mig.index
+		COMMENT "Generating xtrace MIG index"
+	)
+	if (targets)
+		add_dependencies(xtrace_mig_index ${targets})
+	endif (targets)
+
+	install(FILES ${CMAKE_BINARY_DIR}/xtrace-mig.index DESTINATION "libexec/darling/usr/lib/darling/")
+endfunction(xtrace_mig_index)
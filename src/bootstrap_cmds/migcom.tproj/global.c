@@ -112,6 +112,8 @@ string_t ServerFileName = strNULL;
 string_t GenerationDate = strNULL;
 #ifdef DARLING
 string_t XtraceMigFileName = strNULL;
+string_t XtraceMigIndexFileName = strNULL;
+string_t XtraceMigLibName = strNULL;
 #endif
 
 void
@@ -140,6 +142,12 @@ more_global()
     XtraceMigFileName = strconcat(SubsystemName, "XtraceMig.c");
   else if (streql(XtraceMigFileName, "/dev/null"))
     XtraceMigFileName = strNULL;
+
+  if (XtraceMigIndexFileName != strNULL && streql(XtraceMigIndexFileName, "/dev/null"))
+    XtraceMigIndexFileName = strNULL;
+
+  if (XtraceMigLibName == strNULL)
+    XtraceMigLibName = strconcat(SubsystemName, "XtraceMig.dylib");
 #endif
 
   if (ServerDemux == strNULL)
@@ -106,6 +106,8 @@ extern string_t UserFileName;
 extern string_t ServerFileName;
 #ifdef DARLING
 extern string_t XtraceMigFileName;
+extern string_t XtraceMigIndexFileName;
+extern string_t XtraceMigLibName;
 #endif
 
 extern void more_global(void);
@@ -284,6 +284,22 @@ parseArgs(int argc,char *argv[])
             XtraceMigFileName = strmake(argv[0]);
             break;
           }
+          else if (streql(argv[0], "-xtracemigindex")) {
+            --argc;
+            ++argv;
+            if (argc == 0)
+              fatal("missing name for -xtracemigindex option");
+            XtraceMigIndexFileName = strmake(argv[0]);
+            break;
+          }
+          else if (streql(argv[0], "-xtracemiglib")) {
+            --argc;
+            ++argv;
+            if (argc == 0)
+              fatal("missing name for -xtracemiglib option");
+            XtraceMigLibName = strmake(argv[0]);
+            break;
+          }
           else
 #endif
           ShortCircuit = TRUE;
@@ -301,6 +317,7 @@ parseArgs(int argc,char *argv[])
 FILE *uheader, *server, *user;
 #ifdef DARLING
 FILE *xtracemig;
+FILE *xtracemigindex;
 #endif
 
 int
@@ -346,6 +363,8 @@ main(int argc, char *argv[])
 #ifdef DARLING
   if (XtraceMigFileName && !IsKernelServer && !IsKernelUser)
     xtracemig = myfopen(XtraceMigFileName, "w");
+  if (XtraceMigIndexFileName && !IsKernelServer && !IsKernelUser)
+    xtracemigindex = myfopen(XtraceMigIndexFileName, "w");
 #endif
   if (BeVerbose) {
     printf("Writing %s ... ", UserHeaderFileName);
@@ -405,6 +424,14 @@ main(int argc, char *argv[])
     }
     WriteXtraceMig(xtracemig, stats);
   }
+  if (XtraceMigIndexFileName && !IsKernelServer && !IsKernelUser) {
+    if (BeVerbose) {
+      printf("done.\nWriting %s ... ", XtraceMigIndexFileName);
+      fflush(stdout);
+    }
+    WriteXtraceMigIndex(xtracemigindex);
+    fclose(xtracemigindex);
+  }
 #endif
   fclose(server);
   if (BeVerbose)
@@ -114,6 +114,8 @@ do
 	-iheader ) iheader="$2"; migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
 	-dheader ) dheader="$2"; migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
 	-xtracemig ) xtracemig="$2"; migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
+	-xtracemigindex ) migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
+	-xtracemiglib ) migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
 	-arch ) arch="$2"; shift; shift;;
 	-target ) target=( "$1" "$2"); shift; shift;;
 	-maxonstack ) migflags=( "${migflags[@]}" "$1" "$2"); shift; shift;;
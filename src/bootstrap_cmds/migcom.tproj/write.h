@@ -77,6 +77,7 @@ extern void WriteBogusServerRoutineAnnotationDefine( FILE *file );
 
 #ifdef DARLING
 extern void WriteXtraceMig( FILE *file, statement_t *stats );
+extern void WriteXtraceMigIndex( FILE *file );
 #endif
 
 #endif /* _WRITE_H */
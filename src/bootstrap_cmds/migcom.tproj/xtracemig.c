@@ -2060,3 +2060,15 @@ WriteXtraceMig(FILE *file, statement_t *stats)
     }
   WriteEpilog(file, stats);
 }
+
+/*************************************************************
+ *  Writes out the xtrace MIG index entry for this subsystem
+ *  (the range of message IDs it covers), so that xtrace can
+ *  tell which decoder library to load for a given message
+ *  without loading all of them. Called by mig.c
+ *************************************************************/
+void
+WriteXtraceMigIndex(FILE *file)
+{
+  fprintf(file, "%d %lu %s %s\n", SubsystemBase, (unsigned long) rtNumber, SubsystemName, XtraceMigLibName);
+}
@@ -1,5 +1,9 @@
+#include <machine/cpu_capabilities.h>
+#include <stdint.h>
+
 int _NumCPUs(void)
 {
-	return 2; // use MP codepaths
+	// mldr fills this in from the host's topology (limited to our affinity mask and cgroup CPU quota)
+	int ncpus = *((volatile uint8_t*) _COMM_PAGE_ACTIVE_CPUS);
+	return (ncpus > 0) ? ncpus : 1;
 }
-
@@ -0,0 +1,1054 @@
+#include "aio.h"
+#include "io_uring.h"
+#include "../base.h"
+#include "../errno.h"
+#include "../duct_errno.h"
+#include "../elfcalls_wrapper.h"
+#include "../fcntl/fcntl.h"
+#include "../fcntl/open.h"
+#include "../guarded/table.h"
+#include "../mman/duct_mman.h"
+#include "../signal/sigaction.h"
+#include "../unistd/close.h"
+#include "../ext/futex.h"
+#include <linux-syscalls/linux.h>
+#include <libsimple/lock.h>
+#include <sys/errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern void* memset(void* s, int c, size_t n);
+
+// POSIX AIO for the whole process is served by a single io_uring instance and one native
+// helper thread that reaps its completions. if io_uring is unavailable (old kernel, seccomp,
+// etc.), we fall back to a small pool of native threads doing plain pread/pwrite/fsync.
+//
+// the helper threads are plain native threads: they never talk to darlingserver and never
+// run Darwin code, so they may only make Linux syscalls. completion notifications are
+// delivered with rt_sigqueueinfo, like the kernel would on macOS.
+
+#define AIO_RING_ENTRIES AIO_MAX_REQUESTS
+#define AIO_MAX_GROUPS AIO_MAX_REQUESTS
+#define AIO_POOL_WORKERS 4
+
+typedef enum aio_backend {
+	aio_backend_none,
+	aio_backend_io_uring,
+	aio_backend_thread_pool,
+} aio_backend_t;
+
+typedef enum aio_state {
+	aio_state_free,
+	aio_state_queued,
+	aio_state_in_progress,
+	aio_state_done,
+} aio_state_t;
+
+// a lio_listio batch
+typedef struct aio_group {
+	bool in_use;
+	bool waited_on;
+	unsigned int remaining;
+	struct sigevent sigevent;
+} aio_group_t;
+
+typedef struct aio_entry {
+	aio_state_t state;
+	struct aiocb* aiocb;
+	int opcode;
+	int fd;
+	long long offset;
+	struct {
+		void* base;
+		size_t length;
+	} iov;
+	struct sigevent sigevent;
+	aio_group_t* group;
+	// byte count on success, negated BSD errno on failure
+	long result;
+	// link in the thread pool queue
+	struct aio_entry* next;
+} aio_entry_t;
+
+typedef struct aio_ring {
+	int fd;
+	void* sq_map;
+	size_t sq_map_size;
+	void* cq_map;
+	size_t cq_map_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	uint32_t* sq_head;
+	uint32_t* sq_tail;
+	uint32_t* sq_mask;
+	uint32_t* sq_array;
+	uint32_t* cq_head;
+	uint32_t* cq_tail;
+	uint32_t* cq_mask;
+	struct io_uring_cqe* cqes;
+	uint32_t unsubmitted;
+} aio_ring_t;
+
+static libsimple_lock_t aio_lock = LIBSIMPLE_LOCK_INITIALIZER;
+static libsimple_condvar_t aio_pool_cond = LIBSIMPLE_CONDVAR_INITIALIZER;
+
+static aio_backend_t aio_backend = aio_backend_none;
+static aio_ring_t aio_ring = { .fd = -1 };
+static aio_entry_t* aio_pool_head = NULL;
+static aio_entry_t* aio_pool_tail = NULL;
+static bool aio_pool_started = false;
+
+// notifications for requests that failed while `aio_lock` was held; sent by `aio_unlock_and_notify`
+static struct sigevent aio_pending_notifications[AIO_MAX_REQUESTS * 2];
+static int aio_pending_notification_count = 0;
+
+static aio_entry_t aio_entries[AIO_MAX_REQUESTS];
+static aio_group_t aio_groups[AIO_MAX_GROUPS];
+
+// bumped on every completion; aio_suspend and lio_listio(LIO_WAIT) sleep on it
+static uint32_t aio_completion_seq = 0;
+static uint32_t aio_completion_waiters = 0;
+
+//
+// notification
+//
+
+static void aio_completion_wake(void)
+{
+	__atomic_add_fetch(&aio_completion_seq, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&aio_completion_waiters, __ATOMIC_SEQ_CST) > 0)
+		LINUX_SYSCALL(__NR_futex, &aio_completion_seq, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 0x7fffffff, NULL);
+}
+
+static long aio_completion_wait(uint32_t seq, const struct timespec* timeout)
+{
+	int ret;
+
+	__atomic_add_fetch(&aio_completion_waiters, 1, __ATOMIC_SEQ_CST);
+	ret = LINUX_SYSCALL(__NR_futex, &aio_completion_seq, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, seq, timeout);
+	__atomic_sub_fetch(&aio_completion_waiters, 1, __ATOMIC_SEQ_CST);
+
+	// EAGAIN just means something completed before we went to sleep
+	if (ret < 0 && ret != -LINUX_EAGAIN)
+		return errno_linux_to_bsd(ret);
+
+	return 0;
+}
+
+// must be called without `aio_lock` held: the handler may well run on this thread and call aio_error()
+static void aio_notify(const struct sigevent* sigevent)
+{
+	struct linux_siginfo info;
+	int linux_signum;
+	int pid;
+
+	if (sigevent->sigev_notify != SIGEV_SIGNAL)
+		return;
+
+	linux_signum = signum_bsd_to_linux(sigevent->sigev_signo);
+	if (linux_signum == 0)
+		return;
+
+	pid = LINUX_SYSCALL0(__NR_getpid);
+
+	memset(&info, 0, sizeof(info));
+	info.si_signo = linux_signum;
+	info.si_code = LINUX_SI_ASYNCIO;
+	info.si_pid = pid;
+	info.si_value = (unsigned long) sigevent->sigev_value.sival_ptr;
+
+	LINUX_SYSCALL3(__NR_rt_sigqueueinfo, pid, linux_signum, &info);
+}
+
+static void aio_entry_finish_locked(aio_entry_t* entry, long result, struct sigevent* entry_sigevent, struct sigevent* group_sigevent)
+{
+	aio_group_t* group = entry->group;
+
+	entry->result = result;
+	entry->state = aio_state_done;
+	entry->group = NULL;
+
+	*entry_sigevent = entry->sigevent;
+	group_sigevent->sigev_notify = SIGEV_NONE;
+
+	if (group && --group->remaining == 0 && !group->waited_on)
+	{
+		// LIO_NOWAIT batches are released by whoever completes the last request;
+		// LIO_WAIT batches are released by the waiter
+		*group_sigevent = group->sigevent;
+		group->in_use = false;
+	}
+}
+
+// fails a request that never reached a backend; the caller must release `aio_lock` with `aio_unlock_and_notify`
+static void aio_entry_fail_locked(aio_entry_t* entry, long result)
+{
+	aio_entry_finish_locked(entry, result, &aio_pending_notifications[aio_pending_notification_count],
+			&aio_pending_notifications[aio_pending_notification_count + 1]);
+	aio_pending_notification_count += 2;
+}
+
+static void aio_unlock_and_notify(void)
+{
+	struct sigevent notifications[AIO_MAX_REQUESTS * 2];
+	int notification_count = aio_pending_notification_count;
+
+	for (int i = 0; i < notification_count; ++i)
+		notifications[i] = aio_pending_notifications[i];
+	aio_pending_notification_count = 0;
+
+	libsimple_lock_unlock(&aio_lock);
+
+	if (notification_count == 0)
+		return;
+
+	aio_completion_wake();
+	for (int i = 0; i < notification_count; ++i)
+		aio_notify(&notifications[i]);
+}
+
+static void aio_complete(aio_entry_t* entry, long linux_result)
+{
+	struct sigevent entry_sigevent;
+	struct sigevent group_sigevent;
+
+	libsimple_lock_lock(&aio_lock);
+	aio_entry_finish_locked(entry, (linux_result < 0) ? errno_linux_to_bsd(linux_result) : linux_result,
+			&entry_sigevent, &group_sigevent);
+	libsimple_lock_unlock(&aio_lock);
+
+	aio_completion_wake();
+	aio_notify(&entry_sigevent);
+	aio_notify(&group_sigevent);
+}
+
+//
+// io_uring backend
+//
+
+static bool aio_thread_pool_setup_locked(void);
+static void aio_pool_append_locked(aio_entry_t* entry);
+
+static void* aio_ring_map(int fd, size_t size, unsigned long offset)
+{
+	void* ret;
+
+#ifdef __NR_mmap2
+	ret = (void*) LINUX_SYSCALL6(__NR_mmap2, NULL, size, LINUX_PROT_READ | LINUX_PROT_WRITE,
+			LINUX_MAP_SHARED | LINUX_MAP_POPULATE, fd, offset / 4096);
+#else
+	ret = (void*) LINUX_SYSCALL6(__NR_mmap, NULL, size, LINUX_PROT_READ | LINUX_PROT_WRITE,
+			LINUX_MAP_SHARED | LINUX_MAP_POPULATE, fd, offset);
+#endif
+
+	if ((unsigned long)ret > (unsigned long) -4096)
+		return NULL;
+
+	return ret;
+}
+
+static void aio_ring_unmap(void)
+{
+	if (aio_ring.sqes)
+		LINUX_SYSCALL2(__NR_munmap, aio_ring.sqes, aio_ring.sqes_size);
+	if (aio_ring.cq_map && aio_ring.cq_map != aio_ring.sq_map)
+		LINUX_SYSCALL2(__NR_munmap, aio_ring.cq_map, aio_ring.cq_map_size);
+	if (aio_ring.sq_map)
+		LINUX_SYSCALL2(__NR_munmap, aio_ring.sq_map, aio_ring.sq_map_size);
+
+	memset(&aio_ring, 0, sizeof(aio_ring));
+	aio_ring.fd = -1;
+}
+
+static void aio_io_uring_reap(void)
+{
+	uint32_t head = *aio_ring.cq_head;
+	uint32_t tail = __atomic_load_n(aio_ring.cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail)
+	{
+		struct io_uring_cqe* cqe = &aio_ring.cqes[head & *aio_ring.cq_mask];
+		aio_entry_t* entry = (aio_entry_t*)(uintptr_t) cqe->user_data;
+		int res = cqe->res;
+
+		// hand the CQE back to the kernel before completing the entry
+		++head;
+		__atomic_store_n(aio_ring.cq_head, head, __ATOMIC_RELEASE);
+
+		aio_complete(entry, res);
+	}
+}
+
+static void* aio_io_uring_reaper(void* context)
+{
+	int fd = aio_ring.fd;
+
+	while (true)
+	{
+		int ret = LINUX_SYSCALL6(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret == -LINUX_EBADF)
+			break;
+
+		aio_io_uring_reap();
+	}
+
+	return NULL;
+}
+
+static bool aio_io_uring_setup_locked(void)
+{
+	struct io_uring_params params;
+	char* sq_map;
+	char* cq_map;
+	int fd;
+
+	memset(&params, 0, sizeof(params));
+
+	fd = LINUX_SYSCALL2(__NR_io_uring_setup, AIO_RING_ENTRIES, &params);
+	if (fd < 0)
+		return false;
+
+	aio_ring.fd = fd;
+	aio_ring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	aio_ring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	aio_ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (aio_ring.cq_map_size > aio_ring.sq_map_size)
+			aio_ring.sq_map_size = aio_ring.cq_map_size;
+		aio_ring.cq_map_size = aio_ring.sq_map_size;
+	}
+
+	aio_ring.sq_map = aio_ring_map(fd, aio_ring.sq_map_size, IORING_OFF_SQ_RING);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		aio_ring.cq_map = aio_ring.sq_map;
+	else
+		aio_ring.cq_map = aio_ring_map(fd, aio_ring.cq_map_size, IORING_OFF_CQ_RING);
+	aio_ring.sqes = aio_ring_map(fd, aio_ring.sqes_size, IORING_OFF_SQES);
+
+	if (!aio_ring.sq_map || !aio_ring.cq_map || !aio_ring.sqes)
+		goto fail;
+
+	sq_map = aio_ring.sq_map;
+	cq_map = aio_ring.cq_map;
+
+	aio_ring.sq_head = (uint32_t*)(sq_map + params.sq_off.head);
+	aio_ring.sq_tail = (uint32_t*)(sq_map + params.sq_off.tail);
+	aio_ring.sq_mask = (uint32_t*)(sq_map + params.sq_off.ring_mask);
+	aio_ring.sq_array = (uint32_t*)(sq_map + params.sq_off.array);
+	aio_ring.cq_head = (uint32_t*)(cq_map + params.cq_off.head);
+	aio_ring.cq_tail = (uint32_t*)(cq_map + params.cq_off.tail);
+	aio_ring.cq_mask = (uint32_t*)(cq_map + params.cq_off.ring_mask);
+	aio_ring.cqes = (struct io_uring_cqe*)(cq_map + params.cq_off.cqes);
+
+	// the program must not be able to close the ring from under us;
+	// after a fork, the child gets its own ring on first use
+	guard_table_add(fd, guard_flag_prevent_close | guard_flag_close_on_fork, NULL);
+
+	if (native_thread_create(aio_io_uring_reaper, NULL) < 0)
+	{
+		guard_table_remove(fd);
+		goto fail;
+	}
+
+	return true;
+
+fail:
+	aio_ring_unmap();
+	close_internal(fd);
+	return false;
+}
+
+static void aio_io_uring_queue_locked(aio_entry_t* entry)
+{
+	uint32_t tail = *aio_ring.sq_tail;
+	uint32_t index = tail & *aio_ring.sq_mask;
+	struct io_uring_sqe* sqe = &aio_ring.sqes[index];
+
+	// there are never more than AIO_MAX_REQUESTS entries outstanding,
+	// so the submission queue can't be full here
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = entry->fd;
+	sqe->user_data = (uintptr_t) entry;
+
+	switch (entry->opcode)
+	{
+		case LIO_READ:
+		case LIO_WRITE:
+			// READV/WRITEV rather than READ/WRITE so that we work on 5.1+
+			sqe->opcode = (entry->opcode == LIO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+			sqe->addr = (uintptr_t) &entry->iov;
+			sqe->len = 1;
+			sqe->off = entry->offset;
+			break;
+		case AIO_OP_DSYNC:
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			// fallthrough
+		case AIO_OP_FSYNC:
+			sqe->opcode = IORING_OP_FSYNC;
+			break;
+	}
+
+	aio_ring.sq_array[index] = index;
+	__atomic_store_n(aio_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	entry->state = aio_state_in_progress;
+	++aio_ring.unsubmitted;
+}
+
+// takes back whatever the kernel hasn't consumed from the submission queue and hands it to the thread pool
+// (or, if even that can't be started, fails it with `error`)
+static void aio_io_uring_requeue_locked(long error)
+{
+	uint32_t head = __atomic_load_n(aio_ring.sq_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = *aio_ring.sq_tail;
+	bool have_pool = aio_thread_pool_setup_locked();
+
+	// without SQPOLL, the kernel only reads the submission queue inside io_uring_enter, so we can safely rewind it
+	__atomic_store_n(aio_ring.sq_tail, head, __ATOMIC_RELEASE);
+	aio_ring.unsubmitted = 0;
+
+	for (; head != tail; ++head)
+	{
+		struct io_uring_sqe* sqe = &aio_ring.sqes[aio_ring.sq_array[head & *aio_ring.sq_mask]];
+		aio_entry_t* entry = (aio_entry_t*)(uintptr_t) sqe->user_data;
+
+		if (have_pool)
+		{
+			entry->state = aio_state_queued;
+			aio_pool_append_locked(entry);
+		}
+		else
+		{
+			aio_entry_fail_locked(entry, error);
+		}
+	}
+}
+
+static void aio_io_uring_submit_locked(void)
+{
+	while (aio_ring.unsubmitted > 0)
+	{
+		int ret = LINUX_SYSCALL6(__NR_io_uring_enter, aio_ring.fd, aio_ring.unsubmitted, 0, 0, NULL, 0);
+
+		if (ret == -LINUX_EINTR)
+			continue;
+		if (ret == -LINUX_EAGAIN || ret == -LINUX_EBUSY)
+		{
+			LINUX_SYSCALL0(__NR_sched_yield);
+			continue;
+		}
+		// anything else is unexpected, and nothing would ever retry the leftovers, so they're handled right here
+		if (ret <= 0)
+		{
+			aio_io_uring_requeue_locked((ret < 0) ? errno_linux_to_bsd(ret) : -EIO);
+			break;
+		}
+
+		aio_ring.unsubmitted -= ret;
+	}
+}
+
+//
+// thread pool backend
+//
+
+static long aio_perform(aio_entry_t* entry)
+{
+	switch (entry->opcode)
+	{
+		case LIO_READ:
+			return LINUX_SYSCALL(__NR_pread64, entry->fd, entry->iov.base, entry->iov.length, LL_ARG(entry->offset));
+		case LIO_WRITE:
+			return LINUX_SYSCALL(__NR_pwrite64, entry->fd, entry->iov.base, entry->iov.length, LL_ARG(entry->offset));
+		case AIO_OP_FSYNC:
+			return LINUX_SYSCALL1(__NR_fsync, entry->fd);
+		case AIO_OP_DSYNC:
+			return LINUX_SYSCALL1(__NR_fdatasync, entry->fd);
+	}
+
+	return -LINUX_EINVAL;
+}
+
+static void* aio_pool_worker(void* context)
+{
+	while (true)
+	{
+		aio_entry_t* entry;
+
+		libsimple_lock_lock(&aio_lock);
+
+		while (aio_pool_head == NULL)
+			libsimple_condvar_wait(&aio_pool_cond, &aio_lock);
+
+		entry = aio_pool_head;
+		aio_pool_head = entry->next;
+		if (aio_pool_head == NULL)
+			aio_pool_tail = NULL;
+		entry->next = NULL;
+		entry->state = aio_state_in_progress;
+
+		libsimple_lock_unlock(&aio_lock);
+
+		// nobody touches an in-progress entry but us
+		aio_complete(entry, aio_perform(entry));
+	}
+
+	return NULL;
+}
+
+// also used as a fallback by the io_uring backend, so this may be called more than once
+static bool aio_thread_pool_setup_locked(void)
+{
+	int started = 0;
+
+	if (aio_pool_started)
+		return true;
+
+	for (int i = 0; i < AIO_POOL_WORKERS; ++i)
+	{
+		if (native_thread_create(aio_pool_worker, NULL) == 0)
+			++started;
+	}
+
+	aio_pool_started = started > 0;
+	return aio_pool_started;
+}
+
+static void aio_pool_append_locked(aio_entry_t* entry)
+{
+	if (aio_pool_tail)
+		aio_pool_tail->next = entry;
+	else
+		aio_pool_head = entry;
+	aio_pool_tail = entry;
+
+	libsimple_condvar_notify_one(&aio_pool_cond, &aio_lock);
+}
+
+static void aio_pool_remove_locked(aio_entry_t* entry)
+{
+	aio_entry_t* prev = NULL;
+
+	for (aio_entry_t* it = aio_pool_head; it != NULL; prev = it, it = it->next)
+	{
+		if (it != entry)
+			continue;
+
+		if (prev)
+			prev->next = entry->next;
+		else
+			aio_pool_head = entry->next;
+
+		if (aio_pool_tail == entry)
+			aio_pool_tail = prev;
+
+		entry->next = NULL;
+		break;
+	}
+}
+
+//
+// common
+//
+
+static bool aio_prepare_locked(void)
+{
+#ifdef VARIANT_DYLD
+	return false;
+#else
+	if (aio_backend != aio_backend_none)
+		return true;
+
+	if (aio_io_uring_setup_locked())
+		aio_backend = aio_backend_io_uring;
+	else if (aio_thread_pool_setup_locked())
+		aio_backend = aio_backend_thread_pool;
+
+	return aio_backend != aio_backend_none;
+#endif
+}
+
+static void aio_entry_dispatch_locked(aio_entry_t* entry)
+{
+	if (aio_backend == aio_backend_io_uring)
+	{
+		aio_io_uring_queue_locked(entry);
+		return;
+	}
+
+	aio_pool_append_locked(entry);
+}
+
+static void aio_dispatch_flush_locked(void)
+{
+	if (aio_backend == aio_backend_io_uring)
+		aio_io_uring_submit_locked();
+}
+
+static aio_entry_t* aio_entry_find_locked(const struct aiocb* aiocbp)
+{
+	for (size_t i = 0; i < AIO_MAX_REQUESTS; ++i)
+	{
+		if (aio_entries[i].state != aio_state_free && aio_entries[i].aiocb == aiocbp)
+			return &aio_entries[i];
+	}
+
+	return NULL;
+}
+
+static long aio_entry_allocate_locked(struct aiocb* aiocbp, int opcode, aio_entry_t** out_entry)
+{
+	aio_entry_t* entry = aio_entry_find_locked(aiocbp);
+
+	if (entry != NULL)
+	{
+		// an aiocb describes one request at a time, but lots of code reuses an aiocb
+		// once aio_error() says it's done without bothering to call aio_return()
+		if (entry->state != aio_state_done)
+			return -EINVAL;
+	}
+	else
+	{
+		for (size_t i = 0; i < AIO_MAX_REQUESTS; ++i)
+		{
+			if (aio_entries[i].state == aio_state_free)
+			{
+				entry = &aio_entries[i];
+				break;
+			}
+		}
+
+		if (entry == NULL)
+			return -EAGAIN;
+	}
+
+	entry->state = aio_state_queued;
+	entry->aiocb = aiocbp;
+	entry->opcode = opcode;
+	entry->fd = aiocbp->aio_fildes;
+	entry->offset = aiocbp->aio_offset;
+	entry->iov.base = (void*) aiocbp->aio_buf;
+	entry->iov.length = aiocbp->aio_nbytes;
+	entry->sigevent = aiocbp->aio_sigevent;
+	entry->group = NULL;
+	entry->result = 0;
+	entry->next = NULL;
+
+	*out_entry = entry;
+	return 0;
+}
+
+static aio_group_t* aio_group_allocate_locked(void)
+{
+	for (size_t i = 0; i < AIO_MAX_GROUPS; ++i)
+	{
+		if (!aio_groups[i].in_use)
+		{
+			memset(&aio_groups[i], 0, sizeof(aio_groups[i]));
+			aio_groups[i].in_use = true;
+			aio_groups[i].sigevent.sigev_notify = SIGEV_NONE;
+			return &aio_groups[i];
+		}
+	}
+
+	return NULL;
+}
+
+static long aio_validate_sigevent(const struct sigevent* sigevent)
+{
+	switch (sigevent->sigev_notify)
+	{
+		case SIGEV_NONE:
+			return 0;
+		case SIGEV_SIGNAL:
+			if (sigevent->sigev_signo <= 0 || sigevent->sigev_signo >= NSIG
+					|| sigevent->sigev_signo == SIGKILL || sigevent->sigev_signo == SIGSTOP)
+				return -EINVAL;
+			return 0;
+		default:
+			// XNU doesn't support SIGEV_THREAD for AIO either
+			return -EINVAL;
+	}
+}
+
+static long aio_validate(const struct aiocb* aiocbp, int opcode)
+{
+	long ret;
+	int flags;
+
+	if (aiocbp == NULL)
+		return -EINVAL;
+
+	ret = aio_validate_sigevent(&aiocbp->aio_sigevent);
+	if (ret < 0)
+		return ret;
+
+	if (opcode == LIO_READ || opcode == LIO_WRITE)
+	{
+		if (aiocbp->aio_offset < 0 || aiocbp->aio_nbytes > INTPTR_MAX)
+			return -EINVAL;
+	}
+
+	flags = LINUX_SYSCALL(__NR_fcntl, aiocbp->aio_fildes, LINUX_F_GETFL);
+	if (flags < 0)
+		return -EBADF;
+
+	if (opcode == LIO_READ && (flags & 3) == LINUX_O_WRONLY)
+		return -EBADF;
+	if (opcode == LIO_WRITE && (flags & 3) == LINUX_O_RDONLY)
+		return -EBADF;
+
+	return 0;
+}
+
+long aio_submit(struct aiocb* aiocbp, int opcode)
+{
+	aio_entry_t* entry;
+	long ret;
+
+	ret = aio_validate(aiocbp, opcode);
+	if (ret < 0)
+		return ret;
+
+	libsimple_lock_lock(&aio_lock);
+
+	if (!aio_prepare_locked())
+	{
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	ret = aio_entry_allocate_locked(aiocbp, opcode, &entry);
+	if (ret < 0)
+		goto out;
+
+	aio_entry_dispatch_locked(entry);
+	aio_dispatch_flush_locked();
+
+out:
+	aio_unlock_and_notify();
+	return ret;
+}
+
+long aio_submit_list(int mode, struct aiocb* const* list, int nent, const struct sigevent* sigevent)
+{
+	aio_entry_t* entries[AIO_LISTIO_MAX];
+	aio_group_t* group;
+	int count = 0;
+	bool failed = false;
+	long ret;
+
+	if (mode != LIO_WAIT && mode != LIO_NOWAIT)
+		return -EINVAL;
+	if (list == NULL || nent < 1 || nent > AIO_LISTIO_MAX)
+		return -EINVAL;
+
+	if (mode == LIO_NOWAIT && sigevent != NULL)
+	{
+		ret = aio_validate_sigevent(sigevent);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (int i = 0; i < nent; ++i)
+	{
+		if (list[i] == NULL || list[i]->aio_lio_opcode == LIO_NOP)
+			continue;
+		if (list[i]->aio_lio_opcode != LIO_READ && list[i]->aio_lio_opcode != LIO_WRITE)
+			return -EINVAL;
+
+		ret = aio_validate(list[i], list[i]->aio_lio_opcode);
+		if (ret < 0)
+			return ret;
+	}
+
+	libsimple_lock_lock(&aio_lock);
+
+	if (!aio_prepare_locked() || (group = aio_group_allocate_locked()) == NULL)
+	{
+		libsimple_lock_unlock(&aio_lock);
+		return -EAGAIN;
+	}
+
+	group->waited_on = (mode == LIO_WAIT);
+	if (mode == LIO_NOWAIT && sigevent != NULL)
+		group->sigevent = *sigevent;
+
+	// like XNU, either the whole batch is queued or none of it is
+	for (int i = 0; i < nent; ++i)
+	{
+		if (list[i] == NULL || list[i]->aio_lio_opcode == LIO_NOP)
+			continue;
+
+		ret = aio_entry_allocate_locked(list[i], list[i]->aio_lio_opcode, &entries[count]);
+		if (ret < 0)
+		{
+			for (int j = 0; j < count; ++j)
+				entries[j]->state = aio_state_free;
+			group->in_use = false;
+			libsimple_lock_unlock(&aio_lock);
+			return ret;
+		}
+
+		entries[count++]->group = group;
+	}
+
+	group->remaining = count;
+	if (count == 0)
+		group->in_use = false;
+
+	// for io_uring, the whole batch goes to the kernel with a single io_uring_enter
+	for (int i = 0; i < count; ++i)
+		aio_entry_dispatch_locked(entries[i]);
+	aio_dispatch_flush_locked();
+
+	aio_unlock_and_notify();
+
+	if (mode == LIO_NOWAIT || count == 0)
+		return 0;
+
+	while (true)
+	{
+		uint32_t seq = __atomic_load_n(&aio_completion_seq, __ATOMIC_SEQ_CST);
+		bool done;
+
+		libsimple_lock_lock(&aio_lock);
+		done = group->remaining == 0;
+		if (done)
+			group->in_use = false;
+		libsimple_lock_unlock(&aio_lock);
+
+		if (done)
+			break;
+
+		if (aio_completion_wait(seq, NULL) == -EINTR)
+		{
+			// the requests keep going; like a LIO_NOWAIT batch without a notification,
+			// the batch is now released by whoever completes its last request
+			libsimple_lock_lock(&aio_lock);
+			if (group->remaining == 0)
+				group->in_use = false;
+			else
+				group->waited_on = false;
+			libsimple_lock_unlock(&aio_lock);
+
+			return -EINTR;
+		}
+	}
+
+	// like XNU, report EIO if any request in the batch failed (aio_error() has the details)
+	libsimple_lock_lock(&aio_lock);
+	for (int i = 0; i < nent; ++i)
+	{
+		aio_entry_t* entry;
+
+		if (list[i] == NULL || list[i]->aio_lio_opcode == LIO_NOP)
+			continue;
+
+		entry = aio_entry_find_locked(list[i]);
+		if (entry && entry->state == aio_state_done && entry->result < 0)
+			failed = true;
+	}
+	libsimple_lock_unlock(&aio_lock);
+
+	return failed ? -EIO : 0;
+}
+
+long aio_entry_error(const struct aiocb* aiocbp)
+{
+	aio_entry_t* entry;
+	long ret;
+
+	libsimple_lock_lock(&aio_lock);
+
+	entry = aio_entry_find_locked(aiocbp);
+	if (entry == NULL)
+		ret = -EINVAL;
+	else if (entry->state != aio_state_done)
+		ret = EINPROGRESS;
+	else
+		ret = (entry->result < 0) ? -entry->result : 0;
+
+	libsimple_lock_unlock(&aio_lock);
+
+	return ret;
+}
+
+long aio_entry_return(struct aiocb* aiocbp)
+{
+	aio_entry_t* entry;
+	long ret;
+
+	libsimple_lock_lock(&aio_lock);
+
+	entry = aio_entry_find_locked(aiocbp);
+	if (entry == NULL || entry->state != aio_state_done)
+	{
+		ret = -EINVAL;
+	}
+	else
+	{
+		ret = entry->result;
+		entry->state = aio_state_free;
+		entry->aiocb = NULL;
+	}
+
+	libsimple_lock_unlock(&aio_lock);
+
+	return ret;
+}
+
+long aio_entry_cancel(int fd, struct aiocb* aiocbp)
+{
+	// two notifications (the request's and its batch's) per canceled request
+	struct sigevent notifications[AIO_MAX_REQUESTS * 2];
+	int notification_count = 0;
+	bool canceled = false;
+	bool not_canceled = false;
+
+	if (aiocbp != NULL && aiocbp->aio_fildes != fd)
+		return -EBADF;
+	if (LINUX_SYSCALL(__NR_fcntl, fd, LINUX_F_GETFL) < 0)
+		return -EBADF;
+
+	libsimple_lock_lock(&aio_lock);
+
+	for (size_t i = 0; i < AIO_MAX_REQUESTS; ++i)
+	{
+		aio_entry_t* entry = &aio_entries[i];
+
+		if (entry->state == aio_state_free)
+			continue;
+		if (aiocbp != NULL ? (entry->aiocb != aiocbp) : (entry->fd != fd))
+			continue;
+
+		switch (entry->state)
+		{
+			case aio_state_queued:
+				// only requests still waiting for a pool thread can be pulled back;
+				// once the kernel has a request, we let it run to completion
+				aio_pool_remove_locked(entry);
+				aio_entry_finish_locked(entry, -ECANCELED,
+						&notifications[notification_count], &notifications[notification_count + 1]);
+				notification_count += 2;
+				canceled = true;
+				break;
+			case aio_state_in_progress:
+				not_canceled = true;
+				break;
+			default:
+				break;
+		}
+	}
+
+	libsimple_lock_unlock(&aio_lock);
+
+	if (canceled)
+		aio_completion_wake();
+
+	for (int i = 0; i < notification_count; ++i)
+		aio_notify(&notifications[i]);
+
+	if (not_canceled)
+		return AIO_NOTCANCELED;
+	if (canceled)
+		return AIO_CANCELED;
+	return AIO_ALLDONE;
+}
+
+long aio_wait_any(struct aiocb* const* list, int nent, const struct timespec* timeout)
+{
+	struct timespec deadline;
+	struct timespec now;
+	struct timespec remaining;
+
+	if (list == NULL || nent < 1 || nent > AIO_MAX_REQUESTS)
+		return -EINVAL;
+
+	if (timeout != NULL)
+	{
+		if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000)
+			return -EINVAL;
+
+		LINUX_SYSCALL2(__NR_clock_gettime, 1 /* CLOCK_MONOTONIC */, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	while (true)
+	{
+		uint32_t seq = __atomic_load_n(&aio_completion_seq, __ATOMIC_SEQ_CST);
+		bool any_done = false;
+		long ret;
+
+		libsimple_lock_lock(&aio_lock);
+		for (int i = 0; i < nent && !any_done; ++i)
+		{
+			aio_entry_t* entry;
+
+			if (list[i] == NULL)
+				continue;
+
+			// an aiocb we don't know about has already been aio_return()ed
+			entry = aio_entry_find_locked(list[i]);
+			any_done = (entry == NULL || entry->state == aio_state_done);
+		}
+		libsimple_lock_unlock(&aio_lock);
+
+		if (any_done)
+			return 0;
+
+		if (timeout != NULL)
+		{
+			LINUX_SYSCALL2(__NR_clock_gettime, 1 /* CLOCK_MONOTONIC */, &now);
+
+			remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+			remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0)
+			{
+				remaining.tv_sec--;
+				remaining.tv_nsec += 1000000000;
+			}
+
+			if (remaining.tv_sec < 0)
+				return -EAGAIN;
+		}
+
+		ret = aio_completion_wait(seq, (timeout != NULL) ? &remaining : NULL);
+		if (ret == -EINTR)
+			return ret;
+		// a timeout is caught on the next pass
+	}
+}
+
+void aio_postfork_child(void)
+{
+	// the helper threads stayed behind in the parent, and so did the requests;
+	// like on XNU, the child starts out with no outstanding AIO
+	libsimple_lock_init(&aio_lock);
+	libsimple_condvar_init(&aio_pool_cond);
+
+	// the ring descriptor itself has already been closed by `guard_table_postfork_child`
+	if (aio_backend == aio_backend_io_uring)
+		aio_ring_unmap();
+
+	aio_backend = aio_backend_none;
+	aio_pool_head = aio_pool_tail = NULL;
+	aio_pool_started = false;
+	aio_pending_notification_count = 0;
+	aio_completion_seq = 0;
+	aio_completion_waiters = 0;
+
+	memset(aio_entries, 0, sizeof(aio_entries));
+	memset(aio_groups, 0, sizeof(aio_groups));
+}
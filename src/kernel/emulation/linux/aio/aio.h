@@ -0,0 +1,25 @@
+#ifndef LINUX_AIO_H
+#define LINUX_AIO_H
+
+#include <sys/aio.h>
+
+// operations besides LIO_READ and LIO_WRITE that can be queued
+#define AIO_OP_FSYNC 0x100
+#define AIO_OP_DSYNC 0x101
+
+// XNU's default `kern.aioprocmax` is only 16, but outstanding requests are cheap for us.
+// this must not exceed the size of the io_uring submission queue.
+#define AIO_MAX_REQUESTS 128
+
+long aio_submit(struct aiocb* aiocbp, int opcode);
+long aio_submit_list(int mode, struct aiocb* const* list, int nent, const struct sigevent* sigevent);
+
+long aio_entry_error(const struct aiocb* aiocbp);
+long aio_entry_return(struct aiocb* aiocbp);
+long aio_entry_cancel(int fd, struct aiocb* aiocbp);
+
+long aio_wait_any(struct aiocb* const* list, int nent, const struct timespec* timeout);
+
+void aio_postfork_child(void);
+
+#endif
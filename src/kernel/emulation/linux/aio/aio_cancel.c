@@ -0,0 +1,8 @@
+#include "aio_cancel.h"
+#include "aio.h"
+
+long sys_aio_cancel(int fd, struct aiocb* aiocbp)
+{
+	return aio_entry_cancel(fd, aiocbp);
+}
+
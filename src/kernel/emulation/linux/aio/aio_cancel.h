@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_CANCEL_H
+#define LINUX_AIO_CANCEL_H
+
+struct aiocb;
+long sys_aio_cancel(int fd, struct aiocb* aiocbp);
+
+#endif
+
@@ -0,0 +1,8 @@
+#include "aio_error.h"
+#include "aio.h"
+
+long sys_aio_error(const struct aiocb* aiocbp)
+{
+	return aio_entry_error(aiocbp);
+}
+
@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_ERROR_H
+#define LINUX_AIO_ERROR_H
+
+struct aiocb;
+long sys_aio_error(const struct aiocb* aiocbp);
+
+#endif
+
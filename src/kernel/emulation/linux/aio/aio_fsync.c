@@ -0,0 +1,16 @@
+#include "aio_fsync.h"
+#include "aio.h"
+#include <sys/errno.h>
+#include <sys/fcntl.h>
+
+long sys_aio_fsync(int op, struct aiocb* aiocbp)
+{
+	// XNU treats 0 the same as O_SYNC
+	if (op == O_SYNC || op == 0)
+		return aio_submit(aiocbp, AIO_OP_FSYNC);
+	if (op == O_DSYNC)
+		return aio_submit(aiocbp, AIO_OP_DSYNC);
+
+	return -EINVAL;
+}
+
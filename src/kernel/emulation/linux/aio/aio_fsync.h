@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_FSYNC_H
+#define LINUX_AIO_FSYNC_H
+
+struct aiocb;
+long sys_aio_fsync(int op, struct aiocb* aiocbp);
+
+#endif
+
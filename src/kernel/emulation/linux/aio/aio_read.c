@@ -0,0 +1,8 @@
+#include "aio_read.h"
+#include "aio.h"
+
+long sys_aio_read(struct aiocb* aiocbp)
+{
+	return aio_submit(aiocbp, LIO_READ);
+}
+
@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_READ_H
+#define LINUX_AIO_READ_H
+
+struct aiocb;
+long sys_aio_read(struct aiocb* aiocbp);
+
+#endif
+
@@ -0,0 +1,8 @@
+#include "aio_return.h"
+#include "aio.h"
+
+long sys_aio_return(struct aiocb* aiocbp)
+{
+	return aio_entry_return(aiocbp);
+}
+
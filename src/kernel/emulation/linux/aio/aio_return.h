@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_RETURN_H
+#define LINUX_AIO_RETURN_H
+
+struct aiocb;
+long sys_aio_return(struct aiocb* aiocbp);
+
+#endif
+
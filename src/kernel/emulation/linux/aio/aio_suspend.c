@@ -0,0 +1,15 @@
+#include "aio_suspend.h"
+#include "aio.h"
+#include "../bsdthread/cancelable.h"
+
+long sys_aio_suspend(struct aiocb* const* aiocblist, int nent, const struct timespec* timeout)
+{
+	CANCELATION_POINT();
+	return sys_aio_suspend_nocancel(aiocblist, nent, timeout);
+}
+
+long sys_aio_suspend_nocancel(struct aiocb* const* aiocblist, int nent, const struct timespec* timeout)
+{
+	return aio_wait_any(aiocblist, nent, timeout);
+}
+
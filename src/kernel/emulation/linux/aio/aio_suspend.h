@@ -0,0 +1,11 @@
+#ifndef LINUX_AIO_SUSPEND_H
+#define LINUX_AIO_SUSPEND_H
+
+struct aiocb;
+struct timespec;
+
+long sys_aio_suspend(struct aiocb* const* aiocblist, int nent, const struct timespec* timeout);
+long sys_aio_suspend_nocancel(struct aiocb* const* aiocblist, int nent, const struct timespec* timeout);
+
+#endif
+
@@ -0,0 +1,8 @@
+#include "aio_write.h"
+#include "aio.h"
+
+long sys_aio_write(struct aiocb* aiocbp)
+{
+	return aio_submit(aiocbp, LIO_WRITE);
+}
+
@@ -0,0 +1,8 @@
+#ifndef LINUX_AIO_WRITE_H
+#define LINUX_AIO_WRITE_H
+
+struct aiocb;
+long sys_aio_write(struct aiocb* aiocbp);
+
+#endif
+
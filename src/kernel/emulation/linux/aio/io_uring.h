@@ -0,0 +1,85 @@
+#ifndef LINUX_AIO_IO_URING_H
+#define LINUX_AIO_IO_URING_H
+
+#include <stdint.h>
+
+// the parts of the Linux io_uring ABI (include/uapi/linux/io_uring.h) that we use
+
+#define IORING_OP_NOP 0
+#define IORING_OP_READV 1
+#define IORING_OP_WRITEV 2
+#define IORING_OP_FSYNC 3
+
+#define IORING_FSYNC_DATASYNC (1U << 0)
+
+#define IORING_ENTER_GETEVENTS (1U << 0)
+
+#define IORING_FEAT_SINGLE_MMAP (1U << 0)
+
+#define IORING_OFF_SQ_RING 0UL
+#define IORING_OFF_CQ_RING 0x8000000UL
+#define IORING_OFF_SQES 0x10000000UL
+
+struct io_uring_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off;
+	uint64_t addr;
+	uint32_t len;
+	union {
+		uint32_t rw_flags;
+		uint32_t fsync_flags;
+	};
+	uint64_t user_data;
+	uint16_t buf_index;
+	uint16_t personality;
+	int32_t splice_fd_in;
+	uint64_t __pad2[2];
+};
+
+struct io_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct io_sqring_offsets {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t flags;
+	uint32_t dropped;
+	uint32_t array;
+	uint32_t resv1;
+	uint64_t resv2;
+};
+
+struct io_cqring_offsets {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t ring_mask;
+	uint32_t ring_entries;
+	uint32_t overflow;
+	uint32_t cqes;
+	uint32_t flags;
+	uint32_t resv1;
+	uint64_t resv2;
+};
+
+struct io_uring_params {
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+	uint32_t sq_thread_cpu;
+	uint32_t sq_thread_idle;
+	uint32_t features;
+	uint32_t wq_fd;
+	uint32_t resv[3];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+#endif
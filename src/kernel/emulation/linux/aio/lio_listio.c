@@ -0,0 +1,8 @@
+#include "lio_listio.h"
+#include "aio.h"
+
+long sys_lio_listio(int mode, struct aiocb* const* aiocblist, int nent, struct sigevent* sig)
+{
+	return aio_submit_list(mode, aiocblist, nent, sig);
+}
+
@@ -0,0 +1,10 @@
+#ifndef LINUX_LIO_LISTIO_H
+#define LINUX_LIO_LISTIO_H
+
+struct aiocb;
+struct sigevent;
+
+long sys_lio_listio(int mode, struct aiocb* const* aiocblist, int nent, struct sigevent* sig);
+
+#endif
+
@@ -56,6 +56,11 @@ void* __darling_thread_get_stack(void)
 	return elfcalls()->darling_thread_get_stack();
 }
 
+int native_thread_create(void* (*entry)(void*), void* arg)
+{
+	return elfcalls()->native_thread_create(entry, arg);
+}
+
 void* native_dlopen(const char* path)
 {
 	return elfcalls()->dlopen(path);
@@ -92,6 +97,10 @@ void __dserver_close_socket(int socket) {
 	return elfcalls()->dserver_close_socket(socket);
 };
 
+void __dserver_socket_postfork_child(void) {
+	return elfcalls()->dserver_socket_postfork_child();
+};
+
 int __dserver_get_process_lifetime_pipe() {
 	return elfcalls()->dserver_get_process_lifetime_pipe();
 }
@@ -28,10 +28,14 @@ int __darling_thread_terminate(void* stackaddr,
 
 void* __darling_thread_get_stack(void);
 
+// Plain native threads (no Darwin TSD, no darlingserver connection)
+int native_thread_create(void* (*entry)(void*), void* arg);
+
 const void* __dserver_socket_address(void);
 int __dserver_per_thread_socket(void);
 void __dserver_per_thread_socket_refresh(void);
 void __dserver_close_socket(int socket);
+void __dserver_socket_postfork_child(void);
 
 int __dserver_get_process_lifetime_pipe(void);
 int __dserver_process_lifetime_pipe_refresh(void);
@@ -2,8 +2,11 @@
 #include <darlingserver/rpc.h>
 #include <linux-syscalls/linux.h>
 #include "../errno.h"
+#include "../mach/msg_local.h"
 
 int _dserver_rpc_kqchan_mach_port_open_4libkqueue(uint32_t port_name, void* receive_buffer, uint64_t receive_buffer_size, uint64_t saved_filter_flags, int* out_socket) {
+	// the server is the one watching the port now
+	msg_local_demote(port_name);
 	return dserver_rpc_kqchan_mach_port_open(port_name, receive_buffer, receive_buffer_size, saved_filter_flags, out_socket);
 };
 
@@ -3,6 +3,10 @@
 #include "../misc/abort_with_payload.h"
 #include "../fcntl/open.h"
 #include "../unistd/close.h"
+#include "../unistd/ftruncate.h"
+#include "../unistd/getpid.h"
+#include "../unistd/read.h"
+#include "../stat/fstat.h"
 
 VISIBLE
 void* _mmap_for_xtrace(void* start, unsigned long len, int prot, int flags, int fd, long pos) {
@@ -29,6 +33,22 @@ long _close_for_xtrace(int fd) {
 	return sys_close_nocancel(fd);
 };
 
+long _ftruncate_for_xtrace(int fd, long long length) {
+	return sys_ftruncate(fd, length);
+};
+
+long _getpid_for_xtrace(void) {
+	return sys_getpid();
+};
+
+long _read_for_xtrace(int fd, void* mem, int len) {
+	return sys_read_nocancel(fd, mem, len);
+};
+
+long _fstat64_for_xtrace(int fd, struct stat64* stat) {
+	return sys_fstat64(fd, stat);
+};
+
 extern size_t default_sigaltstack_size;
 
 long _sigaltstack_set_default_size_for_xtrace(size_t new_size) {
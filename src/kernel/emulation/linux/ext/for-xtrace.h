@@ -23,6 +23,20 @@ long _open_for_xtrace(const char* filename, int flags, unsigned int mode);
 VISIBLE
 long _close_for_xtrace(int fd);
 
+VISIBLE
+long _ftruncate_for_xtrace(int fd, long long length);
+
+VISIBLE
+long _getpid_for_xtrace(void);
+
+VISIBLE
+long _read_for_xtrace(int fd, void* mem, int len);
+
+struct stat64;
+
+VISIBLE
+long _fstat64_for_xtrace(int fd, struct stat64* stat);
+
 VISIBLE
 long _sigaltstack_set_default_size_for_xtrace(size_t new_size);
 
@@ -3,6 +3,13 @@
 
 #define FUTEX_WAIT	0
 #define FUTEX_WAKE	1
+#define FUTEX_WAIT_BITSET	9
+
+#ifndef FUTEX_PRIVATE_FLAG
+#	define FUTEX_PRIVATE_FLAG	128
+#endif
+
+#define FUTEX_BITSET_MATCH_ANY	0xffffffff
 
 struct timespec;
 
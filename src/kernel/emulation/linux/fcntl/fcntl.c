@@ -144,6 +144,7 @@ long sys_fcntl_nocancel(int fd, int cmd, long arg)
 		} break;
 		case F_DUPFD:
 		case F_DUPFD_CLOEXEC:
+			fdpath_cache_dup(fd, ret);
 			kqueue_dup(fd, ret);
 			break;
 	}
@@ -8,6 +8,7 @@
 #include "../simple.h"
 #include "../vchroot_expand.h"
 #include "../bsdthread/cancelable.h"
+#include "../fdpath.h"
 
 #include <darlingserver/rpc.h>
 
@@ -83,6 +84,8 @@ long sys_openat_nocancel(int fd, const char* filename, int flags, unsigned int m
 	ret = LINUX_SYSCALL(__NR_openat, vc.dfd, vc.path, linux_flags, mode);
 	if (ret < 0)
 		ret = errno_linux_to_bsd(ret);
+	else
+		fdpath_cache_set(ret, vc.path);
 
 	return ret;
 }
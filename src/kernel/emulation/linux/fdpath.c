@@ -1,6 +1,43 @@
 #include "fdpath.h"
 #include "mach/lkm.h"
+#include "vchroot_expand.h"
 #include <lkm/api.h>
+#include <libsimple/lock.h>
+
+extern __SIZE_TYPE__ strlen(const char* str);
+extern int strncmp(const char* str1, const char* str2, __SIZE_TYPE__ n);
+extern void* memcpy(void* dest, const void* src, __SIZE_TYPE__ len);
+
+// Direct-mapped on the descriptor number; low descriptors are what gets reused the most.
+#define FDPATH_CACHE_SIZE 64
+#define FDPATH_CACHE_MAXLEN 1024
+
+struct fdpath_cache_entry
+{
+	int fd; // -1 if unused
+	int length;
+	char path[FDPATH_CACHE_MAXLEN];
+};
+
+static libsimple_lock_t fdpath_cache_lock = LIBSIMPLE_LOCK_INITIALIZER;
+static struct fdpath_cache_entry fdpath_cache[FDPATH_CACHE_SIZE];
+static int fdpath_cache_initialized = 0;
+
+static inline struct fdpath_cache_entry* fdpath_cache_slot(int fd)
+{
+	return &fdpath_cache[(unsigned int)fd % FDPATH_CACHE_SIZE];
+}
+
+// must be called with the lock held
+static void fdpath_cache_init(void)
+{
+	if (fdpath_cache_initialized)
+		return;
+
+	for (int i = 0; i < FDPATH_CACHE_SIZE; i++)
+		fdpath_cache[i].fd = -1;
+	fdpath_cache_initialized = 1;
+}
 
 int fdpath(int fd, char* buf, size_t bufsiz)
 {
@@ -9,8 +46,131 @@ int fdpath(int fd, char* buf, size_t bufsiz)
 		.path = buf,
 		.maxlen = bufsiz
 	};
+	char cached[FDPATH_CACHE_MAXLEN];
+	int length = -1;
+
+	if (fd >= 0)
+	{
+		struct fdpath_cache_entry* entry = fdpath_cache_slot(fd);
+
+		libsimple_lock_lock(&fdpath_cache_lock);
+		if (fdpath_cache_initialized && entry->fd == fd)
+		{
+			length = entry->length;
+			memcpy(cached, entry->path, length + 1);
+		}
+		libsimple_lock_unlock(&fdpath_cache_lock);
+	}
+
+	if (length >= 0)
+		return vchroot_unexpand_path(cached, length, buf, bufsiz);
 
 	// return lkm_call(NR_vchroot_fdpath, &args);
 	return vchroot_fdpath(&args);
 }
 
+void fdpath_cache_set(int fd, const char* expanded_path)
+{
+	__SIZE_TYPE__ length;
+	struct fdpath_cache_entry* entry;
+
+	if (fd < 0)
+		return;
+
+	length = strlen(expanded_path);
+	entry = fdpath_cache_slot(fd);
+
+	libsimple_lock_lock(&fdpath_cache_lock);
+	fdpath_cache_init();
+
+	// pseudo-files under /proc don't have a stable name; /proc/self/fd/N knows better than us.
+	// relative paths and overly long ones aren't worth it, either.
+	if (expanded_path[0] != '/' || length >= FDPATH_CACHE_MAXLEN || strncmp(expanded_path, "/proc/", 6) == 0)
+	{
+		if (entry->fd == fd)
+			entry->fd = -1;
+	}
+	else
+	{
+		entry->fd = fd;
+		entry->length = length;
+		memcpy(entry->path, expanded_path, length + 1);
+	}
+	libsimple_lock_unlock(&fdpath_cache_lock);
+}
+
+void fdpath_cache_dup(int oldfd, int newfd)
+{
+	struct fdpath_cache_entry* old_entry;
+	struct fdpath_cache_entry* new_entry;
+
+	if (oldfd < 0 || newfd < 0 || oldfd == newfd)
+		return;
+
+	old_entry = fdpath_cache_slot(oldfd);
+	new_entry = fdpath_cache_slot(newfd);
+
+	libsimple_lock_lock(&fdpath_cache_lock);
+	fdpath_cache_init();
+
+	if (old_entry->fd == oldfd)
+	{
+		// both descriptors can only share a slot if they're FDPATH_CACHE_SIZE apart; the newer one wins
+		if (old_entry != new_entry)
+		{
+			new_entry->length = old_entry->length;
+			memcpy(new_entry->path, old_entry->path, old_entry->length + 1);
+		}
+		new_entry->fd = newfd;
+	}
+	else if (new_entry->fd == newfd)
+		new_entry->fd = -1;
+
+	libsimple_lock_unlock(&fdpath_cache_lock);
+}
+
+void fdpath_cache_invalidate(int fd)
+{
+	struct fdpath_cache_entry* entry;
+
+	if (fd < 0)
+		return;
+
+	entry = fdpath_cache_slot(fd);
+
+	libsimple_lock_lock(&fdpath_cache_lock);
+	if (entry->fd == fd)
+		entry->fd = -1;
+	libsimple_lock_unlock(&fdpath_cache_lock);
+}
+
+void fdpath_cache_invalidate_path(const char* expanded_path)
+{
+	__SIZE_TYPE__ length = strlen(expanded_path);
+
+	libsimple_lock_lock(&fdpath_cache_lock);
+	if (fdpath_cache_initialized)
+	{
+		for (int i = 0; i < FDPATH_CACHE_SIZE; i++)
+		{
+			struct fdpath_cache_entry* entry = &fdpath_cache[i];
+
+			if (entry->fd < 0 || entry->length < length)
+				continue;
+			if (strncmp(entry->path, expanded_path, length) != 0)
+				continue;
+
+			// either the file itself or something inside a renamed directory
+			if (entry->path[length] == '\0' || entry->path[length] == '/')
+				entry->fd = -1;
+		}
+	}
+	libsimple_lock_unlock(&fdpath_cache_lock);
+}
+
+void fdpath_cache_postfork_child(void)
+{
+	// descriptors (and therefore their paths) are inherited, but another thread may have held the lock
+	libsimple_lock_init(&fdpath_cache_lock);
+}
+
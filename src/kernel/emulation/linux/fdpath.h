@@ -4,5 +4,16 @@
 
 int fdpath(int fd, char* buf, size_t bufsiz);
 
+// Per-FD path cache, so that F_GETPATH doesn't have to readlink() /proc/self/fd/N every time.
+// Paths are stored in their expanded (Linux) form, as passed to the Linux openat().
+void fdpath_cache_set(int fd, const char* expanded_path);
+void fdpath_cache_dup(int oldfd, int newfd);
+void fdpath_cache_invalidate(int fd);
+
+// Drops every entry at or below `expanded_path` (used when it gets renamed)
+void fdpath_cache_invalidate_path(const char* expanded_path);
+
+void fdpath_cache_postfork_child(void);
+
 #endif
 
@@ -11,6 +11,8 @@
 #include <darlingserver/rpc.h>
 #include "../simple.h"
 #include "../duct_errno.h"
+#include "semaphore_local.h"
+#include "msg_local.h"
 
 #define UNIMPLEMENTED_TRAP() { char msg[] = "Called unimplemented Mach trap: "; write(2, msg, sizeof(msg)-1); write(2, __FUNCTION__, sizeof(__FUNCTION__)-1); write(2, "\n", 1); }
 
@@ -56,7 +58,7 @@ mach_msg_return_t mach_msg_trap_impl(
 			msg, 0);
 }
 
-mach_msg_return_t mach_msg_overwrite_trap_impl(
+static mach_msg_return_t mach_msg_overwrite_rpc(
 				mach_msg_header_t *msg,
 				mach_msg_option_t option,
 				mach_msg_size_t send_size,
@@ -64,8 +66,7 @@ mach_msg_return_t mach_msg_overwrite_trap_impl(
 				mach_port_name_t rcv_name,
 				mach_msg_timeout_t timeout,
 				mach_port_name_t notify,
-				mach_msg_header_t *rcv_msg,
-				mach_msg_size_t rcv_limit)
+				mach_msg_header_t *rcv_msg)
 {
 	int code;
 
@@ -95,9 +96,64 @@ retry:
 	return code;
 }
 
+mach_msg_return_t mach_msg_overwrite_trap_impl(
+				mach_msg_header_t *msg,
+				mach_msg_option_t option,
+				mach_msg_size_t send_size,
+				mach_msg_size_t rcv_size,
+				mach_port_name_t rcv_name,
+				mach_msg_timeout_t timeout,
+				mach_port_name_t notify,
+				mach_msg_header_t *rcv_msg,
+				mach_msg_size_t rcv_limit)
+{
+	mach_msg_return_t code;
+	int create_value = 0;
+	bool semaphore_create = false;
+
+	if ((option & MACH_SEND_MSG) != 0) {
+		semaphore_create = semaphore_local_msg_send(msg, &create_value);
+
+		if (msg_local_send(msg, option, send_size, timeout, &code)) {
+			if (code != MACH_MSG_SUCCESS || (option & MACH_RCV_MSG) == 0)
+				return code;
+			option &= ~MACH_SEND_MSG;
+		}
+	}
+
+	if ((option & MACH_RCV_MSG) != 0 && msg_local_tracked(rcv_name)) {
+		// the send half (if any) is for someone else; do that first, then wait on our local queue
+		if ((option & MACH_SEND_MSG) != 0) {
+			code = mach_msg_overwrite_rpc(msg, option & ~(MACH_RCV_MSG | MACH_RCV_TIMEOUT | MACH_RCV_INTERRUPT),
+				send_size, 0, MACH_PORT_NULL, timeout, notify, NULL);
+			if (code != MACH_MSG_SUCCESS)
+				return code;
+			option &= ~MACH_SEND_MSG;
+		}
+
+		if (msg_local_receive(rcv_msg ? rcv_msg : msg, option, rcv_size, rcv_name, timeout, &code))
+			return code;
+	}
+
+	if ((option & (MACH_SEND_MSG | MACH_RCV_MSG)) == 0)
+		return MACH_MSG_SUCCESS;
+
+	code = mach_msg_overwrite_rpc(msg, option, send_size, rcv_size, rcv_name, timeout, notify, rcv_msg);
+
+	if (semaphore_create && code == MACH_MSG_SUCCESS && (option & MACH_RCV_MSG) != 0)
+		semaphore_local_msg_created(rcv_msg ? rcv_msg : msg, create_value);
+
+	return code;
+}
+
 kern_return_t semaphore_signal_trap_impl(
 				mach_port_name_t signal_name)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_signal(signal_name, false, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_signal(signal_name);
 
 	if (code < 0) {
@@ -111,6 +167,11 @@ kern_return_t semaphore_signal_trap_impl(
 kern_return_t semaphore_signal_all_trap_impl(
 				mach_port_name_t signal_name)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_signal(signal_name, true, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_signal_all(signal_name);
 
 	if (code < 0) {
@@ -132,6 +193,11 @@ kern_return_t semaphore_signal_thread_trap_impl(
 kern_return_t semaphore_wait_trap_impl(
 				mach_port_name_t wait_name)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_wait(wait_name, false, 0, 0, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_wait(wait_name);
 
 	if (code < 0) {
@@ -149,6 +215,11 @@ kern_return_t semaphore_wait_signal_trap_impl(
 				mach_port_name_t wait_name,
 				mach_port_name_t signal_name)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_wait_signal(wait_name, signal_name, false, 0, 0, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_wait_signal(wait_name, signal_name);
 
 	if (code < 0) {
@@ -167,6 +238,11 @@ kern_return_t semaphore_timedwait_trap_impl(
 				unsigned int sec,
 				clock_res_t nsec)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_wait(wait_name, true, sec, nsec, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_timedwait(wait_name, sec, nsec);
 
 	if (code < 0) {
@@ -186,6 +262,11 @@ kern_return_t semaphore_timedwait_signal_trap_impl(
 				unsigned int sec,
 				clock_res_t nsec)
 {
+	kern_return_t kr;
+
+	if (semaphore_local_wait_signal(wait_name, signal_name, true, sec, nsec, &kr))
+		return kr;
+
 	int code = dserver_rpc_semaphore_timedwait_signal(wait_name, signal_name, sec, nsec);
 
 	if (code < 0) {
@@ -382,6 +463,9 @@ kern_return_t _kernelrpc_mach_port_allocate_trap_impl(
 		__simple_abort();
 	}
 
+	if (code == KERN_SUCCESS && target == mach_task_self() && right == MACH_PORT_RIGHT_RECEIVE)
+		msg_local_port_allocated(*name, MACH_PORT_QLIMIT_DEFAULT, false, 0);
+
 	return code;
 }
 
@@ -391,6 +475,11 @@ kern_return_t _kernelrpc_mach_port_destroy_trap_impl(
 				mach_port_name_t name
 )
 {
+	if (target == mach_task_self()) {
+		semaphore_local_forget(name);
+		msg_local_port_destroyed(name);
+	}
+
 	int code = dserver_rpc_mach_port_destruct(target, name, 0, 0);
 
 	if (code < 0) {
@@ -406,6 +495,11 @@ kern_return_t _kernelrpc_mach_port_deallocate_trap_impl(
 				mach_port_name_t name
 )
 {
+	if (target == mach_task_self()) {
+		semaphore_local_forget(name);
+		msg_local_send_refs(name, -1);
+	}
+
 	int code = dserver_rpc_mach_port_deallocate(target, name);
 
 	if (code < 0) {
@@ -423,6 +517,16 @@ kern_return_t _kernelrpc_mach_port_mod_refs_trap_impl(
 				mach_port_delta_t delta
 )
 {
+	if (target == mach_task_self() && delta < 0)
+		semaphore_local_forget(name);
+
+	if (target == mach_task_self()) {
+		if (right == MACH_PORT_RIGHT_SEND)
+			msg_local_send_refs(name, delta);
+		else if (right == MACH_PORT_RIGHT_RECEIVE && delta < 0)
+			msg_local_port_destroyed(name);
+	}
+
 	int code = dserver_rpc_mach_port_mod_refs(target, name, right, delta);
 
 	if (code < 0) {
@@ -439,6 +543,10 @@ kern_return_t _kernelrpc_mach_port_move_member_trap_impl(
 				mach_port_name_t after
 )
 {
+	// port sets are received from on the server
+	if (target == mach_task_self())
+		msg_local_demote(member);
+
 	int code = dserver_rpc_mach_port_move_member(target, member, after);
 
 	if (code < 0) {
@@ -456,6 +564,12 @@ kern_return_t _kernelrpc_mach_port_insert_right_trap_impl(
 				mach_msg_type_name_t polyPoly
 )
 {
+	// giving another task a right to one of our semaphores (or ports)
+	if (target != mach_task_self()) {
+		semaphore_local_demote(poly);
+		msg_local_demote(poly);
+	}
+
 	int code = dserver_rpc_mach_port_insert_right(target, name, poly, polyPoly);
 
 	if (code < 0) {
@@ -463,6 +577,10 @@ kern_return_t _kernelrpc_mach_port_insert_right_trap_impl(
 		__simple_abort();
 	}
 
+	if (code == KERN_SUCCESS && target == mach_task_self() && name == poly
+		&& (polyPoly == MACH_MSG_TYPE_MAKE_SEND || polyPoly == MACH_MSG_TYPE_COPY_SEND))
+		msg_local_send_refs(name, 1);
+
 	return code;
 }
 
@@ -472,6 +590,9 @@ kern_return_t _kernelrpc_mach_port_insert_member_trap_impl(
 				mach_port_name_t pset
 )
 {
+	if (target == mach_task_self())
+		msg_local_demote(name);
+
 	int code = dserver_rpc_mach_port_insert_member(target, name, pset);
 
 	if (code < 0) {
@@ -512,6 +633,13 @@ kern_return_t _kernelrpc_mach_port_construct_trap_impl(
 		__simple_abort();
 	}
 
+	// ports with any other options (e.g. importance or temp owner tracking) are left to the server
+	if (code == KERN_SUCCESS && target == mach_task_self() && (options->flags & ~MSG_LOCAL_CONSTRUCT_FLAGS) == 0) {
+		msg_local_port_allocated(*name,
+			(options->flags & MPO_QLIMIT) ? options->mpl.mpl_qlimit : MACH_PORT_QLIMIT_DEFAULT,
+			(options->flags & MPO_INSERT_SEND_RIGHT) != 0, context);
+	}
+
 	return code;
 }
 
@@ -522,6 +650,11 @@ kern_return_t _kernelrpc_mach_port_destruct_trap_impl(
 				uint64_t guard
 )
 {
+	if (target == mach_task_self()) {
+		semaphore_local_forget(name);
+		msg_local_port_destroyed(name);
+	}
+
 	int code = dserver_rpc_mach_port_destruct(target, name, srdelta, guard);
 
 	if (code < 0) {
@@ -584,6 +717,12 @@ kern_return_t _kernelrpc_mach_port_request_notification_impl(
 	mach_port_name_t* previous
 )
 {
+	// the server has to know about the port to send the notification (and the notify port may receive it)
+	if (task == mach_task_self()) {
+		msg_local_demote(name);
+		msg_local_demote(notify);
+	}
+
 	int code = dserver_rpc_mach_port_request_notification(task, name, msgid, sync, notify, notifyPoly, previous);
 
 	if (code < 0) {
@@ -602,6 +741,10 @@ kern_return_t _kernelrpc_mach_port_get_attributes_impl(
 	mach_msg_type_number_t* port_info_outCnt
 )
 {
+	// the message counts live here while the port is local
+	if (target == mach_task_self() && flavor != MACH_PORT_LIMITS_INFO)
+		msg_local_demote(name);
+
 	int code = dserver_rpc_mach_port_get_attributes(target, name, flavor, port_info_out, port_info_outCnt);
 
 	if (code < 0) {
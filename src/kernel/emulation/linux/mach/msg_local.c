@@ -0,0 +1,894 @@
+#include "msg_local.h"
+#include "msg_ports.h"
+#include <mach/mach_init.h>
+#include <mach/mach_time.h>
+#include <mach/ndr.h>
+#include <sys/errno.h>
+#include <sys/linux_time.h>
+#include <darlingserver/rpc.h>
+#include <libsimple/lock.h>
+#include "../ext/futex.h"
+#include "../simple.h"
+#include "../duct_errno.h"
+
+extern void* memcpy(void* dest, const void* src, __SIZE_TYPE__ len);
+
+#ifndef NSEC_PER_MSEC
+#	define NSEC_PER_MSEC 1000000ull
+#endif
+#ifndef NSEC_PER_SEC
+#	define NSEC_PER_SEC 1000000000ull
+#endif
+
+#define MSG_LOCAL_PORTS 64
+
+// freshly allocated receive rights that nothing has been done with yet (see `msg_local_port_allocated`)
+#define MSG_LOCAL_FRESH 8
+
+// Only small messages are queued locally; anything bigger demotes the port.
+// The same goes for queue limits above MSG_LOCAL_QUEUE.
+#define MSG_LOCAL_MSG_MAX 256
+#define MSG_LOCAL_QUEUE 8
+
+// mach_port.defs routine IDs
+#define MACH_PORT_SUBSYSTEM_BASE 3200
+#define MACH_PORT_SUBSYSTEM_END 3300
+#define MACH_PORT_TYPE_ID 3201
+#define MACH_PORT_DESTROY_ID 3205
+#define MACH_PORT_GET_REFS_ID 3207
+#define MACH_PORT_SET_ATTRIBUTES_ID 3218
+#define MACH_PORT_GET_CONTEXT_ID 3228
+#define MACH_PORT_DESTRUCT_ID 3232
+
+struct local_message
+{
+	mach_msg_size_t size;
+	bool send_once;
+	union {
+		mach_msg_header_t header;
+		char data[MSG_LOCAL_MSG_MAX];
+	};
+};
+
+struct local_port
+{
+	mach_port_name_t name; // MACH_PORT_NULL if the slot is unused
+	libsimple_lock_t lock;
+
+	unsigned int qlimit;
+	int send_refs;
+	// send rights moved into locally queued messages that the server still thinks we have;
+	// released once we run out of send rights (or the port is handed over)
+	int moved_refs;
+	uint64_t context;
+	mach_port_seqno_t seqno;
+
+	// futex words; bumped whenever a message is queued/dequeued (or the port goes away).
+	// these are never reset, so that a thread still sleeping on a slot that has been reused can't miss a wakeup.
+	int receive_seq;
+	int space_seq;
+	int receivers;
+	int senders;
+
+	unsigned int head;
+	unsigned int count;
+	struct local_message queue[MSG_LOCAL_QUEUE];
+};
+
+struct fresh_port
+{
+	mach_port_name_t name; // MACH_PORT_NULL if the entry is unused
+	unsigned int qlimit;
+	uint64_t context;
+};
+
+// only guards slot allocation and the fresh ports; everything else is protected by the per-port locks
+static libsimple_lock_t msg_local_table_lock = LIBSIMPLE_LOCK_INITIALIZER;
+static struct local_port msg_local_table[MSG_LOCAL_PORTS];
+
+// one past the highest slot ever used; zero means there's nothing to look up
+static int msg_local_high = 0;
+
+static struct fresh_port msg_local_fresh[MSG_LOCAL_FRESH];
+static unsigned int msg_local_fresh_next = 0;
+static int msg_local_fresh_count = 0;
+
+// our own sender/audit tokens for trailers, fetched from the server the first time they're needed
+static libsimple_lock_t msg_local_tokens_lock = LIBSIMPLE_LOCK_INITIALIZER;
+static bool msg_local_have_tokens = false;
+static security_token_t msg_local_sender_token;
+static audit_token_t msg_local_audit_token;
+
+static inline bool msg_local_empty(void)
+{
+	return __atomic_load_n(&msg_local_high, __ATOMIC_ACQUIRE) == 0 && __atomic_load_n(&msg_local_fresh_count, __ATOMIC_ACQUIRE) == 0;
+}
+
+// returns the port locked, or NULL if the name isn't tracked
+static struct local_port* msg_local_lock(mach_port_name_t name)
+{
+	int high;
+
+	if (name == MACH_PORT_NULL || msg_local_empty())
+		return NULL;
+
+	high = __atomic_load_n(&msg_local_high, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < high; i++)
+	{
+		struct local_port* port = &msg_local_table[i];
+
+		if (__atomic_load_n(&port->name, __ATOMIC_ACQUIRE) != name)
+			continue;
+
+		libsimple_lock_lock(&port->lock);
+		if (port->name == name)
+			return port;
+		libsimple_lock_unlock(&port->lock);
+		return NULL;
+	}
+
+	return NULL;
+}
+
+static void msg_local_wake(int* word, int count)
+{
+	__atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+	__linux_futex_reterr(word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+
+// sleeps on `word` (which must've had the value `seen`) with the port unlocked; returns with the port locked again.
+// the return value is 0 or a negative BSD errno (ETIMEDOUT/EINTR).
+static int msg_local_sleep(struct local_port* port, int* word, int seen, int* sleepers, const struct timespec* deadline)
+{
+	int ret;
+
+	++*sleepers;
+	libsimple_lock_unlock(&port->lock);
+
+	ret = __linux_futex_reterr(word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, seen, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+
+	libsimple_lock_lock(&port->lock);
+	--*sleepers;
+
+	if (ret == -ETIMEDOUT || ret == -EINTR)
+		return ret;
+	return 0;
+}
+
+static void msg_local_deadline(mach_msg_timeout_t timeout, struct timespec* deadline)
+{
+	uint64_t abstime = mach_absolute_time() + timeout * NSEC_PER_MSEC;
+
+	deadline->tv_sec = abstime / NSEC_PER_SEC;
+	deadline->tv_nsec = abstime % NSEC_PER_SEC;
+}
+
+static mach_msg_return_t msg_local_rpc(mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t send_size, mach_msg_size_t rcv_size, mach_port_name_t rcv_name)
+{
+	int code;
+
+	do
+	{
+		code = dserver_rpc_mach_msg_overwrite(msg, option, send_size, rcv_size, rcv_name, 0, MACH_PORT_NULL, msg);
+	}
+	while (code == -LINUX_EINTR);
+
+	if (code < 0)
+	{
+		__simple_printf("mach_msg_overwrite failed (internally): %d\n", code);
+		__simple_abort();
+	}
+
+	return code;
+}
+
+static void msg_local_fetch_tokens(void)
+{
+	struct {
+		mach_msg_header_t header;
+		mach_msg_audit_trailer_t trailer;
+	} buf;
+	mach_port_name_t port;
+
+	libsimple_lock_lock(&msg_local_tokens_lock);
+
+	// the easiest way to find out what the server would put in there is to bounce a message off a port of our own
+	if (!msg_local_have_tokens && dserver_rpc_mach_reply_port(&port) == 0 && port != MACH_PORT_NULL)
+	{
+		buf.header.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND_ONCE, 0);
+		buf.header.msgh_size = sizeof(buf.header);
+		buf.header.msgh_remote_port = port;
+		buf.header.msgh_local_port = MACH_PORT_NULL;
+		buf.header.msgh_voucher_port = MACH_PORT_NULL;
+		buf.header.msgh_id = 0;
+
+		if (msg_local_rpc(&buf.header, MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_TRAILER_TYPE(MACH_MSG_TRAILER_FORMAT_0)
+			| MACH_RCV_TRAILER_ELEMENTS(MACH_RCV_TRAILER_AUDIT), sizeof(buf.header), sizeof(buf), port) == MACH_MSG_SUCCESS)
+		{
+			msg_local_sender_token = buf.trailer.msgh_sender;
+			msg_local_audit_token = buf.trailer.msgh_audit;
+			msg_local_have_tokens = true;
+		}
+
+		dserver_rpc_mach_port_destruct(mach_task_self(), port, 0, 0);
+	}
+
+	libsimple_lock_unlock(&msg_local_tokens_lock);
+}
+
+static mach_msg_size_t msg_local_trailer_size(mach_msg_option_t option)
+{
+	switch (GET_RCV_ELEMENTS(option))
+	{
+		case MACH_RCV_TRAILER_NULL:
+			return sizeof(mach_msg_trailer_t);
+		case MACH_RCV_TRAILER_SEQNO:
+			return sizeof(mach_msg_seqno_trailer_t);
+		case MACH_RCV_TRAILER_SENDER:
+			return sizeof(mach_msg_security_trailer_t);
+		case MACH_RCV_TRAILER_AUDIT:
+			return sizeof(mach_msg_audit_trailer_t);
+		case MACH_RCV_TRAILER_CTX:
+			return sizeof(mach_msg_context_trailer_t);
+		default:
+			return sizeof(mach_msg_mac_trailer_t);
+	}
+}
+
+static void msg_local_fill_trailer(struct local_port* port, mach_msg_header_t* msg, mach_msg_size_t trailer_size)
+{
+	mach_msg_mac_trailer_t trailer = {
+		.msgh_trailer_type = MACH_MSG_TRAILER_FORMAT_0,
+		.msgh_trailer_size = trailer_size,
+		.msgh_seqno = port->seqno,
+		.msgh_sender = msg_local_sender_token,
+		.msgh_audit = msg_local_audit_token,
+		.msgh_context = port->context,
+	};
+
+	memcpy((char*)msg + msg->msgh_size, &trailer, trailer_size);
+}
+
+// wakes up everyone sleeping on the port, e.g. because it's going away
+static void msg_local_wake_all(struct local_port* port)
+{
+	if (port->receivers > 0)
+		msg_local_wake(&port->receive_seq, 0x7fffffff);
+	else
+		__atomic_add_fetch(&port->receive_seq, 1, __ATOMIC_RELEASE);
+
+	if (port->senders > 0)
+		msg_local_wake(&port->space_seq, 0x7fffffff);
+	else
+		__atomic_add_fetch(&port->space_seq, 1, __ATOMIC_RELEASE);
+}
+
+// must be called with the port locked (and still tracked)
+static void msg_local_release_moved_locked(struct local_port* port)
+{
+	int code;
+
+	if (port->moved_refs == 0)
+		return;
+
+	code = dserver_rpc_mach_port_mod_refs(mach_task_self(), port->name, MACH_PORT_RIGHT_SEND, -port->moved_refs);
+	if (code < 0)
+	{
+		__simple_printf("mach_port_mod_refs failed (internally): %d\n", code);
+		__simple_abort();
+	}
+
+	port->moved_refs = 0;
+}
+
+static void msg_local_pop(struct local_port* port)
+{
+	port->head = (port->head + 1) % MSG_LOCAL_QUEUE;
+	port->count--;
+
+	if (port->senders > 0)
+		msg_local_wake(&port->space_seq, 1);
+	else
+		__atomic_add_fetch(&port->space_seq, 1, __ATOMIC_RELEASE);
+}
+
+// must be called with the port locked; the port is no longer tracked afterwards (but is still locked)
+static void msg_local_demote_locked(struct local_port* port)
+{
+	// nobody else could send to the port so far, so its queue on the server is empty
+	// and has room for everything we've queued here (we never queue more than the limit)
+	while (port->count > 0)
+	{
+		struct local_message* message = &port->queue[port->head];
+		mach_msg_header_t* header = &message->header;
+		mach_msg_return_t code;
+
+		header->msgh_bits = (header->msgh_bits & ~MACH_MSGH_BITS_PORTS_MASK)
+			| MACH_MSGH_BITS(message->send_once ? MACH_MSG_TYPE_MAKE_SEND_ONCE : MACH_MSG_TYPE_MAKE_SEND, 0);
+		header->msgh_remote_port = port->name;
+		header->msgh_local_port = MACH_PORT_NULL;
+
+		code = msg_local_rpc(header, MACH_SEND_MSG | MACH_SEND_TIMEOUT, message->size, 0, MACH_PORT_NULL);
+		if (code != MACH_MSG_SUCCESS)
+			__simple_printf("Dropped a locally queued message while handing port %d over: %d\n", port->name, code);
+
+		msg_local_pop(port);
+	}
+
+	msg_local_release_moved_locked(port);
+	__atomic_store_n(&port->name, MACH_PORT_NULL, __ATOMIC_RELEASE);
+
+	// anyone still sleeping here has to go to the server now
+	msg_local_wake_all(port);
+}
+
+// must be called with the table lock held
+static void msg_local_port_track_locked(mach_port_name_t name, unsigned int qlimit, int send_refs, uint64_t context)
+{
+	struct local_port* port = NULL;
+	int high;
+
+	high = msg_local_high;
+	for (int i = 0; i < high; i++)
+	{
+		if (__atomic_load_n(&msg_local_table[i].name, __ATOMIC_ACQUIRE) == MACH_PORT_NULL)
+		{
+			port = &msg_local_table[i];
+			break;
+		}
+	}
+
+	if (port == NULL && high < MSG_LOCAL_PORTS)
+		port = &msg_local_table[high++];
+
+	// if the table is full, the port simply lives on the server
+	if (port != NULL)
+	{
+		libsimple_lock_lock(&port->lock);
+		port->qlimit = qlimit;
+		port->send_refs = send_refs;
+		port->moved_refs = 0;
+		port->context = context;
+		port->seqno = 0;
+		port->head = 0;
+		port->count = 0;
+		__atomic_store_n(&port->name, name, __ATOMIC_RELEASE);
+		libsimple_lock_unlock(&port->lock);
+
+		__atomic_store_n(&msg_local_high, high, __ATOMIC_RELEASE);
+	}
+}
+
+// fresh ports are looked up without the lock first, since there usually aren't any
+static bool msg_local_fresh_contains(mach_port_name_t name)
+{
+	if (name == MACH_PORT_NULL || __atomic_load_n(&msg_local_fresh_count, __ATOMIC_ACQUIRE) == 0)
+		return false;
+
+	for (int i = 0; i < MSG_LOCAL_FRESH; i++)
+	{
+		if (__atomic_load_n(&msg_local_fresh[i].name, __ATOMIC_ACQUIRE) == name)
+			return true;
+	}
+
+	return false;
+}
+
+// must be called with the table lock held; returns the index of the entry for `name`, or -1
+static int msg_local_fresh_find_locked(mach_port_name_t name)
+{
+	for (int i = 0; i < MSG_LOCAL_FRESH; i++)
+	{
+		if (msg_local_fresh[i].name == name)
+			return i;
+	}
+
+	return -1;
+}
+
+static void msg_local_fresh_clear_locked(int i)
+{
+	__atomic_store_n(&msg_local_fresh[i].name, MACH_PORT_NULL, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&msg_local_fresh_count, 1, __ATOMIC_RELEASE);
+}
+
+// a fresh port whose right has been given away will never get a slot
+static void msg_local_fresh_forget(mach_port_name_t name)
+{
+	int i;
+
+	if (!msg_local_fresh_contains(name))
+		return;
+
+	libsimple_lock_lock(&msg_local_table_lock);
+	i = msg_local_fresh_find_locked(name);
+	if (i >= 0)
+		msg_local_fresh_clear_locked(i);
+	libsimple_lock_unlock(&msg_local_table_lock);
+}
+
+// gives a fresh port a slot, now that it's about to be used
+static void msg_local_fresh_promote(mach_port_name_t name)
+{
+	int i;
+
+	if (!msg_local_fresh_contains(name))
+		return;
+
+	libsimple_lock_lock(&msg_local_table_lock);
+	i = msg_local_fresh_find_locked(name);
+	if (i >= 0)
+	{
+		msg_local_port_track_locked(name, msg_local_fresh[i].qlimit, 0, msg_local_fresh[i].context);
+		// only now, so that anyone who doesn't find the fresh entry anymore finds the slot instead
+		msg_local_fresh_clear_locked(i);
+	}
+	libsimple_lock_unlock(&msg_local_table_lock);
+}
+
+void msg_local_demote(mach_port_name_t name)
+{
+	struct local_port* port;
+
+	msg_local_fresh_forget(name);
+
+	port = msg_local_lock(name);
+	if (port == NULL)
+		return;
+
+	msg_local_demote_locked(port);
+	libsimple_lock_unlock(&port->lock);
+}
+
+static void msg_local_demote_carried(mach_port_name_t name, mach_msg_type_name_t disposition)
+{
+	msg_local_demote(name);
+}
+
+bool msg_local_tracked(mach_port_name_t name)
+{
+	struct local_port* port;
+
+	// once someone receives on a fresh port, local senders have to find it here
+	msg_local_fresh_promote(name);
+
+	port = msg_local_lock(name);
+
+	if (port == NULL)
+		return false;
+
+	libsimple_lock_unlock(&port->lock);
+	return true;
+}
+
+// Most receive rights without a send right are reply ports: their first use is to be carried out in a request,
+// which would hand them over right away. So these only get a slot once they're sent to locally, received on
+// or given a send right; until then, they're just remembered as fresh (and forgotten if they're given away).
+void msg_local_port_allocated(mach_port_name_t name, unsigned int qlimit, bool send_right, uint64_t context)
+{
+	struct fresh_port* fresh;
+
+	if (name == MACH_PORT_NULL || qlimit > MSG_LOCAL_QUEUE)
+		return;
+
+	libsimple_lock_lock(&msg_local_table_lock);
+
+	if (send_right)
+	{
+		msg_local_port_track_locked(name, qlimit, 1, context);
+	}
+	else
+	{
+		// if all entries are taken, the oldest port simply stays on the server
+		fresh = &msg_local_fresh[msg_local_fresh_next];
+		msg_local_fresh_next = (msg_local_fresh_next + 1) % MSG_LOCAL_FRESH;
+
+		if (fresh->name == MACH_PORT_NULL)
+			__atomic_add_fetch(&msg_local_fresh_count, 1, __ATOMIC_RELEASE);
+
+		fresh->qlimit = qlimit;
+		fresh->context = context;
+		__atomic_store_n(&fresh->name, name, __ATOMIC_RELEASE);
+	}
+
+	libsimple_lock_unlock(&msg_local_table_lock);
+}
+
+void msg_local_port_destroyed(mach_port_name_t name)
+{
+	struct local_port* port;
+
+	msg_local_fresh_forget(name);
+
+	port = msg_local_lock(name);
+	if (port == NULL)
+		return;
+
+	// the receive right is gone, and so is everything queued on it.
+	// any send rights left under the name turn into dead names on the server, so their count has to be right.
+	port->count = 0;
+	msg_local_release_moved_locked(port);
+	__atomic_store_n(&port->name, MACH_PORT_NULL, __ATOMIC_RELEASE);
+	msg_local_wake_all(port);
+
+	libsimple_lock_unlock(&port->lock);
+}
+
+void msg_local_send_refs(mach_port_name_t name, int delta)
+{
+	struct local_port* port;
+
+	if (delta > 0)
+		msg_local_fresh_promote(name);
+
+	port = msg_local_lock(name);
+	if (port == NULL)
+		return;
+
+	port->send_refs += delta;
+	if (port->send_refs < 0)
+		port->send_refs = 0;
+
+	// once we're out of send rights, the server has to see that too
+	if (port->send_refs == 0)
+		msg_local_release_moved_locked(port);
+
+	libsimple_lock_unlock(&port->lock);
+}
+
+// keeps track of mach_port_* calls on our own ports that go through MIG rather than traps
+static void msg_local_port_request(mach_msg_header_t* msg)
+{
+	char* args = (char*)(msg + 1);
+	char* end = (char*)msg + msg->msgh_size;
+	mach_port_name_t name;
+
+	// requests that carry a right have their descriptors first
+	if ((msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) != 0)
+	{
+		mach_msg_body_t* body = (mach_msg_body_t*)args;
+		args += sizeof(*body) + body->msgh_descriptor_count * sizeof(mach_msg_port_descriptor_t);
+	}
+	args += sizeof(NDR_record_t);
+
+	if (args + sizeof(name) > end)
+		return;
+	memcpy(&name, args, sizeof(name));
+
+	switch (msg->msgh_id)
+	{
+		case MACH_PORT_TYPE_ID:
+		case MACH_PORT_GET_REFS_ID:
+		{
+			// these don't care about messages, but the server has to have the right send right count
+			struct local_port* port = msg_local_lock(name);
+			if (port != NULL)
+			{
+				msg_local_release_moved_locked(port);
+				libsimple_lock_unlock(&port->lock);
+			}
+			break;
+		}
+
+		case MACH_PORT_GET_CONTEXT_ID:
+			// doesn't care about messages
+			break;
+
+		case MACH_PORT_DESTROY_ID:
+		case MACH_PORT_DESTRUCT_ID:
+			msg_local_port_destroyed(name);
+			break;
+
+		case MACH_PORT_SET_ATTRIBUTES_ID:
+		{
+			// name, flavor, count, info[]
+			int args_int[4];
+			struct local_port* port;
+
+			if (args + sizeof(args_int) > end)
+				break;
+			memcpy(args_int, args, sizeof(args_int));
+
+			if (args_int[1] != MACH_PORT_LIMITS_INFO || args_int[2] < 1)
+				break;
+
+			msg_local_fresh_promote(name);
+			port = msg_local_lock(name);
+			if (port == NULL)
+				break;
+
+			// the server gets to see the new limit as well, so that it's right if we ever have to hand the port over
+			if ((unsigned int)args_int[3] > MSG_LOCAL_QUEUE)
+				msg_local_demote_locked(port);
+			else
+			{
+				port->qlimit = args_int[3];
+				msg_local_wake(&port->space_seq, 0x7fffffff);
+			}
+
+			libsimple_lock_unlock(&port->lock);
+			break;
+		}
+
+		default:
+			msg_local_demote(name);
+			break;
+	}
+}
+
+static bool msg_local_can_queue(struct local_port* port, mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t send_size)
+{
+	mach_msg_type_name_t disposition = MACH_MSGH_BITS_REMOTE(msg->msgh_bits);
+
+	if ((option & (MACH_SEND_NOTIFY | MACH_SEND_TRAILER)) != 0)
+		return false;
+
+	if ((msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) != 0)
+		return false;
+	if (MACH_MSGH_BITS_LOCAL(msg->msgh_bits) != 0 || msg->msgh_local_port != MACH_PORT_NULL)
+		return false;
+	if (MACH_MSGH_BITS_VOUCHER(msg->msgh_bits) != 0 || msg->msgh_voucher_port != MACH_PORT_NULL)
+		return false;
+
+	if (send_size < sizeof(mach_msg_header_t) || send_size > MSG_LOCAL_MSG_MAX || (send_size & 3) != 0)
+		return false;
+
+	switch (disposition)
+	{
+		case MACH_MSG_TYPE_MAKE_SEND:
+		case MACH_MSG_TYPE_MAKE_SEND_ONCE:
+			return true;
+		case MACH_MSG_TYPE_COPY_SEND:
+		case MACH_MSG_TYPE_MOVE_SEND:
+			// we need to be sure the send would succeed on the server, too
+			return port->send_refs > 0;
+		default:
+			return false;
+	}
+}
+
+bool msg_local_send(mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t send_size, mach_msg_timeout_t timeout, mach_msg_return_t* ret)
+{
+	struct local_port* port;
+	struct local_message* message;
+	struct timespec deadline;
+	mach_msg_type_name_t disposition;
+	bool timed = (option & MACH_SEND_TIMEOUT) != 0 && timeout != 0;
+	bool deadline_set = false;
+
+	if (msg_local_empty())
+		return false;
+
+	// rights to our ports leaving the task mean others could start sending to them
+	mach_msg_foreach_port(msg, msg_local_demote_carried);
+
+	if (msg->msgh_remote_port == mach_task_self() && msg->msgh_id >= MACH_PORT_SUBSYSTEM_BASE && msg->msgh_id < MACH_PORT_SUBSYSTEM_END)
+		msg_local_port_request(msg);
+
+	msg_local_fresh_promote(msg->msgh_remote_port);
+
+	port = msg_local_lock(msg->msgh_remote_port);
+	if (port == NULL)
+		return false;
+
+	if (!msg_local_can_queue(port, msg, option, send_size))
+	{
+		// the receiver wouldn't be looking at the server, so the port has to move there first
+		msg_local_demote_locked(port);
+		libsimple_lock_unlock(&port->lock);
+		return false;
+	}
+
+	disposition = MACH_MSGH_BITS_REMOTE(msg->msgh_bits);
+
+	// send-once rights aren't subject to the queue limit (but we still only have so much room)
+	while ((disposition == MACH_MSG_TYPE_MAKE_SEND_ONCE) ? port->count >= MSG_LOCAL_QUEUE : port->count >= port->qlimit)
+	{
+		int seen, err;
+
+		if (disposition == MACH_MSG_TYPE_MAKE_SEND_ONCE)
+		{
+			msg_local_demote_locked(port);
+			libsimple_lock_unlock(&port->lock);
+			return false;
+		}
+
+		if ((option & MACH_SEND_TIMEOUT) != 0 && timeout == 0)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_SEND_TIMED_OUT;
+			return true;
+		}
+
+		if (timed && !deadline_set)
+		{
+			msg_local_deadline(timeout, &deadline);
+			deadline_set = true;
+		}
+
+		seen = port->space_seq;
+		err = msg_local_sleep(port, &port->space_seq, seen, &port->senders, timed ? &deadline : NULL);
+
+		if (port->name != msg->msgh_remote_port)
+		{
+			// handed over (or destroyed) while we were waiting
+			libsimple_lock_unlock(&port->lock);
+			return false;
+		}
+
+		if (err == -ETIMEDOUT)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_SEND_TIMED_OUT;
+			return true;
+		}
+		if (err == -EINTR && (option & MACH_SEND_INTERRUPT) != 0)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_SEND_INTERRUPTED;
+			return true;
+		}
+	}
+
+	message = &port->queue[(port->head + port->count) % MSG_LOCAL_QUEUE];
+	memcpy(message->data, msg, send_size);
+	message->size = send_size;
+	message->send_once = disposition == MACH_MSG_TYPE_MAKE_SEND_ONCE;
+
+	// this is what the receiver gets to see
+	message->header.msgh_bits = (msg->msgh_bits & ~MACH_MSGH_BITS_PORTS_MASK)
+		| MACH_MSGH_BITS(0, message->send_once ? MACH_MSG_TYPE_PORT_SEND_ONCE : MACH_MSG_TYPE_PORT_SEND);
+	message->header.msgh_size = send_size;
+	message->header.msgh_remote_port = MACH_PORT_NULL;
+	message->header.msgh_local_port = port->name;
+	message->header.msgh_voucher_port = MACH_PORT_NULL;
+
+	if (disposition == MACH_MSG_TYPE_MOVE_SEND)
+	{
+		// the server still counts the right we've just moved into the queue;
+		// it's released in bulk once we're out of send rights, rather than with an RPC per message
+		port->send_refs--;
+		port->moved_refs++;
+		if (port->send_refs == 0)
+			msg_local_release_moved_locked(port);
+	}
+
+	port->count++;
+
+	if (port->receivers > 0)
+		msg_local_wake(&port->receive_seq, 1);
+	else
+		__atomic_add_fetch(&port->receive_seq, 1, __ATOMIC_RELEASE);
+
+	libsimple_lock_unlock(&port->lock);
+
+	*ret = MACH_MSG_SUCCESS;
+	return true;
+}
+
+bool msg_local_receive(mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t rcv_size, mach_port_name_t rcv_name, mach_msg_timeout_t timeout, mach_msg_return_t* ret)
+{
+	struct local_port* port;
+	struct local_message* message;
+	struct timespec deadline;
+	mach_msg_size_t trailer_size = msg_local_trailer_size(option);
+	bool timed = (option & MACH_RCV_TIMEOUT) != 0 && timeout != 0;
+	bool deadline_set = false;
+
+	if (msg_local_empty())
+		return false;
+
+	if (GET_RCV_ELEMENTS(option) >= MACH_RCV_TRAILER_SENDER && !__atomic_load_n(&msg_local_have_tokens, __ATOMIC_ACQUIRE))
+		msg_local_fetch_tokens();
+
+	port = msg_local_lock(rcv_name);
+	if (port == NULL)
+		return false;
+
+#ifdef MACH_RCV_SYNC_PEEK
+	if ((option & MACH_RCV_SYNC_PEEK) != 0)
+	{
+		msg_local_demote_locked(port);
+		libsimple_lock_unlock(&port->lock);
+		return false;
+	}
+#endif
+
+	while (port->count == 0)
+	{
+		int seen, err;
+
+		if ((option & MACH_RCV_TIMEOUT) != 0 && timeout == 0)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_RCV_TIMED_OUT;
+			return true;
+		}
+
+		if (timed && !deadline_set)
+		{
+			msg_local_deadline(timeout, &deadline);
+			deadline_set = true;
+		}
+
+		seen = port->receive_seq;
+		err = msg_local_sleep(port, &port->receive_seq, seen, &port->receivers, timed ? &deadline : NULL);
+
+		if (port->name != rcv_name)
+		{
+			// handed over (or destroyed) while we were waiting; the server will take it from here
+			libsimple_lock_unlock(&port->lock);
+			return false;
+		}
+
+		if (port->count > 0)
+			break;
+
+		if (err == -ETIMEDOUT)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_RCV_TIMED_OUT;
+			return true;
+		}
+		if (err == -EINTR && (option & MACH_RCV_INTERRUPT) != 0)
+		{
+			libsimple_lock_unlock(&port->lock);
+			*ret = MACH_RCV_INTERRUPTED;
+			return true;
+		}
+	}
+
+	message = &port->queue[port->head];
+
+	if (message->size + trailer_size > rcv_size)
+	{
+		if ((option & MACH_RCV_LARGE) != 0)
+		{
+			// leave it queued and tell the caller how much room it needs
+			if (rcv_size >= sizeof(mach_msg_header_t))
+			{
+				msg->msgh_size = message->size + trailer_size;
+				if ((option & MACH_RCV_LARGE_IDENTITY) != 0)
+					msg->msgh_local_port = rcv_name;
+			}
+		}
+		else
+		{
+			// just like XNU, the message is destroyed
+			port->seqno++;
+			msg_local_pop(port);
+		}
+
+		libsimple_lock_unlock(&port->lock);
+		*ret = MACH_RCV_TOO_LARGE;
+		return true;
+	}
+
+	memcpy(msg, message->data, message->size);
+	msg_local_fill_trailer(port, msg, trailer_size);
+	port->seqno++;
+	msg_local_pop(port);
+
+	libsimple_lock_unlock(&port->lock);
+
+	*ret = MACH_MSG_SUCCESS;
+	return true;
+}
+
+void msg_local_postfork_child(void)
+{
+	// the child starts out with a fresh port namespace
+	libsimple_lock_init(&msg_local_table_lock);
+	libsimple_lock_init(&msg_local_tokens_lock);
+	for (int i = 0; i < MSG_LOCAL_PORTS; i++)
+	{
+		libsimple_lock_init(&msg_local_table[i].lock);
+		msg_local_table[i].name = MACH_PORT_NULL;
+	}
+	__atomic_store_n(&msg_local_high, 0, __ATOMIC_RELEASE);
+	for (int i = 0; i < MSG_LOCAL_FRESH; i++)
+		msg_local_fresh[i].name = MACH_PORT_NULL;
+	msg_local_fresh_next = 0;
+	__atomic_store_n(&msg_local_fresh_count, 0, __ATOMIC_RELEASE);
+	msg_local_have_tokens = false;
+}
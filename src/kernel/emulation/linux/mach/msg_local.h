@@ -0,0 +1,46 @@
+#ifndef _MACH_MSG_LOCAL_H
+#define _MACH_MSG_LOCAL_H
+
+#include <mach/mach_traps.h>
+#include <mach/message.h>
+#include <mach/port.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Receive rights allocated by this task are tracked here. As long as no right to such a port has left
+// the task, nobody else can send to it, so simple messages (no port rights, no descriptors) sent to it
+// by our own threads are queued in-process and never reach darlingserver.
+//
+// Anything that could let someone else see the port (a right to it being sent or inserted elsewhere,
+// adding it to a port set, watching it with kqueue, requesting notifications, a message we can't queue
+// locally, ...) hands the port over to the server for good: queued messages are re-sent through the server
+// and all further traffic goes through it.
+//
+// Receive rights allocated without a send right are usually MIG reply ports, which are handed over as soon as
+// they're first used. So those are only remembered as fresh, and get tracked once they're actually used locally.
+
+// mach_port_construct() options that don't need anything from the server beyond what we track here
+#ifdef MPO_IMMOVABLE_RECEIVE
+#	define MSG_LOCAL_CONSTRUCT_FLAGS (MPO_CONTEXT_AS_GUARD | MPO_QLIMIT | MPO_INSERT_SEND_RIGHT | MPO_STRICT | MPO_IMMOVABLE_RECEIVE)
+#else
+#	define MSG_LOCAL_CONSTRUCT_FLAGS (MPO_CONTEXT_AS_GUARD | MPO_QLIMIT | MPO_INSERT_SEND_RIGHT | MPO_STRICT)
+#endif
+
+void msg_local_port_allocated(mach_port_name_t name, unsigned int qlimit, bool send_right, uint64_t context);
+void msg_local_port_destroyed(mach_port_name_t name);
+void msg_local_send_refs(mach_port_name_t name, int delta);
+
+// Hands the port over to the server (if it is tracked)
+void msg_local_demote(mach_port_name_t name);
+
+// Both return `true` if the operation was handled locally (with the result in `ret`)
+// and `false` if the caller should go through the server instead.
+// msg_local_send() must be called for every outgoing message (it keeps track of rights leaving the task).
+bool msg_local_send(mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t send_size, mach_msg_timeout_t timeout, mach_msg_return_t* ret);
+bool msg_local_receive(mach_msg_header_t* msg, mach_msg_option_t option, mach_msg_size_t rcv_size, mach_port_name_t rcv_name, mach_msg_timeout_t timeout, mach_msg_return_t* ret);
+
+bool msg_local_tracked(mach_port_name_t name);
+
+void msg_local_postfork_child(void);
+
+#endif
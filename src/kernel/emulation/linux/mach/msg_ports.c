@@ -0,0 +1,56 @@
+#include "msg_ports.h"
+
+void mach_msg_foreach_port(mach_msg_header_t* msg, mach_msg_port_callback_t callback)
+{
+	mach_msg_body_t* body;
+	char* ptr;
+	char* end;
+
+	if (msg->msgh_local_port != MACH_PORT_NULL)
+		callback(msg->msgh_local_port, MACH_MSGH_BITS_LOCAL(msg->msgh_bits));
+	if (msg->msgh_voucher_port != MACH_PORT_NULL)
+		callback(msg->msgh_voucher_port, MACH_MSGH_BITS_VOUCHER(msg->msgh_bits));
+
+	if ((msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) == 0)
+		return;
+
+	body = (mach_msg_body_t*)(msg + 1);
+	ptr = (char*)(body + 1);
+	end = (char*)msg + msg->msgh_size;
+
+	for (mach_msg_size_t i = 0; i < body->msgh_descriptor_count; i++)
+	{
+		mach_msg_descriptor_t* desc = (mach_msg_descriptor_t*)ptr;
+
+		if (ptr + sizeof(mach_msg_type_descriptor_t) > end)
+			break;
+
+		switch (desc->type.type)
+		{
+			case MACH_MSG_PORT_DESCRIPTOR:
+				callback(desc->port.name, desc->port.disposition);
+				ptr += sizeof(mach_msg_port_descriptor_t);
+				break;
+			case MACH_MSG_GUARDED_PORT_DESCRIPTOR:
+				callback(desc->guarded_port.name, desc->guarded_port.disposition);
+				ptr += sizeof(mach_msg_guarded_port_descriptor_t);
+				break;
+			case MACH_MSG_OOL_PORTS_DESCRIPTOR:
+			{
+				mach_port_name_t* names = (mach_port_name_t*)desc->ool_ports.address;
+
+				for (mach_msg_size_t j = 0; names != NULL && j < desc->ool_ports.count; j++)
+					callback(names[j], desc->ool_ports.disposition);
+				ptr += sizeof(mach_msg_ool_ports_descriptor_t);
+				break;
+			}
+			case MACH_MSG_OOL_DESCRIPTOR:
+			case MACH_MSG_OOL_VOLATILE_DESCRIPTOR:
+				ptr += sizeof(mach_msg_ool_descriptor_t);
+				break;
+			default:
+				// malformed; the server will reject it anyway
+				return;
+		}
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef _MACH_MSG_PORTS_H
+#define _MACH_MSG_PORTS_H
+
+#include <mach/message.h>
+
+typedef void (*mach_msg_port_callback_t)(mach_port_name_t name, mach_msg_type_name_t disposition);
+
+// Calls `callback` for every port right an outgoing message carries besides its destination:
+// the reply and voucher ports in the header and everything in its descriptors.
+void mach_msg_foreach_port(mach_msg_header_t* msg, mach_msg_port_callback_t callback);
+
+#endif
@@ -0,0 +1,548 @@
+#include "semaphore_local.h"
+#include "msg_ports.h"
+#include <mach/mach_init.h>
+#include <mach/mach_time.h>
+#include <mach/ndr.h>
+#include <sys/errno.h>
+#include <sys/linux_time.h>
+#include <darlingserver/rpc.h>
+#include <libsimple/lock.h>
+#include "../ext/futex.h"
+#include "../simple.h"
+#include "../duct_errno.h"
+
+#ifndef NSEC_PER_SEC
+#	define NSEC_PER_SEC 1000000000ull
+#endif
+
+#define SEMAPHORE_LOCAL_MAX 64
+
+// task.defs routine IDs
+#define SEMAPHORE_CREATE_ID 3418
+#define SEMAPHORE_DESTROY_ID 3419
+#define SEMAPHORE_CREATE_REPLY_ID (SEMAPHORE_CREATE_ID + 100)
+
+// set in `tokens` once the semaphore has been handed over to the server
+#define TOKENS_DEMOTED 0x40000000
+
+struct local_semaphore
+{
+	mach_port_name_t name; // MACH_PORT_NULL if the slot is unused
+
+	// like XNU: the number of pending signals if positive,
+	// minus the number of waiters that haven't been signaled yet if negative
+	int count;
+
+	// signals handed out to waiters that haven't picked them up yet; this is what waiters sleep on
+	int tokens;
+
+	// the value of the server-side semaphore, which stays untouched while we handle it locally
+	int initial;
+
+	// threads that are waiting on this slot (and may still touch `count` and `tokens`) without holding the lock.
+	// a slot isn't reused until it drops to zero, so that they can't end up waiting on someone else's semaphore.
+	int waiters;
+};
+
+struct semaphore_create_request
+{
+	mach_msg_header_t Head;
+	NDR_record_t NDR;
+	int policy;
+	int value;
+};
+
+// the reply to semaphore_create() and the request for semaphore_destroy() look the same
+struct semaphore_port_message
+{
+	mach_msg_header_t Head;
+	mach_msg_body_t msgh_body;
+	mach_msg_port_descriptor_t semaphore;
+};
+
+// signal/wait only ever take this for reading; changing the table or demoting a semaphore takes it for writing.
+static libsimple_rwlock_t semaphore_local_lock = LIBSIMPLE_RWLOCK_INITIALIZER;
+static struct local_semaphore semaphore_local_table[SEMAPHORE_LOCAL_MAX];
+
+// one past the highest slot in use; zero means there's nothing to look up
+static int semaphore_local_high = 0;
+
+static inline bool semaphore_local_empty(void)
+{
+	return __atomic_load_n(&semaphore_local_high, __ATOMIC_ACQUIRE) == 0;
+}
+
+// must be called with the lock held (either way)
+static struct local_semaphore* semaphore_local_lookup(mach_port_name_t name)
+{
+	int high = __atomic_load_n(&semaphore_local_high, __ATOMIC_ACQUIRE);
+
+	if (name == MACH_PORT_NULL)
+		return NULL;
+
+	for (int i = 0; i < high; i++)
+	{
+		if (semaphore_local_table[i].name == name)
+			return &semaphore_local_table[i];
+	}
+
+	return NULL;
+}
+
+static inline bool semaphore_local_demoted(struct local_semaphore* sem)
+{
+	return (__atomic_load_n(&sem->tokens, __ATOMIC_ACQUIRE) & TOKENS_DEMOTED) != 0;
+}
+
+// returns 1 if a signal was picked up, 0 if there was none and -1 if there was none and the semaphore has been demoted.
+// the value of `tokens` that was seen is stored in `seen`.
+static int semaphore_local_take_token(struct local_semaphore* sem, int* seen)
+{
+	int tokens = __atomic_load_n(&sem->tokens, __ATOMIC_ACQUIRE);
+
+	while ((tokens & ~TOKENS_DEMOTED) > 0)
+	{
+		if (__atomic_compare_exchange_n(&sem->tokens, &tokens, tokens - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return 1;
+	}
+
+	*seen = tokens;
+	return (tokens & TOKENS_DEMOTED) ? -1 : 0;
+}
+
+// must be called with the lock held for writing
+static void semaphore_local_demote_locked(struct local_semaphore* sem)
+{
+	int target;
+
+	if (semaphore_local_demoted(sem))
+		return;
+
+	// waiters that haven't been signaled yet will redo their wait on the server,
+	// so the server-side count only needs to reflect pending signals
+	target = (sem->count > 0) ? sem->count : 0;
+
+	while (sem->initial != target)
+	{
+		bool up = sem->initial < target;
+		int code = up ? dserver_rpc_semaphore_signal(sem->name) : dserver_rpc_semaphore_wait(sem->name);
+
+		if (code == -LINUX_EINTR)
+			continue;
+		if (code < 0)
+		{
+			__simple_printf("semaphore handover failed (internally): %d\n", code);
+			__simple_abort();
+		}
+
+		// the port is already gone; there's nothing left to hand over
+		if (code != KERN_SUCCESS)
+			break;
+
+		sem->initial += up ? 1 : -1;
+	}
+
+	__atomic_or_fetch(&sem->tokens, TOKENS_DEMOTED, __ATOMIC_RELEASE);
+	__linux_futex_reterr(&sem->tokens, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 0x7fffffff, NULL, NULL, 0);
+}
+
+bool semaphore_local_contains(mach_port_name_t name)
+{
+	struct local_semaphore* sem;
+	bool result;
+
+	if (semaphore_local_empty())
+		return false;
+
+	libsimple_rwlock_lock_read(&semaphore_local_lock);
+	sem = semaphore_local_lookup(name);
+	result = sem != NULL && !semaphore_local_demoted(sem);
+	libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+	return result;
+}
+
+void semaphore_local_demote(mach_port_name_t name)
+{
+	struct local_semaphore* sem;
+
+	if (!semaphore_local_contains(name))
+		return;
+
+	libsimple_rwlock_lock_write(&semaphore_local_lock);
+	sem = semaphore_local_lookup(name);
+	if (sem != NULL)
+		semaphore_local_demote_locked(sem);
+	libsimple_rwlock_unlock_write(&semaphore_local_lock);
+}
+
+void semaphore_local_forget(mach_port_name_t name)
+{
+	struct local_semaphore* sem;
+	int high;
+
+	if (semaphore_local_empty())
+		return;
+
+	libsimple_rwlock_lock_write(&semaphore_local_lock);
+	sem = semaphore_local_lookup(name);
+	if (sem != NULL)
+	{
+		semaphore_local_demote_locked(sem);
+		sem->name = MACH_PORT_NULL;
+
+		high = semaphore_local_high;
+		while (high > 0 && semaphore_local_table[high - 1].name == MACH_PORT_NULL)
+			high--;
+		__atomic_store_n(&semaphore_local_high, high, __ATOMIC_RELEASE);
+	}
+	libsimple_rwlock_unlock_write(&semaphore_local_lock);
+}
+
+// must be called with the lock held (either way)
+static void semaphore_local_signal_locked(struct local_semaphore* sem, bool all)
+{
+	int count;
+	int woken = 0;
+
+	if (all)
+	{
+		// only wakes up current waiters; doesn't leave a signal behind if there are none
+		count = __atomic_load_n(&sem->count, __ATOMIC_ACQUIRE);
+		while (count < 0 && !__atomic_compare_exchange_n(&sem->count, &count, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		if (count < 0)
+			woken = -count;
+	}
+	else
+	{
+		if (__atomic_fetch_add(&sem->count, 1, __ATOMIC_ACQ_REL) < 0)
+			woken = 1;
+	}
+
+	if (woken > 0)
+	{
+		__atomic_add_fetch(&sem->tokens, woken, __ATOMIC_RELEASE);
+		__linux_futex_reterr(&sem->tokens, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, woken, NULL, NULL, 0);
+	}
+}
+
+bool semaphore_local_signal(mach_port_name_t name, bool all, kern_return_t* kr)
+{
+	struct local_semaphore* sem;
+
+	if (semaphore_local_empty())
+		return false;
+
+	libsimple_rwlock_lock_read(&semaphore_local_lock);
+
+	sem = semaphore_local_lookup(name);
+	if (sem == NULL || semaphore_local_demoted(sem))
+	{
+		libsimple_rwlock_unlock_read(&semaphore_local_lock);
+		return false;
+	}
+
+	semaphore_local_signal_locked(sem, all);
+
+	libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+	*kr = KERN_SUCCESS;
+	return true;
+}
+
+// returns `true` if we were still waiting and have now stopped,
+// `false` if we've already been signaled (or the semaphore was demoted in the meantime)
+static bool semaphore_local_cancel_wait(struct local_semaphore* sem)
+{
+	bool cancelled = false;
+	int count;
+
+	libsimple_rwlock_lock_read(&semaphore_local_lock);
+	if (!semaphore_local_demoted(sem))
+	{
+		count = __atomic_load_n(&sem->count, __ATOMIC_ACQUIRE);
+		while (count < 0)
+		{
+			if (__atomic_compare_exchange_n(&sem->count, &count, count + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				cancelled = true;
+				break;
+			}
+		}
+	}
+	libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+	return cancelled;
+}
+
+// the first half of a wait, called with the lock held (either way) after checking that `nsec` is valid.
+// returns `true` if the wait is already over (with the result in `kr`); otherwise, the caller is now
+// registered as a waiter and must drop the lock and call `semaphore_local_sleep`.
+static bool semaphore_local_wait_locked(struct local_semaphore* sem, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr)
+{
+	int count;
+
+	if (timed && sec == 0 && nsec == 0)
+	{
+		// just polling; never register as a waiter
+		count = __atomic_load_n(&sem->count, __ATOMIC_ACQUIRE);
+		while (count > 0 && !__atomic_compare_exchange_n(&sem->count, &count, count - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+		*kr = (count > 0) ? KERN_SUCCESS : KERN_OPERATION_TIMED_OUT;
+		return true;
+	}
+
+	if (__atomic_fetch_sub(&sem->count, 1, __ATOMIC_ACQ_REL) > 0)
+	{
+		*kr = KERN_SUCCESS;
+		return true;
+	}
+
+	// keeps the slot from being reused until we're done with it
+	__atomic_add_fetch(&sem->waiters, 1, __ATOMIC_ACQ_REL);
+	return false;
+}
+
+// the second half of a wait; returns `false` if the semaphore was demoted while we were waiting
+static bool semaphore_local_sleep(struct local_semaphore* sem, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr)
+{
+	struct timespec deadline;
+	int seen, ret;
+	bool handled;
+
+	if (timed)
+	{
+		uint64_t abstime = mach_absolute_time() + sec * NSEC_PER_SEC + nsec;
+		deadline.tv_sec = abstime / NSEC_PER_SEC;
+		deadline.tv_nsec = abstime % NSEC_PER_SEC;
+	}
+
+	while (true)
+	{
+		ret = semaphore_local_take_token(sem, &seen);
+		if (ret > 0)
+		{
+			*kr = KERN_SUCCESS;
+			handled = true;
+			break;
+		}
+
+		// the semaphore was handed over while we were waiting; the server now accounts for us
+		if (ret < 0)
+		{
+			handled = false;
+			break;
+		}
+
+		ret = __linux_futex_reterr(&sem->tokens, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, seen, timed ? &deadline : NULL, NULL, FUTEX_BITSET_MATCH_ANY);
+
+		if (ret == -ETIMEDOUT || ret == -EINTR)
+		{
+			if (semaphore_local_cancel_wait(sem))
+			{
+				*kr = (ret == -ETIMEDOUT) ? KERN_OPERATION_TIMED_OUT : KERN_ABORTED;
+				handled = true;
+				break;
+			}
+
+			// someone signaled us just now; their wakeup is on its way
+			timed = false;
+		}
+	}
+
+	__atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_ACQ_REL);
+	return handled;
+}
+
+bool semaphore_local_wait(mach_port_name_t name, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr)
+{
+	struct local_semaphore* sem;
+	bool done;
+
+	if (semaphore_local_empty())
+		return false;
+
+	libsimple_rwlock_lock_read(&semaphore_local_lock);
+
+	sem = semaphore_local_lookup(name);
+	if (sem == NULL || semaphore_local_demoted(sem))
+	{
+		libsimple_rwlock_unlock_read(&semaphore_local_lock);
+		return false;
+	}
+
+	if (timed && nsec >= NSEC_PER_SEC)
+	{
+		libsimple_rwlock_unlock_read(&semaphore_local_lock);
+		*kr = KERN_INVALID_VALUE;
+		return true;
+	}
+
+	done = semaphore_local_wait_locked(sem, timed, sec, nsec, kr);
+	libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+	if (done)
+		return true;
+
+	return semaphore_local_sleep(sem, timed, sec, nsec, kr);
+}
+
+bool semaphore_local_wait_signal(mach_port_name_t wait_name, mach_port_name_t signal_name, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr)
+{
+	struct local_semaphore* wait_sem;
+	struct local_semaphore* signal_sem;
+	bool done;
+	int code;
+
+	if (semaphore_local_empty())
+		return false;
+
+	libsimple_rwlock_lock_read(&semaphore_local_lock);
+
+	wait_sem = semaphore_local_lookup(wait_name);
+	if (wait_sem != NULL && semaphore_local_demoted(wait_sem))
+		wait_sem = NULL;
+
+	signal_sem = semaphore_local_lookup(signal_name);
+	if (signal_sem != NULL && semaphore_local_demoted(signal_sem))
+		signal_sem = NULL;
+
+	if (wait_sem == NULL || signal_sem == NULL)
+	{
+		libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+		// the server can only do both halves at once if it has both semaphores
+		if (wait_sem != NULL)
+			semaphore_local_demote(wait_name);
+		if (signal_sem != NULL)
+			semaphore_local_demote(signal_name);
+		return false;
+	}
+
+	if (timed && nsec >= NSEC_PER_SEC)
+	{
+		libsimple_rwlock_unlock_read(&semaphore_local_lock);
+		*kr = KERN_INVALID_VALUE;
+		return true;
+	}
+
+	// like XNU, we're registered as a waiter before the signal goes out,
+	// so a semaphore_signal_all() prompted by our signal can't miss us
+	done = semaphore_local_wait_locked(wait_sem, timed, sec, nsec, kr);
+	semaphore_local_signal_locked(signal_sem, false);
+	libsimple_rwlock_unlock_read(&semaphore_local_lock);
+
+	if (done)
+		return true;
+
+	if (semaphore_local_sleep(wait_sem, timed, sec, nsec, kr))
+		return true;
+
+	// the wait semaphore was demoted while we were waiting. our signal has already gone out,
+	// so only the wait is left for the server (and the caller mustn't redo the whole thing).
+	code = timed ? dserver_rpc_semaphore_timedwait(wait_name, sec, nsec) : dserver_rpc_semaphore_wait(wait_name);
+	if (code == -LINUX_EINTR)
+	{
+		*kr = KERN_ABORTED;
+		return true;
+	}
+	if (code < 0)
+	{
+		__simple_printf("semaphore_wait_signal failed (internally): %d\n", code);
+		__simple_abort();
+	}
+
+	*kr = code;
+	return true;
+}
+
+static void semaphore_local_demote_carried(mach_port_name_t name, mach_msg_type_name_t disposition)
+{
+	semaphore_local_demote(name);
+}
+
+bool semaphore_local_msg_send(mach_msg_header_t* msg, int* create_value)
+{
+	bool for_task_self = msg->msgh_remote_port == mach_task_self();
+
+	if (for_task_self && msg->msgh_id == SEMAPHORE_CREATE_ID && msg->msgh_size >= sizeof(struct semaphore_create_request))
+	{
+		*create_value = ((struct semaphore_create_request*)msg)->value;
+		return true;
+	}
+
+	if (semaphore_local_empty())
+		return false;
+
+	mach_msg_foreach_port(msg, semaphore_local_demote_carried);
+
+	if ((msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) != 0)
+	{
+		// semaphore_destroy() consumes the name
+		if (for_task_self && msg->msgh_id == SEMAPHORE_DESTROY_ID)
+		{
+			struct semaphore_port_message* destroy = (struct semaphore_port_message*)msg;
+			if (msg->msgh_size >= sizeof(*destroy) && destroy->msgh_body.msgh_descriptor_count == 1)
+				semaphore_local_forget(destroy->semaphore.name);
+		}
+	}
+
+	return false;
+}
+
+void semaphore_local_msg_created(const mach_msg_header_t* reply, int value)
+{
+	const struct semaphore_port_message* created = (const struct semaphore_port_message*)reply;
+	struct local_semaphore* sem = NULL;
+	mach_port_name_t name;
+	int high;
+
+	if (reply->msgh_id != SEMAPHORE_CREATE_REPLY_ID || (reply->msgh_bits & MACH_MSGH_BITS_COMPLEX) == 0)
+		return;
+	if (reply->msgh_size < sizeof(*created) || created->msgh_body.msgh_descriptor_count != 1)
+		return;
+
+	name = created->semaphore.name;
+	if (name == MACH_PORT_NULL)
+		return;
+
+	libsimple_rwlock_lock_write(&semaphore_local_lock);
+
+	high = semaphore_local_high;
+	sem = semaphore_local_lookup(name);
+
+	// slots that still have (stale) waiters are skipped, even past `high`
+	for (int i = 0; sem == NULL && i < SEMAPHORE_LOCAL_MAX; i++)
+	{
+		if (semaphore_local_table[i].name == MACH_PORT_NULL && __atomic_load_n(&semaphore_local_table[i].waiters, __ATOMIC_ACQUIRE) == 0)
+		{
+			sem = &semaphore_local_table[i];
+			if (i >= high)
+				high = i + 1;
+		}
+	}
+
+	// if the table is full, the semaphore simply lives on the server
+	if (sem != NULL)
+	{
+		sem->count = value;
+		sem->initial = value;
+		__atomic_store_n(&sem->tokens, 0, __ATOMIC_RELAXED);
+		sem->name = name;
+		__atomic_store_n(&semaphore_local_high, high, __ATOMIC_RELEASE);
+	}
+
+	libsimple_rwlock_unlock_write(&semaphore_local_lock);
+}
+
+void semaphore_local_postfork_child(void)
+{
+	// the child gets a fresh port namespace; none of our semaphores exist there
+	libsimple_rwlock_init(&semaphore_local_lock);
+	for (int i = 0; i < SEMAPHORE_LOCAL_MAX; i++)
+	{
+		semaphore_local_table[i].name = MACH_PORT_NULL;
+		semaphore_local_table[i].waiters = 0;
+	}
+	__atomic_store_n(&semaphore_local_high, 0, __ATOMIC_RELEASE);
+}
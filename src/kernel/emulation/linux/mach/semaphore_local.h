@@ -0,0 +1,41 @@
+#ifndef _MACH_SEMAPHORE_LOCAL_H
+#define _MACH_SEMAPHORE_LOCAL_H
+
+#include <mach/mach_traps.h>
+#include <mach/kern_return.h>
+#include <mach/message.h>
+#include <mach/clock_types.h>
+#include <stdbool.h>
+
+// Semaphores created by this task are kept in a local table and operated on with futexes
+// for as long as their port never leaves the task. As soon as a right to one is sent elsewhere
+// (or the name is deallocated), its state is handed over to darlingserver and all further
+// operations on it go through RPC again.
+//
+// The functions below return `true` if the semaphore was handled locally (with the result in `kr`)
+// and `false` if the caller should fall back to the server.
+
+bool semaphore_local_signal(mach_port_name_t name, bool all, kern_return_t* kr);
+bool semaphore_local_wait(mach_port_name_t name, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr);
+bool semaphore_local_contains(mach_port_name_t name);
+
+// Like XNU, registers as a waiter on `wait_name` before signaling `signal_name`. This is only done locally
+// if both semaphores are local; otherwise, the local one is demoted so that the server can do it atomically.
+bool semaphore_local_wait_signal(mach_port_name_t wait_name, mach_port_name_t signal_name, bool timed, unsigned int sec, clock_res_t nsec, kern_return_t* kr);
+
+// Called for every outgoing message. Demotes local semaphores whose rights are carried by the message
+// and returns `true` if it's a `semaphore_create` request for our own task (storing the initial value).
+bool semaphore_local_msg_send(mach_msg_header_t* msg, int* create_value);
+
+// Called with the reply to a `semaphore_create` request flagged by `semaphore_local_msg_send`
+void semaphore_local_msg_created(const mach_msg_header_t* reply, int value);
+
+// Hands the semaphore over to the server (if it is local)
+void semaphore_local_demote(mach_port_name_t name);
+
+// Hands the semaphore over to the server and stops tracking the name
+void semaphore_local_forget(mach_port_name_t name);
+
+void semaphore_local_postfork_child(void);
+
+#endif
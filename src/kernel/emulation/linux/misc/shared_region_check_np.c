@@ -7,6 +7,7 @@
 
 long sys_shared_region_check_np(void* addr)
 {
+	// TODO: dyld shared cache support. That needs a cache built once per prefix (update_dyld_shared_cache
+	// isn't part of this tree) and shared_region_map_and_slide_np so that dyld can map it.
 	return -EINVAL; // means: no shared region
 }
-
@@ -6,6 +6,7 @@
 #include "sysctl_inc.h"
 #include <stddef.h>
 #include <limits.h>
+#include <stdbool.h>
 #include "sysctl_hw.h"
 #include "sysctl_unspec.h"
 #include "sysctl_kern.h"
@@ -38,6 +39,138 @@ const struct known_sysctl sysctls_root = {
 	.oid = 0, .type = CTLTYPE_NODE, .exttype = "", .name = "", .subctls = sysctls_global
 };
 
+// Hash of every full name in the tree ("kern.ostype" etc.) so that lookups by name don't have to
+// strcmp their way through each level. It's built the first time it's needed; misses (and callers
+// that come along while it's being built) walk the tree like before, which also takes care of the error codes.
+#define SYSCTL_NAME_SLOTS 256
+#define SYSCTL_NAME_MAX_DEPTH 4
+
+struct sysctl_name_entry
+{
+	unsigned int hash;
+	int depth; // 0 if the slot is unused
+	const struct known_sysctl* path[SYSCTL_NAME_MAX_DEPTH];
+};
+
+enum {
+	SYSCTL_NAMES_NONE,
+	SYSCTL_NAMES_BUILDING,
+	SYSCTL_NAMES_READY,
+};
+
+static struct sysctl_name_entry sysctl_names[SYSCTL_NAME_SLOTS];
+static int sysctl_names_state = SYSCTL_NAMES_NONE;
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static unsigned int sysctl_hash_add(unsigned int hash, const char* str)
+{
+	while (*str)
+	{
+		hash ^= (unsigned char) *str++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static void sysctl_names_add(const struct known_sysctl** path, int depth, unsigned int hash)
+{
+	for (unsigned int i = 0; i < SYSCTL_NAME_SLOTS; i++)
+	{
+		struct sysctl_name_entry* entry = &sysctl_names[(hash + i) % SYSCTL_NAME_SLOTS];
+
+		if (entry->depth == 0)
+		{
+			entry->hash = hash;
+			entry->depth = depth;
+			for (int j = 0; j < depth; j++)
+				entry->path[j] = path[j];
+			return;
+		}
+	}
+	// the table is full; this name will be looked up the slow way
+}
+
+static void sysctl_names_build(const struct known_sysctl* node, const struct known_sysctl** path, int depth, unsigned int hash)
+{
+	for (int i = 0; node->subctls[i].oid != -1; i++)
+	{
+		const struct known_sysctl* child = &node->subctls[i];
+		unsigned int child_hash = sysctl_hash_add((depth > 0) ? sysctl_hash_add(hash, ".") : hash, child->name);
+
+		path[depth] = child;
+		sysctl_names_add(path, depth + 1, child_hash);
+
+		if (child->type == CTLTYPE_NODE && depth + 1 < SYSCTL_NAME_MAX_DEPTH)
+			sysctl_names_build(child, path, depth + 1, child_hash);
+	}
+}
+
+// checks that `name` is exactly the entry's components joined with dots
+static bool sysctl_names_match(const struct sysctl_name_entry* entry, const char* name)
+{
+	for (int i = 0; i < entry->depth; i++)
+	{
+		__SIZE_TYPE__ len = strlen(entry->path[i]->name);
+
+		if (strncmp(name, entry->path[i]->name, len) != 0)
+			return false;
+		name += len;
+
+		if (i + 1 < entry->depth)
+		{
+			if (*name != '.')
+				return false;
+			name++;
+		}
+	}
+	return *name == '\0';
+}
+
+const struct known_sysctl* sysctl_lookup_name(const char* name, int* oid, int* oid_len)
+{
+	int state = __atomic_load_n(&sysctl_names_state, __ATOMIC_ACQUIRE);
+	unsigned int hash;
+
+	if (state != SYSCTL_NAMES_READY)
+	{
+		const struct known_sysctl* path[SYSCTL_NAME_MAX_DEPTH];
+
+		if (state != SYSCTL_NAMES_NONE || !__atomic_compare_exchange_n(&sysctl_names_state, &state, SYSCTL_NAMES_BUILDING,
+			false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			return NULL;
+		}
+
+		sysctl_names_build(&sysctls_root, path, 0, FNV_OFFSET);
+		__atomic_store_n(&sysctl_names_state, SYSCTL_NAMES_READY, __ATOMIC_RELEASE);
+	}
+
+	hash = sysctl_hash_add(FNV_OFFSET, name);
+
+	for (unsigned int i = 0; i < SYSCTL_NAME_SLOTS; i++)
+	{
+		const struct sysctl_name_entry* entry = &sysctl_names[(hash + i) % SYSCTL_NAME_SLOTS];
+
+		if (entry->depth == 0)
+			break;
+
+		if (entry->hash == hash && sysctl_names_match(entry, name))
+		{
+			if (oid != NULL)
+			{
+				for (int j = 0; j < entry->depth; j++)
+					oid[j] = entry->path[j]->oid;
+				*oid_len = entry->depth;
+			}
+			return entry->path[entry->depth - 1];
+		}
+	}
+
+	return NULL;
+}
+
 void copyout_string(const char* str, char* out, unsigned long* out_len)
 {
 	unsigned long len;
@@ -106,6 +239,15 @@ long sys_sysctlbyname(const char* name, unsigned long namelen, void* old, unsign
 	// Used by launchd, assumed to succeed
 	if (strcmp(name, "vfs.generic.noremotehang") == 0)
 		return 0;
+
+	current = sysctl_lookup_name(name, NULL, NULL);
+	if (current != NULL)
+	{
+		if (current->type == CTLTYPE_NODE)
+			return -EISDIR;
+		return current->handler(NULL, 0, old, oldlen, _new, newlen);
+	}
+	current = &sysctls_root;
 	
 	strlcpy(name_copy, name, sizeof(name_copy));
 	token = strtok_r(name_copy, ".", &saveptr);
@@ -33,5 +33,9 @@ struct known_sysctl
 };
 extern const struct known_sysctl sysctls_root;
 
+// Looks up a full name (e.g. "hw.ncpu") and optionally returns its OID (up to 4 components).
+// Returns NULL if the name isn't known; callers walk the tree themselves in that case to find out why.
+const struct known_sysctl* sysctl_lookup_name(const char* name, int* oid, int* oid_len);
+
 #endif
 
@@ -9,6 +9,12 @@
 #include "../simple.h"
 #include "../string.h"
 
+// for the commpage layout
+#ifndef PRIVATE
+#	define PRIVATE 1
+#endif
+#include <machine/cpu_capabilities.h>
+
 extern kern_return_t mach_port_deallocate(ipc_space_t task, mach_port_name_t name);
 extern kern_return_t host_info(mach_port_name_t host, int itype, void* hinfo, mach_msg_type_number_t* count);
 
@@ -22,9 +28,27 @@ enum {
 	_HW_CPUSUBTYPE,
 	_HW_CPUTHREADTYPE,
 	_HW_64BITCAPABLE,
+	_HW_ACTIVECPU,
+	_HW_PACKAGES,
+	_HW_NPERFLEVELS,
+	_HW_PERFLEVEL0,
 	_HW_CPUFREQUENCY = 15,
 };
 
+enum {
+	_HW_PERFLEVEL_PHYSICAL_CPU = 1,
+	_HW_PERFLEVEL_PHYSICAL_CPU_MAX,
+	_HW_PERFLEVEL_LOGICAL_CPU,
+	_HW_PERFLEVEL_LOGICAL_CPU_MAX,
+	_HW_PERFLEVEL_L1ICACHESIZE,
+	_HW_PERFLEVEL_L1DCACHESIZE,
+	_HW_PERFLEVEL_L2CACHESIZE,
+	_HW_PERFLEVEL_L3CACHESIZE,
+	_HW_PERFLEVEL_CPUSPERL2,
+	_HW_PERFLEVEL_CPUSPERL3,
+	_HW_PERFLEVEL_NAME,
+};
+
 static sysctl_handler(handle_availcpu);
 static sysctl_handler(handle_physicalcpu);
 static sysctl_handler(handle_physicalcpu_max);
@@ -38,10 +62,41 @@ static sysctl_handler(handle_cputhreadtype);
 static sysctl_handler(handle_cpu64bitcapable);
 static sysctl_handler(handle_machine);
 static sysctl_handler(handle_cpufrequency);
+static sysctl_handler(handle_packages);
+static sysctl_handler(handle_nperflevels);
+static sysctl_handler(handle_cachelinesize);
+static sysctl_handler(handle_l1icachesize);
+static sysctl_handler(handle_l1dcachesize);
+static sysctl_handler(handle_l2cachesize);
+static sysctl_handler(handle_l3cachesize);
+static sysctl_handler(handle_perflevel_l1icachesize);
+static sysctl_handler(handle_perflevel_l1dcachesize);
+static sysctl_handler(handle_perflevel_l2cachesize);
+static sysctl_handler(handle_perflevel_l3cachesize);
+static sysctl_handler(handle_cpusperl2);
+static sysctl_handler(handle_cpusperl3);
+static sysctl_handler(handle_perflevel_name);
+
+// Darling has a single performance level, which covers all CPUs
+static const struct known_sysctl sysctls_hw_perflevel0[] = {
+	{ .oid = _HW_PERFLEVEL_PHYSICAL_CPU, .type = CTLTYPE_INT, .exttype = "", .name = "physicalcpu", .handler = handle_physicalcpu },
+	{ .oid = _HW_PERFLEVEL_PHYSICAL_CPU_MAX, .type = CTLTYPE_INT, .exttype = "", .name = "physicalcpu_max", .handler = handle_physicalcpu_max },
+	{ .oid = _HW_PERFLEVEL_LOGICAL_CPU, .type = CTLTYPE_INT, .exttype = "", .name = "logicalcpu", .handler = handle_logicalcpu },
+	{ .oid = _HW_PERFLEVEL_LOGICAL_CPU_MAX, .type = CTLTYPE_INT, .exttype = "", .name = "logicalcpu_max", .handler = handle_logicalcpu_max },
+	{ .oid = _HW_PERFLEVEL_L1ICACHESIZE, .type = CTLTYPE_INT, .exttype = "", .name = "l1icachesize", .handler = handle_perflevel_l1icachesize },
+	{ .oid = _HW_PERFLEVEL_L1DCACHESIZE, .type = CTLTYPE_INT, .exttype = "", .name = "l1dcachesize", .handler = handle_perflevel_l1dcachesize },
+	{ .oid = _HW_PERFLEVEL_L2CACHESIZE, .type = CTLTYPE_INT, .exttype = "", .name = "l2cachesize", .handler = handle_perflevel_l2cachesize },
+	{ .oid = _HW_PERFLEVEL_L3CACHESIZE, .type = CTLTYPE_INT, .exttype = "", .name = "l3cachesize", .handler = handle_perflevel_l3cachesize },
+	{ .oid = _HW_PERFLEVEL_CPUSPERL2, .type = CTLTYPE_INT, .exttype = "", .name = "cpusperl2", .handler = handle_cpusperl2 },
+	{ .oid = _HW_PERFLEVEL_CPUSPERL3, .type = CTLTYPE_INT, .exttype = "", .name = "cpusperl3", .handler = handle_cpusperl3 },
+	{ .oid = _HW_PERFLEVEL_NAME, .type = CTLTYPE_STRING, .exttype = "S", .name = "name", .handler = handle_perflevel_name },
+	{ .oid = -1 }
+};
 
 const struct known_sysctl sysctls_hw[] = {
 	{ .oid = HW_AVAILCPU, .type = CTLTYPE_INT, .exttype = "", .name = "availcpu", .handler = handle_availcpu },
 	{ .oid = HW_NCPU, .type = CTLTYPE_INT, .exttype = "", .name = "ncpu", .handler = handle_availcpu },
+	{ .oid = _HW_ACTIVECPU, .type = CTLTYPE_INT, .exttype = "", .name = "activecpu", .handler = handle_availcpu },
 	{ .oid = _HW_PHYSICAL_CPU, .type = CTLTYPE_INT, .exttype = "", .name = "physicalcpu", .handler = handle_physicalcpu },
 	{ .oid = _HW_PHYSICAL_CPU_MAX, .type = CTLTYPE_INT, .exttype = "", .name = "physicalcpu_max", .handler = handle_physicalcpu_max },
 	{ .oid = _HW_LOGICAL_CPU, .type = CTLTYPE_INT, .exttype = "", .name = "logicalcpu", .handler = handle_logicalcpu },
@@ -54,58 +109,251 @@ const struct known_sysctl sysctls_hw[] = {
 	{ .oid = _HW_64BITCAPABLE, .type = CTLTYPE_INT, .exttype = "", .name = "cpu64bit_capable", .handler = handle_cpu64bitcapable },
 	{ .oid = HW_MACHINE, .type = CTLTYPE_STRING, .exttype = "S", .name = "machine", .handler = handle_machine },
 	{ .oid = _HW_CPUFREQUENCY, .type = CTLTYPE_INT, .exttype = "", .name = "cpufrequency", .handler = handle_cpufrequency },
+	{ .oid = _HW_PACKAGES, .type = CTLTYPE_INT, .exttype = "", .name = "packages", .handler = handle_packages },
+	{ .oid = HW_CACHELINE, .type = CTLTYPE_QUAD, .exttype = "", .name = "cachelinesize", .handler = handle_cachelinesize },
+	{ .oid = HW_L1ICACHESIZE, .type = CTLTYPE_QUAD, .exttype = "", .name = "l1icachesize", .handler = handle_l1icachesize },
+	{ .oid = HW_L1DCACHESIZE, .type = CTLTYPE_QUAD, .exttype = "", .name = "l1dcachesize", .handler = handle_l1dcachesize },
+	{ .oid = HW_L2CACHESIZE, .type = CTLTYPE_QUAD, .exttype = "", .name = "l2cachesize", .handler = handle_l2cachesize },
+	{ .oid = HW_L3CACHESIZE, .type = CTLTYPE_QUAD, .exttype = "", .name = "l3cachesize", .handler = handle_l3cachesize },
+	{ .oid = _HW_NPERFLEVELS, .type = CTLTYPE_INT, .exttype = "", .name = "nperflevels", .handler = handle_nperflevels },
+	{ .oid = _HW_PERFLEVEL0, .type = CTLTYPE_NODE, .exttype = "", .name = "perflevel0", .subctls = sysctls_hw_perflevel0 },
 	{ .oid = -1 }
 };
 
+// none of this changes while we're running, so the server only gets asked once
 static const struct host_basic_info* gethostinfo(void)
 {
 	static struct host_basic_info hinfo;
+	static int hinfo_valid;
 
-	if (!hinfo.avail_cpus)
+	if (!__atomic_load_n(&hinfo_valid, __ATOMIC_ACQUIRE))
 	{
+		struct host_basic_info info;
 		mach_msg_type_number_t hcount = HOST_BASIC_INFO_COUNT;
 		mach_port_t hself;
 
+		// racing threads simply all ask; they all get the same answer
 		hself = mach_host_self();
-		host_info(hself, HOST_BASIC_INFO, &hinfo, &hcount);
+		if (host_info(hself, HOST_BASIC_INFO, &info, &hcount) == KERN_SUCCESS)
+		{
+			hinfo = info;
+			__atomic_store_n(&hinfo_valid, 1, __ATOMIC_RELEASE);
+		}
 		mach_port_deallocate(mach_task_self(), hself);
 	}
 
 	return &hinfo;
 }
 
+// How many CPUs we may use (i.e. within our affinity mask and cgroup CPU quota) is in the commpage, where mldr put it.
+// Everything else about the host's CPUs and caches is read from sysfs once, the first time it's asked for.
+
+enum {
+	CACHE_L1I,
+	CACHE_L1D,
+	CACHE_L2,
+	CACHE_L3,
+	CACHE_COUNT,
+};
+
+struct cpu_topology
+{
+	int packages;
+	int physical_max;
+	int logical_max;
+	int cache_size[CACHE_COUNT];
+	int cpus_per_cache[CACHE_COUNT];
+};
+
+#define TOPOLOGY_MAX_CPUS 4096
+#define TOPOLOGY_MAX_PACKAGES 64
+
+// Marks every CPU in a Linux CPU list (e.g. "0-3,8,10-11") in `set`; returns how many there are
+static int parse_cpu_list(const char* list, uint64_t* set)
+{
+	int count = 0;
+
+	while (*list >= '0' && *list <= '9')
+	{
+		const char* end;
+		unsigned long long first = __simple_atoi(list, &end);
+		unsigned long long last = first;
+
+		if (*end == '-')
+			last = __simple_atoi(end + 1, &end);
+
+		for (unsigned long long cpu = first; cpu <= last; cpu++)
+		{
+			count++;
+			if (set != NULL && cpu < TOPOLOGY_MAX_CPUS)
+				set[cpu / 64] |= 1ull << (cpu % 64);
+		}
+
+		list = (*end == ',') ? end + 1 : end;
+	}
+
+	return count;
+}
+
+// e.g. "48K"
+static int parse_size(const char* str)
+{
+	const char* end;
+	int size = __simple_atoi(str, &end);
+
+	if (*end == 'K')
+		size *= 1024;
+	else if (*end == 'M')
+		size *= 1024 * 1024;
+
+	return size;
+}
+
+static void read_caches(struct cpu_topology* topology)
+{
+	char path[128];
+	char buf[256];
+
+	for (int index = 0; ; index++)
+	{
+		int level, cache;
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		if (!read_string(path, buf, sizeof(buf)))
+			break;
+		level = __simple_atoi(buf, NULL);
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+		if (!read_string(path, buf, sizeof(buf)))
+			continue;
+
+		if (level == 1 && strncmp(buf, "Instruction", 11) == 0)
+			cache = CACHE_L1I;
+		else if (level == 1 && strncmp(buf, "Data", 4) == 0)
+			cache = CACHE_L1D;
+		else if (level == 2)
+			cache = CACHE_L2;
+		else if (level == 3)
+			cache = CACHE_L3;
+		else
+			continue;
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		if (read_string(path, buf, sizeof(buf)))
+			topology->cache_size[cache] = parse_size(buf);
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/shared_cpu_list", index);
+		if (read_string(path, buf, sizeof(buf)))
+			topology->cpus_per_cache[cache] = parse_cpu_list(buf, NULL);
+	}
+}
+
+static void read_topology(struct cpu_topology* topology)
+{
+	uint64_t present[TOPOLOGY_MAX_CPUS / 64] = {0};
+	uint64_t seen[TOPOLOGY_MAX_CPUS / 64] = {0};
+	int packages[TOPOLOGY_MAX_PACKAGES];
+	char path[128];
+	char buf[256];
+
+	if (read_string("/sys/devices/system/cpu/present", buf, sizeof(buf)))
+		topology->logical_max = parse_cpu_list(buf, present);
+
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++)
+	{
+		int package, i;
+
+		if (!(present[cpu / 64] & (1ull << (cpu % 64))) || (seen[cpu / 64] & (1ull << (cpu % 64))))
+			continue;
+
+		// a physical core is a set of SMT siblings, all of which are in the same package
+		topology->physical_max++;
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		if (read_string(path, buf, sizeof(buf)))
+			parse_cpu_list(buf, seen);
+
+		__simple_snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		if (!read_string(path, buf, sizeof(buf)))
+			continue;
+
+		package = __simple_atoi(buf, NULL);
+		for (i = 0; i < topology->packages; i++)
+		{
+			if (packages[i] == package)
+				break;
+		}
+		if (i == topology->packages && topology->packages < TOPOLOGY_MAX_PACKAGES)
+			packages[topology->packages++] = package;
+	}
+
+	read_caches(topology);
+}
+
+static const struct cpu_topology* get_topology(void)
+{
+	static struct cpu_topology topology;
+	static int topology_valid;
+
+	if (!__atomic_load_n(&topology_valid, __ATOMIC_ACQUIRE))
+	{
+		struct cpu_topology result = {0};
+
+		// racing threads simply all read it; they all get the same answer
+		read_topology(&result);
+
+		if (result.packages == 0)
+			result.packages = 1;
+		if (result.physical_max == 0)
+			result.physical_max = gethostinfo()->physical_cpu_max;
+		if (result.logical_max == 0)
+			result.logical_max = gethostinfo()->logical_cpu_max;
+
+		topology = result;
+		__atomic_store_n(&topology_valid, 1, __ATOMIC_RELEASE);
+	}
+
+	return &topology;
+}
+
+static int commpage_cpus(uintptr_t address)
+{
+	int cpus = *((volatile uint8_t*) address);
+	return (cpus > 0) ? cpus : 1;
+}
+
 sysctl_handler(handle_availcpu)
 {
 	sysctl_handle_size(sizeof(int));
-	*((int*) old) = gethostinfo()->avail_cpus;
+	*((int*) old) = commpage_cpus(_COMM_PAGE_ACTIVE_CPUS);
 	return 0;
 }
 
 sysctl_handler(handle_physicalcpu)
 {
 	sysctl_handle_size(sizeof(int));
-	*((int*) old) = gethostinfo()->physical_cpu;
+	*((int*) old) = commpage_cpus(_COMM_PAGE_PHYSICAL_CPUS);
 	return 0;
 }
 
 sysctl_handler(handle_physicalcpu_max)
 {
 	sysctl_handle_size(sizeof(int));
-	*((int*) old) = gethostinfo()->physical_cpu_max;
+	*((int*) old) = get_topology()->physical_max;
 	return 0;
 }
 
 sysctl_handler(handle_logicalcpu)
 {
 	sysctl_handle_size(sizeof(int));
-	*((int*) old) = gethostinfo()->logical_cpu;
+	*((int*) old) = commpage_cpus(_COMM_PAGE_LOGICAL_CPUS);
 	return 0;
 }
 
 sysctl_handler(handle_logicalcpu_max)
 {
 	sysctl_handle_size(sizeof(int));
-	*((int*) old) = gethostinfo()->logical_cpu_max;
+	*((int*) old) = get_topology()->logical_max;
 	return 0;
 }
 
@@ -169,13 +417,22 @@ sysctl_handler(handle_cputhreadtype)
 
 sysctl_handler(handle_cpufrequency)
 {
-	int freq = 2400000;
-	char buf[16];
+	static int cached_freq;
+	int freq = __atomic_load_n(&cached_freq, __ATOMIC_RELAXED);
+
+	sysctl_handle_size(sizeof(int));
+
+	if (freq == 0)
+	{
+		char buf[16];
+
+		freq = 2400000;
+		if (read_string("/sys/bus/cpu/devices/cpu0/cpufreq/cpuinfo_max_freq", buf, sizeof(buf)))
+			freq = __simple_atoi(buf, NULL);
+		__atomic_store_n(&cached_freq, freq, __ATOMIC_RELAXED);
+	}
 
-	if (read_string("/sys/bus/cpu/devices/cpu0/cpufreq/cpuinfo_max_freq", buf, sizeof(buf)))
-		freq = __simple_atoi(buf, NULL);
 	*((int*) old) = freq;
-	
 	return 0;
 }
 
@@ -191,3 +448,101 @@ sysctl_handler(handle_machine)
 	copyout_string(need_uname()->machine, (char*) old, oldlen);
 	return 0;
 }
+
+sysctl_handler(handle_packages)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->packages;
+	return 0;
+}
+
+sysctl_handler(handle_nperflevels)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = 1;
+	return 0;
+}
+
+sysctl_handler(handle_cachelinesize)
+{
+	sysctl_handle_size(sizeof(long long));
+	*((long long*) old) = *((volatile uint16_t*) _COMM_PAGE_CACHE_LINESIZE);
+	return 0;
+}
+
+sysctl_handler(handle_l1icachesize)
+{
+	sysctl_handle_size(sizeof(long long));
+	*((long long*) old) = get_topology()->cache_size[CACHE_L1I];
+	return 0;
+}
+
+sysctl_handler(handle_l1dcachesize)
+{
+	sysctl_handle_size(sizeof(long long));
+	*((long long*) old) = get_topology()->cache_size[CACHE_L1D];
+	return 0;
+}
+
+sysctl_handler(handle_l2cachesize)
+{
+	sysctl_handle_size(sizeof(long long));
+	*((long long*) old) = get_topology()->cache_size[CACHE_L2];
+	return 0;
+}
+
+sysctl_handler(handle_l3cachesize)
+{
+	sysctl_handle_size(sizeof(long long));
+	*((long long*) old) = get_topology()->cache_size[CACHE_L3];
+	return 0;
+}
+
+// the hw.perflevel0 cache sizes are ints, unlike the hw ones
+sysctl_handler(handle_perflevel_l1icachesize)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cache_size[CACHE_L1I];
+	return 0;
+}
+
+sysctl_handler(handle_perflevel_l1dcachesize)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cache_size[CACHE_L1D];
+	return 0;
+}
+
+sysctl_handler(handle_perflevel_l2cachesize)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cache_size[CACHE_L2];
+	return 0;
+}
+
+sysctl_handler(handle_perflevel_l3cachesize)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cache_size[CACHE_L3];
+	return 0;
+}
+
+sysctl_handler(handle_cpusperl2)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cpus_per_cache[CACHE_L2];
+	return 0;
+}
+
+sysctl_handler(handle_cpusperl3)
+{
+	sysctl_handle_size(sizeof(int));
+	*((int*) old) = get_topology()->cpus_per_cache[CACHE_L3];
+	return 0;
+}
+
+sysctl_handler(handle_perflevel_name)
+{
+	copyout_string("Performance", (char*) old, oldlen);
+	return 0;
+}
@@ -76,6 +76,10 @@ sysctl_handler(handle_name_to_oid)
 	char _new_copy[128]; // the actual max for this is MAXPATHLEN
 
 	strlcpy(_new_copy, _new, sizeof(_new_copy));
+
+	if (sysctl_lookup_name(_new_copy, oid, &oid_len) != NULL)
+		goto found;
+
 	token = strtok_r((char*) _new_copy, ".", &saveptr);
 
 	while (token != NULL)
@@ -103,6 +107,7 @@ sysctl_handler(handle_name_to_oid)
 		token = strtok_r(NULL, ".", &saveptr);
 	}
 
+found:
 	if (old == NULL)
 	{
 		*oldlen = sizeof(int) * oid_len;
@@ -25,6 +25,13 @@
 
 #undef memcpy
 #include "../resources/dserver-rpc-defs.h"
+
+// for the commpage layout
+#ifndef PRIVATE
+#	define PRIVATE 1
+#endif
+#include <machine/cpu_capabilities.h>
+
 extern bool isspace(char c);
 
 extern void _xtrace_execve_inject(const char*** envp_ptr);
@@ -185,10 +192,16 @@ long sys_execve(const char* fname, const char** argvp, const char** envp)
 		char mldr_lifetime_pipe_env[32] = { '\0' };
 		__simple_snprintf(mldr_lifetime_pipe_env, sizeof(mldr_lifetime_pipe_env) - 1, "__mldr_lifetime_pipe=%d", __dserver_get_process_lifetime_pipe());
 
+		// the CPU topology mldr worked out for us, so that it doesn't have to read it from sysfs again
+		char mldr_cputopo_env[48] = { '\0' };
+		__simple_snprintf(mldr_cputopo_env, sizeof(mldr_cputopo_env) - 1, "__mldr_cputopo=%d,%d,%d",
+			*((volatile uint8_t*) _COMM_PAGE_LOGICAL_CPUS), *((volatile uint8_t*) _COMM_PAGE_PHYSICAL_CPUS),
+			*((volatile uint16_t*) _COMM_PAGE_CACHE_LINESIZE));
+
 		// count original env vars
 		while (envp[len++]);
 
-		const int new_env_count = 2;
+		const int new_env_count = 3;
 
 		// allocate a new envp and env0, env1
 		modenvp = (const char**)__builtin_alloca(sizeof(void*) * (len + new_env_count));
@@ -199,6 +212,7 @@ long sys_execve(const char* fname, const char** argvp, const char** envp)
 		strcat(buf, server_socket_path);
 		modenvp[0] = buf;
 		modenvp[1] = mldr_lifetime_pipe_env;
+		modenvp[2] = mldr_cputopo_env;
 
 		// append original env vars
 		for (int i = new_env_count; i < len + new_env_count; i++)
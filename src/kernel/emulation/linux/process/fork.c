@@ -13,6 +13,10 @@
 #include "../unistd/close.h"
 #include "../../../libsyscall/wrappers/_libkernel_init.h"
 #include "../guarded/table.h"
+#include "../aio/aio.h"
+#include "../fdpath.h"
+#include "../mach/semaphore_local.h"
+#include "../mach/msg_local.h"
 
 extern _libkernel_functions_t _libkernel_functions;
 
@@ -32,11 +36,24 @@ long sys_fork(void)
 	{
 		// in the child
 
+		// this has to come first: closing any RPC socket (as below) needs locks that
+		// another thread in the parent (e.g. the one refilling the socket pool) may have been holding
+		__dserver_socket_postfork_child();
+
 		// the old RPC FD will be closed in `guard_table_postfork_child`;
 		// we don't need to close it ourselves.
 		// that should also take care of closing descriptors for any other threads.
 		guard_table_postfork_child();
 
+		// outstanding AIO requests (and the threads serving them) belong to the parent
+		aio_postfork_child();
+
+		fdpath_cache_postfork_child();
+
+		// the child starts out with a fresh port namespace
+		semaphore_local_postfork_child();
+		msg_local_postfork_child();
+
 		// create a new dserver RPC socket
 		__dserver_per_thread_socket_refresh();
 		int newReadFd = __dserver_process_lifetime_pipe_refresh();
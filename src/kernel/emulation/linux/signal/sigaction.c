@@ -255,7 +255,7 @@ void handler_linux_to_bsd(int linux_signum, struct linux_siginfo* info, void* ct
 		memset(&binfo, 0, sizeof(binfo));
 		binfo.si_signo = signum_linux_to_bsd(info->si_signo);
 		binfo.si_errno = errno_linux_to_bsd(info->si_errno);
-		binfo.si_code = info->si_code;
+		binfo.si_code = (info->si_code == LINUX_SI_ASYNCIO) ? SI_ASYNCIO : info->si_code;
 		binfo.si_pid = info->si_pid;
 		binfo.si_uid = info->si_uid;
 		binfo.si_addr = info->si_addr;
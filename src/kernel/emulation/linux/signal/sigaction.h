@@ -21,6 +21,8 @@
 #define LINUX_SA_NODEFER      0x40000000u
 #define LINUX_SA_RESETHAND    0x80000000u
 
+#define LINUX_SI_ASYNCIO      (-4)
+
 struct bsd_siginfo
 {
 	int si_signo;
@@ -216,6 +216,14 @@
 #include "sysv_sem/semop.h"
 #include "mach/audit_session_self.h"
 #include "audit/audit_addr.h"
+#include "aio/aio_read.h"
+#include "aio/aio_write.h"
+#include "aio/aio_fsync.h"
+#include "aio/aio_error.h"
+#include "aio/aio_return.h"
+#include "aio/aio_cancel.h"
+#include "aio/aio_suspend.h"
+#include "aio/lio_listio.h"
 
 void* __bsd_syscall_table[600] = {
 	[0] = sys_syscall,
@@ -392,6 +400,14 @@ void* __bsd_syscall_table[600] = {
 	[308] = sys_psynch_rw_unlock,
 	[310] = sys_getsid,
 	[312] = sys_psynch_cvclrprepost,
+	[313] = sys_aio_fsync,
+	[314] = sys_aio_return,
+	[315] = sys_aio_suspend,
+	[316] = sys_aio_cancel,
+	[317] = sys_aio_error,
+	[318] = sys_aio_read,
+	[319] = sys_aio_write,
+	[320] = sys_lio_listio,
 	[322] = sys_iopolicysys,
 	[327] = sys_issetugid,
 	[328] = sys_pthread_kill,
@@ -451,6 +467,7 @@ void* __bsd_syscall_table[600] = {
 	[415] = sys_pwrite_nocancel,
 	[417] = sys_poll_nocancel,
 	[420] = sys_sem_wait_nocancel,
+	[421] = sys_aio_suspend_nocancel,
 	[422] = sys_sigwait_nocancel,
 	[423] = sys_semwait_signal_nocancel,
 	[427] = sys_fsgetpath,
@@ -7,6 +7,7 @@
 #include <lkm/api.h>
 #include "../simple.h"
 #include "../guarded/table.h"
+#include "../fdpath.h"
 
 __attribute__((weak))
 __attribute__((visibility("default")))
@@ -33,6 +34,8 @@ long sys_close_nocancel(int fd)
 		return 0;
 	}
 
+	fdpath_cache_invalidate(fd);
+
 	if (kqueue_close(fd)) {
 		// this FD belongs to libkqueue and it will take care of closing it
 		return 0;
@@ -51,6 +54,8 @@ long close_internal(int fd)
 {
 	int ret;
 
+	fdpath_cache_invalidate(fd);
+
 	ret = LINUX_SYSCALL1(__NR_close, fd);
 	if (ret < 0)
 		ret = errno_linux_to_bsd(ret);
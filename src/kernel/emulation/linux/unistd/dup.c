@@ -2,6 +2,7 @@
 #include "../base.h"
 #include "../errno.h"
 #include <linux-syscalls/linux.h>
+#include "../fdpath.h"
 
 __attribute__((weak))
 __attribute__((visibility("default")))
@@ -15,7 +16,10 @@ long sys_dup(int fd)
 	if (ret < 0)
 		ret = errno_linux_to_bsd(ret);
 	else
+	{
+		fdpath_cache_dup(fd, ret);
 		kqueue_dup(fd, ret);
+	}
 
 	return ret;
 }
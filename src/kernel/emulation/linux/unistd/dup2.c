@@ -7,6 +7,7 @@
 #include <lkm/api.h>
 #include "../simple.h"
 #include "../guarded/table.h"
+#include "../fdpath.h"
 
 extern void kqueue_dup(int oldfd, int newfd);
 
@@ -32,7 +33,10 @@ long sys_dup2(int fd_from, int fd_to)
 	if (ret < 0)
 		ret = errno_linux_to_bsd(ret);
 	else
+	{
+		fdpath_cache_dup(fd_from, fd_to);
 		kqueue_dup(fd_from, fd_to);
+	}
 
 	return ret;
 }
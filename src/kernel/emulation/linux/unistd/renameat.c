@@ -7,6 +7,7 @@
 #include "../vchroot_expand.h"
 #include <lkm/api.h>
 #include <mach/lkm.h>
+#include "../fdpath.h"
 
 extern char* strcpy(char* dst, const char* src);
 
@@ -37,5 +38,10 @@ long sys_renameat(int oldfd, const char* oldpath, int newfd, const char* newpath
 	if (ret < 0)
 		return errno_linux_to_bsd(ret);
 
+	// descriptors open on (or below) the old name now have a different path,
+	// and those open on a replaced target no longer have one at all
+	fdpath_cache_invalidate_path(vc.path);
+	fdpath_cache_invalidate_path(vc2.path);
+
 	return 0;
 }
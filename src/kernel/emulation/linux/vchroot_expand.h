@@ -10,5 +10,8 @@ struct vchroot_unexpand_args
 };
 int vchroot_unexpand(struct vchroot_unexpand_args* args);
 
+// translates an expanded (Linux) path of length `len` back into a path as seen from inside the prefix
+int vchroot_unexpand_path(const char* path, int len, char* out, __SIZE_TYPE__ maxlen);
+
 #endif
 
@@ -476,11 +476,6 @@ static bool next_component(const char* from, const char** end)
 
 int vchroot_fdpath(struct vchroot_fdpath_args* args)
 {
-#ifndef TEST
-	if (prefix_path_len == -1)
-		init_vchroot_path();
-#endif
-
 	char buf[50];
 	char link[4096];
 
@@ -496,28 +491,42 @@ int vchroot_fdpath(struct vchroot_fdpath_args* args)
 
 	link[rv] = '\0';
 
-	if (rv >= prefix_path_len && strncmp(link, prefix_path, prefix_path_len) == 0)
+	rv = vchroot_unexpand_path(link, rv, args->path, args->maxlen);
+	if (rv < 0)
+		return rv;
+
+#ifndef TEST
+	__simple_printf("fdpath %d -> %s\n", args->fd, args->path);
+#endif
+
+	return 0;
+}
+
+int vchroot_unexpand_path(const char* path, int len, char* out, size_t maxlen)
+{
+#ifndef TEST
+	if (prefix_path_len == -1)
+		init_vchroot_path();
+#endif
+
+	if (len >= prefix_path_len && strncmp(path, prefix_path, prefix_path_len) == 0)
 	{
-		if (args->maxlen-1 < rv - prefix_path_len)
+		if (maxlen-1 < len - prefix_path_len)
 			return -LINUX_ENAMETOOLONG;
-		strcpy(args->path, link + prefix_path_len);
+		strcpy(out, path + prefix_path_len);
 
-		if (args->path[0] == '\0')
-			strcpy(args->path, "/");
+		if (out[0] == '\0')
+			strcpy(out, "/");
 	}
 	else
 	{
-		if (args->maxlen < sizeof(EXIT_PATH) + rv)
+		if (maxlen < sizeof(EXIT_PATH) + len)
 			return -LINUX_ENAMETOOLONG;
 
-		memcpy(args->path, EXIT_PATH, sizeof(EXIT_PATH) - 1);
-		memcpy(args->path + sizeof(EXIT_PATH) - 1, link, rv+1);
+		memcpy(out, EXIT_PATH, sizeof(EXIT_PATH) - 1);
+		memcpy(out + sizeof(EXIT_PATH) - 1, path, len+1);
 	}
 
-#ifndef TEST
-	__simple_printf("fdpath %d -> %s\n", args->fd, args->path);
-#endif
-
 	return 0;
 }
 
@@ -171,6 +171,13 @@ struct launch_msg_header {
 
 #define LAUNCH_MSG_HEADER_MAGIC 0xD2FEA02366B39A41ull
 
+/* Connection buffers start at this size and grow by doubling. Once drained,
+ * buffers that grew past LAUNCH_MSG_BUFFER_KEEP are released again, so one
+ * big message doesn't pin its memory for the life of the connection.
+ */
+#define LAUNCH_MSG_BUFFER_MIN	(8 * 1024)
+#define LAUNCH_MSG_BUFFER_KEEP	(256 * 1024)
+
 enum {
 	LAUNCHD_USE_CHECKIN_FD,
 	LAUNCHD_USE_OTHER_FD,
@@ -184,6 +191,9 @@ struct _launch {
 	size_t	sendfdcnt;
 	size_t	recvlen;
 	size_t	recvfdcnt;
+	size_t	sendbufsize;
+	size_t	sendfdsize;
+	size_t	recvbufsize;
 	int which;
 	int cifd;
 	int	fd;
@@ -195,6 +205,8 @@ static void launch_client_init(void);
 static void launch_msg_getmsgs(launch_data_t m, void *context);
 static launch_data_t launch_msg_internal(launch_data_t d);
 static void launch_mach_checkin_service(launch_data_t obj, const char *key, void *context);
+static bool launchd_buffer_reserve(void **buf, size_t *size, size_t needed);
+static void launchd_buffer_trim(void **buf, size_t *size);
 
 void
 _launch_init_globals(launch_globals_t globals)
@@ -694,6 +706,37 @@ launchd_close(launch_t lh, typeof(close) closefunc)
 
 #define ROUND_TO_64BIT_WORD_SIZE(x)	((x + 7) & ~7)
 
+size_t
+launch_data_pack_size(launch_data_t d, size_t *fd_cnt)
+{
+	size_t i, node_data_len = sizeof(struct _launch_data);
+
+	switch (d->type) {
+	case LAUNCH_DATA_FD:
+		if (fd_cnt && d->fd != -1) {
+			(*fd_cnt)++;
+		}
+		break;
+	case LAUNCH_DATA_STRING:
+		node_data_len += ROUND_TO_64BIT_WORD_SIZE(d->string_len + 1);
+		break;
+	case LAUNCH_DATA_OPAQUE:
+		node_data_len += ROUND_TO_64BIT_WORD_SIZE(d->opaque_size);
+		break;
+	case LAUNCH_DATA_DICTIONARY:
+	case LAUNCH_DATA_ARRAY:
+		node_data_len += d->_array_cnt * sizeof(uint64_t);
+		for (i = 0; i < d->_array_cnt; i++) {
+			node_data_len += launch_data_pack_size(d->_array[i], fd_cnt);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return node_data_len;
+}
+
 size_t
 launch_data_pack(launch_data_t d, void *where, size_t len, int *fd_where, size_t *fd_cnt)
 {
@@ -870,6 +913,40 @@ launch_data_unpack(void *data, size_t data_size, int *fds, size_t fd_cnt, size_t
 	return r;
 }
 
+static bool
+launchd_buffer_reserve(void **buf, size_t *size, size_t needed)
+{
+	size_t newsize = *size ? *size : LAUNCH_MSG_BUFFER_MIN;
+	void *newbuf;
+
+	if (needed <= *size) {
+		return true;
+	}
+
+	while (newsize < needed) {
+		newsize *= 2;
+	}
+
+	if ((newbuf = realloc(*buf, newsize)) == NULL) {
+		errno = ENOMEM;
+		return false;
+	}
+
+	*buf = newbuf;
+	*size = newsize;
+	return true;
+}
+
+static void
+launchd_buffer_trim(void **buf, size_t *size)
+{
+	if (*size > LAUNCH_MSG_BUFFER_KEEP) {
+		free(*buf);
+		*buf = malloc(0);
+		*size = 0;
+	}
+}
+
 int
 launchd_msg_send(launch_t lh, launch_data_t d)
 {
@@ -892,28 +969,19 @@ launchd_msg_send(launch_t lh, launch_data_t d)
 	assert((d && lh->sendlen == 0) || (!d && lh->sendlen));
 
 	if (d) {
-		size_t fd_slots_used = 0;
-		size_t good_enough_size = 10 * 1024 * 1024;
+		size_t fd_slots_used = 0, fd_slots_needed = 0;
+		size_t needed = launch_data_pack_size(d, &fd_slots_needed);
 		uint64_t msglen;
 
-		/* hack, see the above assert to verify "correctness" */
-		free(lh->sendbuf);
-		lh->sendbuf = malloc(good_enough_size);
-		if (!lh->sendbuf) {
-			errno = ENOMEM;
+		/* the buffers are empty (see the above assert), so they only need to be big enough */
+		if (!launchd_buffer_reserve(&lh->sendbuf, &lh->sendbufsize, needed)) {
 			return -1;
 		}
-
-		free(lh->sendfds);
-		lh->sendfds = malloc(4 * 1024);
-		if (!lh->sendfds) {
-			free(lh->sendbuf);
-			lh->sendbuf = NULL;
-			errno = ENOMEM;
+		if (!launchd_buffer_reserve((void **)&lh->sendfds, &lh->sendfdsize, fd_slots_needed * sizeof(int))) {
 			return -1;
 		}
 
-		lh->sendlen = launch_data_pack(d, lh->sendbuf, good_enough_size, lh->sendfds, &fd_slots_used);
+		lh->sendlen = launch_data_pack(d, lh->sendbuf, lh->sendbufsize, lh->sendfds, &fd_slots_used);
 
 		if (lh->sendlen == 0) {
 			errno = ENOMEM;
@@ -971,13 +1039,11 @@ launchd_msg_send(launch_t lh, launch_data_t d)
 	if (lh->sendlen > 0) {
 		memmove(lh->sendbuf, lh->sendbuf + r, lh->sendlen);
 	} else {
-		free(lh->sendbuf);
-		lh->sendbuf = malloc(0);
+		launchd_buffer_trim(&lh->sendbuf, &lh->sendbufsize);
 	}
 
 	lh->sendfdcnt = 0;
-	free(lh->sendfds);
-	lh->sendfds = malloc(0);
+	launchd_buffer_trim((void **)&lh->sendfds, &lh->sendfdsize);
 
 	if (lh->sendlen > 0) {
 		errno = EAGAIN;
@@ -1234,10 +1300,13 @@ launchd_msg_recv(launch_t lh, void (*cb)(launch_data_t, void *), void *context)
 	mh.msg_iov = &iov;
 	mh.msg_iovlen = 1;
 
-	lh->recvbuf = reallocf(lh->recvbuf, lh->recvlen + 8*1024);
+	if (!launchd_buffer_reserve(&lh->recvbuf, &lh->recvbufsize, lh->recvlen + LAUNCH_MSG_BUFFER_MIN)) {
+		return -1;
+	}
 
+	/* read as much as fits; doubling the buffer lets big messages come in with fewer, larger reads */
 	iov.iov_base = lh->recvbuf + lh->recvlen;
-	iov.iov_len = 8*1024;
+	iov.iov_len = lh->recvbufsize - lh->recvlen;
 	mh.msg_control = cm;
 	mh.msg_controllen = 4096;
 
@@ -1301,8 +1370,7 @@ launchd_msg_recv(launch_t lh, void (*cb)(launch_data_t, void *), void *context)
 		if (lh->recvlen > 0) {
 			memmove(lh->recvbuf, lh->recvbuf + data_offset, lh->recvlen);
 		} else {
-			free(lh->recvbuf);
-			lh->recvbuf = malloc(0);
+			launchd_buffer_trim(&lh->recvbuf, &lh->recvbufsize);
 		}
 
 		lh->recvfdcnt -= fd_offset;
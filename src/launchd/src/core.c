@@ -150,7 +150,76 @@ extern int gL1CacheEnabled;
 #define TAKE_SUBSET_PID "TakeSubsetPID"
 #define TAKE_SUBSET_PERPID "TakeSubsetPerPID"
 
-#define IS_POWER_OF_TWO(v) (!(v & (v - 1)) && v)
+/* Chained hash tables, linked through a LIST_ENTRY in each element, whose
+ * bucket arrays double whenever they average more than
+ * HASH_TABLE_LOAD_FACTOR elements per bucket.
+ *
+ * Elements leave a table with a plain LIST_REMOVE(), so the table only counts
+ * insertions. Once those reach the limit, the live elements are counted
+ * (which costs no more than the rehash that would follow) and the table only
+ * grows if at least half of the limit is still in use; otherwise it just
+ * resets its count. Either way, there are at least half a limit's worth of
+ * insertions until the next check.
+ */
+#define HASH_TABLE_MIN_SIZE 32
+#define HASH_TABLE_LOAD_FACTOR 2
+
+#define HASH_TABLE(type) \
+	struct { \
+		LIST_HEAD(, type) *buckets; \
+		size_t mask; \
+		size_t inserted; \
+	}
+
+#define HASH_TABLE_SIZE(table) ((table)->buckets ? (table)->mask + 1 : 0)
+
+static const struct { void *lh_first; } hash_table_empty_bucket;
+
+// The bucket for `hash`; lookups in a table that never had anything inserted see an empty bucket.
+#define HASH_TABLE_BUCKET(table, hash) \
+	((table)->buckets ? &(table)->buckets[(hash) & (table)->mask] : (__typeof__((table)->buckets))&hash_table_empty_bucket)
+
+#define HASH_TABLE_INSERT(table, elm, field, hashfn) do { \
+	if ((table)->buckets == NULL || (table)->inserted >= HASH_TABLE_SIZE(table) * HASH_TABLE_LOAD_FACTOR) { \
+		HASH_TABLE_RESIZE(table, field, hashfn); \
+	} \
+	os_assert((table)->buckets != NULL); \
+	LIST_INSERT_HEAD(&(table)->buckets[hashfn(elm) & (table)->mask], elm, field); \
+	(table)->inserted++; \
+} while (0)
+
+#define HASH_TABLE_RESIZE(table, field, hashfn) do { \
+	__typeof__((table)->buckets) __old = (table)->buckets, __new; \
+	__typeof__(__old[0].lh_first) __elm; \
+	size_t __old_size = HASH_TABLE_SIZE(table), __size, __live = 0; \
+	for (size_t __i = 0; __i < __old_size; __i++) { \
+		LIST_FOREACH(__elm, &__old[__i], field) { \
+			__live++; \
+		} \
+	} \
+	(table)->inserted = __live; \
+	if (__old != NULL && __live < __old_size * HASH_TABLE_LOAD_FACTOR / 2) { \
+		break; \
+	} \
+	__size = __old ? __old_size * 2 : HASH_TABLE_MIN_SIZE; \
+	if ((__new = calloc(__size, sizeof(*__new))) == NULL) { \
+		break; \
+	} \
+	for (size_t __i = 0; __i < __old_size; __i++) { \
+		while ((__elm = LIST_FIRST(&__old[__i]))) { \
+			LIST_REMOVE(__elm, field); \
+			LIST_INSERT_HEAD(&__new[hashfn(__elm) & (__size - 1)], __elm, field); \
+		} \
+	} \
+	free(__old); \
+	(table)->buckets = __new; \
+	(table)->mask = __size - 1; \
+} while (0)
+
+#define HASH_TABLE_DESTROY(table) do { \
+	free((table)->buckets); \
+	(table)->buckets = NULL; \
+} while (0)
 
 extern char **environ;
 
@@ -196,10 +265,11 @@ struct machservice {
 // HACK: This should be per jobmgr_t
 static SLIST_HEAD(, machservice) special_ports;
 
-#define PORT_HASH_SIZE 32
-#define HASH_PORT(x) (IS_POWER_OF_TWO(PORT_HASH_SIZE) ? (MACH_PORT_INDEX(x) & (PORT_HASH_SIZE - 1)) : (MACH_PORT_INDEX(x) % PORT_HASH_SIZE))
+static size_t hash_int(uint64_t x) __attribute__((const));
+#define MS_PORT_HASH(ms) hash_int(MACH_PORT_INDEX((ms)->port))
+#define MS_NAME_HASH(ms) hash_ms((ms)->name)
 
-static LIST_HEAD(, machservice) port_hash[PORT_HASH_SIZE];
+static HASH_TABLE(machservice) port_hash;
 
 static void machservice_setup(launch_data_t obj, const char *key, void *context);
 static void machservice_setup_options(launch_data_t obj, const char *key, void *context);
@@ -371,12 +441,8 @@ static struct waiting4attach *waiting4attach_new(jobmgr_t jm, const char *name,
 static void waiting4attach_delete(jobmgr_t jm, struct waiting4attach *w4a);
 static struct waiting4attach *waiting4attach_find(jobmgr_t jm, job_t j);
 
-#define ACTIVE_JOB_HASH_SIZE 32
-#define ACTIVE_JOB_HASH(x) (IS_POWER_OF_TWO(ACTIVE_JOB_HASH_SIZE) ? (x & (ACTIVE_JOB_HASH_SIZE - 1)) : (x % ACTIVE_JOB_HASH_SIZE))
-
-#define MACHSERVICE_HASH_SIZE	37
-
-#define LABEL_HASH_SIZE 53
+#define JOB_PID_HASH(j) hash_int((j)->p)
+#define JOB_LABEL_HASH(j) hash_label((j)->label)
 struct jobmgr_s {
 	kq_callback kqjobmgr_callback;
 	LIST_ENTRY(jobmgr_s) xpc_le;
@@ -390,9 +456,9 @@ struct jobmgr_s {
 	 * its own label hash that is separate from the "global" one stored in the
 	 * root job manager.
 	 */
-	LIST_HEAD(, job_s) label_hash[LABEL_HASH_SIZE];
-	LIST_HEAD(, job_s) active_jobs[ACTIVE_JOB_HASH_SIZE];
-	LIST_HEAD(, machservice) ms_hash[MACHSERVICE_HASH_SIZE];
+	HASH_TABLE(job_s) label_hash;
+	HASH_TABLE(job_s) active_jobs;
+	HASH_TABLE(machservice) ms_hash;
 	LIST_HEAD(, job_s) global_env_jobs;
 	mach_port_t jm_port;
 	mach_port_t req_port;
@@ -747,7 +813,7 @@ struct job_s {
 static size_t hash_label(const char *label) __attribute__((pure));
 static size_t hash_ms(const char *msstr) __attribute__((pure));
 static SLIST_HEAD(, job_s) s_curious_jobs;
-static LIST_HEAD(, job_s) managed_actives[ACTIVE_JOB_HASH_SIZE];
+static HASH_TABLE(job_s) managed_actives;
 
 #define job_assumes(j, e) os_assumes_ctx(job_log_bug, j, (e))
 #define job_assumes_zero(j, e) os_assumes_zero_ctx(job_log_bug, j, (e))
@@ -1355,6 +1421,9 @@ jobmgr_remove(jobmgr_t jm)
 		exit(EXIT_SUCCESS);
 	}
 
+	HASH_TABLE_DESTROY(&jm->label_hash);
+	HASH_TABLE_DESTROY(&jm->active_jobs);
+	HASH_TABLE_DESTROY(&jm->ms_hash);
 	free(jm);
 }
 
@@ -1803,7 +1872,7 @@ job_new_anonymous(jobmgr_t jm, pid_t anonpid)
 		jr->p = anonpid;
 
 		// Anonymous process reaping is messy.
-		LIST_INSERT_HEAD(&jm->active_jobs[ACTIVE_JOB_HASH(jr->p)], jr, pid_hash_sle);
+		HASH_TABLE_INSERT(&jm->active_jobs, jr, pid_hash_sle, JOB_PID_HASH);
 
 		if (unlikely(kevent_mod(jr->p, EVFILT_PROC, EV_ADD, proc_fflags, 0, root_jobmgr) == -1)) {
 			if (errno != ESRCH) {
@@ -2036,7 +2105,7 @@ job_new_subjob(job_t j, uuid_t identifier)
 		if (j->mgr->properties & BOOTSTRAP_PROPERTY_XPC_DOMAIN) {
 			where2put = j->mgr;
 		}
-		LIST_INSERT_HEAD(&where2put->label_hash[hash_label(nj->label)], nj, label_hash_sle);
+		HASH_TABLE_INSERT(&where2put->label_hash, nj, label_hash_sle, JOB_LABEL_HASH);
 		LIST_INSERT_HEAD(&j->subjobs, nj, subjob_sle);
 	} else {
 		(void)os_assumes_zero(errno);
@@ -2190,7 +2259,7 @@ job_new(jobmgr_t jm, const char *label, const char *prog, const char *const *arg
 	if (j->mgr->properties & BOOTSTRAP_PROPERTY_XPC_DOMAIN) {
 		where2put_label = j->mgr;
 	}
-	LIST_INSERT_HEAD(&where2put_label->label_hash[hash_label(j->label)], j, label_hash_sle);
+	HASH_TABLE_INSERT(&where2put_label->label_hash, j, label_hash_sle, JOB_LABEL_HASH);
 	uuid_clear(j->expected_audit_uuid);
 
 	job_log(j, LOG_DEBUG, "Conceived");
@@ -2222,7 +2291,7 @@ job_new_alias(jobmgr_t jm, job_t src)
 
 	(void)strcpy((char *)j->label, src->label);
 	LIST_INSERT_HEAD(&jm->jobs, j, sle);
-	LIST_INSERT_HEAD(&jm->label_hash[hash_label(j->label)], j, label_hash_sle);
+	HASH_TABLE_INSERT(&jm->label_hash, j, label_hash_sle, JOB_LABEL_HASH);
 	/* Bad jump address. The kqueue callback for aliases should never be
 	 * invoked.
 	 */
@@ -3313,7 +3382,7 @@ job_find(jobmgr_t jm, const char *label)
 		jm = root_jobmgr;
 	}
 
-	LIST_FOREACH(ji, &jm->label_hash[hash_label(label)], label_hash_sle) {
+	LIST_FOREACH(ji, HASH_TABLE_BUCKET(&jm->label_hash, hash_label(label)), label_hash_sle) {
 		if (unlikely(ji->removal_pending || ji->mgr->shutting_down)) {
 			// 5351245 and 5488633 respectively
 			continue;
@@ -3333,7 +3402,7 @@ job_t
 jobmgr_find_by_pid_deep(jobmgr_t jm, pid_t p, bool anon_okay)
 {
 	job_t ji = NULL;
-	LIST_FOREACH(ji, &jm->active_jobs[ACTIVE_JOB_HASH(p)], pid_hash_sle) {
+	LIST_FOREACH(ji, HASH_TABLE_BUCKET(&jm->active_jobs, hash_int(p)), pid_hash_sle) {
 		if (ji->p == p && (!ji->anonymous || (ji->anonymous && anon_okay))) {
 			return ji;
 		}
@@ -3354,7 +3423,7 @@ jobmgr_find_by_pid(jobmgr_t jm, pid_t p, bool create_anon)
 {
 	job_t ji;
 
-	LIST_FOREACH(ji, &jm->active_jobs[ACTIVE_JOB_HASH(p)], pid_hash_sle) {
+	LIST_FOREACH(ji, HASH_TABLE_BUCKET(&jm->active_jobs, hash_int(p)), pid_hash_sle) {
 		if (ji->p == p) {
 			return ji;
 		}
@@ -3368,7 +3437,7 @@ managed_job(pid_t p)
 {
 	job_t ji;
 
-	LIST_FOREACH(ji, &managed_actives[ACTIVE_JOB_HASH(p)], pid_hash_sle) {
+	LIST_FOREACH(ji, HASH_TABLE_BUCKET(&managed_actives, hash_int(p)), global_pid_hash_sle) {
 		if (ji->p == p) {
 			return ji;
 		}
@@ -3431,7 +3500,7 @@ job_find_by_service_port(mach_port_t p)
 {
 	struct machservice *ms;
 
-	LIST_FOREACH(ms, &port_hash[HASH_PORT(p)], port_hash_sle) {
+	LIST_FOREACH(ms, HASH_TABLE_BUCKET(&port_hash, hash_int(MACH_PORT_INDEX(p))), port_hash_sle) {
 		if (ms->recv && (ms->port == p)) {
 			return ms->job;
 		}
@@ -4101,7 +4170,7 @@ job_callback_proc(job_t j, struct kevent *kev)
 				if (j->mgr->properties & BOOTSTRAP_PROPERTY_XPC_DOMAIN) {
 					where2put = j->mgr;
 				}
-				LIST_INSERT_HEAD(&where2put->label_hash[hash_label(j->label)], j, label_hash_sle);
+				HASH_TABLE_INSERT(&where2put->label_hash, j, label_hash_sle, JOB_LABEL_HASH);
 			} else if (errno != ESRCH) {
 				(void)job_assumes_zero(j, errno);
 			}
@@ -4486,9 +4555,9 @@ job_start(job_t j)
 		job_log(j, LOG_PERF, "Job started.");
 		runtime_add_ref();
 		total_children++;
-		LIST_INSERT_HEAD(&j->mgr->active_jobs[ACTIVE_JOB_HASH(c)], j, pid_hash_sle);
-		LIST_INSERT_HEAD(&managed_actives[ACTIVE_JOB_HASH(c)], j, global_pid_hash_sle);
 		j->p = c;
+		HASH_TABLE_INSERT(&j->mgr->active_jobs, j, pid_hash_sle, JOB_PID_HASH);
+		HASH_TABLE_INSERT(&managed_actives, j, global_pid_hash_sle, JOB_PID_HASH);
 
 		struct proc_uniqidentifierinfo info;
 		if (proc_pidinfo(c, PROC_PIDUNIQIDENTIFIERINFO, 0, &info, PROC_PIDUNIQIDENTIFIERINFO_SIZE) != 0) {
@@ -6295,7 +6364,7 @@ machservice_resetport(job_t j, struct machservice *ms)
 	ms->gen_num++;
 	(void)job_assumes_zero(j, launchd_mport_create_recv(&ms->port));
 	(void)job_assumes_zero(j, launchd_mport_make_send(ms->port));
-	LIST_INSERT_HEAD(&port_hash[HASH_PORT(ms->port)], ms, port_hash_sle);
+	HASH_TABLE_INSERT(&port_hash, ms, port_hash_sle, MS_PORT_HASH);
 }
 
 void
@@ -6376,9 +6445,9 @@ machservice_new(job_t j, const char *name, mach_port_t *serviceport, bool pid_lo
 	 * uniquify the names ourselves to avoid collisions. This is just easier.
 	 */
 	if (!j->dedicated_instance) {
-		LIST_INSERT_HEAD(&where2put->ms_hash[hash_ms(ms->name)], ms, name_hash_sle);	
+		HASH_TABLE_INSERT(&where2put->ms_hash, ms, name_hash_sle, MS_NAME_HASH);
 	}
-	LIST_INSERT_HEAD(&port_hash[HASH_PORT(ms->port)], ms, port_hash_sle);
+	HASH_TABLE_INSERT(&port_hash, ms, port_hash_sle, MS_PORT_HASH);
 
 	if (ms->recv) {
 		machservice_stamp_port(j, ms);
@@ -6403,7 +6472,7 @@ machservice_new_alias(job_t j, struct machservice *orig)
 		ms->alias = orig;
 		ms->job = j;
 
-		LIST_INSERT_HEAD(&j->mgr->ms_hash[hash_ms(ms->name)], ms, name_hash_sle);
+		HASH_TABLE_INSERT(&j->mgr->ms_hash, ms, name_hash_sle, MS_NAME_HASH);
 		SLIST_INSERT_HEAD(&j->machservices, ms, sle);
 		jobmgr_log(j->mgr, LOG_DEBUG, "Service aliased into job manager: %s", orig->name);
 	}
@@ -7100,7 +7169,7 @@ jobmgr_delete_anything_with_port(jobmgr_t jm, mach_port_t port)
 			return jobmgr_shutdown(jm);
 		}
 
-		LIST_FOREACH_SAFE(ms, &port_hash[HASH_PORT(port)], port_hash_sle, next_ms) {
+		LIST_FOREACH_SAFE(ms, HASH_TABLE_BUCKET(&port_hash, hash_int(MACH_PORT_INDEX(port))), port_hash_sle, next_ms) {
 			if (ms->port == port && !ms->recv) {
 				machservice_delete(ms->job, ms, true);
 			}
@@ -7168,7 +7237,7 @@ jobmgr_lookup_service(jobmgr_t jm, const char *name, bool check_parent, pid_t ta
 		}
 	}
 
-	LIST_FOREACH(ms, &where2look->ms_hash[hash_ms(name)], name_hash_sle) {
+	LIST_FOREACH(ms, HASH_TABLE_BUCKET(&where2look->ms_hash, hash_ms(name)), name_hash_sle) {
 		if (!ms->per_pid && strcmp(name, ms->name) == 0) {
 			return ms;
 		}
@@ -7389,7 +7458,7 @@ job_ack_port_destruction(mach_port_t p)
 	struct machservice *ms;
 	job_t j;
 
-	LIST_FOREACH(ms, &port_hash[HASH_PORT(p)], port_hash_sle) {
+	LIST_FOREACH(ms, HASH_TABLE_BUCKET(&port_hash, hash_int(MACH_PORT_INDEX(p))), port_hash_sle) {
 		if (ms->recv && (ms->port == p)) {
 			break;
 		}
@@ -9263,8 +9332,8 @@ job_mig_info(job_t j, name_array_t *servicenamesp,
 
 	unsigned int i = 0;
 	struct machservice *msi = NULL;
-	for (i = 0; i < MACHSERVICE_HASH_SIZE; i++) {
-		LIST_FOREACH(msi, &jm->ms_hash[i], name_hash_sle) {
+	for (i = 0; i < HASH_TABLE_SIZE(&jm->ms_hash); i++) {
+		LIST_FOREACH(msi, &jm->ms_hash.buckets[i], name_hash_sle) {
 			cnt += !msi->per_pid ? 1 : 0;
 		}
 	}
@@ -9288,8 +9357,8 @@ job_mig_info(job_t j, name_array_t *servicenamesp,
 		goto out_bad;
 	}
 
-	for (i = 0; i < MACHSERVICE_HASH_SIZE; i++) {
-		LIST_FOREACH(msi, &jm->ms_hash[i], name_hash_sle) {
+	for (i = 0; i < HASH_TABLE_SIZE(&jm->ms_hash); i++) {
+		LIST_FOREACH(msi, &jm->ms_hash.buckets[i], name_hash_sle) {
 			if (!msi->per_pid) {
 				strlcpy(service_names[cnt2], machservice_name(msi), sizeof(service_names[0]));
 				msi = msi->alias ? msi->alias : msi;
@@ -9666,7 +9735,7 @@ job_mig_move_subset(job_t j, mach_port_t target_subset, name_t session_type, mac
 
 		// Put the job into the target job manager.
 		LIST_INSERT_HEAD(&jmr->jobs, j, sle);
-		LIST_INSERT_HEAD(&jmr->active_jobs[ACTIVE_JOB_HASH(j->p)], j, pid_hash_sle);
+		HASH_TABLE_INSERT(&jmr->active_jobs, j, pid_hash_sle, JOB_PID_HASH);
 
 		j->mgr = jmr;
 		job_set_global_on_demand(j, true);
@@ -9849,7 +9918,7 @@ job_mig_switch_to_session(job_t j, mach_port_t requestor_port, name_t session_na
 
 	// Put the job into the target job manager.
 	LIST_INSERT_HEAD(&target_jm->jobs, j, sle);
-	LIST_INSERT_HEAD(&target_jm->active_jobs[ACTIVE_JOB_HASH(j->p)], j, pid_hash_sle);
+	HASH_TABLE_INSERT(&target_jm->active_jobs, j, pid_hash_sle, JOB_PID_HASH);
 
 	if (ji) {
 		LIST_INSERT_HEAD(&target_jm->global_env_jobs, j, global_env_sle);
@@ -9860,7 +9929,7 @@ job_mig_switch_to_session(job_t j, mach_port_t requestor_port, name_t session_na
 		struct machservice *msi = NULL, *msit = NULL;
 		SLIST_FOREACH_SAFE(msi, &j->machservices, sle, msit) {
 			LIST_REMOVE(msi, name_hash_sle);
-			LIST_INSERT_HEAD(&target_jm->ms_hash[hash_ms(msi->name)], msi, name_hash_sle);
+			HASH_TABLE_INSERT(&target_jm->ms_hash, msi, name_hash_sle, MS_NAME_HASH);
 		}
 	}
 
@@ -11801,29 +11870,40 @@ jobmgr_init(bool sflag)
 size_t
 our_strhash(const char *s)
 {
-	size_t c, r = 5381;
+	uint64_t c, r = 0xcbf29ce484222325ULL;
 
-	/* djb2
-	 * This algorithm was first reported by Dan Bernstein many years ago in comp.lang.c
+	/* 64-bit FNV-1a, folded so that the low bits (which pick the bucket)
+	 * depend on every byte.
 	 */
 
-	while ((c = *s++)) {
-		r = ((r << 5) + r) + c; // hash*33 + c
+	while ((c = (unsigned char)*s++)) {
+		r ^= c;
+		r *= 0x100000001b3ULL;
 	}
 
-	return r;
+	return (size_t)(r ^ (r >> 32));
 }
 
 size_t
 hash_label(const char *label)
 {
-	return our_strhash(label) % LABEL_HASH_SIZE;
+	return our_strhash(label);
 }
 
 size_t
 hash_ms(const char *msstr)
 {
-	return our_strhash(msstr) % MACHSERVICE_HASH_SIZE;
+	return our_strhash(msstr);
+}
+
+size_t
+hash_int(uint64_t x)
+{
+	/* Sequential values (like PIDs and port indices) still land in
+	 * consecutive buckets, but everything else gets mixed in too.
+	 */
+	x *= 0x9e3779b97f4a7c15ULL;
+	return (size_t)(x ^ (x >> 32));
 }
 
 bool
@@ -80,6 +80,7 @@
 #include <fnmatch.h>
 #include <os/assumes.h>
 #include <dlfcn.h>
+#include <dispatch/dispatch.h>
 #if HAVE_SYSTEMSTATS
 #include <systemstats/systemstats.h>
 #endif
@@ -119,6 +120,7 @@ extern char **environ;
 
 struct load_unload_state {
 	launch_data_t pass1;
+	launch_data_t paths;
 	char *session_type;
 	bool editondisk:1, load:1, forceload:1;
 };
@@ -138,6 +140,8 @@ static void sock_dict_cb(launch_data_t what, const char *key, void *context);
 static void sock_dict_edit_entry(launch_data_t tmp, const char *key, launch_data_t fdarray, launch_data_t thejob);
 static launch_data_t CF2launch_data(CFTypeRef);
 static launch_data_t read_plist_file(const char *file, bool editondisk, bool load);
+static CFPropertyListRef create_job_plist(const char *file);
+static launch_data_t job_from_plist(CFPropertyListRef plist, const char *file, bool editondisk, bool load);
 #if TARGET_OS_EMBEDDED
 static CFPropertyListRef GetPropertyListFromCache(void);
 static CFPropertyListRef CreateMyPropertyListFromCachedFile(const char *posixfile);
@@ -148,7 +152,8 @@ static CFPropertyListRef CFPropertyListCreateFromFile(CFURLRef plistURL);
 static void WriteMyPropertyListToFile(CFPropertyListRef, const char *);
 static bool path_goodness_check(const char *path, bool forceload);
 static void readpath(const char *, struct load_unload_state *);
-static void readfile(const char *, struct load_unload_state *);
+static void readfile(const char *, CFPropertyListRef, struct load_unload_state *);
+static void readfiles(struct load_unload_state *);
 static int _fd(int);
 static int demux_cmd(int argc, char *const argv[]);
 static void submit_job_pass(launch_data_t jobs);
@@ -915,17 +920,25 @@ read_jetsam_defaults(void)
 launch_data_t
 read_plist_file(const char *file, bool editondisk, bool load)
 {
-	CFPropertyListRef plist;
-	launch_data_t r = NULL;
+	return job_from_plist(create_job_plist(file), file, editondisk, load);
+}
+
+CFPropertyListRef
+create_job_plist(const char *file)
+{
 #if TARGET_OS_EMBEDDED
 	if (require_jobs_from_cache()) {
-		plist = CreateMyPropertyListFromCachedFile(file);
-	} else {
-		plist = CreateMyPropertyListFromFile(file);
+		return CreateMyPropertyListFromCachedFile(file);
 	}
-#else
-	plist = CreateMyPropertyListFromFile(file);
 #endif
+	return CreateMyPropertyListFromFile(file);
+}
+
+/* Consumes plist, which may be NULL if it couldn't be read. */
+launch_data_t
+job_from_plist(CFPropertyListRef plist, const char *file, bool editondisk, bool load)
+{
+	launch_data_t r = NULL;
 
 	if (NULL == plist) {
 		launchctl_log(LOG_ERR, "%s: no plist was returned for: %s", getprogname(), file);
@@ -934,6 +947,7 @@ read_plist_file(const char *file, bool editondisk, bool load)
 
 	CFStringRef label = CFDictionaryGetValue(plist, CFSTR(LAUNCH_JOBKEY_LABEL));
 	if (!(label && CFTypeCheck(label, CFString))) {
+		CFRelease(plist);
 		return NULL;
 	}
 
@@ -1039,7 +1053,7 @@ limitloadtohardware_iterator(launch_data_t val, const char *key, void *ctx)
 }
 
 void
-readfile(const char *what, struct load_unload_state *lus)
+readfile(const char *what, CFPropertyListRef plist, struct load_unload_state *lus)
 {
 	char ourhostname[1024];
 	launch_data_t tmpd, tmps, thejob, tmpa;
@@ -1048,7 +1062,7 @@ readfile(const char *what, struct load_unload_state *lus)
 
 	gethostname(ourhostname, sizeof(ourhostname));
 
-	if (NULL == (thejob = read_plist_file(what, lus->editondisk, lus->load))) {
+	if (NULL == (thejob = job_from_plist(plist, what, lus->editondisk, lus->load))) {
 		launchctl_log(LOG_ERR, "%s: no plist was returned for: %s", getprogname(), what);
 		return;
 	}
@@ -1313,7 +1327,7 @@ readpath(const char *what, struct load_unload_state *lus)
 	}
 
 	if (S_ISREG(sb.st_mode)) {
-		readfile(what, lus);
+		launch_data_array_append(lus->paths, launch_data_new_string(what));
 	} else if (S_ISDIR(sb.st_mode)) {
 		if ((d = opendir(what)) == NULL) {
 			launchctl_log(LOG_ERR, "%s: opendir() failed to open the directory", getprogname());
@@ -1330,12 +1344,65 @@ readpath(const char *what, struct load_unload_state *lus)
 				continue;
 			}
 
-			readfile(buf, lus);
+			launch_data_array_append(lus->paths, launch_data_new_string(buf));
 		}
 		closedir(d);
 	}
 }
 
+struct readfiles_context {
+	launch_data_t paths;
+	CFPropertyListRef *plists;
+};
+
+static void
+readfiles_parse(void *context, size_t i)
+{
+	struct readfiles_context *ctx = context;
+
+	ctx->plists[i] = create_job_plist(launch_data_get_string(launch_data_array_get_index(ctx->paths, i)));
+}
+
+/* Parsing is what makes loading a directory of jobs slow, so the plists
+ * readpath() found are parsed in parallel. Everything else readfile() does
+ * touches shared state (the overrides database, lus->pass1), so the jobs are
+ * then vetted one at a time, in the order the paths were found.
+ */
+void
+readfiles(struct load_unload_state *lus)
+{
+	struct readfiles_context ctx;
+	size_t i, c = launch_data_array_get_count(lus->paths);
+
+	if (c == 0) {
+		return;
+	}
+
+	ctx.paths = lus->paths;
+	if ((ctx.plists = calloc(c, sizeof(CFPropertyListRef))) == NULL) {
+		for (i = 0; i < c; i++) {
+			const char *what = launch_data_get_string(launch_data_array_get_index(lus->paths, i));
+			readfile(what, create_job_plist(what), lus);
+		}
+		return;
+	}
+
+#if TARGET_OS_EMBEDDED
+	/* the cache is loaded lazily, and not in a thread-safe way */
+	if (require_jobs_from_cache()) {
+		(void)GetPropertyListFromCache();
+	}
+#endif
+
+	dispatch_apply_f(c, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &ctx, readfiles_parse);
+
+	for (i = 0; i < c; i++) {
+		readfile(launch_data_get_string(launch_data_array_get_index(lus->paths, i)), ctx.plists[i], lus);
+	}
+
+	free(ctx.plists);
+}
+
 void
 insert_event(launch_data_t job, const char *stream, const char *key, launch_data_t event)
 {
@@ -2726,6 +2793,7 @@ load_and_unload_cmd(int argc, char *const argv[])
 
 	/* Only one pass! */
 	lus.pass1 = launch_data_alloc(LAUNCH_DATA_ARRAY);
+	lus.paths = launch_data_alloc(LAUNCH_DATA_ARRAY);
 
 	es = NSStartSearchPathEnumeration(NSLibraryDirectory, es);
 
@@ -2778,6 +2846,9 @@ load_and_unload_cmd(int argc, char *const argv[])
 		readpath(argv[i], &lus);
 	}
 
+	readfiles(&lus);
+	launch_data_free(lus.paths);
+
 	if (launch_data_array_get_count(lus.pass1) == 0) {
 		if (!_launchctl_is_managed) {
 			launchctl_log(LOG_ERR, "nothing found to %s", lus.load ? "load" : "unload");
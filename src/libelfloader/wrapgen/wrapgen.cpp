@@ -210,6 +210,8 @@ end_dyn:
 
 					sym = (const Elf64_Sym*) (((char*) ehdr) + shdr->sh_offset + j);
 
+					// STT_TLS variables are left out on purpose: their address is different in every thread,
+					// so they can't go through the cached accessors generate_var_wrappers() makes
 					if (ELF64_ST_TYPE(sym->st_info) != STT_OBJECT && ELF64_ST_TYPE(sym->st_info) != STT_FUNC)
 						continue;
 					if (ELF64_ST_BIND(sym->st_info) != STB_GLOBAL)
@@ -240,7 +242,7 @@ end_dyn:
 		else
 			soname = elf;
 	}
-	if (symbols.empty())
+	if (symbols.empty() && vars.empty())
 	{
 		std::stringstream ss;
 		ss << "No symbols found in " << elf;
@@ -256,20 +258,36 @@ void generate_wrapper(std::ofstream& output, const char* soname, const std::set<
 		"extern struct elf_calls* _elfcalls;\n\n"
 		"extern const char __elfname[];\n\n";
 
-	output << "static void* lib_handle;\n"
-		"__attribute__((constructor)) static void initializer() {\n"
-		"\tlib_handle = _elfcalls->dlopen_fatal(__elfname);\n"
+	// The library is only loaded once something in it is actually used (i.e. when dyld first
+	// calls one of the resolvers below, or a variable is first accessed).
+	// Threads racing to load it may all dlopen() it; all but one then drop their reference.
+	output << "static void* lib_handle;\n\n";
+
+	output << "static void* load_library(void) {\n"
+		"\tvoid* handle = __atomic_load_n(&lib_handle, __ATOMIC_ACQUIRE);\n"
+		"\tif (__builtin_expect(handle == 0, 0)) {\n"
+		"\t\tvoid* expected = 0;\n"
+		"\t\thandle = _elfcalls->dlopen_fatal(__elfname);\n"
+		"\t\tif (!__atomic_compare_exchange_n(&lib_handle, &expected, handle, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {\n"
+		"\t\t\t_elfcalls->dlclose_fatal(handle);\n"
+		"\t\t\thandle = expected;\n"
+		"\t\t}\n"
+		"\t}\n"
+		"\treturn handle;\n"
 		"}\n\n";
 
 	output << "__attribute__((destructor)) static void destructor() {\n"
-		"\t_elfcalls->dlclose_fatal(lib_handle);\n"
+		"\tif (lib_handle != 0)\n"
+		"\t\t_elfcalls->dlclose_fatal(lib_handle);\n"
 		"}\n\n";
-	
+
+	// Each function is only looked up when dyld asks for it, so a program that uses a handful
+	// of a big library's functions doesn't pay for looking up the rest
 	for (const std::string& sym : symbols)
 	{
 		output << "void* " << sym << "() {\n"
 			"\t__asm__(\".symbol_resolver _" << sym << "\");\n"
-			"\treturn _elfcalls->dlsym_fatal(lib_handle, \"" << sym << "\");\n"
+			"\treturn _elfcalls->dlsym_fatal(load_library(), \"" << sym << "\");\n"
 			"}\n\n";
 	}
 	output << "asm(\".section __TEXT,__elfname\\n"
@@ -284,12 +302,24 @@ void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, c
 		"extern \"C\" {\n"
 		"#endif\n\n";
 
+	// A variable's address never changes once the library is loaded, so each accessor only looks it up once.
+	// Threads racing on the first access all get the same answer, so they may simply all look it up.
+	output << "static void* resolve_var(void** cache, const char* name) {\n"
+		"\tvoid* addr = __atomic_load_n(cache, __ATOMIC_ACQUIRE);\n"
+		"\tif (__builtin_expect(addr == 0, 0)) {\n"
+		"\t\taddr = _elfcalls->dlsym_fatal(load_library(), name);\n"
+		"\t\t__atomic_store_n(cache, addr, __ATOMIC_RELEASE);\n"
+		"\t}\n"
+		"\treturn addr;\n"
+		"}\n\n";
+
 	for (const std::string& sym : vars)
 	{
 		output << "void* __elf_get_" << sym << "(void) {\n"
-			"\treturn _elfcalls->dlsym_fatal(lib_handle, \"" << sym << "\");\n"
+			"\tstatic void* addr;\n"
+			"\treturn resolve_var(&addr, \"" << sym << "\");\n"
 			"}\n\n";
-		
+
 		outputHeader << "extern __typeof(" << sym << ")* __elf_get_" << sym << "(void);\n"
 			"#define " << sym << " (*__elf_get_" << sym << "())\n\n";
 	}
@@ -33,24 +33,71 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/event.h>
 #include <sys/ioctl.h>
 #include <signal.h>
+#include <time.h>
 #include "shellspawn.h"
 #include "duct_signals.h"
 
 #define DBG 0
 
+// how many idle processes to keep waiting for commands (see --pool)
+#define POOL_SIZE_MAX 64
+
+// how long to wait before replacing pool workers that failed (doubled on every failure in a row)
+#define POOL_RETRY_MIN_MS 100
+#define POOL_RETRY_MAX_MS 30000
+
+// what a pool worker writes to g_poolNotify
+#define POOL_NOTIFY_ACCEPTED 'a'
+#define POOL_NOTIFY_FAILED 'f'
+
 int g_serverSocket = -1;
+int g_poolSize = 0;
+int g_poolNotify[2] = { -1, -1 };
+
+struct shell_request
+{
+	char** argv;
+	int argc;
+	int shellfd[3];
+	bool direct;
+};
 
 void setupSocket(void);
 void listenForConnections(void);
+void runPool(void);
 void spawnShell(int fd);
 void setupSigchild(void);
 void reapAll(void);
 
+static bool readCommands(int fd, struct shell_request* req);
+static void startShell(int fd, struct shell_request* req);
+static void execShell(struct shell_request* req, int errfd);
+static void superviseShell(int fd, pid_t shell_pid, int shellfd[3]);
+static bool startPoolWorker(void);
+static void poolWorker(void);
+static void poolProcess(int sp);
+
 int main(int argc, const char** argv)
 {
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--pool") == 0 && i + 1 < argc)
+		{
+			g_poolSize = atoi(argv[++i]);
+			if (g_poolSize < 0)
+				g_poolSize = 0;
+			else if (g_poolSize > POOL_SIZE_MAX)
+				g_poolSize = POOL_SIZE_MAX;
+		}
+	}
+
 	setupSigchild();
 	setupSocket();
-	listenForConnections();
+
+	if (g_poolSize > 0)
+		runPool();
+	else
+		listenForConnections();
 
 	if (g_serverSocket != -1)
 		close(g_serverSocket);
@@ -82,7 +129,8 @@ void setupSocket(void)
 
 	chmod(addr.sun_path, 0600);
 
-	if (listen(g_serverSocket, 1) == -1)
+	// `darling` may be invoked many times at once (e.g. by build scripts)
+	if (listen(g_serverSocket, SOMAXCONN) == -1)
 	{
 		perror("Listening on unix socket");
 		exit(EXIT_FAILURE);
@@ -114,25 +162,329 @@ void listenForConnections(void)
 	}
 }
 
-void spawnShell(int fd)
+// With --pool, connections aren't accepted (and forked off) here. Instead, we keep a number of
+// pool workers around, each of which has already forked the process that will become the command
+// and is blocked in accept(). Both forks (and everything darlingserver does for a new process) are
+// then out of the way by the time a command comes in.
+//
+// A worker writes a byte to g_poolNotify when its process has taken a connection (or died), and we
+// start a replacement for it right away. Workers that failed (e.g. because we're out of descriptors
+// or processes) are only replaced after a delay that grows with every failure in a row, so that we
+// don't end up forking in a tight loop.
+static long long monotonicMs(void)
 {
-	pid_t shell_pid = -1;
-	int shellfd[3] = { -1, -1, -1 };
-	int pipefd[2];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void runPool(void)
+{
+	int missing = 0; // workers that failed and haven't been replaced yet
+	int failures = 0; // in a row, i.e. since a worker last accepted a connection
+	long long retryAt = 0;
+
+	if (pipe(g_poolNotify) == -1)
+	{
+		perror("Creating pool pipe");
+		listenForConnections();
+		return;
+	}
+
+	fcntl(g_poolNotify[0], F_SETFD, FD_CLOEXEC);
+	fcntl(g_poolNotify[1], F_SETFD, FD_CLOEXEC);
+
+	for (int i = 0; i < g_poolSize; i++)
+	{
+		if (!startPoolWorker())
+			missing++;
+	}
+
+	while (true)
+	{
+		char buf[POOL_SIZE_MAX];
+		struct pollfd pfd = { .fd = g_poolNotify[0], .events = POLLIN };
+		int timeout = -1;
+		int rv;
+		ssize_t count;
+		bool scheduled = missing > 0;
+
+		if (missing > 0)
+		{
+			long long now = monotonicMs();
+			timeout = (retryAt > now) ? (int)(retryAt - now) : 0;
+		}
+
+		rv = poll(&pfd, 1, timeout);
+		if (rv == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (rv == 0)
+		{
+			// time to try again
+			scheduled = false;
+			while (missing > 0 && startPoolWorker())
+				missing--;
+		}
+		else
+		{
+			count = read(g_poolNotify[0], buf, sizeof(buf));
+			if (count <= 0)
+			{
+				if (count == -1 && errno == EINTR)
+					continue;
+				break;
+			}
+
+			for (ssize_t i = 0; i < count; i++)
+			{
+				if (buf[i] == POOL_NOTIFY_ACCEPTED)
+				{
+					failures = 0;
+					if (startPoolWorker())
+						continue;
+				}
+				missing++;
+			}
+		}
+
+		if (missing > 0 && !scheduled)
+		{
+			int delay = POOL_RETRY_MAX_MS;
+			if (failures < 16 && (POOL_RETRY_MIN_MS << failures) < POOL_RETRY_MAX_MS)
+				delay = POOL_RETRY_MIN_MS << failures;
+
+			retryAt = monotonicMs() + delay;
+			failures++;
+		}
+	}
+}
+
+static bool startPoolWorker(void)
+{
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		poolWorker();
+		exit(EXIT_SUCCESS);
+	}
+	else if (pid == -1)
+	{
+		perror("Starting pool worker");
+		return false;
+	}
+
+	return true;
+}
+
+// Runs in the pool worker. It plays the same part as the process forked for every connection
+// without the pool (i.e. it passes signals on and reports the exit code), except that the process
+// it supervises was forked ahead of time and took the connection by itself.
+static void poolWorker(void)
+{
+	int sp[2];
+	pid_t pid;
+	char c;
+	int fds[4]; // the connection, then the shell's stdin, stdout and stderr
+	int direct;
 	int rv;
-	struct pollfd pfd[2];
-	char** argv = NULL;
-	int argc = 2;
+	struct msghdr msg;
+	struct iovec iov;
+	char cmsgbuf[CMSG_SPACE(sizeof(fds))];
+	struct cmsghdr* cmptr;
+
+	close(g_poolNotify[0]);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == -1)
+	{
+		pid = -1;
+		goto notify;
+	}
+
+	pid = fork();
+	if (pid == 0)
+	{
+		close(sp[0]);
+		close(g_poolNotify[1]);
+		fcntl(sp[1], F_SETFD, FD_CLOEXEC);
+
+		poolProcess(sp[1]);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(sp[1]);
+	close(g_serverSocket);
+
+	// Wait until it has accepted a connection (or died trying)
+	rv = 0;
+	while (pid != -1 && (rv = read(sp[0], &c, 1)) == -1 && errno == EINTR);
+
+notify:
+	c = (pid != -1 && rv == 1) ? POOL_NOTIFY_ACCEPTED : POOL_NOTIFY_FAILED;
+	write(g_poolNotify[1], &c, 1);
+	close(g_poolNotify[1]);
+
+	if (pid == -1)
+		return;
+
+	// It only hands the connection over to us if it's going to exec a command directly;
+	// for shells, it sets up a session the usual way (see poolProcess())
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	iov.iov_base = &direct;
+	iov.iov_len = sizeof(direct);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (recvmsg(sp[0], &msg, 0) != sizeof(direct))
+		goto out;
+
+	cmptr = CMSG_FIRSTHDR(&msg);
+	if (cmptr == NULL || cmptr->cmsg_level != SOL_SOCKET || cmptr->cmsg_type != SCM_RIGHTS
+			|| cmptr->cmsg_len != CMSG_LEN(sizeof(fds)))
+	{
+		if (DBG) puts("bad pool handoff");
+		goto out;
+	}
+
+	memcpy(fds, CMSG_DATA(cmptr), sizeof(fds));
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+	// Check that exec succeeded
+	if (read(sp[0], &rv, sizeof(rv)) == sizeof(rv))
+	{
+		int wstatus = (rv == ENOENT) ? 127 : 126;
+		write(fds[0], &wstatus, sizeof(int));
+
+		for (int i = 0; i < 4; i++)
+			close(fds[i]);
+
+		kill(pid, SIGKILL);
+		goto out;
+	}
+
+	superviseShell(fds[0], pid, &fds[1]);
+
+out:
+	close(sp[0]);
+	reapAll();
+}
+
+// Runs in the process that sits in the pool, waiting for a connection.
+// It's forked before anyone asks for it, so all that's left to do once a command comes in is to exec it.
+static void poolProcess(int sp)
+{
+	struct shell_request req;
+	int fds[4];
+	int direct = 1;
+	int fd;
+	struct msghdr msg;
+	struct iovec iov;
+	char cmsgbuf[CMSG_SPACE(sizeof(fds))];
+	struct cmsghdr* cmptr;
+
+	while ((fd = accept(g_serverSocket, NULL, NULL)) == -1)
+	{
+		if (errno != EINTR)
+			return;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	close(g_serverSocket);
+
+	// Let the worker know, so that it gets replaced
+	write(sp, "a", 1);
+
+	if (!readCommands(fd, &req))
+	{
+		close(fd);
+		return;
+	}
+
+	if (!req.direct)
+	{
+		// Interactive shells need to be supervised from inside their session (so that signals go
+		// to the foreground job), so let this process become the usual supervisor instead
+		close(sp);
+		startShell(fd, &req);
+		return;
+	}
+
+	setsid();
+
+	dup2(req.shellfd[0], STDIN_FILENO);
+	dup2(req.shellfd[1], STDOUT_FILENO);
+	dup2(req.shellfd[2], STDERR_FILENO);
+
+	ioctl(STDIN_FILENO, TIOCSCTTY, STDIN_FILENO);
+
+	// Hand the connection over to the worker
+	fds[0] = fd;
+	memcpy(&fds[1], req.shellfd, sizeof(req.shellfd));
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	iov.iov_base = &direct;
+	iov.iov_len = sizeof(direct);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	cmptr = CMSG_FIRSTHDR(&msg);
+	cmptr->cmsg_level = SOL_SOCKET;
+	cmptr->cmsg_type = SCM_RIGHTS;
+	cmptr->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmptr), fds, sizeof(fds));
+
+	if (sendmsg(sp, &msg, 0) != sizeof(direct))
+		return;
+
+	close(fd);
+	for (int i = 0; i < 3; i++)
+	{
+		if (req.shellfd[i] > STDERR_FILENO)
+			close(req.shellfd[i]);
+	}
+
+	execShell(&req, sp);
+}
+
+void spawnShell(int fd)
+{
+	struct shell_request req;
+
+	if (!readCommands(fd, &req))
+	{
+		close(fd);
+		reapAll();
+		return;
+	}
+
+	startShell(fd, &req);
+}
+
+// Reads commands from the client, up to and including SHELLSPAWN_GO
+static bool readCommands(int fd, struct shell_request* req)
+{
 	struct msghdr msg;
 	struct iovec iov;
 	char cmsgbuf[CMSG_SPACE(sizeof(int)) * 3];
-	int kq;
 
 	bool read_cmds = true;
 
-	argv = (char**) malloc(sizeof(char*) * 3);
-	argv[0] = "/bin/bash";
-	argv[1] = "--login";
+	req->argc = 2;
+	req->direct = false;
+	req->argv = (char**) malloc(sizeof(char*) * 3);
+	req->argv[0] = "/bin/bash";
+	req->argv[1] = "--login";
 
 	// Read commands from client
 	while (read_cmds)
@@ -152,14 +504,17 @@ void spawnShell(int fd)
 		if (recvmsg(fd, &msg, 0) != sizeof(cmd))
 		{
 			if (DBG) puts("bad recvmsg");
-			goto err;
+			return false;
 		}
 
 		if (cmd.data_length != 0)
 		{
 			param = (char*) malloc(cmd.data_length + 1);
 			if (read(fd, param, cmd.data_length) != cmd.data_length)
-				goto err;
+			{
+				free(param);
+				return false;
+			}
 			param[cmd.data_length] = '\0';
 		}
 
@@ -169,10 +524,10 @@ void spawnShell(int fd)
 			{
 				if (param != NULL)
 				{
-					argv = (char**) realloc(argv, sizeof(char*) * (argc + 1));
-					argv[argc] = param;
+					req->argv = (char**) realloc(req->argv, sizeof(char*) * (req->argc + 1));
+					req->argv[req->argc] = param;
 					if (DBG) printf("add arg: %s\n", param);
-					argc++;
+					req->argc++;
 				}
 				break;
 			}
@@ -199,27 +554,28 @@ void spawnShell(int fd)
 			{
 				struct cmsghdr *cmptr = CMSG_FIRSTHDR(&msg);
 
+				free(param);
+
 				if (cmptr == NULL)
 				{
 					if (DBG) puts("bad cmptr");
-					goto err;
+					return false;
 				}
 				if (cmptr->cmsg_level != SOL_SOCKET
 						|| cmptr->cmsg_type != SCM_RIGHTS)
 				{
 					if (DBG) puts("bad cmsg level/type");
-					goto err;
+					return false;
 				}
 				if (cmptr->cmsg_len != CMSG_LEN(sizeof(int) * 3))
 				{
 					if (DBG) printf("bad cmsg_len: %d\n", cmptr->cmsg_len);
-					goto err;
+					return false;
 				}
 
-				memcpy(shellfd, CMSG_DATA(cmptr), sizeof(int) * 3);
+				memcpy(req->shellfd, CMSG_DATA(cmptr), sizeof(int) * 3);
 
-				if (DBG) printf("go, fds={ %d, %d, %d }\n", shellfd[0], shellfd[1], shellfd[2]);
-				free(param);
+				if (DBG) printf("go, fds={ %d, %d, %d }\n", req->shellfd[0], req->shellfd[1], req->shellfd[2]);
 				read_cmds = false;
 				break;
 			}
@@ -238,12 +594,39 @@ void spawnShell(int fd)
 
 				break;
 			}
+			case SHELLSPAWN_EXEC:
+			{
+				if (DBG) puts("exec directly");
+				req->direct = true;
+				free(param);
+				break;
+			}
 		}
 	}
 
+	// With SHELLSPAWN_EXEC, the arguments are the command itself,
+	// so we skip starting a login shell just to have it run the command
+	if (req->direct && req->argc <= 2)
+	{
+		for (int i = 0; i < 3; i++)
+			close(req->shellfd[i]);
+		return false;
+	}
+
 	// Add terminating NULL
-	argv = (char**) realloc(argv, sizeof(char*) * (argc + 1));
-	argv[argc] = NULL;
+	req->argv = (char**) realloc(req->argv, sizeof(char*) * (req->argc + 1));
+	req->argv[req->argc] = NULL;
+
+	return true;
+}
+
+// Starts the shell (or the command) in a new session and supervises it
+static void startShell(int fd, struct shell_request* req)
+{
+	pid_t shell_pid = -1;
+	int pipefd[2];
+	int rv;
+	int wstatus;
 
 	if (pipe(pipefd) == -1)
 		goto err;
@@ -255,9 +638,9 @@ void spawnShell(int fd)
 	close(STDOUT_FILENO);
 	close(STDERR_FILENO);
 
-	dup2(shellfd[0], STDIN_FILENO);
-	dup2(shellfd[1], STDOUT_FILENO);
-	dup2(shellfd[2], STDERR_FILENO);
+	dup2(req->shellfd[0], STDIN_FILENO);
+	dup2(req->shellfd[1], STDOUT_FILENO);
+	dup2(req->shellfd[2], STDERR_FILENO);
 
 	ioctl(STDIN_FILENO, TIOCSCTTY, STDIN_FILENO);
 
@@ -265,29 +648,81 @@ void spawnShell(int fd)
 	if (shell_pid == 0)
 	{
 		close(fd);
+		close(pipefd[0]);
 
 		fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
-
-		// In future, we may support spawning something else than Bash
-		// and check the provided shell against /etc/shells
-		execv("/bin/bash", argv);
-
-		rv = errno;
-		write(pipefd[1], &rv, sizeof(rv));
-		close(pipefd[1]);
-
-		exit(EXIT_FAILURE);
+		execShell(req, pipefd[1]);
 	}
 
 	// Check that exec succeeded
 	close(pipefd[1]); // close the write end
 	if (read(pipefd[0], &rv, sizeof(rv)) == sizeof(rv))
 	{
+		if (req->direct)
+		{
+			wstatus = (rv == ENOENT) ? 127 : 126;
+			write(fd, &wstatus, sizeof(int));
+		}
+
 		errno = rv;
 		goto err;
 	}
 	close(pipefd[0]);
 
+	superviseShell(fd, shell_pid, req->shellfd);
+	return;
+err:
+	if (DBG) fprintf(stderr, "Error spawning shell: %s\n", strerror(errno));
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (req->shellfd[i] != -1)
+			close(req->shellfd[i]);
+	}
+
+	if (shell_pid != -1)
+		kill(shell_pid, SIGKILL);
+
+	close(fd);
+	reapAll();
+}
+
+// Runs in the child; on failure, the exec errno is written to `errfd` (which must be close-on-exec)
+static void execShell(struct shell_request* req, int errfd)
+{
+	int rv;
+
+	if (req->direct)
+	{
+		execvp(req->argv[2], &req->argv[2]);
+	}
+	else
+	{
+		// In future, we may support spawning something else than Bash
+		// and check the provided shell against /etc/shells
+		execv("/bin/bash", req->argv);
+	}
+
+	rv = errno;
+
+	if (req->direct)
+	{
+		// Report it the way a shell would have
+		fprintf(stderr, "darling: %s: %s\n", req->argv[2], strerror(rv));
+	}
+
+	write(errfd, &rv, sizeof(rv));
+	close(errfd);
+
+	exit(EXIT_FAILURE);
+}
+
+// Passes signals from the client on to the shell and reports its exit code back
+static void superviseShell(int fd, pid_t shell_pid, int shellfd[3])
+{
+	int kq;
+	int wstatus;
+
 	// Now we start passing signals
 	// and check for child process exit
 
@@ -374,11 +809,10 @@ void spawnShell(int fd)
 	for (int i = 0; i < 3; i++)
 	{
 		if (shellfd[i] != -1)
-			close(shellfd[0]);
+			close(shellfd[i]);
 	}
 
 	// Reap the child
-	int wstatus;
 	waitpid(shell_pid, &wstatus, WEXITED);
 	wstatus = WEXITSTATUS(wstatus);
 	
@@ -396,11 +830,10 @@ err:
 	for (int i = 0; i < 3; i++)
 	{
 		if (shellfd[i] != -1)
-			close(shellfd[0]);
+			close(shellfd[i]);
 	}
 
-	if (shell_pid != -1)
-		kill(shell_pid, SIGKILL);
+	kill(shell_pid, SIGKILL);
 
 	close(fd);
 	reapAll();
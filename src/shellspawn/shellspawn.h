@@ -35,6 +35,7 @@ enum {
 	SHELLSPAWN_GO, // execute the shell now, must also contain file descriptors
 	SHELLSPAWN_SIGNAL, // pass a signal from client
 	SHELLSPAWN_SETUIDGID, // set virtual uid and gid
+	SHELLSPAWN_EXEC, // run the arguments as a command (looked up in PATH) instead of passing them to the shell
 };
 
 struct __attribute__((packed)) shellspawn_cmd
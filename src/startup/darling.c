@@ -19,6 +19,7 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,11 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <termios.h>
 #include <pty.h>
 #include <pwd.h>
+#include <ftw.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
 #include "../shellspawn/shellspawn.h"
 #include "darling.h"
 #include "darling-config.h"
@@ -51,6 +57,8 @@ uid_t g_originalUid, g_originalGid;
 bool g_fixPermissions = false;
 char g_workingDirectory[4096];
 
+static void setupPrefixUsers(void);
+
 int main(int argc, char ** argv)
 {
 	pid_t pidInit;
@@ -86,11 +94,41 @@ int main(int argc, char ** argv)
 	unsetenv("DPREFIX");
 	getcwd(g_workingDirectory, sizeof(g_workingDirectory));
 
+	if (strcmp(argv[1], "template") == 0)
+	{
+		if (argc != 3)
+		{
+			showHelp(argv[0]);
+			return 1;
+		}
+		if (!checkPrefixDir())
+		{
+			fprintf(stderr, "There is no prefix at %s to make a template of\n", prefix);
+			return 1;
+		}
+		checkPrefixOwner();
+
+		if (getInitProcess() != 0)
+		{
+			fprintf(stderr, "The Darling container is running; stop it with `%s shutdown' first\n", argv[0]);
+			return 1;
+		}
+
+		createPrefixTemplate(argv[2]);
+		return 0;
+	}
+
 	if (!checkPrefixDir())
 	{
-		setupPrefix();
+		const char* template = getenv("DPREFIX_TEMPLATE");
+
+		if (template != NULL && template[0] != '\0')
+			setupPrefixFromTemplate(template);
+		else
+			setupPrefix();
 		g_fixPermissions = true;
 	}
+	unsetenv("DPREFIX_TEMPLATE");
 	checkPrefixOwner();
 
 	int c;
@@ -200,6 +238,17 @@ int main(int argc, char ** argv)
 		else
 			spawnShell(NULL);
 	}
+	else if (strcmp(argv[1], "exec") == 0)
+	{
+		// No login shell, which is most of what it costs to start a command;
+		// the command doesn't get the environment the login profile sets up, though
+		if (argc < 3)
+		{
+			showHelp(argv[0]);
+			return 1;
+		}
+		spawnCommand((const char**) &argv[2]);
+	}
 	else
 	{
 		char *fullPath;
@@ -267,6 +316,8 @@ static void pushShellspawnCommandData(int sockfd, shellspawn_cmd_type_t type, co
 		fprintf(stderr, "Error sending command to shellspawn: %s\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
+
+	free(cmd);
 }
 
 static void pushShellspawnCommand(int sockfd, shellspawn_cmd_type_t type, const char* value)
@@ -532,7 +583,7 @@ static size_t escapeQuotes(char *dest, const char *src)
 	return len;
 }
 
-void spawnShell(const char** argv)
+static void spawn(const char** argv, bool direct)
 {
 	size_t total_len = 0;
 	int count;
@@ -541,7 +592,9 @@ void spawnShell(const char** argv)
 	struct sockaddr_un addr;
 	char* buffer;
 
-	if (argv != NULL)
+	if (direct)
+		buffer = NULL;
+	else if (argv != NULL)
 	{
 		for (count = 0; argv[count] != NULL; count++)
 			total_len += escapeQuotes(NULL, argv[count]);
@@ -612,7 +665,15 @@ void spawnShell(const char** argv)
 	pushShellspawnCommand(sockfd, SHELLSPAWN_SETENV, buffer2);
 
 	// Push shell arguments
-	if (buffer != NULL)
+	if (direct)
+	{
+		// Have shellspawn run the command itself, rather than through a login shell
+		pushShellspawnCommand(sockfd, SHELLSPAWN_EXEC, NULL);
+
+		for (int i = 0; argv[i] != NULL; i++)
+			pushShellspawnCommand(sockfd, SHELLSPAWN_ADDARG, argv[i]);
+	}
+	else if (buffer != NULL)
 	{
 		pushShellspawnCommand(sockfd, SHELLSPAWN_ADDARG, "-c");
 		pushShellspawnCommand(sockfd, SHELLSPAWN_ADDARG, buffer);
@@ -648,6 +709,16 @@ void spawnShell(const char** argv)
 	close(sockfd);
 }
 
+void spawnShell(const char** argv)
+{
+	spawn(argv, false);
+}
+
+void spawnCommand(const char** argv)
+{
+	spawn(argv, true);
+}
+
 void showHelp(const char* argv0)
 {
 	fprintf(stderr, "This is Darling, translation layer for macOS software.\n\n");
@@ -656,9 +727,12 @@ void showHelp(const char* argv0)
 	fprintf(stderr, "Usage:\n");
 	fprintf(stderr, "\t%s program-path [arguments...]\n", argv0);
 	fprintf(stderr, "\t%s shell [arguments...]\n", argv0);
+	fprintf(stderr, "\t%s exec command [arguments...] (without a login shell)\n", argv0);
+	fprintf(stderr, "\t%s template template-path\n", argv0);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Environment variables:\n"
-		"DPREFIX - specifies the location of Darling prefix, defaults to ~/.darling\n");
+		"DPREFIX - specifies the location of Darling prefix, defaults to ~/.darling\n"
+		"DPREFIX_TEMPLATE - a template (made with `template') to create new prefixes from\n");
 }
 
 void showVersion(const char* argv0) {
@@ -885,8 +959,6 @@ void setupPrefix()
 {
 	char path[4096];
 	size_t plen;
-	FILE* file;
-	struct passwd* passwd_entry;
 	
 	const char* dirs[] = {
 		"/Volumes",
@@ -922,7 +994,24 @@ void setupPrefix()
 		createDir(path);
 	}
 
-	// create passwd, master.passwd, and group
+	setupPrefixUsers();
+
+	seteuid(0);
+	setegid(0);
+}
+
+// Creates passwd, master.passwd, and group for the current user
+// Must be called with the original UID/GID
+static void setupPrefixUsers(void)
+{
+	char path[4096];
+	size_t plen;
+	FILE* file;
+	struct passwd* passwd_entry;
+
+	strcpy(path, prefix);
+	strcat(path, "/");
+	plen = strlen(path);
 
 	passwd_entry = getpwuid(g_originalUid);
 	if (!passwd_entry) {
@@ -983,7 +1072,445 @@ void setupPrefix()
 		passwd_entry->pw_name
 	);
 	fclose(file);
-	
+}
+
+// Prefix templates
+//
+// A template is a copy of a prefix that has been fully set up (i.e. that Darling has already
+// started in once). New prefixes are cloned from it instead of starting out empty, so that
+// they don't go through the first start's setup again.
+//
+// Files are cloned with reflinks (FICLONE) where the filesystem supports them (Btrfs, XFS, ...),
+// so creating a prefix costs a few metadata operations per file rather than copying their data.
+// Elsewhere, we fall back to copy_file_range() and then to plain copying.
+
+static const char* g_cloneSource;
+static const char* g_cloneDestination;
+static bool g_cloneFailed;
+static int g_cloneDestinationFd = -1;
+static char g_cloneParentPath[4096];
+static int g_cloneParentFd = -1;
+
+// Not worth keeping in a template: state of the (stopped) container that made it
+static const char* const g_templateSkip[] = {
+	"/.init.pid",
+	"/var/run",
+	"/private/var/run",
+};
+
+static bool copyFileData(int in, int out, off_t size)
+{
+	char buf[64 * 1024];
+	ssize_t len;
+
+	if (ioctl(out, FICLONE, in) == 0)
+		return true;
+
+	while (size > 0)
+	{
+		len = copy_file_range(in, NULL, out, NULL, size, 0);
+		if (len <= 0)
+			break;
+		size -= len;
+	}
+	if (size == 0)
+		return true;
+
+	// e.g. EXDEV on kernels that can't do copy_file_range() across filesystems;
+	// carry on from wherever it stopped
+	while ((len = read(in, buf, sizeof(buf))) > 0)
+	{
+		if (write(out, buf, len) != len)
+			return false;
+	}
+
+	return len == 0;
+}
+
+// The prefix is overlayfs' upper directory, so it also holds overlayfs' own bookkeeping:
+// whiteouts (0:0 character devices) for files deleted from the lower layer, and
+// trusted.overlay.* xattrs (e.g. "opaque" on directories that hide the lower one).
+// Creating either needs root. Both trees belong to the user, who could swap any directory in
+// them for a symlink while we're at it, so everything done as root goes through descriptors:
+// the destination is walked from g_cloneDestinationFd without following symlinks, and every
+// directory on the way must belong to the user.
+static bool isWhiteout(const struct stat* st)
+{
+	return S_ISCHR(st->st_mode) && st->st_rdev == makedev(0, 0);
+}
+
+static bool isOwnedByUser(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+		return false;
+	if (st.st_uid != g_originalUid)
+	{
+		errno = EPERM;
+		return false;
+	}
+	return true;
+}
+
+static int openCloneDirAt(int dirfd, const char* name)
+{
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (fd != -1 && !isOwnedByUser(fd))
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+// Returns a descriptor for the destination directory that `rel` (relative to the destination root)
+// goes into and sets `name` to its last component. The descriptor is kept for the next entry
+// (nftw mostly visits entries of the same directory one after another), so it mustn't be closed.
+static int openCloneParent(const char* rel, const char** name)
+{
+	const char* slash = strrchr(rel, '/');
+	size_t len = slash - rel;
+	int fd;
+
+	*name = slash + 1;
+
+	if (g_cloneParentFd != -1 && strlen(g_cloneParentPath) == len && strncmp(g_cloneParentPath, rel, len) == 0)
+		return g_cloneParentFd;
+
+	if (g_cloneParentFd != -1)
+	{
+		close(g_cloneParentFd);
+		g_cloneParentFd = -1;
+	}
+
+	fd = fcntl(g_cloneDestinationFd, F_DUPFD_CLOEXEC, 0);
+	for (const char* p = rel; fd != -1 && p < rel + len; )
+	{
+		char component[NAME_MAX + 1];
+		size_t n;
+		int next;
+
+		p++;
+		n = strcspn(p, "/");
+		if (p + n > rel + len)
+			n = rel + len - p;
+		if (n > NAME_MAX)
+		{
+			close(fd);
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		memcpy(component, p, n);
+		component[n] = '\0';
+		p += n;
+
+		next = openCloneDirAt(fd, component);
+		close(fd);
+		fd = next;
+	}
+
+	if (fd != -1)
+	{
+		memcpy(g_cloneParentPath, rel, len);
+		g_cloneParentPath[len] = '\0';
+		g_cloneParentFd = fd;
+	}
+	return fd;
+}
+
+static bool copyOverlayXattrs(int in, int out)
+{
+	char names[4096];
+	ssize_t len;
+	bool ok = true;
+	int err = 0;
+
+	seteuid(0);
+
+	len = flistxattr(in, names, sizeof(names));
+	if (len < 0 && errno != ENOTSUP)
+	{
+		ok = false;
+		err = errno;
+	}
+
+	for (const char* name = names; ok && len > 0 && name < names + len; name += strlen(name) + 1)
+	{
+		char value[4096];
+		ssize_t size;
+
+		if (strncmp(name, "trusted.overlay.", 16) != 0 && strncmp(name, "user.overlay.", 13) != 0)
+			continue;
+
+		size = fgetxattr(in, name, value, sizeof(value));
+		if (size < 0 || fsetxattr(out, name, value, size, 0) != 0)
+		{
+			ok = false;
+			err = errno;
+		}
+	}
+
+	seteuid(g_originalUid);
+
+	errno = err;
+	return ok;
+}
+
+static bool cloneFile(const char* src, const char* rel, const struct stat* st)
+{
+	const struct timespec times[2] = { st->st_atim, st->st_mtim };
+	const char* name;
+	int in, out, dirfd;
+	bool ok;
+
+	dirfd = openCloneParent(rel, &name);
+	if (dirfd == -1)
+		return false;
+
+	in = open(src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (in == -1)
+		return false;
+
+	out = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, st->st_mode & 07777);
+	if (out == -1)
+	{
+		close(in);
+		return false;
+	}
+
+	// newer kernels may also keep whiteouts as regular files marked with an xattr
+	ok = copyFileData(in, out, st->st_size) && copyOverlayXattrs(in, out);
+	if (ok)
+	{
+		fchmod(out, st->st_mode & 07777);
+		futimens(out, times);
+	}
+
+	close(in);
+	close(out);
+	return ok;
+}
+
+static bool cloneDirXattrs(const char* src, const char* rel)
+{
+	const char* name;
+	int in, out, dirfd;
+	bool ok;
+
+	if (rel[0] == '\0')
+		out = fcntl(g_cloneDestinationFd, F_DUPFD_CLOEXEC, 0);
+	else if ((dirfd = openCloneParent(rel, &name)) != -1)
+		out = openCloneDirAt(dirfd, name);
+	else
+		return false;
+	if (out == -1)
+		return false;
+
+	in = open(src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (in == -1)
+	{
+		close(out);
+		return false;
+	}
+
+	ok = copyOverlayXattrs(in, out);
+
+	close(in);
+	close(out);
+	return ok;
+}
+
+static bool cloneWhiteout(const char* rel, const struct stat* st)
+{
+	const char* name;
+	int dirfd;
+	bool ok;
+	int err;
+
+	dirfd = openCloneParent(rel, &name);
+	if (dirfd == -1)
+		return false;
+
+	seteuid(0);
+	ok = mknodat(dirfd, name, S_IFCHR | (st->st_mode & 07777), makedev(0, 0)) == 0
+		&& fchownat(dirfd, name, g_originalUid, g_originalGid, AT_SYMLINK_NOFOLLOW) == 0;
+	err = errno;
+	seteuid(g_originalUid);
+
+	errno = err;
+	return ok;
+}
+
+static int cloneEntry(const char* fpath, const struct stat* st, int typeflag, struct FTW* ftwbuf)
+{
+	const char* rel = fpath + strlen(g_cloneSource);
+	char dst[4096];
+
+	if (snprintf(dst, sizeof(dst), "%s%s", g_cloneDestination, rel) >= sizeof(dst))
+	{
+		fprintf(stderr, "Path too long: %s\n", fpath);
+		g_cloneFailed = true;
+		return FTW_STOP;
+	}
+
+	for (size_t i = 0; i < sizeof(g_templateSkip)/sizeof(g_templateSkip[0]); i++)
+	{
+		if (strcmp(rel, g_templateSkip[i]) != 0)
+			continue;
+
+		// keep the directory itself, just not what's in it
+		if (typeflag == FTW_D && mkdir(dst, st->st_mode & 07777) == 0)
+			return FTW_SKIP_SUBTREE;
+		return (typeflag == FTW_D) ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+	}
+
+	switch (typeflag)
+	{
+		case FTW_D:
+			if (mkdir(dst, st->st_mode & 07777) != 0 && !(errno == EEXIST && ftwbuf->level == 0))
+				break;
+			if (ftwbuf->level == 0)
+			{
+				g_cloneDestinationFd = open(dst, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+				if (g_cloneDestinationFd == -1)
+					break;
+				if (!isOwnedByUser(g_cloneDestinationFd))
+					break;
+			}
+			if (!cloneDirXattrs(fpath, rel))
+				break;
+			return FTW_CONTINUE;
+		case FTW_SL:
+		{
+			char target[4096];
+			ssize_t len = readlink(fpath, target, sizeof(target) - 1);
+
+			if (len < 0)
+				break;
+			target[len] = '\0';
+
+			if (symlink(target, dst) != 0)
+				break;
+			return FTW_CONTINUE;
+		}
+		case FTW_F:
+			if (isWhiteout(st))
+			{
+				if (!cloneWhiteout(rel, st))
+					break;
+				return FTW_CONTINUE;
+			}
+
+			// sockets, FIFOs and the like belong to the container that created them
+			if (!S_ISREG(st->st_mode))
+				return FTW_CONTINUE;
+
+			if (!cloneFile(fpath, rel, st))
+				break;
+			return FTW_CONTINUE;
+		default:
+			errno = EACCES;
+			break;
+	}
+
+	fprintf(stderr, "Cannot copy %s to %s: %s\n", fpath, dst, strerror(errno));
+	g_cloneFailed = true;
+	return FTW_STOP;
+}
+
+static int removeEntry(const char* fpath, const struct stat* st, int typeflag, struct FTW* ftwbuf)
+{
+	remove(fpath);
+	return 0;
+}
+
+// Copies the `src` tree into `dst`, which must not exist yet (or be empty)
+// Must be called with the original UID/GID
+static bool cloneTree(const char* src, const char* dst)
+{
+	g_cloneSource = src;
+	g_cloneDestination = dst;
+	g_cloneFailed = false;
+
+	if (nftw(src, cloneEntry, 64, FTW_PHYS | FTW_ACTIONRETVAL) != 0 && !g_cloneFailed)
+	{
+		fprintf(stderr, "Cannot read %s: %s\n", src, strerror(errno));
+		g_cloneFailed = true;
+	}
+
+	if (g_cloneParentFd != -1)
+	{
+		close(g_cloneParentFd);
+		g_cloneParentFd = -1;
+	}
+	if (g_cloneDestinationFd != -1)
+	{
+		close(g_cloneDestinationFd);
+		g_cloneDestinationFd = -1;
+	}
+
+	if (g_cloneFailed)
+	{
+		nftw(dst, removeEntry, 64, FTW_PHYS | FTW_DEPTH);
+		return false;
+	}
+
+	return true;
+}
+
+void createPrefixTemplate(const char* templatePath)
+{
+	struct stat st;
+
+	seteuid(g_originalUid);
+	setegid(g_originalGid);
+
+	if (lstat(templatePath, &st) == 0)
+	{
+		fprintf(stderr, "%s already exists. Remove it first.\n", templatePath);
+		exit(1);
+	}
+
+	fprintf(stderr, "Making a template of %s at %s\n", prefix, templatePath);
+
+	if (!cloneTree(prefix, templatePath))
+		exit(1);
+
+	seteuid(0);
+	setegid(0);
+}
+
+void setupPrefixFromTemplate(const char* templatePath)
+{
+	struct stat st;
+
+	fprintf(stderr, "Setting up a new Darling prefix at %s from %s\n", prefix, templatePath);
+
+	seteuid(g_originalUid);
+	setegid(g_originalGid);
+
+	if (stat(templatePath, &st) != 0)
+	{
+		fprintf(stderr, "Cannot use %s as a prefix template: %s\n", templatePath, strerror(errno));
+		exit(1);
+	}
+	if (!S_ISDIR(st.st_mode))
+	{
+		fprintf(stderr, "Cannot use %s as a prefix template: %s\n", templatePath, strerror(ENOTDIR));
+		exit(1);
+	}
+
+	if (!cloneTree(templatePath, prefix))
+		exit(1);
+
+	// The template may have been made by another user
+	setupPrefixUsers();
+
 	seteuid(0);
 	setegid(0);
 }
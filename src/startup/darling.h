@@ -35,6 +35,12 @@ void setupWorkdir(void);
 
 void setupPrefix(void);
 
+// Creates the prefix as a copy of the given template instead (see DPREFIX_TEMPLATE)
+void setupPrefixFromTemplate(const char* templatePath);
+
+// Copies the (stopped) prefix into a new template
+void createPrefixTemplate(const char* templatePath);
+
 int checkPrefixDir(void);
 
 // Creates the given directory, exit()ing if not possible
@@ -42,6 +48,10 @@ void createDir(const char* path);
 
 void spawnShell(const char** argv);
 
+// Runs the given command (a path or a name to look up in the prefix's PATH)
+// directly, without going through a login shell
+void spawnCommand(const char** argv);
+
 // Set up some environment variables
 // As well as the working directory
 // Called in the child process
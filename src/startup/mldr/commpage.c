@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <cpuid.h>
 #include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <sys/sysinfo.h>
 
 // Include commpage definitions
@@ -16,6 +18,7 @@ static const char* SIGNATURE32 = "commpage 32-bit";
 static const char* SIGNATURE64 = "commpage 64-bit";
 
 static uint64_t get_cpu_caps(void);
+static void get_cpu_topology(int* logical, int* physical, int* cache_line);
 
 #define CGET(p) (commpage + ((p)-_COMM_PAGE_START_ADDRESS))
 
@@ -29,6 +32,8 @@ void commpage_setup(bool _64bit)
 	uint64_t my_caps;
 	uint8_t *ncpus, *nactivecpus;
 	uint8_t *physcpus, *logcpus;
+	uint16_t* cache_linesize;
+	int logical, physical, cache_line;
 	struct sysinfo si;
 
 	commpage = (uint8_t*) mmap((void*)(_64bit ? _COMM_PAGE64_BASE_ADDRESS : _COMM_PAGE32_BASE_ADDRESS),
@@ -47,20 +52,32 @@ void commpage_setup(bool _64bit)
 	strcpy(signature, _64bit ? SIGNATURE64 : SIGNATURE32);
 	*version = _COMM_PAGE_THIS_VERSION;
 
-	ncpus = (uint8_t*)CGET(_COMM_PAGE_NCPUS);
-	*ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	// All of these are what this process may actually use (i.e. within its affinity mask and cgroup CPU quota),
+	// since that's what thread pools size themselves from; hw.*_max report the whole machine
+	get_cpu_topology(&logical, &physical, &cache_line);
 
+	ncpus = (uint8_t*)CGET(_COMM_PAGE_NCPUS);
 	nactivecpus = (uint8_t*)CGET(_COMM_PAGE_ACTIVE_CPUS);
-	*nactivecpus = sysconf(_SC_NPROCESSORS_ONLN);
+	logcpus = (uint8_t*)CGET(_COMM_PAGE_LOGICAL_CPUS);
+	*ncpus = *nactivecpus = *logcpus = (logical > 255) ? 255 : logical;
 
-	// Better imprecise information than no information
 	physcpus = (uint8_t*)CGET(_COMM_PAGE_PHYSICAL_CPUS);
-	logcpus = (uint8_t*)CGET(_COMM_PAGE_LOGICAL_CPUS);
-	*physcpus = *logcpus = *ncpus;
+	*physcpus = (physical > 255) ? 255 : physical;
+
+	cache_linesize = (uint16_t*)CGET(_COMM_PAGE_CACHE_LINESIZE);
+	*cache_linesize = cache_line;
 
 	my_caps = get_cpu_caps();
 	if (*ncpus == 1)
 		my_caps |= kUP;
+	my_caps |= ((uint64_t)*ncpus << kNumCPUsShift) & kNumCPUs;
+
+	if (cache_line == 32)
+		my_caps |= kCache32;
+	else if (cache_line == 64)
+		my_caps |= kCache64;
+	else if (cache_line == 128)
+		my_caps |= kCache128;
 
 	*cpu_caps = (uint32_t) my_caps;
 	*cpu_caps64 = my_caps;
@@ -72,6 +89,203 @@ void commpage_setup(bool _64bit)
 	}
 }
 
+// Reads a small sysfs/procfs file into `buf`; returns false if it can't be read
+static bool read_file(const char* path, char* buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	ssize_t rd;
+
+	if (fd < 0)
+		return false;
+
+	rd = read(fd, buf, size - 1);
+	close(fd);
+
+	if (rd <= 0)
+		return false;
+
+	buf[rd] = '\0';
+	return true;
+}
+
+// Marks every CPU in a Linux CPU list (e.g. "0-3,8,10-11") in `set`
+static void parse_cpu_list(const char* list, cpu_set_t* set, size_t setsize)
+{
+	while (*list >= '0' && *list <= '9')
+	{
+		char* end;
+		unsigned long first = strtoul(list, &end, 10);
+		unsigned long last = first;
+
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET_S(cpu, setsize, set);
+
+		list = (*end == ',') ? end + 1 : end;
+	}
+}
+
+// Returns how many CPUs' worth of time the cgroup CPU quota allows (rounded up), or 0 if there's no quota
+static int get_cgroup_cpu_limit(void)
+{
+	char cgroups[4096];
+	char path[4096];
+	char buf[64];
+	char* line;
+	int limit = 0;
+
+	if (!read_file("/proc/self/cgroup", cgroups, sizeof(cgroups)))
+		return 0;
+
+	for (line = strtok(cgroups, "\n"); line != NULL; line = strtok(NULL, "\n"))
+	{
+		if (strncmp(line, "0::/", 4) == 0)
+		{
+			// cgroup v2: a quota on any of our ancestors applies to us, too
+			char* group = line + 3;
+			char* slash;
+
+			while (true)
+			{
+				long long quota, period;
+
+				snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", group);
+				if (read_file(path, buf, sizeof(buf)) && sscanf(buf, "%lld %lld", &quota, &period) == 2 && quota > 0 && period > 0)
+				{
+					int cpus = (quota + period - 1) / period;
+					if (limit == 0 || cpus < limit)
+						limit = cpus;
+				}
+
+				slash = strrchr(group, '/');
+				if (slash == NULL || slash == group)
+					break;
+				*slash = '\0';
+			}
+		}
+		else
+		{
+			// cgroup v1: only the cpu controller's own group
+			char* controllers = strchr(line, ':');
+			char* group = controllers ? strchr(controllers + 1, ':') : NULL;
+			long long quota, period;
+
+			if (group == NULL)
+				continue;
+			*group++ = '\0';
+			controllers++;
+
+			if (strcmp(controllers, "cpu,cpuacct") != 0 && strcmp(controllers, "cpu") != 0)
+				continue;
+
+			snprintf(path, sizeof(path), "/sys/fs/cgroup/%s%s/cpu.cfs_quota_us", controllers, group);
+			if (!read_file(path, buf, sizeof(buf)) || sscanf(buf, "%lld", &quota) != 1 || quota <= 0)
+				continue;
+
+			snprintf(path, sizeof(path), "/sys/fs/cgroup/%s%s/cpu.cfs_period_us", controllers, group);
+			if (!read_file(path, buf, sizeof(buf)) || sscanf(buf, "%lld", &period) != 1 || period <= 0)
+				continue;
+
+			int cpus = (quota + period - 1) / period;
+			if (limit == 0 || cpus < limit)
+				limit = cpus;
+		}
+	}
+
+	return limit;
+}
+
+static void get_cpu_topology(int* logical, int* physical, int* cache_line)
+{
+	int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	size_t setsize;
+	cpu_set_t* allowed = NULL;
+	cpu_set_t* seen;
+	char path[128];
+	char buf[256];
+	const char* inherited;
+	int limit;
+
+	// Darwin processes pass their own values on to whatever they exec (see sys_execve()),
+	// so this is only worked out once per prefix, by the first process in it.
+	// Nothing in the prefix can change its affinity mask or cgroup, so they stay valid.
+	inherited = getenv("__mldr_cputopo");
+	if (inherited != NULL && sscanf(inherited, "%d,%d,%d", logical, physical, cache_line) == 3
+		&& *logical > 0 && *physical > 0 && *cache_line > 0)
+	{
+		return;
+	}
+
+	*logical = *physical = 0;
+
+	// the affinity mask may be larger than the number of configured CPUs, so grow it until the kernel takes it
+	for (int count = (ncpus > CPU_SETSIZE) ? ncpus : CPU_SETSIZE; count <= 64 * 1024; count *= 2)
+	{
+		allowed = CPU_ALLOC(count);
+		setsize = CPU_ALLOC_SIZE(count);
+		if (allowed == NULL)
+			break;
+
+		if (sched_getaffinity(0, setsize, allowed) == 0)
+			break;
+
+		CPU_FREE(allowed);
+		allowed = NULL;
+
+		if (errno != EINVAL)
+			break;
+	}
+
+	if (allowed == NULL)
+	{
+		*logical = *physical = (ncpus > 0) ? ncpus : 1;
+	}
+	else
+	{
+		*logical = CPU_COUNT_S(setsize, allowed);
+
+		seen = CPU_ALLOC(setsize * 8);
+		if (seen == NULL)
+		{
+			*physical = *logical;
+			setsize = 0;
+		}
+		else
+			CPU_ZERO_S(setsize, seen);
+
+		// a physical core is a set of SMT siblings; count each one we may run on once
+		for (size_t cpu = 0; cpu < setsize * 8; cpu++)
+		{
+			if (!CPU_ISSET_S(cpu, setsize, allowed) || CPU_ISSET_S(cpu, setsize, seen))
+				continue;
+
+			(*physical)++;
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+			if (read_file(path, buf, sizeof(buf)))
+				parse_cpu_list(buf, seen, setsize);
+		}
+
+		if (seen != NULL)
+			CPU_FREE(seen);
+		CPU_FREE(allowed);
+	}
+
+	limit = get_cgroup_cpu_limit();
+	if (limit > 0 && limit < *logical)
+		*logical = limit;
+	if (*physical > *logical)
+		*physical = *logical;
+	if (*logical < 1)
+		*logical = *physical = 1;
+
+	*cache_line = 64;
+	if (read_file("/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", buf, sizeof(buf)) && atoi(buf) > 0)
+		*cache_line = atoi(buf);
+}
+
 uint64_t get_cpu_caps(void)
 {
 	uint64_t caps = 0;
@@ -63,6 +63,7 @@ static const void* __dserver_socket_address(void) {
 };
 
 extern void __mldr_close_rpc_socket(int socket);
+extern void __mldr_rpc_socket_pool_postfork_child(void);
 
 extern int __mldr_create_process_lifetime_pipe(int* fds);
 extern void __mldr_close_process_lifetime_pipe(int fd);
@@ -98,6 +99,7 @@ void elfcalls_make(struct elf_calls* calls)
 	calls->darling_thread_create = __darling_thread_create;
 	calls->darling_thread_terminate = __darling_thread_terminate;
 	calls->darling_thread_get_stack = __darling_thread_get_stack;
+	calls->native_thread_create = __darling_native_thread_create;
 
 	calls->get_errno = get_errno;
 	calls->exit = exit;
@@ -118,6 +120,7 @@ void elfcalls_make(struct elf_calls* calls)
 	calls->dserver_per_thread_socket = __darling_thread_rpc_socket;
 	calls->dserver_per_thread_socket_refresh = __darling_thread_rpc_socket_refresh;
 	calls->dserver_close_socket = __mldr_close_rpc_socket;
+	calls->dserver_socket_postfork_child = __mldr_rpc_socket_pool_postfork_child;
 
 	calls->dserver_get_process_lifetime_pipe = __dserver_get_process_lifetime_pipe;
 	calls->dserver_process_lifetime_pipe_refresh = __dserver_process_lifetime_pipe_refresh;
@@ -33,6 +33,10 @@ struct elf_calls
 	// this returns the address of the main thread's stack
 	void* (*darling_thread_get_stack)(void);
 
+	// plain native threads for helpers internal to the emulation (e.g. AIO completion);
+	// these never check in with darlingserver and may only make Linux syscalls
+	int (*native_thread_create)(void* (*entry)(void*), void* arg);
+
 	// The same as above, except they abort() in case of failure
 	void* (*dlopen_fatal)(const char* name);
 	int (*dlclose_fatal)(void* lib);
@@ -61,6 +65,7 @@ struct elf_calls
 	int (*dserver_per_thread_socket)(void);
 	void (*dserver_per_thread_socket_refresh)(void);
 	void (*dserver_close_socket)(int socket);
+	void (*dserver_socket_postfork_child)(void);
 
 	// darlingserver process lifetime pipe info
 	int (*dserver_get_process_lifetime_pipe)(void);
@@ -39,6 +39,7 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 
 extern int __mldr_create_rpc_socket(void);
 extern void __mldr_close_rpc_socket(int socket);
+extern void __mldr_rpc_socket_pool_start(void (*guard)(int socket));
 
 // The point of this file is build macOS threads on top of native libc's threads,
 // otherwise it would not be possible to make native calls from these threads.
@@ -46,6 +47,8 @@ extern void __mldr_close_rpc_socket(int socket);
 static __thread jmp_buf t_jmpbuf;
 static __thread void* t_freeaddr;
 static __thread size_t t_freesize;
+static __thread void* t_ownaddr; // the block we allocated for this thread (if any)
+static __thread size_t t_ownstacksize;
 static __thread int t_server_socket = -1;
 static __thread darling_thread_create_callbacks_t t_callbacks = NULL;
 
@@ -67,6 +70,7 @@ struct arg_struct
 	uintptr_t stack_bottom;
 	uintptr_t stack_addr;
 	bool is_workqueue;
+	bool own_stack;
 };
 
 static void* darling_thread_entry(void* p);
@@ -77,6 +81,68 @@ static void* darling_thread_entry(void* p);
 
 #define DEFAULT_DTHREAD_GUARD_SIZE 0x1000
 
+// Stacks we've allocated ourselves (i.e. for workqueue threads) are kept around for reuse once their thread exits,
+// which saves the mmap/mprotect/munmap dance and the page faults on a fresh stack every time a worker comes and goes.
+// This does NOT cover pthread_create()/pthread_exit(): libpthread allocates those blocks itself (with its own guard
+// and pthread layout) before we ever see them, so they're freed as usual; recycling them belongs in libpthread.
+#define DTHREAD_CACHE_SIZE 16
+
+enum {
+	DTHREAD_CACHE_EMPTY,
+	DTHREAD_CACHE_BUSY,
+	DTHREAD_CACHE_FULL,
+};
+
+struct dthread_cache_entry {
+	int state;
+	void* base_addr;
+	size_t stack_size;
+	size_t guard_size;
+};
+
+// slots are claimed with a CAS on `state`, so there's no lock for a thread to be holding across a fork
+static struct dthread_cache_entry dthread_cache[DTHREAD_CACHE_SIZE];
+
+static void* dthread_cache_get(size_t stack_size, size_t guard_size) {
+	for (int i = 0; i < DTHREAD_CACHE_SIZE; i++) {
+		struct dthread_cache_entry* entry = &dthread_cache[i];
+		int expected = DTHREAD_CACHE_FULL;
+
+		if (__atomic_load_n(&entry->state, __ATOMIC_RELAXED) != DTHREAD_CACHE_FULL)
+			continue;
+		if (!__atomic_compare_exchange_n(&entry->state, &expected, DTHREAD_CACHE_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+
+		if (entry->stack_size == stack_size && entry->guard_size == guard_size) {
+			void* base_addr = entry->base_addr;
+			__atomic_store_n(&entry->state, DTHREAD_CACHE_EMPTY, __ATOMIC_RELEASE);
+			return base_addr;
+		}
+
+		__atomic_store_n(&entry->state, DTHREAD_CACHE_FULL, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static bool dthread_cache_put(void* base_addr, size_t stack_size, size_t guard_size) {
+	for (int i = 0; i < DTHREAD_CACHE_SIZE; i++) {
+		struct dthread_cache_entry* entry = &dthread_cache[i];
+		int expected = DTHREAD_CACHE_EMPTY;
+
+		if (!__atomic_compare_exchange_n(&entry->state, &expected, DTHREAD_CACHE_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+
+		entry->base_addr = base_addr;
+		entry->stack_size = stack_size;
+		entry->guard_size = guard_size;
+		__atomic_store_n(&entry->state, DTHREAD_CACHE_FULL, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	return false;
+}
+
 static dthread_t dthread_structure_init(dthread_t dthread, size_t guard_size, void* stack_addr, size_t stack_size, void* base_addr, size_t total_size) {
 	// the pthread signature is the address of the pthread XORed with the "pointer munge" token passed in by the kernel
 	// since the LKM doesn't pass in a token, it's always zero, so the signature is equal to just the address
@@ -112,11 +178,16 @@ static dthread_t dthread_structure_init(dthread_t dthread, size_t guard_size, vo
 static dthread_t dthread_structure_allocate(size_t stack_size, size_t guard_size, void** stack_addr) {
 	size_t total_size = guard_size + stack_size + sizeof(struct _dthread);
 
-	// allocate our stack, guard page, and dthread structure
-	void* base_addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	// a recycled block already has its guard page set up; only the dthread needs resetting (below)
+	void* base_addr = dthread_cache_get(stack_size, guard_size);
+
+	if (base_addr == NULL) {
+		// allocate our stack, guard page, and dthread structure
+		base_addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	// protect our guard page
-	mprotect(base_addr, guard_size, PROT_NONE);
+		// protect our guard page
+		mprotect(base_addr, guard_size, PROT_NONE);
+	}
 
 	/**
 	 * memory layout of newly allocated block:
@@ -155,10 +226,14 @@ void* __darling_thread_create(unsigned long stack_size, unsigned long pth_obj_si
 		.callbacks        = callbacks,
 		.stack_addr       = 0, // set later on
 		.is_workqueue     = real_entry_point == 0, // our `workq_kernreturn` sets `real_entry_point` to NULL; `bsdthread_create` actually passes a value
+		.own_stack        = false,
 	};
 	pthread_attr_t attr;
 	pthread_t nativeLibcThread;
 
+	// from now on, keep a few RPC sockets ready for new threads
+	__mldr_rpc_socket_pool_start(callbacks->rpc_guard);
+
 	pthread_attr_init(&attr);
 	//pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 	// pthread_attr_setstacksize(&attr, stack_size);
@@ -169,6 +244,7 @@ void* __darling_thread_create(unsigned long stack_size, unsigned long pth_obj_si
 	// otherwise, allocate them ourselves
 	if (pth == NULL || args.is_workqueue) {
 		pth = dthread_structure_allocate(stack_size, DEFAULT_DTHREAD_GUARD_SIZE, (void**)&args.stack_addr);
+		args.own_stack = true;
 	} else if (!args.is_workqueue) {
 		// `arg2` is `stack_addr` for normal threads
 		args.stack_addr = arg2;
@@ -208,6 +284,10 @@ static void* darling_thread_entry(void* p)
 	dthread_t dthread = args.pth;
 	uintptr_t* flags = args.is_workqueue ? &args.arg2 : &args.arg3;
 
+	// remember whether the block is ours; libpthread may have changed the dthread by the time we exit
+	t_ownaddr = args.own_stack ? dthread->freeaddr : NULL;
+	t_ownstacksize = args.stack_addr - args.stack_bottom;
+
 	// create a new dserver RPC socket
 	int new_rpc_fd = __mldr_create_rpc_socket();
 	if (new_rpc_fd < 0) {
@@ -245,7 +325,12 @@ static void* darling_thread_entry(void* p)
 	if (setjmp(t_jmpbuf))
 	{
 		// Terminate the Linux thread
-		munmap(t_freeaddr, t_freesize);
+		// (we're back on the native stack, so the Darwin one can be handed to the next thread)
+		if (t_ownaddr == NULL || t_freeaddr != t_ownaddr || t_freesize != DEFAULT_DTHREAD_GUARD_SIZE + t_ownstacksize + sizeof(struct _dthread)
+			|| !dthread_cache_put(t_freeaddr, t_ownstacksize, DEFAULT_DTHREAD_GUARD_SIZE))
+		{
+			munmap(t_freeaddr, t_freesize);
+		}
 		pthread_detach(pthread_self());
 		return NULL;
 	}
@@ -342,6 +427,33 @@ int __darling_thread_terminate(void* stackaddr,
 	__builtin_unreachable();
 }
 
+#define NATIVE_THREAD_STACK_SIZE (64 * 1024)
+
+int __darling_native_thread_create(void* (*entry)(void*), void* arg)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all_signals;
+	sigset_t old_mask;
+	int ret;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, NATIVE_THREAD_STACK_SIZE);
+
+	// these threads have no Darwin TSD, so they must never run a Darwin signal handler;
+	// the new thread inherits our mask, so block everything while creating it
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+	ret = pthread_create(&thread, &attr, entry, arg);
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	pthread_attr_destroy(&attr);
+
+	return -ret;
+}
+
 extern void* __mldr_main_stack_top;
 
 void* __darling_thread_get_stack(void)
@@ -365,6 +477,7 @@ int __darling_thread_rpc_socket(void) {
 };
 
 void __darling_thread_rpc_socket_refresh(void) {
+	// we only get called in a fork child, after `__mldr_rpc_socket_pool_postfork_child` has reset the socket pool
 	int new_rpc_fd = __mldr_create_rpc_socket();
 	if (new_rpc_fd < 0) {
 		abort();
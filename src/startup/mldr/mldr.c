@@ -34,6 +34,7 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <endian.h>
 #include "commpage.h"
 #include "loader.h"
+#include "prefetch.h"
 #include <sys/resource.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -41,6 +42,7 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <darlingserver/rpc.h>
 #include <sys/ptrace.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/utsname.h>
 
 #ifndef PAGE_SIZE
@@ -99,6 +101,7 @@ static const char* const skip_env_vars[] = {
 	"__mldr_bprefs=",
 	"__mldr_sockpath=",
 	"__mldr_lifetime_pipe",
+	"__mldr_cputopo=",
 };
 
 void* __mldr_main_stack_top = NULL;
@@ -164,6 +167,8 @@ int main(int argc, char** argv, char** envp)
 	load(filename, 0, false, argv, &mldr_load_results);
 #endif
 
+	prefetch_setup(filename, &mldr_load_results);
+
 	// this was previously necessary when we were loading the binary from the LKM
 	// (presumably because the break was detected incorrectly)
 	// but this shouldn't be necessary for loading Mach-O's from userspace (the heap space should already be set up properly).
@@ -221,7 +226,8 @@ int main(int argc, char** argv, char** envp)
 
 		if (
 			SKIP_VAR("__mldr_bprefs=")   ||
-			SKIP_VAR("__mldr_sockpath=")
+			SKIP_VAR("__mldr_sockpath=") ||
+			SKIP_VAR("__mldr_cputopo=")
 		) {
 			size_t len_after = 0;
 			const char* orig_envp_i_plus_one = mldr_load_results.envp[i + 1];
@@ -533,31 +539,32 @@ static void unset_special_env() {
 	unsetenv("__mldr_bprefs");
 	unsetenv("__mldr_sockpath");
 	unsetenv("__mldr_lifetime_pipe");
+	unsetenv("__mldr_cputopo");
 };
 
 typedef struct socket_bitmap {
 	pthread_mutex_t mutex;
 	/**
-	 * This is always next lowest available index.
-	 * If this is equal to #bit_length, then the bitmap is full.
+	 * Index of the lowest word that might have a free bit.
+	 * If this is equal to #word_count, then the bitmap is full (and needs to grow).
 	 */
-	size_t next_index;
-	uint8_t* bits;
-	size_t bit_length;
+	size_t next_word;
+	uint64_t* words;
+	size_t word_count;
 	int highest;
 } socket_bitmap_t;
 
 static socket_bitmap_t socket_bitmap = {
 	.mutex = PTHREAD_MUTEX_INITIALIZER,
-	.next_index = 0,
-	.bits = NULL,
-	.bit_length = 0,
+	.next_word = 0,
+	.words = NULL,
+	.word_count = 0,
 	.highest = -1,
 };
 
-static int socket_bitmap_get(socket_bitmap_t* bitmap) {
+// if `reserved` isn't NULL, the descriptor number is stored there before the bitmap is unlocked
+static int socket_bitmap_get(socket_bitmap_t* bitmap, int* reserved) {
 	int fd = -1;
-	bool updated = false;
 
 	pthread_mutex_lock(&bitmap->mutex);
 
@@ -577,56 +584,35 @@ static int socket_bitmap_get(socket_bitmap_t* bitmap) {
 		bitmap->highest = limit.rlim_cur - 1;
 	}
 
-	if (bitmap->next_index >= bitmap->bit_length) {
-		// we need to grow the bitmap
-
-		if ((bitmap->bit_length % 8) == 0) {
-			// we need to allocate an additional byte
-
-			void* ptr = realloc(bitmap->bits, (bitmap->bit_length / 8) + 1);
-			if (!ptr) {
-				goto out;
-			}
-
-			bitmap->bits = ptr;
+	// `next_word` never points past a full word, so this only ever skips words that filled up since they were last checked
+	while (bitmap->next_word < bitmap->word_count && bitmap->words[bitmap->next_word] == UINT64_MAX) {
+		++bitmap->next_word;
+	}
 
-			bitmap->bits[bitmap->bit_length / 8] = 0;
-		} else {
-			// we just need to increment the bit length
+	if (bitmap->next_word == bitmap->word_count) {
+		// we need to grow the bitmap
+		void* ptr = realloc(bitmap->words, (bitmap->word_count + 1) * sizeof(uint64_t));
+		if (!ptr) {
+			goto out;
 		}
 
-		++bitmap->bit_length;
+		bitmap->words = ptr;
+		bitmap->words[bitmap->word_count++] = 0;
 	}
 
-	fd = bitmap->highest - bitmap->next_index;
-
-	bitmap->bits[bitmap->next_index / 8] |= 1 << (bitmap->next_index % 8);
-
-	// update the next available index
-	for (size_t i = bitmap->next_index + 1; i < bitmap->bit_length; ++i) {
-		size_t byte = i / 8;
-		uint8_t bit = i % 8;
+	uint64_t* word = &bitmap->words[bitmap->next_word];
+	size_t index = (bitmap->next_word * 64) + __builtin_ctzll(~*word);
 
-		if (bit == 0) {
-			// check the entire byte at once so we can avoid unnecessary iteration
-			if (bitmap->bits[byte] == 0xff) {
-				// this byte is full, skip it
-				i += 7;
-				continue;
-			}
-		}
-
-		if ((bitmap->bits[byte] & (1 << bit)) == 0) {
-			// this index is unused
-			bitmap->next_index = i;
-			updated = true;
-			break;
-		}
+	if (index > (size_t)bitmap->highest) {
+		// we've run out of descriptors
+		goto out;
 	}
 
-	if (!updated) {
-		// all of our entries are currently in-use
-		bitmap->next_index = bitmap->bit_length;
+	*word |= 1ull << (index % 64);
+	fd = bitmap->highest - index;
+
+	if (reserved) {
+		__atomic_store_n(reserved, fd, __ATOMIC_RELAXED);
 	}
 
 out:
@@ -642,55 +628,27 @@ static void socket_bitmap_put(socket_bitmap_t* bitmap, int socket) {
 
 	index = bitmap->highest - socket;
 
-	bitmap->bits[index / 8] &= ~(1 << (index % 8));
+	bitmap->words[index / 64] &= ~(1ull << (index % 64));
 
-	if (index < bitmap->next_index) {
-		bitmap->next_index = index;
+	if (index / 64 < bitmap->next_word) {
+		bitmap->next_word = index / 64;
 	}
 
-	if (index == bitmap->bit_length - 1) {
-		// we can shrink the bitmap
-		size_t old_byte_size = (bitmap->bit_length + 7) / 8;
-		size_t new_byte_size = old_byte_size;
-
-		while (bitmap->bit_length > 0) {
-			size_t index = bitmap->bit_length - 1;
-
-			if ((bitmap->bit_length % 8) == 0) {
-				// check the entire byte at once to avoid unnecessary iteration
-				if (bitmap->bits[(bitmap->bit_length / 8) - 1] == 0) {
-					// remove this entire byte
-					bitmap->bit_length -= 8;
-					continue;
-				}
-			}
-
-			if ((bitmap->bits[index / 8] & (1 << (index % 8))) == 0) {
-				// this bit is in-use, so we can't shrink any further
-				break;
-			}
-
-			--bitmap->bit_length;
-		}
-
-		new_byte_size = (bitmap->bit_length + 7) / 8;
-
-		if (old_byte_size != new_byte_size) {
-			// we can free one or more bytes from the bitmap
-			void* ptr = realloc(bitmap->bits, new_byte_size);
-			if (!ptr) {
-				goto out;
-			}
-
-			bitmap->bits = ptr;
-		}
-	}
+	// there's no point in shrinking the bitmap; it's 8 bytes for every 64 descriptors
 
-out:
 	pthread_mutex_unlock(&bitmap->mutex);
 };
 
-int __mldr_create_rpc_socket(void) {
+/**
+ * Descriptors a socket is being created on (if any); see `rpc_socket_create`.
+ * Only the pool's refill thread uses this, so that a fork child can release what it was in the middle of creating.
+ */
+struct rpc_socket_pending {
+	int pre_fd;
+	int fd;
+};
+
+static int rpc_socket_create(struct rpc_socket_pending* pending) {
 	int pre_fd = -1;
 	int fd = -1;
 
@@ -698,19 +656,29 @@ int __mldr_create_rpc_socket(void) {
 	if (pre_fd < 0) {
 		goto err_out;
 	}
+	if (pending) {
+		__atomic_store_n(&pending->pre_fd, pre_fd, __ATOMIC_RELAXED);
+	}
 
-	fd = socket_bitmap_get(&socket_bitmap);
+	fd = socket_bitmap_get(&socket_bitmap, pending ? &pending->fd : NULL);
 	if (fd < 0) {
 		goto err_out;
 	}
 
 	if (dup2(pre_fd, fd) < 0) {
 		// we have to put it away ourselves here because `fd` is not yet valid, so we can't close() it in the error handler
+		if (pending) {
+			__atomic_store_n(&pending->fd, -1, __ATOMIC_RELAXED);
+		}
 		socket_bitmap_put(&socket_bitmap, fd);
 		fd = -1;
 		goto err_out;
 	}
 
+	// forget it before closing it; another thread could get the same number right after
+	if (pending) {
+		__atomic_store_n(&pending->pre_fd, -1, __ATOMIC_RELAXED);
+	}
 	close(pre_fd);
 	pre_fd = -1;
 
@@ -733,6 +701,11 @@ out:
 	return fd;
 
 err_out:
+	if (pending) {
+		__atomic_store_n(&pending->fd, -1, __ATOMIC_RELAXED);
+		__atomic_store_n(&pending->pre_fd, -1, __ATOMIC_RELAXED);
+	}
+
 	if (fd >= 0) {
 		socket_bitmap_put(&socket_bitmap, fd);
 		close(fd);
@@ -745,6 +718,135 @@ err_out:
 	return -1;
 };
 
+/**
+ * A few sockets are kept ready (allocated, moved into place, and bound) so that new threads
+ * don't have to go through all that before their first call to darlingserver.
+ * The pool is refilled by a native thread that is started along with the first Darwin thread.
+ */
+#define RPC_SOCKET_POOL_SIZE 4
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int fds[RPC_SOCKET_POOL_SIZE];
+	int count;
+	bool started;
+	void (*guard)(int socket);
+	// what the refill thread is creating right now (until it's been guarded)
+	struct rpc_socket_pending pending;
+} rpc_socket_pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.count = 0,
+	.started = false,
+	.guard = NULL,
+	.pending = { .pre_fd = -1, .fd = -1 },
+};
+
+static void* rpc_socket_pool_refill(void* context) {
+	while (true) {
+		pthread_mutex_lock(&rpc_socket_pool.mutex);
+		while (rpc_socket_pool.count == RPC_SOCKET_POOL_SIZE) {
+			pthread_cond_wait(&rpc_socket_pool.cond, &rpc_socket_pool.mutex);
+		}
+		pthread_mutex_unlock(&rpc_socket_pool.mutex);
+
+		int fd = rpc_socket_create(&rpc_socket_pool.pending);
+		if (fd < 0) {
+			// try again once someone takes a socket (by then, some descriptors may have been freed up)
+			pthread_mutex_lock(&rpc_socket_pool.mutex);
+			pthread_cond_wait(&rpc_socket_pool.cond, &rpc_socket_pool.mutex);
+			pthread_mutex_unlock(&rpc_socket_pool.mutex);
+			continue;
+		}
+
+		// guard it right away; Darwin code that closes every descriptor it doesn't know about must not get to it
+		rpc_socket_pool.guard(fd);
+		__atomic_store_n(&rpc_socket_pool.pending.fd, -1, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&rpc_socket_pool.mutex);
+		rpc_socket_pool.fds[rpc_socket_pool.count++] = fd;
+		pthread_mutex_unlock(&rpc_socket_pool.mutex);
+	}
+
+	return NULL;
+};
+
+void __mldr_rpc_socket_pool_start(void (*guard)(int socket)) {
+	pthread_mutex_lock(&rpc_socket_pool.mutex);
+
+	if (!rpc_socket_pool.started) {
+		pthread_attr_t attr;
+		pthread_t thread;
+		sigset_t all_signals;
+		sigset_t old_mask;
+
+		rpc_socket_pool.started = true;
+		rpc_socket_pool.guard = guard;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		pthread_attr_setstacksize(&attr, 64 * 1024);
+
+		// this thread never runs Darwin code, so it must never get Darwin signals
+		sigfillset(&all_signals);
+		pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+		if (pthread_create(&thread, &attr, rpc_socket_pool_refill, NULL) != 0) {
+			// no pool, then; every thread creates its own socket
+			rpc_socket_pool.started = false;
+		}
+
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		pthread_attr_destroy(&attr);
+	}
+
+	pthread_mutex_unlock(&rpc_socket_pool.mutex);
+};
+
+/**
+ * Must be the first thing a fork child does with RPC sockets: the refill thread is gone,
+ * and it may have been holding either lock (which closing any socket needs) when the parent forked.
+ */
+void __mldr_rpc_socket_pool_postfork_child(void) {
+	pthread_mutex_init(&socket_bitmap.mutex, NULL);
+	pthread_mutex_init(&rpc_socket_pool.mutex, NULL);
+	pthread_cond_init(&rpc_socket_pool.cond, NULL);
+
+	// a socket it was still creating isn't guarded yet, so nobody else is going to close it
+	if (rpc_socket_pool.pending.pre_fd >= 0) {
+		close(rpc_socket_pool.pending.pre_fd);
+	}
+	if (rpc_socket_pool.pending.fd >= 0) {
+		close(rpc_socket_pool.pending.fd);
+		socket_bitmap_put(&socket_bitmap, rpc_socket_pool.pending.fd);
+	}
+	rpc_socket_pool.pending.pre_fd = -1;
+	rpc_socket_pool.pending.fd = -1;
+
+	// pooled sockets are bound to addresses the parent still uses;
+	// they're guarded, so they're closed (and their numbers released) along with the other guarded descriptors
+	rpc_socket_pool.count = 0;
+	rpc_socket_pool.started = false;
+};
+
+int __mldr_create_rpc_socket(void) {
+	int fd = -1;
+
+	pthread_mutex_lock(&rpc_socket_pool.mutex);
+	if (rpc_socket_pool.count > 0) {
+		fd = rpc_socket_pool.fds[--rpc_socket_pool.count];
+		pthread_cond_signal(&rpc_socket_pool.cond);
+	}
+	pthread_mutex_unlock(&rpc_socket_pool.mutex);
+
+	if (fd < 0) {
+		fd = rpc_socket_create(NULL);
+	}
+
+	return fd;
+};
+
 void __mldr_close_rpc_socket(int socket) {
 	close(socket);
 	socket_bitmap_put(&socket_bitmap, socket);
@@ -764,7 +866,7 @@ int __mldr_create_process_lifetime_pipe(int* fds) {
 	}
 
 	for (int i = 0; i < 2; ++i) {
-		fds[i] = socket_bitmap_get(&socket_bitmap);
+		fds[i] = socket_bitmap_get(&socket_bitmap, NULL);
 		if (fds[i] < 0) {
 			goto err_out;
 		}
@@ -803,6 +905,30 @@ void __mldr_close_process_lifetime_pipe(int fd) {
 	}
 }
 
+int mldr_move_fd_high(int fd) {
+	int high_fd = socket_bitmap_get(&socket_bitmap, NULL);
+
+	if (high_fd < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (dup2(fd, high_fd) < 0) {
+		socket_bitmap_put(&socket_bitmap, high_fd);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	fcntl(high_fd, F_SETFD, FD_CLOEXEC);
+	return high_fd;
+};
+
+void mldr_close_high_fd(int fd) {
+	close(fd);
+	socket_bitmap_put(&socket_bitmap, fd);
+};
+
 static void setup_space(struct load_results* lr, bool is_64_bit) {
 	commpage_setup(is_64_bit);
 
@@ -846,7 +972,7 @@ static void setup_space(struct load_results* lr, bool is_64_bit) {
 	// darlingserver should already have the read pipe, so we don't need
 	// to check that in.
 	if (lr->lifetime_pipe != -1) {
-		lifetime_pipe[1] = socket_bitmap_get(&socket_bitmap);
+		lifetime_pipe[1] = socket_bitmap_get(&socket_bitmap, NULL);
 
 		if (lr->lifetime_pipe != lifetime_pipe[1]) {
 			// move the existing pipe to a higher fd number, and invalidate
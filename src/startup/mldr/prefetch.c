@@ -0,0 +1,585 @@
+// mldr32 needs 64-bit offsets to read /proc/self/pagemap
+#define _FILE_OFFSET_BITS 64
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prefetch.h"
+
+// Startup prefetch profiles
+//
+// Every page of dyld, the main executable and the libraries dyld loads is demand-faulted the first time it's touched,
+// so a cold launch takes thousands of page faults, many of them waiting on the disk one page at a time.
+//
+// With DARLING_PREFETCH=1, the first launch of a binary records which pages of which files it touched
+// during its first few seconds into a profile inside the prefix. Later launches read that profile before jumping into dyld,
+// start reading all of those ranges in at once (POSIX_FADV_WILLNEED) and pre-fault the ones that fall into
+// the segments mldr has mapped itself (MADV_POPULATE_READ).
+//
+// A profile is recorded again if any of its files has changed, or if DARLING_PREFETCH=record.
+
+#ifndef PAGE_SIZE
+#	define PAGE_SIZE	4096
+#endif
+
+#ifndef MADV_POPULATE_READ
+#	define MADV_POPULATE_READ 22
+#endif
+
+#define PROFILE_DIR "/private/var/db/mldr"
+#define PROFILE_HEADER "mldr-prefetch 1\n"
+
+#define MAX_FILES 256
+#define MAX_RANGES 16384
+
+// touched pages that are at most this far apart are read in together
+#define RANGE_GAP_PAGES 8
+
+// the recorder takes its first snapshot this long after startup, then keeps doubling the delay until it's past the window.
+// every snapshot rewrites the profile, so short-lived processes still leave one behind.
+#define RECORD_FIRST_DELAY_MS 25
+#define RECORD_WINDOW_MS 3200
+
+#define PAGEMAP_PRESENT (1ull << 63)
+#define PAGEMAP_SWAPPED (1ull << 62)
+
+struct profile_file {
+	const char* path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int fd;
+};
+
+struct profile_range {
+	uint32_t file;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct mapping {
+	uintptr_t start;
+	uintptr_t end;
+	uint64_t offset;
+	const char* path;
+};
+
+typedef void (*mapping_callback_t)(const struct mapping* mapping);
+
+// the recorder runs alongside Darwin code, which may fork() at any point without going through glibc;
+// so everything it uses is static, rather than allocated
+static struct profile_file files[MAX_FILES];
+static uint32_t file_count = 0;
+static struct profile_range ranges[MAX_RANGES];
+static uint32_t range_count = 0;
+
+static char path_pool[64 * 1024];
+static size_t path_pool_used = 0;
+
+static char maps_buffer[16 * 1024];
+static char profile_buffer[256 * 1024];
+static uint64_t pagemap_buffer[512];
+static int pagemap_fd = -1;
+
+static char profile_path[PATH_MAX];
+
+static int open_high(const char* path, int flags, mode_t mode) {
+	int fd = open(path, flags | O_CLOEXEC, mode);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	return mldr_move_fd_high(fd);
+};
+
+static void reset_profile(void) {
+	file_count = 0;
+	range_count = 0;
+	path_pool_used = 0;
+};
+
+static int find_file(const char* path) {
+	for (uint32_t i = 0; i < file_count; ++i) {
+		if (strcmp(files[i].path, path) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+};
+
+static int add_file(const char* path, const struct stat* st) {
+	size_t length = strlen(path) + 1;
+	struct profile_file* file;
+
+	if (file_count == MAX_FILES || path_pool_used + length > sizeof(path_pool)) {
+		return -1;
+	}
+
+	file = &files[file_count];
+	file->path = memcpy(&path_pool[path_pool_used], path, length);
+	file->dev = st->st_dev;
+	file->ino = st->st_ino;
+	file->size = st->st_size;
+	file->mtime = st->st_mtim;
+	file->fd = -1;
+	path_pool_used += length;
+
+	return file_count++;
+};
+
+static void add_page(uint32_t file, uint32_t page) {
+	struct profile_range* last = (range_count > 0) ? &ranges[range_count - 1] : NULL;
+
+	if (last && last->file == file && page >= last->first && page <= last->first + last->count + RANGE_GAP_PAGES) {
+		if (page >= last->first + last->count) {
+			last->count = page - last->first + 1;
+		}
+		return;
+	}
+
+	if (range_count == MAX_RANGES) {
+		return;
+	}
+
+	ranges[range_count++] = (struct profile_range) {
+		.file = file,
+		.first = page,
+		.count = 1,
+	};
+};
+
+static void parse_mapping_line(char* line, mapping_callback_t callback) {
+	unsigned long start, end;
+	unsigned long long offset;
+	unsigned long inode;
+	int path_start = 0;
+	size_t length;
+	struct mapping mapping;
+
+	if (sscanf(line, "%lx-%lx %*s %llx %*x:%*x %lu %n", &start, &end, &offset, &inode, &path_start) < 4 || path_start == 0) {
+		return;
+	}
+
+	// anonymous memory, [stack], [vdso] and the like
+	if (inode == 0 || line[path_start] != '/') {
+		return;
+	}
+
+	length = strlen(&line[path_start]);
+	if (length > sizeof(" (deleted)") - 1 && strcmp(&line[path_start + length - (sizeof(" (deleted)") - 1)], " (deleted)") == 0) {
+		return;
+	}
+
+	mapping.start = start;
+	mapping.end = end;
+	mapping.offset = offset;
+	mapping.path = &line[path_start];
+
+	callback(&mapping);
+};
+
+static void for_each_file_mapping(mapping_callback_t callback) {
+	int fd = open_high("/proc/self/maps", O_RDONLY, 0);
+	size_t used = 0;
+
+	if (fd < 0) {
+		return;
+	}
+
+	while (true) {
+		ssize_t count = read(fd, &maps_buffer[used], sizeof(maps_buffer) - 1 - used);
+		char* line = maps_buffer;
+		char* newline;
+
+		if (count <= 0) {
+			break;
+		}
+
+		used += count;
+
+		while ((newline = memchr(line, '\n', &maps_buffer[used] - line)) != NULL) {
+			*newline = '\0';
+			parse_mapping_line(line, callback);
+			line = newline + 1;
+		}
+
+		// keep the incomplete line around for the next read
+		used = &maps_buffer[used] - line;
+		memmove(maps_buffer, line, used);
+
+		if (used == sizeof(maps_buffer) - 1) {
+			// a single line that doesn't fit in the buffer; skip it
+			used = 0;
+		}
+	}
+
+	mldr_close_high_fd(fd);
+};
+
+//
+// recording
+//
+
+static void record_mapping(const struct mapping* mapping) {
+	int file = find_file(mapping->path);
+
+	if (file < 0) {
+		struct stat st;
+
+		if (stat(mapping->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			return;
+		}
+
+		file = add_file(mapping->path, &st);
+		if (file < 0) {
+			return;
+		}
+	}
+
+	for (uintptr_t address = mapping->start; address < mapping->end; ) {
+		size_t pages = (mapping->end - address) / PAGE_SIZE;
+		ssize_t count;
+
+		if (pages > sizeof(pagemap_buffer) / sizeof(pagemap_buffer[0])) {
+			pages = sizeof(pagemap_buffer) / sizeof(pagemap_buffer[0]);
+		}
+
+		count = pread(pagemap_fd, pagemap_buffer, pages * sizeof(uint64_t), (off_t)(address / PAGE_SIZE) * sizeof(uint64_t));
+		if (count <= 0) {
+			break;
+		}
+		pages = count / sizeof(uint64_t);
+
+		for (size_t i = 0; i < pages; ++i) {
+			// a page that's mapped in (or was, before being swapped out) is one we touched;
+			// for private mappings, that includes the ones we've copied on write, which still had to be read in first
+			if (pagemap_buffer[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) {
+				add_page(file, mapping->offset / PAGE_SIZE + (address - mapping->start) / PAGE_SIZE + i);
+			}
+		}
+
+		address += pages * PAGE_SIZE;
+	}
+};
+
+static size_t format_profile(void) {
+	size_t used = 0;
+	int count;
+
+	count = snprintf(profile_buffer, sizeof(profile_buffer), "%s", PROFILE_HEADER);
+	used += count;
+
+	for (uint32_t i = 0; i < file_count; ++i) {
+		const struct profile_file* file = &files[i];
+
+		count = snprintf(&profile_buffer[used], sizeof(profile_buffer) - used, "f %llu %llu %lld %lld %ld %s\n",
+			(unsigned long long) file->dev, (unsigned long long) file->ino, (long long) file->size,
+			(long long) file->mtime.tv_sec, (long) file->mtime.tv_nsec, file->path);
+		if (count < 0 || (size_t) count >= sizeof(profile_buffer) - used) {
+			return used;
+		}
+		used += count;
+
+		// ranges are added in the order the file's mappings appear in, so they're already (mostly) sorted
+		for (uint32_t j = 0; j < range_count; ++j) {
+			if (ranges[j].file != i) {
+				continue;
+			}
+
+			count = snprintf(&profile_buffer[used], sizeof(profile_buffer) - used, "r %u %u\n", ranges[j].first, ranges[j].count);
+			if (count < 0 || (size_t) count >= sizeof(profile_buffer) - used) {
+				return used;
+			}
+			used += count;
+		}
+	}
+
+	return used;
+};
+
+static void write_profile(void) {
+	char temp_path[PATH_MAX + 32];
+	size_t length = format_profile();
+	size_t written = 0;
+	int fd;
+
+	snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", profile_path, getpid());
+
+	fd = open_high(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return;
+	}
+
+	while (written < length) {
+		ssize_t count = write(fd, &profile_buffer[written], length - written);
+		if (count <= 0) {
+			break;
+		}
+		written += count;
+	}
+
+	mldr_close_high_fd(fd);
+
+	if (written == length) {
+		rename(temp_path, profile_path);
+	} else {
+		unlink(temp_path);
+	}
+};
+
+static void take_snapshot(void) {
+	pagemap_fd = open_high("/proc/self/pagemap", O_RDONLY, 0);
+	if (pagemap_fd < 0) {
+		return;
+	}
+
+	reset_profile();
+	for_each_file_mapping(record_mapping);
+
+	mldr_close_high_fd(pagemap_fd);
+	pagemap_fd = -1;
+
+	write_profile();
+};
+
+static void* recorder_thread(void* context) {
+	unsigned int elapsed = 0;
+
+	for (unsigned int delay = RECORD_FIRST_DELAY_MS; elapsed < RECORD_WINDOW_MS; delay *= 2) {
+		struct timespec duration = {
+			.tv_sec = delay / 1000,
+			.tv_nsec = (delay % 1000) * 1000000L,
+		};
+
+		while (nanosleep(&duration, &duration) != 0 && errno == EINTR);
+
+		elapsed += delay;
+		take_snapshot();
+	}
+
+	return NULL;
+};
+
+static void start_recorder(void) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all_signals;
+	sigset_t old_mask;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+
+	// like the RPC socket pool thread, this thread never runs Darwin code, so it must never get Darwin signals
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+	// if this fails, we just don't get a profile this time
+	pthread_create(&thread, &attr, recorder_thread, NULL);
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	pthread_attr_destroy(&attr);
+};
+
+//
+// replaying
+//
+
+static void populate_mapping(const struct mapping* mapping) {
+	int file = find_file(mapping->path);
+	uint64_t first_page = mapping->offset / PAGE_SIZE;
+	uint64_t end_page = first_page + (mapping->end - mapping->start) / PAGE_SIZE;
+
+	if (file < 0 || files[file].fd < 0) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < range_count; ++i) {
+		const struct profile_range* range = &ranges[i];
+		uint64_t start, end;
+
+		if (range->file != (uint32_t) file) {
+			continue;
+		}
+
+		start = (range->first > first_page) ? range->first : first_page;
+		end = (range->first + range->count < end_page) ? range->first + range->count : end_page;
+
+		if (start < end) {
+			// not supported before Linux 5.14, in which case the pages will just be faulted in as usual (but without waiting on the disk)
+			madvise((void*)(mapping->start + (start - first_page) * PAGE_SIZE), (end - start) * PAGE_SIZE, MADV_POPULATE_READ);
+		}
+	}
+};
+
+// returns false if there's no usable profile, i.e. if we should record one
+static bool replay_profile(void) {
+	int fd = open_high(profile_path, O_RDONLY, 0);
+	size_t length = 0;
+	bool stale = false;
+	int current = -1;
+	char* line;
+	char* newline;
+
+	if (fd < 0) {
+		return false;
+	}
+
+	while (length < sizeof(profile_buffer) - 1) {
+		ssize_t count = read(fd, &profile_buffer[length], sizeof(profile_buffer) - 1 - length);
+		if (count <= 0) {
+			break;
+		}
+		length += count;
+	}
+	profile_buffer[length] = '\0';
+
+	mldr_close_high_fd(fd);
+
+	if (strncmp(profile_buffer, PROFILE_HEADER, sizeof(PROFILE_HEADER) - 1) != 0) {
+		return false;
+	}
+
+	reset_profile();
+
+	for (line = &profile_buffer[sizeof(PROFILE_HEADER) - 1]; (newline = strchr(line, '\n')) != NULL; line = newline + 1) {
+		*newline = '\0';
+
+		if (line[0] == 'f') {
+			unsigned long long dev, ino;
+			long long size, mtime_sec;
+			long mtime_nsec;
+			int path_start = 0;
+			struct stat st;
+
+			current = -1;
+
+			if (sscanf(line, "f %llu %llu %lld %lld %ld %n", &dev, &ino, &size, &mtime_sec, &mtime_nsec, &path_start) < 5 || path_start == 0) {
+				continue;
+			}
+
+			if (stat(&line[path_start], &st) != 0 || st.st_dev != dev || st.st_ino != ino || st.st_size != size
+				|| st.st_mtim.tv_sec != mtime_sec || st.st_mtim.tv_nsec != mtime_nsec)
+			{
+				// the file has changed (or is gone); the rest of the profile is still good for this launch, though
+				stale = true;
+				continue;
+			}
+
+			current = add_file(&line[path_start], &st);
+			if (current >= 0) {
+				files[current].fd = open_high(&line[path_start], O_RDONLY, 0);
+			}
+		} else if (line[0] == 'r' && current >= 0 && files[current].fd >= 0) {
+			unsigned int first, count;
+
+			if (sscanf(line, "r %u %u", &first, &count) != 2) {
+				continue;
+			}
+
+			// start reading everything in right away; this doesn't wait for the reads to complete
+			posix_fadvise(files[current].fd, (off_t) first * PAGE_SIZE, (off_t) count * PAGE_SIZE, POSIX_FADV_WILLNEED);
+
+			if (range_count < MAX_RANGES) {
+				ranges[range_count++] = (struct profile_range) {
+					.file = current,
+					.first = first,
+					.count = count,
+				};
+			}
+		}
+	}
+
+	// dyld and the main executable have already been mapped (by us), so we can fault their pages in ahead of time, too.
+	// the rest is mapped by dyld later on, and will be in the page cache by then.
+	for_each_file_mapping(populate_mapping);
+
+	for (uint32_t i = 0; i < file_count; ++i) {
+		if (files[i].fd >= 0) {
+			mldr_close_high_fd(files[i].fd);
+			files[i].fd = -1;
+		}
+	}
+
+	return !stale;
+};
+
+static bool create_profile_dir(const char* root_path, size_t root_path_length) {
+	char path[PATH_MAX];
+	const char* component = PROFILE_DIR;
+
+	if (root_path_length + sizeof(PROFILE_DIR) > sizeof(path)) {
+		return false;
+	}
+
+	memcpy(path, root_path, root_path_length);
+
+	// create each component in turn; most of them already exist
+	while (*component != '\0') {
+		const char* next = strchr(component + 1, '/');
+		size_t length = next ? (size_t)(next - PROFILE_DIR) : sizeof(PROFILE_DIR) - 1;
+
+		memcpy(&path[root_path_length], PROFILE_DIR, length);
+		path[root_path_length + length] = '\0';
+
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			return false;
+		}
+
+		component = next ? next : "";
+	}
+
+	return true;
+};
+
+void prefetch_setup(const char* filename, const struct load_results* lr) {
+	const char* mode = getenv("DARLING_PREFETCH");
+	uint64_t hash = 0xcbf29ce484222325ull;
+	bool record;
+
+	if (mode == NULL || mode[0] == '\0' || strcmp(mode, "0") == 0) {
+		return;
+	}
+
+	// profiles live inside the prefix
+	if (lr->root_path == NULL) {
+		return;
+	}
+
+	// profiles are per-binary: FNV-1a over the path and the UUID, so that rebuilt binaries get new profiles
+	for (const char* ptr = filename; *ptr != '\0'; ++ptr) {
+		hash = (hash ^ (uint8_t) *ptr) * 0x100000001b3ull;
+	}
+	for (size_t i = 0; i < sizeof(lr->uuid); ++i) {
+		hash = (hash ^ lr->uuid[i]) * 0x100000001b3ull;
+	}
+
+	if (snprintf(profile_path, sizeof(profile_path), "%.*s" PROFILE_DIR "/%016llx.profile", (int) lr->root_path_length, lr->root_path, (unsigned long long) hash) >= (int) sizeof(profile_path)) {
+		return;
+	}
+
+	record = strcmp(mode, "record") == 0;
+
+	if (!record) {
+		record = !replay_profile();
+	}
+
+	if (record && create_profile_dir(lr->root_path, lr->root_path_length)) {
+		start_recorder();
+	}
+};
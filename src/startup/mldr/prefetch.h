@@ -0,0 +1,15 @@
+#ifndef _MLDR_PREFETCH_H_
+#define _MLDR_PREFETCH_H_
+
+#include "loader.h"
+
+// startup prefetch profiles (see prefetch.c)
+//
+// must be called after the main executable and dyld have been mapped, but before jumping into dyld
+void prefetch_setup(const char* filename, const struct load_results* lr);
+
+// provided by mldr.c: moves a descriptor up to where the RPC sockets live, away from the numbers Darwin code gets
+int mldr_move_fd_high(int fd);
+void mldr_close_high_fd(int fd);
+
+#endif // _MLDR_PREFETCH_H_
@@ -0,0 +1,340 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <mach/message.h>
+#include <mach/mach_time.h>
+#include <darling/emulation/simple.h>
+#include <darling/emulation/ext/for-xtrace.h>
+
+#include "binary.h"
+#include "xtracelib.h"
+#include "bsd_trace.h"
+#include "mach_trace.h"
+#include "mig_trace.h"
+#include "tls.h"
+
+extern int sys_thread_selfid(void);
+
+#define MAX_DEPTH 64
+#define RING_SIZE (sizeof(struct xtrace_binary_header) + XTRACE_BINARY_RECORDS * sizeof(struct xtrace_binary_record))
+
+_Static_assert(sizeof(struct xtrace_binary_header) == 64, "binary trace header layout changed");
+_Static_assert(sizeof(struct xtrace_binary_record) == 88, "binary trace record layout changed");
+
+int xtrace_binary = 0;
+
+static char xtrace_binary_base[PATH_MAX] = {0};
+
+struct binary_thread {
+	struct xtrace_binary_header* header;
+	struct xtrace_binary_record* records;
+	// sequence numbers of the records for the calls we're currently inside of, indexed by depth
+	uint64_t seqs[MAX_DEPTH];
+	// sequence number of the last record written
+	uint64_t last;
+};
+
+static void binary_thread_destroy(struct binary_thread* thread) {
+	if (thread && thread->header) {
+		_munmap_for_xtrace(thread->header, RING_SIZE);
+		thread->header = NULL;
+		thread->records = NULL;
+	}
+};
+
+DEFINE_XTRACE_TLS_VAR(struct binary_thread, binary_thread, (struct binary_thread) {0}, binary_thread_destroy);
+
+void xtrace_binary_setup(const char* path_base) {
+	if (path_base == NULL || path_base[0] == '\0') {
+		return;
+	}
+
+	strlcpy(xtrace_binary_base, path_base, sizeof(xtrace_binary_base));
+	xtrace_binary = 1;
+};
+
+const char* xtrace_binary_path_base(void) {
+	return xtrace_binary ? xtrace_binary_base : "";
+};
+
+static void binary_open(struct binary_thread* thread) {
+	char filename[PATH_MAX];
+	char append[32] = {0};
+	int tid = sys_thread_selfid();
+	int fd;
+	void* map;
+
+	strlcpy(filename, xtrace_binary_base, sizeof(filename));
+	__simple_snprintf(append, sizeof(append), ".%d", tid);
+	strlcat(filename, append, sizeof(filename));
+
+	// no O_TRUNC: a thread may come back here after its TLS has been cleaned up (it still makes a few calls on its way out),
+	// in which case it should keep appending to the ring it already has
+	fd = _open_for_xtrace(filename, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		xtrace_abort("xtrace: failed to open binary trace file");
+	}
+
+	if (_ftruncate_for_xtrace(fd, RING_SIZE) < 0) {
+		xtrace_abort("xtrace: failed to resize binary trace file");
+	}
+
+	map = _mmap_for_xtrace(NULL, RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	_close_for_xtrace(fd);
+
+	if ((unsigned long)map > (unsigned long)-4096) {
+		xtrace_abort("xtrace: failed to map binary trace file");
+	}
+
+	thread->header = map;
+	thread->records = (struct xtrace_binary_record*)(thread->header + 1);
+
+	if (memcmp(thread->header->magic, XTRACE_BINARY_MAGIC, sizeof(XTRACE_BINARY_MAGIC)) == 0
+		&& thread->header->version == XTRACE_BINARY_VERSION
+		&& thread->header->pid == _getpid_for_xtrace()
+		&& thread->header->tid == tid)
+	{
+		return;
+	}
+
+	// a stale file from an earlier run; start over
+	memset(thread->header, 0, sizeof(*thread->header));
+	thread->header->version = XTRACE_BINARY_VERSION;
+	thread->header->record_size = sizeof(struct xtrace_binary_record);
+	thread->header->capacity = XTRACE_BINARY_RECORDS;
+	thread->header->start_time = mach_absolute_time();
+	thread->header->pid = _getpid_for_xtrace();
+	thread->header->tid = tid;
+	__atomic_store_n(&thread->header->written, 0, __ATOMIC_RELEASE);
+	memcpy(thread->header->magic, XTRACE_BINARY_MAGIC, sizeof(XTRACE_BINARY_MAGIC));
+};
+
+void xtrace_binary_entry(int type, int nr, void* args[], int depth) {
+	struct binary_thread* thread = get_ptr_binary_thread();
+	struct xtrace_binary_record* record;
+	uint64_t seq;
+
+	if (thread->header == NULL) {
+		binary_open(thread);
+	}
+
+	uint64_t now = mach_absolute_time();
+
+	seq = thread->header->written;
+	record = &thread->records[seq % XTRACE_BINARY_RECORDS];
+
+	record->timestamp = now;
+	record->duration = 0;
+	for (int i = 0; i < 6; i++) {
+		record->args[i] = (uintptr_t)args[i];
+	}
+	record->retval = 0;
+	record->mig_id = 0;
+	record->nr = nr;
+	record->type = type;
+	record->depth = depth;
+	record->flags = 0;
+
+	if (depth >= 0 && depth < MAX_DEPTH) {
+		thread->seqs[depth] = seq;
+	}
+	thread->last = seq;
+
+	__atomic_store_n(&thread->header->written, seq + 1, __ATOMIC_RELEASE);
+};
+
+void xtrace_binary_exit(int depth, uintptr_t retval) {
+	uint64_t now = mach_absolute_time();
+	struct binary_thread* thread = get_ptr_binary_thread();
+	struct xtrace_binary_record* record;
+	uint64_t seq;
+
+	// the entry might have been recorded into a ring we no longer have (e.g. fork() returning in the child)
+	if (thread->header == NULL || depth < 0 || depth >= MAX_DEPTH) {
+		return;
+	}
+
+	seq = thread->seqs[depth];
+
+	// the record has already been overwritten
+	if (thread->header->written - seq > XTRACE_BINARY_RECORDS) {
+		return;
+	}
+
+	record = &thread->records[seq % XTRACE_BINARY_RECORDS];
+
+	// we never saw the exit of the call that was here (e.g. a signal handler that longjmp'd out of it)
+	if (record->depth != depth || (record->flags & XTRACE_BINARY_COMPLETE)) {
+		return;
+	}
+
+	record->retval = retval;
+	record->duration = now - record->timestamp;
+	record->flags |= XTRACE_BINARY_COMPLETE;
+};
+
+void xtrace_binary_note_mig(int32_t msgh_id) {
+	struct binary_thread* thread = get_ptr_binary_thread();
+
+	if (thread->header == NULL) {
+		return;
+	}
+
+	thread->records[thread->last % XTRACE_BINARY_RECORDS].mig_id = msgh_id;
+};
+
+void xtrace_binary_postfork_child(void) {
+	// the mapping is shared with the parent; the child gets its own ring on its next call
+	struct binary_thread* thread = get_ptr_binary_thread();
+
+	binary_thread_destroy(thread);
+	*thread = (struct binary_thread) {0};
+};
+
+//
+// decoding
+//
+// this runs in a process that's only there to decode the file (see `xtrace --decode`), before any tracing is set up;
+// so we're free to use libSystem here
+//
+
+// prints `ns` in the given unit (in nanoseconds) with three decimals; __simple_printf can't pad numbers
+static void print_scaled(uint64_t ns, uint64_t unit) {
+	uint64_t frac = (ns % unit) * 1000 / unit;
+
+	xtrace_log("%llu.", (unsigned long long)(ns / unit));
+	if (frac < 100)
+		xtrace_log("0");
+	if (frac < 10)
+		xtrace_log("0");
+	xtrace_log("%llu", (unsigned long long)frac);
+};
+
+static void print_record(const struct xtrace_binary_header* header, const struct xtrace_binary_record* record) {
+	void* args[6];
+
+	for (int i = 0; i < 6; i++) {
+		args[i] = (void*)(uintptr_t)record->args[i];
+	}
+
+	xtrace_set_gray_color();
+	xtrace_log("[%d] ", header->tid);
+	print_scaled(record->timestamp - header->start_time, 1000000);
+	for (int i = 0; i < 4 * record->depth + 1; i++)
+		xtrace_log(" ");
+	xtrace_reset_color();
+
+	switch (record->type) {
+		case XTRACE_CALL_BSD:
+			xtrace_bsd_print_call_offline(record->nr, args);
+			break;
+		case XTRACE_CALL_MACH:
+			xtrace_mach_print_call_offline(record->nr, args);
+			break;
+		default:
+			xtrace_log("unknown call type %d, call %d(...)", record->type, record->nr);
+			break;
+	}
+
+	if (record->mig_id != 0) {
+		xtrace_log(" [");
+		if (!xtrace_print_mig_name(record->mig_id))
+			xtrace_log("msgh_id %d", record->mig_id);
+		xtrace_log("]");
+	}
+
+	xtrace_set_gray_color();
+	xtrace_log(" -> ");
+	xtrace_reset_color();
+
+	if (!(record->flags & XTRACE_BINARY_COMPLETE)) {
+		xtrace_log("?\n");
+		return;
+	}
+
+	switch (record->type) {
+		case XTRACE_CALL_BSD:
+			xtrace_bsd_print_retval_offline(record->nr, record->retval);
+			break;
+		case XTRACE_CALL_MACH:
+			xtrace_mach_print_retval_offline(record->nr, record->retval);
+			break;
+		default:
+			xtrace_log("0x%llx", (unsigned long long)record->retval);
+			break;
+	}
+
+	xtrace_set_gray_color();
+	xtrace_log(" (");
+	print_scaled(record->duration, 1000);
+	xtrace_log(" us)\n");
+	xtrace_reset_color();
+};
+
+int xtrace_binary_decode(const char* path) {
+	struct stat st;
+	const struct xtrace_binary_header* header;
+	const struct xtrace_binary_record* records;
+	uint64_t written;
+	uint64_t count;
+	int fd;
+	void* map;
+	int ret = -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		xtrace_error("xtrace: failed to open %s\n", path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		xtrace_error("xtrace: %s is not a binary trace\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		xtrace_error("xtrace: failed to map %s\n", path);
+		return -1;
+	}
+
+	header = map;
+	records = (const struct xtrace_binary_record*)(header + 1);
+
+	if (memcmp(header->magic, XTRACE_BINARY_MAGIC, sizeof(XTRACE_BINARY_MAGIC)) != 0
+		|| header->version != XTRACE_BINARY_VERSION
+		|| header->record_size != sizeof(struct xtrace_binary_record)
+		|| header->capacity == 0
+		|| (uint64_t)st.st_size < sizeof(*header) + header->capacity * sizeof(struct xtrace_binary_record))
+	{
+		xtrace_error("xtrace: %s is not a binary trace (or was written by a different version of xtrace)\n", path);
+		goto out;
+	}
+
+	written = header->written;
+	count = written < header->capacity ? written : header->capacity;
+
+	if (written > count) {
+		xtrace_set_gray_color();
+		xtrace_log("[%d] (%llu earlier calls were overwritten)\n", header->tid, (unsigned long long)(written - count));
+		xtrace_reset_color();
+	}
+
+	for (uint64_t seq = written - count; seq < written; seq++) {
+		print_record(header, &records[seq % header->capacity]);
+	}
+
+	ret = 0;
+
+out:
+	munmap(map, st.st_size);
+	return ret;
+};
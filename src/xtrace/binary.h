@@ -0,0 +1,70 @@
+#ifndef _XTRACE_BINARY_H_
+#define _XTRACE_BINARY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "base.h"
+#include "xtracelib.h"
+
+// binary trace format
+//
+// instead of formatting every call as it happens, each thread appends fixed-size records to its own
+// ring file ("${XTRACE_BINARY}.${THREAD_ID}"), which is mmap'd and never written to with syscalls.
+// the records are turned into the usual text output later on by `xtrace --decode`, which reuses the normal formatters.
+
+XTRACE_DECLARATIONS_BEGIN;
+
+#define XTRACE_BINARY_MAGIC "XTRACEB"
+#define XTRACE_BINARY_VERSION 1
+
+// number of records in each thread's ring; when it's full, the oldest records get overwritten
+#define XTRACE_BINARY_RECORDS (64 * 1024)
+
+// the record has been completed by the call's exit
+#define XTRACE_BINARY_COMPLETE 0x1
+
+struct xtrace_binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;
+	// total number of records written so far; the next one goes into `written % capacity`
+	uint64_t written;
+	// mach_absolute_time() when the file was created
+	uint64_t start_time;
+	int32_t pid;
+	int32_t tid;
+	uint8_t reserved[16];
+};
+
+struct xtrace_binary_record {
+	uint64_t timestamp;
+	uint64_t duration;
+	uint64_t args[6];
+	uint64_t retval;
+	// msgh_id of the message sent by mach_msg (if any)
+	int32_t mig_id;
+	uint16_t nr;
+	uint8_t type;
+	uint8_t depth;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+extern int xtrace_binary;
+
+void xtrace_binary_setup(const char* path_base);
+const char* xtrace_binary_path_base(void);
+
+void xtrace_binary_entry(int type, int nr, void* args[], int depth);
+void xtrace_binary_exit(int depth, uintptr_t retval);
+void xtrace_binary_note_mig(int32_t msgh_id);
+
+void xtrace_binary_postfork_child(void);
+
+// prints the contents of the given ring file as text; returns 0 on success and -1 on failure
+int xtrace_binary_decode(const char* path);
+
+XTRACE_DECLARATIONS_END;
+
+#endif // _XTRACE_BINARY_H_
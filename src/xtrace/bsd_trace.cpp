@@ -11,6 +11,10 @@
 
 #include "xtracelib.h"
 #include "bsd_trace.h"
+#include "mig_trace.h"
+#include "control.h"
+#include "filter.h"
+#include "summary.h"
 #include "tls.h"
 
 static void print_errno(int nr, uintptr_t rv);
@@ -1057,9 +1061,20 @@ static void print_args(int nr, void* args[])
 extern "C"
 void darling_bsd_syscall_entry_print(int nr, void* args[])
 {
+	if (xtrace_mig_loading())
+		return;
+
+	xtrace_control_sync_thread();
+
+	if (nr == 1 && xtrace_summary)
+		xtrace_summary_process_exit();
+
+	if (!xtrace_filter_enter(XTRACE_CALL_BSD, nr))
+		return;
+
 	handle_generic_entry(bsd_defs, "bsd", nr, args);
 
-	if (nr == 1 || nr == 59)
+	if ((nr == 1 || nr == 59) && !xtrace_recording())
 	{
 		// For exit() or execve(), print an extra newline,
 		// as we're likely not going to see the return.
@@ -1070,9 +1085,80 @@ void darling_bsd_syscall_entry_print(int nr, void* args[])
 extern "C"
 void darling_bsd_syscall_exit_print(uintptr_t retval)
 {
+	if (xtrace_mig_loading())
+		return;
+
+	xtrace_control_sync_thread();
+
+	if (!xtrace_filter_exit())
+		return;
+
 	handle_generic_exit(bsd_defs, "bsd", retval, 0);
 }
 
+extern "C"
+const char* xtrace_bsd_call_name(int nr)
+{
+	if (nr < 0 || nr >= sizeof(bsd_defs) / sizeof(bsd_defs[0]))
+		return NULL;
+	return bsd_defs[nr].name;
+}
+
+// When decoding a binary trace, the traced process's memory is gone;
+// anything we'd have to read from it is printed as a plain pointer instead.
+
+extern "C"
+void xtrace_bsd_print_call_offline(int nr, void* args[])
+{
+	if (nr < 0 || nr >= sizeof(bsd_defs) / sizeof(bsd_defs[0]) || bsd_defs[nr].name == NULL)
+	{
+		xtrace_log("bsd %d(...)", nr);
+		return;
+	}
+
+	xtrace_log("%s(", bsd_defs[nr].name);
+
+	if (bsd_defs[nr].print_args != print_args)
+		xtrace_log("...");
+	else if (nr < sizeof(args_info) / sizeof(args_info[0]))
+	{
+		for (int i = 0; i < args_info[nr].args_cnt; i++)
+		{
+			void (*print_arg)(void* arg) = args_info[nr].print_arg[i];
+
+			if (print_arg == print_arg_str || print_arg == print_arg_string_array || print_arg == print_arg_posix_spawn_args)
+				print_arg = print_arg_ptr;
+
+			if (i > 0)
+				xtrace_log(", ");
+			print_arg(args[i]);
+		}
+	}
+
+	xtrace_log(")");
+}
+
+extern "C"
+void xtrace_bsd_print_retval_offline(int nr, uintptr_t rv)
+{
+	void (*print_retval)(int nr, uintptr_t rv) = NULL;
+
+	if (nr >= 0 && nr < sizeof(bsd_defs) / sizeof(bsd_defs[0]))
+		print_retval = bsd_defs[nr].print_retval;
+
+	// these print the results stored by their argument printers
+	if (print_retval == print_kevent_return || print_retval == print_kevent64_return
+		|| print_retval == print_kevent_qos_return || print_retval == print_select_return)
+	{
+		print_retval = print_errno_num;
+	}
+
+	if (print_retval != NULL)
+		print_retval(nr, rv);
+	else
+		xtrace_log("0x%lx", rv);
+}
+
 const char* error_strings[128] = {
 	[1] = "EPERM",
 	[2] = "ENOENT",
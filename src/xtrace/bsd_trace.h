@@ -4,6 +4,12 @@ extern "C" {
 
 extern void xtrace_print_string_literal(const char* str);
 
+const char* xtrace_bsd_call_name(int nr);
+
+// used to decode binary traces, where only the raw values of arguments are available
+void xtrace_bsd_print_call_offline(int nr, void* args[]);
+void xtrace_bsd_print_retval_offline(int nr, uintptr_t rv);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <darling/emulation/simple.h>
+#include <darling/emulation/ext/for-xtrace.h>
+
+#include "control.h"
+#include "xtracelib.h"
+#include "filter.h"
+#include "tls.h"
+
+int xtrace_dormant = 0;
+uint32_t xtrace_control_generation = 0;
+
+static int control_signal = 0;
+static bool control_file_given = false;
+static char control_file[PATH_MAX] = {0};
+// where the default control file goes; empty if there's no safe place for it (then the signal just toggles tracing)
+static char control_dir[PATH_MAX] = {0};
+static uid_t control_uid = 0;
+
+DEFINE_XTRACE_TLS_VAR(uint32_t, thread_generation, 0, NULL);
+
+static void set_default_control_file(void) {
+	if (control_dir[0] == '\0') {
+		control_file[0] = '\0';
+		return;
+	}
+
+	__simple_snprintf(control_file, sizeof(control_file), "%s/xtrace-control.%ld", control_dir, _getpid_for_xtrace());
+};
+
+// the default control file lives in a directory only we can get to, so nobody else can plant one (or a symlink) for us.
+// that's $XDG_RUNTIME_DIR, or ${TMPDIR:-/tmp}/xtrace-<uid> (the same one `xtrace --control` uses)
+static void setup_control_dir(void) {
+	const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+	const char* tmp_dir = getenv("TMPDIR");
+	struct stat st;
+
+	if (runtime_dir != NULL && runtime_dir[0] != '\0') {
+		strlcpy(control_dir, runtime_dir, sizeof(control_dir));
+	} else {
+		__simple_snprintf(control_dir, sizeof(control_dir), "%s/xtrace-%u", (tmp_dir != NULL && tmp_dir[0] != '\0') ? tmp_dir : "/tmp", (unsigned int)control_uid);
+		if (mkdir(control_dir, 0700) != 0 && errno != EEXIST) {
+			control_dir[0] = '\0';
+			return;
+		}
+	}
+
+	// this runs before tracing is enabled, so we can use libSystem
+	if (lstat(control_dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != control_uid || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+		xtrace_error("xtrace: %s isn't a private directory; XTRACE_CONTROL_SIGNAL will only toggle tracing\n", control_dir);
+		control_dir[0] = '\0';
+	}
+};
+
+static void control_start(void) {
+	if (!__atomic_load_n(&xtrace_dormant, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	// every thread forgets about the calls it was in when it last saw tracing running
+	__atomic_add_fetch(&xtrace_control_generation, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&xtrace_dormant, 0, __ATOMIC_RELEASE);
+};
+
+static void control_stop(void) {
+	__atomic_store_n(&xtrace_dormant, 1, __ATOMIC_RELEASE);
+};
+
+// this runs while tracing may be running, so only the *_for_xtrace calls may be used
+static void control_signal_handler(int signum) {
+	char command[16] = {0};
+	struct stat64 st;
+	long length;
+	int fd = -1;
+
+	// no symlinks, and no FIFOs to block on
+	if (control_file[0] != '\0') {
+		fd = _open_for_xtrace(control_file, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK, 0);
+	}
+	if (fd < 0) {
+		if (__atomic_load_n(&xtrace_dormant, __ATOMIC_RELAXED)) {
+			control_start();
+		} else {
+			control_stop();
+		}
+		return;
+	}
+
+	// only take commands from ourselves
+	if (_fstat64_for_xtrace(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != control_uid) {
+		_close_for_xtrace(fd);
+		return;
+	}
+
+	length = _read_for_xtrace(fd, command, sizeof(command) - 1);
+	_close_for_xtrace(fd);
+
+	if (length <= 0) {
+		return;
+	}
+
+	if (strncmp(command, "on", 2) == 0) {
+		control_start();
+	} else if (strncmp(command, "off", 3) == 0) {
+		control_stop();
+	}
+};
+
+void xtrace_control_setup(int dormant, const char* signal, const char* file) {
+	xtrace_dormant = dormant;
+
+	control_signal = 0;
+	for (const char* ptr = signal; ptr && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+		control_signal = control_signal * 10 + (*ptr - '0');
+	}
+
+	if (control_signal > 0 && control_signal < NSIG) {
+		control_uid = getuid();
+
+		if (file != NULL && file[0] != '\0') {
+			control_file_given = true;
+			strlcpy(control_file, file, sizeof(control_file));
+		} else {
+			setup_control_dir();
+			set_default_control_file();
+		}
+
+		// this runs before tracing is enabled, so we can use libSystem
+		struct sigaction action = {0};
+		action.sa_handler = control_signal_handler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(control_signal, &action, NULL);
+	} else {
+		control_signal = 0;
+	}
+};
+
+int xtrace_control_signal(void) {
+	return control_signal;
+};
+
+const char* xtrace_control_file_string(void) {
+	return control_file_given ? control_file : "";
+};
+
+void xtrace_control_postfork_child(void) {
+	if (!control_file_given) {
+		set_default_control_file();
+	}
+};
+
+void xtrace_control_sync_thread_slow(void) {
+	uint32_t generation = __atomic_load_n(&xtrace_control_generation, __ATOMIC_RELAXED);
+
+	if (get_thread_generation() == generation) {
+		return;
+	}
+
+	set_thread_generation(generation);
+	xtrace_reset_nested_calls();
+	xtrace_filter_reset_thread();
+};
@@ -0,0 +1,42 @@
+#ifndef _XTRACE_CONTROL_H_
+#define _XTRACE_CONTROL_H_
+
+#include <stdint.h>
+#include "base.h"
+
+// dormant mode and runtime control
+//
+// with XTRACE_DORMANT, xtrace is loaded and its hooks are installed, but the trampolines return right away (see trampoline.S).
+// when the process receives XTRACE_CONTROL_SIGNAL, xtrace reads the control file and starts ("on") or stops ("off") tracing;
+// without a control file, the signal just toggles it.
+
+XTRACE_DECLARATIONS_BEGIN;
+
+// checked by the trampolines before they do anything else
+extern int xtrace_dormant;
+
+// incremented every time tracing is (re)started
+extern uint32_t xtrace_control_generation;
+
+void xtrace_control_setup(int dormant, const char* signal, const char* file);
+
+int xtrace_control_signal(void);
+// the control file, if it was given explicitly (otherwise it depends on the PID)
+const char* xtrace_control_file_string(void);
+
+void xtrace_control_postfork_child(void);
+
+void xtrace_control_sync_thread_slow(void);
+
+// must be called on every call entry and exit (before anything else looks at the per-thread state),
+// so that the state of calls made while tracing was stopped can be thrown away
+XTRACE_INLINE
+void xtrace_control_sync_thread(void) {
+	if (__atomic_load_n(&xtrace_control_generation, __ATOMIC_RELAXED) != 0) {
+		xtrace_control_sync_thread_slow();
+	}
+};
+
+XTRACE_DECLARATIONS_END;
+
+#endif // _XTRACE_CONTROL_H_
@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mach/message.h>
+#include <mach/mach_time.h>
+#include <darling/emulation/simple.h>
+
+#include "filter.h"
+#include "xtracelib.h"
+#include "bsd_trace.h"
+#include "mach_trace.h"
+#include "tls.h"
+
+// these match the sizes of the call tables in bsd_trace.cpp and mach_trace.cpp
+#define BSD_CALLS 600
+#define MACH_CALLS 128
+
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+
+// whether any filtering or sampling is enabled at all; if not, we don't even look at the per-thread state
+static bool xtrace_filtering = false;
+
+static bool filter_enabled = false;
+static uint64_t bsd_bitmap[BITMAP_WORDS(BSD_CALLS)];
+static uint64_t mach_bitmap[BITMAP_WORDS(MACH_CALLS)];
+
+// trace one in every `sample_every` calls (that pass the filter)
+static uint64_t sample_every = 0;
+// trace at most one call every `sample_interval` nanoseconds
+static uint64_t sample_interval = 0;
+
+// the original option strings, to pass them on to child processes
+static char filter_string[1024] = {0};
+static char sample_string[32] = {0};
+static char sample_us_string[32] = {0};
+
+struct filter_thread {
+	// number of calls we're currently inside of, traced or not
+	int depth;
+	// which of those (by depth) weren't traced
+	uint64_t skipped;
+	// number of calls that passed the filter
+	uint64_t calls;
+	// mach_absolute_time() of the last call that was traced
+	uint64_t last_traced;
+};
+
+DEFINE_XTRACE_TLS_VAR(struct filter_thread, filter_thread, (struct filter_thread) {0}, NULL);
+
+static uint64_t parse_number(const char* string) {
+	uint64_t number = 0;
+
+	for (const char* ptr = string; ptr && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+		number = number * 10 + (*ptr - '0');
+	}
+
+	return number;
+};
+
+// matches `name` against a pattern of `length` characters, which may contain `*` wildcards
+static bool glob_match(const char* pattern, size_t length, const char* name) {
+	if (length == 0) {
+		return *name == '\0';
+	}
+
+	if (*pattern == '*') {
+		for (const char* ptr = name; ; ++ptr) {
+			if (glob_match(pattern + 1, length - 1, ptr)) {
+				return true;
+			}
+			if (*ptr == '\0') {
+				return false;
+			}
+		}
+	}
+
+	return *name == *pattern && glob_match(pattern + 1, length - 1, name + 1);
+};
+
+// Mach traps may also be given by their user-facing names (e.g. `mach_msg` for `mach_msg_trap`,
+// `mach_port_allocate` for `_kernelrpc_mach_port_allocate_trap`)
+static bool name_matches(const char* pattern, size_t length, const char* name) {
+	char stripped[128];
+	size_t name_length;
+
+	if (glob_match(pattern, length, name)) {
+		return true;
+	}
+
+	if (strncmp(name, "_kernelrpc_", sizeof("_kernelrpc_") - 1) == 0) {
+		name += sizeof("_kernelrpc_") - 1;
+	}
+
+	strlcpy(stripped, name, sizeof(stripped));
+	name_length = strlen(stripped);
+	if (name_length > sizeof("_trap") - 1 && strcmp(&stripped[name_length - (sizeof("_trap") - 1)], "_trap") == 0) {
+		stripped[name_length - (sizeof("_trap") - 1)] = '\0';
+	}
+
+	return glob_match(pattern, length, stripped);
+};
+
+static void bitmap_apply(uint64_t* bitmap, int count, const char* (*name_for)(int nr), const char* pattern, size_t length, bool include) {
+	for (int nr = 0; nr < count; ++nr) {
+		const char* name = name_for(nr);
+
+		if (name == NULL || !name_matches(pattern, length, name)) {
+			continue;
+		}
+
+		if (include) {
+			bitmap[nr / 64] |= 1ULL << (nr % 64);
+		} else {
+			bitmap[nr / 64] &= ~(1ULL << (nr % 64));
+		}
+	}
+};
+
+void xtrace_filter_setup(const char* filter, const char* sample, const char* sample_us) {
+	if (filter != NULL && filter[0] != '\0') {
+		const char* ptr = filter;
+		bool first = true;
+
+		strlcpy(filter_string, filter, sizeof(filter_string));
+		filter_enabled = true;
+
+		while (*ptr != '\0') {
+			const char* end = strchr(ptr, ',');
+			size_t length = end ? (size_t)(end - ptr) : strlen(ptr);
+			bool include = true;
+
+			if (*ptr == '!' || *ptr == '-') {
+				include = false;
+				++ptr;
+				--length;
+
+				// a filter that starts by excluding calls means "everything but these"
+				if (first) {
+					memset(bsd_bitmap, 0xff, sizeof(bsd_bitmap));
+					memset(mach_bitmap, 0xff, sizeof(mach_bitmap));
+				}
+			}
+
+			if (length > 0) {
+				bitmap_apply(bsd_bitmap, BSD_CALLS, xtrace_bsd_call_name, ptr, length, include);
+				bitmap_apply(mach_bitmap, MACH_CALLS, xtrace_mach_call_name, ptr, length, include);
+			}
+
+			first = false;
+			ptr += length;
+			if (*ptr == ',') {
+				++ptr;
+			}
+		}
+	}
+
+	if (sample != NULL && sample[0] != '\0') {
+		strlcpy(sample_string, sample, sizeof(sample_string));
+		sample_every = parse_number(sample);
+	}
+
+	if (sample_us != NULL && sample_us[0] != '\0') {
+		strlcpy(sample_us_string, sample_us, sizeof(sample_us_string));
+		sample_interval = parse_number(sample_us) * 1000;
+	}
+
+	xtrace_filtering = filter_enabled || sample_every > 1 || sample_interval > 0;
+};
+
+const char* xtrace_filter_string(void) {
+	return filter_string;
+};
+
+const char* xtrace_sample_string(void) {
+	return sample_string;
+};
+
+const char* xtrace_sample_us_string(void) {
+	return sample_us_string;
+};
+
+static bool should_trace(struct filter_thread* thread, int type, int nr) {
+	if (filter_enabled) {
+		const uint64_t* bitmap = (type == XTRACE_CALL_BSD) ? bsd_bitmap : mach_bitmap;
+		int count = (type == XTRACE_CALL_BSD) ? BSD_CALLS : MACH_CALLS;
+
+		if (nr < 0 || nr >= count || !(bitmap[nr / 64] & (1ULL << (nr % 64)))) {
+			return false;
+		}
+	}
+
+	if (sample_every > 1 && (thread->calls++ % sample_every) != 0) {
+		return false;
+	}
+
+	if (sample_interval > 0) {
+		uint64_t now = mach_absolute_time();
+
+		if (thread->last_traced != 0 && now - thread->last_traced < sample_interval) {
+			return false;
+		}
+
+		thread->last_traced = now;
+	}
+
+	return true;
+};
+
+bool xtrace_filter_enter(int type, int nr) {
+	struct filter_thread* thread;
+	bool traced;
+	int depth;
+
+	if (!xtrace_filtering) {
+		return true;
+	}
+
+	thread = get_ptr_filter_thread();
+	depth = thread->depth++;
+	traced = should_trace(thread, type, nr);
+
+	// calls nested deeper than this are always traced, as there'd be no way to tell on their exit
+	if (depth < 64) {
+		if (traced) {
+			thread->skipped &= ~(1ULL << depth);
+		} else {
+			thread->skipped |= 1ULL << depth;
+		}
+	} else {
+		traced = true;
+	}
+
+	return traced;
+};
+
+bool xtrace_filter_exit(void) {
+	struct filter_thread* thread;
+	int depth;
+
+	if (!xtrace_filtering) {
+		return true;
+	}
+
+	thread = get_ptr_filter_thread();
+	if (thread->depth == 0) {
+		// we never saw the entry (e.g. for the calls made while the hooks were being installed)
+		return false;
+	}
+
+	depth = --thread->depth;
+	return depth >= 64 || !(thread->skipped & (1ULL << depth));
+};
+
+void xtrace_filter_reset_thread(void) {
+	if (!xtrace_filtering) {
+		return;
+	}
+
+	get_ptr_filter_thread()->depth = 0;
+};
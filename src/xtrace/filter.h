@@ -0,0 +1,31 @@
+#ifndef _XTRACE_FILTER_H_
+#define _XTRACE_FILTER_H_
+
+#include <stdbool.h>
+#include "base.h"
+
+// call filtering and sampling
+//
+// XTRACE_FILTER is compiled into a bitmap over BSD syscall and Mach trap numbers when xtrace is loaded,
+// so deciding whether to trace a call is just a bit test, done before any of the work in handle_generic_entry().
+
+XTRACE_DECLARATIONS_BEGIN;
+
+void xtrace_filter_setup(const char* filter, const char* sample, const char* sample_us);
+
+const char* xtrace_filter_string(void);
+const char* xtrace_sample_string(void);
+const char* xtrace_sample_us_string(void);
+
+// returns `true` if the call should be traced; must be called on every call entry
+bool xtrace_filter_enter(int type, int nr);
+
+// returns `true` if the call that is returning was traced; must be called on every call exit
+bool xtrace_filter_exit(void);
+
+// forgets about the calls the current thread is inside of
+void xtrace_filter_reset_thread(void);
+
+XTRACE_DECLARATIONS_END;
+
+#endif // _XTRACE_FILTER_H_
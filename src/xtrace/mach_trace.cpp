@@ -11,6 +11,8 @@
 #include "xtracelib.h"
 #include "mach_trace.h"
 #include "mig_trace.h"
+#include "control.h"
+#include "filter.h"
 #include "tls.h"
 
 DEFINE_XTRACE_TLS_VAR(int, mach_call_nr, -1, NULL);
@@ -209,23 +211,91 @@ static const char* const bootstrap_errors[] = {
 extern "C"
 void darling_mach_syscall_entry_print(int nr, void* args[])
 {
+	if (xtrace_mig_loading())
+		return;
+
+	xtrace_control_sync_thread();
+
+	if (!xtrace_filter_enter(XTRACE_CALL_MACH, nr))
+		return;
+
 	set_mach_call_nr(nr);
 	handle_generic_entry(mach_defs, "mach", nr, args);
 	if (nr == 31 || nr == 32)
-		print_mach_msg_entry(args);
+	{
+		if (!xtrace_recording())
+			print_mach_msg_entry(args);
+		else if (((mach_msg_option_t) (long) args[1] & MACH_SEND_MSG) && args[0] != NULL)
+			xtrace_note_mig(((const mach_msg_header_t*) args[0])->msgh_id);
+	}
 }
 
 extern "C"
 void darling_mach_syscall_exit_print(uintptr_t retval)
 {
+	if (xtrace_mig_loading())
+		return;
+
+	xtrace_control_sync_thread();
+
+	if (!xtrace_filter_exit())
+		return;
+
 	int nr = get_mach_call_nr();
 	int is_msg = nr == 31 || nr == 32;
 	handle_generic_exit(mach_defs, "mach", retval, is_msg);
-	if (retval == KERN_SUCCESS && is_msg)
+	if (retval == KERN_SUCCESS && is_msg && !xtrace_recording())
 		print_mach_msg_exit();
 	set_mach_call_nr(-1);
 }
 
+extern "C"
+const char* xtrace_mach_call_name(int nr)
+{
+	if (nr < 0 || nr >= sizeof(mach_defs) / sizeof(mach_defs[0]))
+		return NULL;
+	return mach_defs[nr].name;
+}
+
+extern "C"
+int xtrace_mach_call_failed(int nr, uintptr_t rv)
+{
+	if (nr >= 0 && nr < sizeof(mach_defs) / sizeof(mach_defs[0]) && mach_defs[nr].print_retval == print_port_return)
+		return (mach_port_name_t) rv == MACH_PORT_NULL || (int) rv < 0;
+	return rv != KERN_SUCCESS;
+}
+
+// The argument printers only look at the values themselves, but some of them stash a pointer
+// for the return value printer, which mustn't be dereferenced when decoding a binary trace.
+
+extern "C"
+void xtrace_mach_print_call_offline(int nr, void* args[])
+{
+	if (nr < 0 || nr >= sizeof(mach_defs) / sizeof(mach_defs[0]) || mach_defs[nr].name == NULL)
+	{
+		xtrace_log("mach %d(...)", nr);
+		return;
+	}
+
+	xtrace_log("%s(", mach_defs[nr].name);
+	if (mach_defs[nr].print_args != NULL)
+		mach_defs[nr].print_args(nr, args);
+	else
+		xtrace_log("...");
+	xtrace_log(")");
+
+	set_argument_ptr(NULL);
+}
+
+extern "C"
+void xtrace_mach_print_retval_offline(int nr, uintptr_t rv)
+{
+	if (nr >= 0 && nr < sizeof(mach_defs) / sizeof(mach_defs[0]) && mach_defs[nr].print_retval != NULL)
+		mach_defs[nr].print_retval(nr, rv);
+	else
+		xtrace_log("0x%lx", rv);
+}
+
 void xtrace_print_kern_return(kern_return_t kr)
 {
 	if (kr >= MACH_RCV_IN_PROGRESS && kr <= MACH_RCV_INVALID_TRAILER)
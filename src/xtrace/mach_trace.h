@@ -5,6 +5,14 @@ extern "C" {
 const char* xtrace_msg_type_to_str(mach_msg_type_name_t type_name, int full);
 void xtrace_print_kern_return(kern_return_t kr);
 
+const char* xtrace_mach_call_name(int nr);
+// whether a Mach trap's return value means it failed (most return a kern_return_t, some a port name)
+int xtrace_mach_call_failed(int nr, uintptr_t rv);
+
+// used to decode binary traces, where only the raw values of arguments are available
+void xtrace_mach_print_call_offline(int nr, void* args[]);
+void xtrace_mach_print_retval_offline(int nr, uintptr_t rv);
+
 #ifdef __cplusplus
 }
 #endif
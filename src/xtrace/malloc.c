@@ -5,10 +5,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/queue.h>
+#include <pthread/tsd_private.h>
 
 #include "malloc.h"
 #include "lock.h"
+#include "tls.h"
+#include "xtracelib.h"
 #include <darling/emulation/simple.h>
 
 #ifndef XTRACE_MALLOC_DEBUG
@@ -27,131 +29,102 @@
 // 1. we should be invisible to everyone but libkernel
 // 2. libmalloc might need to `thread_switch(2)`, which will recurse back into xtrace, blowing up the stack
 // so let's roll our own malloc! (using Linux's mmap)
-
-// all blocks will be allocated in multiples of this size
-#define BLOCK_SIZE_MULTIPLE (4096ULL)
-
-#define LIST_PREV(elm, link) ({ \
-		__typeof(elm) elm_cache = elm; \
-		__typeof((elm_cache)->link)* as_link = __container_of(elm_cache->link.le_prev, __typeof((elm_cache)->link), le_next); \
-		elm_cache = __container_of(as_link, __typeof(*elm_cache), link); \
-		elm_cache; \
-	})
-
-typedef LIST_HEAD(xtrace_memory_fragment_head, xtrace_memory_fragment) xtrace_memory_fragment_head_t;
-typedef LIST_ENTRY(xtrace_memory_fragment) xtrace_memory_fragment_entry_t;
-
 //
-// xtrace_memory_fragment
+// every thread allocates from its own heap, which holds a list of slabs for each size class,
+// so the common case (a thread allocating and freeing its own memory) takes no locks at all.
+// memory freed by another thread is pushed onto the slab's lock-free remote free list,
+// which the owning thread takes over the next time it runs out of local free objects.
+// allocations too large for any size class get their own mapping.
 //
+// when a thread dies, its heap (with any memory still allocated from it) is handed over to the next new thread.
+// the few allocations a thread makes after that go to a shared heap, behind a lock.
 
-#define XTRACE_MEMORY_FRAGMENT_FLAG_IN_USE (1ULL << 63)
-#define XTRACE_MEMORY_FRAGMENT_FLAG_IS_MMAP_BASE (1ULL << 62)
-#define XTRACE_MEMORY_FRAGMENT_FLAG_BIT_COUNT (2)
-#define XTRACE_MEMORY_FRAGMENT_SIZE_MASK (0xffffffffffffffffULL >> XTRACE_MEMORY_FRAGMENT_FLAG_BIT_COUNT)
-
-typedef struct xtrace_memory_fragment* xtrace_memory_fragment_t;
-struct xtrace_memory_fragment {
-	uint64_t flags;
-	xtrace_memory_fragment_entry_t block_link;
-	xtrace_memory_fragment_entry_t free_link;
-	char memory[];
-};
+// slabs (and large allocations) are aligned to this, so the header for any pointer can be found by masking it
+#define SLAB_SIZE (64ULL * 1024)
+#define SLAB_MASK (~(SLAB_SIZE - 1))
 
-XTRACE_INLINE
-bool xtrace_memory_fragment_in_use(xtrace_memory_fragment_t fragment) {
-	return fragment->flags & XTRACE_MEMORY_FRAGMENT_FLAG_IN_USE;
-};
+#define PAGE_SIZE_MULTIPLE (4096ULL)
 
-XTRACE_INLINE
-void xtrace_memory_fragment_set_in_use(xtrace_memory_fragment_t fragment, bool in_use) {
-	if (in_use) {
-		fragment->flags |= XTRACE_MEMORY_FRAGMENT_FLAG_IN_USE;
-	} else {
-		fragment->flags &= ~XTRACE_MEMORY_FRAGMENT_FLAG_IN_USE;
-	}
-};
-
-XTRACE_INLINE
-bool xtrace_memory_fragment_is_mmap_base(xtrace_memory_fragment_t fragment) {
-	return fragment->flags & XTRACE_MEMORY_FRAGMENT_FLAG_IS_MMAP_BASE;
-};
+// size classes are powers of two from 16 bytes up to 8KiB
+#define SIZE_CLASS_MIN_SHIFT 4
+#define SIZE_CLASS_MAX_SHIFT 13
+#define SIZE_CLASS_COUNT (SIZE_CLASS_MAX_SHIFT - SIZE_CLASS_MIN_SHIFT + 1)
 
-XTRACE_INLINE
-void xtrace_memory_fragment_set_is_mmap_base(xtrace_memory_fragment_t fragment, bool is_mmap_base) {
-	if (is_mmap_base) {
-		fragment->flags |= XTRACE_MEMORY_FRAGMENT_FLAG_IS_MMAP_BASE;
-	} else {
-		fragment->flags &= ~XTRACE_MEMORY_FRAGMENT_FLAG_IS_MMAP_BASE;
-	}
-};
+// like the TLS table, the heap pointer has to outlive libpthread's TLS, so it's kept in another reserved-but-unused slot
+// (__PTK_XTRACE_MALLOC; see tls.h). Heaps are marked, so that anything else using that slot is noticed.
+#define XTRACE_HEAP_MAGIC 0x78686561 // 'xhea'
 
-XTRACE_INLINE
-size_t xtrace_memory_fragment_size(xtrace_memory_fragment_t fragment) {
-	return fragment->flags & XTRACE_MEMORY_FRAGMENT_SIZE_MASK;
+enum xtrace_memory_kind {
+	xtrace_memory_kind_slab = 1,
+	xtrace_memory_kind_large = 2,
 };
 
-XTRACE_INLINE
-void xtrace_memory_fragment_set_size(xtrace_memory_fragment_t fragment, size_t new_size) {
-	fragment->flags = (fragment->flags & ~XTRACE_MEMORY_FRAGMENT_SIZE_MASK) | (new_size & XTRACE_MEMORY_FRAGMENT_SIZE_MASK);
+typedef struct xtrace_free_object* xtrace_free_object_t;
+struct xtrace_free_object {
+	xtrace_free_object_t next;
 };
 
-XTRACE_INLINE
-void xtrace_memory_fragment_init(xtrace_memory_fragment_t fragment, size_t size) {
-	xtrace_malloc_debug("initializing fragment of %llu bytes at %p", size, fragment);
-	fragment->flags = size & XTRACE_MEMORY_FRAGMENT_SIZE_MASK;
-	fragment->block_link.le_next = NULL;
-	fragment->block_link.le_prev = NULL;
-	fragment->free_link.le_next = NULL;
-	fragment->free_link.le_prev = NULL;
-};
+typedef struct xtrace_heap* xtrace_heap_t;
 
 //
-// xtrace_memory_block
+// xtrace_slab
 //
 
-typedef struct xtrace_memory_block* xtrace_memory_block_t;
-struct xtrace_memory_block {
-	uint64_t size;
-	xtrace_memory_fragment_head_t fragment_list;
-	struct xtrace_memory_fragment fragment;
+typedef struct xtrace_slab* xtrace_slab_t;
+struct xtrace_slab {
+	uint32_t kind;
+	uint32_t size_class;
+	// for slabs, the size of each object; for large allocations, the size of the whole mapping
+	size_t size;
+	// the heap that allocates from this slab
+	xtrace_heap_t heap;
+	// next slab of the same size class in the heap
+	xtrace_slab_t next;
+	// objects freed by the owning thread; only ever touched by that thread
+	xtrace_free_object_t local_free;
+	// objects freed by other threads; pushed atomically, and taken over all at once by the owning thread
+	xtrace_free_object_t remote_free;
+	// memory that has never been handed out yet
+	char* bump;
+	char* end;
 };
 
-XTRACE_INLINE
-bool xtrace_memory_block_in_use(xtrace_memory_block_t block) {
-	// the block is in use if either:
-	//   * the first fragment is in use, or
-	//   * the block has been fragmented
-	return xtrace_memory_fragment_in_use(&block->fragment) || (block->size != xtrace_memory_fragment_size(&block->fragment));
-};
+// objects start after the header, rounded up so that they're at least 16-byte aligned
+#define SLAB_HEADER_SIZE ((sizeof(struct xtrace_slab) + 15) & ~15ULL)
 
 XTRACE_INLINE
-void xtrace_memory_block_init(xtrace_memory_block_t block, size_t size) {
-	block->size = size;
-	LIST_INIT(&block->fragment_list);
-	xtrace_memory_fragment_init(&block->fragment, block->size);
-	xtrace_memory_fragment_set_is_mmap_base(&block->fragment, true);
-	LIST_INSERT_HEAD(&block->fragment_list, &block->fragment, block_link);
+xtrace_slab_t xtrace_slab_for_pointer(void* pointer) {
+	return (xtrace_slab_t)((uintptr_t)pointer & SLAB_MASK);
 };
 
 //
-// global variables
+// xtrace_heap
 //
 
-// list of available fragments
-static xtrace_memory_fragment_head_t free_list = LIST_HEAD_INITIALIZER(free_list);
-// lock for free_list
-static xtrace_lock_t free_lock = XTRACE_LOCK_INITIALIZER;
+struct xtrace_heap {
+	uint32_t magic;
+	xtrace_slab_t slabs[SIZE_CLASS_COUNT];
+	// next abandoned heap (only used while the heap is on the abandoned list)
+	xtrace_heap_t next_abandoned;
+};
+
+// heaps of threads that have died; they're handed over to new threads, along with whatever memory is still in them
+static xtrace_heap_t abandoned_heaps = NULL;
+// lock for abandoned_heaps (only taken when threads are created or die)
+static xtrace_lock_t abandoned_lock = XTRACE_LOCK_INITIALIZER;
+
+// the heap used by threads that have already given up theirs
+static struct xtrace_heap shared_heap = { .magic = XTRACE_HEAP_MAGIC };
+// lock for shared_heap
+static xtrace_lock_t shared_lock = XTRACE_LOCK_INITIALIZER;
+
+// the heap pointer of a thread that has given up its heap
+#define HEAP_ABANDONED ((xtrace_heap_t)1)
 
 //
 // internal functions
 //
 
-static xtrace_memory_fragment_t allocate_fragment(size_t required_size);
-static void release_fragment(xtrace_memory_fragment_t fragment);
-static bool shrink_fragment(xtrace_memory_fragment_t fragment, size_t new_size);
-static bool expand_fragment(xtrace_memory_fragment_t fragment, size_t new_size);
-
 // borrowed from libgmalloc
 XTRACE_INLINE
 size_t round_up(size_t size, size_t increment) {
@@ -161,253 +134,191 @@ size_t round_up(size_t size, size_t increment) {
 	return (size | (increment - 1)) + 1;
 }
 
-static xtrace_memory_fragment_t allocate_fragment(size_t required_size) {
-	xtrace_memory_fragment_t viable_fragment = NULL;
-	size_t viable_fragment_size = 0;
-	xtrace_memory_fragment_t loop_var = NULL;
-	xtrace_lock_lock(&free_lock);
-
-	// look for the smallest free fragment
-	LIST_FOREACH(loop_var, &free_list, free_link) {
-		size_t loop_var_size = xtrace_memory_fragment_size(loop_var);
-
-		// 1. always make sure the current fragment is large enough
-		// 2. we'll prefer the current fragment over the previous candidate if either:
-		//      * we don't currently have a candidate fragment, or
-		//      * the current fragment is smaller than the previous candidate
-		if (loop_var_size > required_size && (viable_fragment == NULL || loop_var_size < viable_fragment_size)) {
-			viable_fragment = loop_var;
-			viable_fragment_size = loop_var_size;
-			xtrace_malloc_debug("found viable fragment with address %p and size %llu", viable_fragment->memory, viable_fragment_size);
-		}
-	}
-
-	// if we didn't find a viable candidate...
-	if (viable_fragment == NULL) {
-		// ...allocate some memory
-		size_t allocation_size = round_up(required_size, BLOCK_SIZE_MULTIPLE);
-		xtrace_memory_block_t block = _mmap_for_xtrace(NULL, allocation_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+// maps `size` bytes aligned to SLAB_SIZE
+static void* map_aligned(size_t size) {
+	size_t map_size = size + SLAB_SIZE;
+	uintptr_t base = (uintptr_t)_mmap_for_xtrace(NULL, map_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
 
-		xtrace_malloc_debug("mmap for %llu bytes returned %p", allocation_size, block);
+	xtrace_malloc_debug("mmap for %llu bytes returned %p", map_size, (void*)base);
 
-		// check if return value is an error code
-		// see similar check in libkernel's `mman.c`
-		if ((unsigned long)block > (unsigned long)-4096) {
-			// we failed to allocate the memory, we can't do anything else
-			xtrace_malloc_debug("mmap result was failure");
-			goto out;
-		}
-
-		// initialize it
-		xtrace_memory_block_init(block, allocation_size - sizeof(struct xtrace_memory_block));
-
-		// add it to the free list
-		LIST_INSERT_HEAD(&free_list, &block->fragment, free_link);
-
-		// and set `viable_fragment` so our code below can handle it the same way as the no-mmap case
-		viable_fragment = &block->fragment;
+	// check if return value is an error code
+	// see similar check in libkernel's `mman.c`
+	if (base > (uintptr_t)-4096) {
+		xtrace_malloc_debug("mmap result was failure");
+		return NULL;
 	}
 
-	// at this point, `viable_fragment` is guaranteed to have a value
-	xtrace_malloc_debug("final fragment for allocation: %llu bytes at %p", xtrace_memory_fragment_size(viable_fragment), viable_fragment->memory);
-
-	// shrink the fragment (if possible)
-	shrink_fragment(viable_fragment, required_size);
-
-	// set the in_use bit
-	xtrace_memory_fragment_set_in_use(viable_fragment, true);
+	uintptr_t aligned = (base + SLAB_SIZE - 1) & SLAB_MASK;
 
-	// finally, remove the viable fragment from the free list
-	LIST_REMOVE(viable_fragment, free_link);
-
-out:
-	xtrace_lock_unlock(&free_lock);
+	// trim the excess on both sides
+	if (aligned > base) {
+		_munmap_for_xtrace((void*)base, aligned - base);
+	}
+	if (base + map_size > aligned + size) {
+		_munmap_for_xtrace((void*)(aligned + size), base + map_size - (aligned + size));
+	}
 
-	return viable_fragment;
+	return (void*)aligned;
 };
 
-static void release_fragment(xtrace_memory_fragment_t fragment) {
-	xtrace_lock_lock(&free_lock);
-
-	xtrace_malloc_debug("releasing fragment of %llu bytes at %p", xtrace_memory_fragment_size(fragment), fragment->memory);
-
-	// clear the in_use bit
-	xtrace_memory_fragment_set_in_use(fragment, false);
-
-	// add it to the free list
-	LIST_INSERT_HEAD(&free_list, fragment, free_link);
-
-	// try to defragment the block
-	while (true) {
-		xtrace_memory_fragment_t prev_frag = xtrace_memory_fragment_is_mmap_base(fragment) ? NULL : LIST_PREV(fragment, block_link);
-		xtrace_memory_fragment_t next_frag = LIST_NEXT(fragment, block_link);
-		bool defragged = false;
-
-		if (prev_frag && !xtrace_memory_fragment_in_use(prev_frag)) {
-			xtrace_malloc_debug("defragmenting with previous fragment (%llu bytes at %p)", xtrace_memory_fragment_size(prev_frag), prev_frag->memory);
-			defragged = true;
-
-			// remove the current fragment from the free list
-			LIST_REMOVE(fragment, free_link);
-
-			// remove the current fragment from the block list
-			LIST_REMOVE(fragment, block_link);
-
-			// expand the previous fragment
-			xtrace_memory_fragment_set_size(prev_frag, xtrace_memory_fragment_size(prev_frag) + sizeof(struct xtrace_memory_fragment) + xtrace_memory_fragment_size(fragment));
-
-			// `fragment` is now gone; set it to `prev_frag`
-			fragment = prev_frag;
-		}
-
-		if (next_frag && !xtrace_memory_fragment_in_use(next_frag)) {
-			xtrace_malloc_debug("defragmenting with next fragment (%llu bytes at %p)", xtrace_memory_fragment_size(fragment), fragment->memory);
-			defragged = true;
+static int size_class_for(size_t size) {
+	int shift = SIZE_CLASS_MIN_SHIFT;
 
-			// remove the next fragment from the free list
-			LIST_REMOVE(next_frag, free_link);
+	while ((1ULL << shift) < size) {
+		++shift;
+	}
 
-			// remove the next fragment from the block list
-			LIST_REMOVE(next_frag, block_link);
+	return shift - SIZE_CLASS_MIN_SHIFT;
+};
 
-			// expand the current fragment
-			xtrace_memory_fragment_set_size(fragment, xtrace_memory_fragment_size(fragment) + sizeof(struct xtrace_memory_fragment) + xtrace_memory_fragment_size(next_frag));
+static xtrace_heap_t current_heap(bool create) {
+	xtrace_heap_t heap = _pthread_getspecific_direct(__PTK_XTRACE_MALLOC);
 
-			// `next_frag` is now gone
-		}
-
-		// if we didn't defragment anything on this loop, we can't defragment any more
-		if (!defragged) {
-			xtrace_malloc_debug("cannot defragment any further");
-			break;
-		} else {
-			// otherwise, keep looping to try to defragment more
-			xtrace_malloc_debug("doing another defragmentation iteration");
-		}
+	if (heap != NULL && heap != HEAP_ABANDONED && heap->magic != XTRACE_HEAP_MAGIC) {
+		xtrace_abort("xtrace: the TSD slot for the heap pointer is in use by something else");
 	}
 
-	xtrace_malloc_debug("final releasing fragment is %llu bytes at %p", xtrace_memory_fragment_size(fragment), fragment->memory);
-
-	// if `fragment` is the mmap base fragment...
-	if (xtrace_memory_fragment_is_mmap_base(fragment)) {
-		xtrace_memory_block_t block = __container_of(fragment, struct xtrace_memory_block, fragment);
-		xtrace_malloc_debug("releasing fragment is base fragment");
-
-		// ...and we managed to defragment the entire block...
-		if (!xtrace_memory_block_in_use(block)) {
-			// ...unmap it!
-			xtrace_malloc_debug("unmapping completely freed block (%llu bytes at %p)", block->size, block->fragment.memory);
+	if (heap != NULL || !create) {
+		return heap;
+	}
 
-			// start off by removing all traces of this block in the free list.
-			// at this point, only the base fragment should be in the free list, so remove it
-			LIST_REMOVE(fragment, free_link);
+	// try to take over an abandoned heap first
+	xtrace_lock_lock(&abandoned_lock);
+	heap = abandoned_heaps;
+	if (heap != NULL) {
+		abandoned_heaps = heap->next_abandoned;
+	}
+	xtrace_lock_unlock(&abandoned_lock);
 
-			// and now, just unmap it
-			_munmap_for_xtrace(block, block->size + sizeof(struct xtrace_memory_block));
-			// and we ignore errors
+	if (heap != NULL) {
+		xtrace_malloc_debug("adopting abandoned heap %p", heap);
+	} else {
+		heap = _mmap_for_xtrace(NULL, round_up(sizeof(struct xtrace_heap), PAGE_SIZE_MULTIPLE), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		if ((uintptr_t)heap > (uintptr_t)-4096) {
+			return NULL;
 		}
+		heap->magic = XTRACE_HEAP_MAGIC;
+		xtrace_malloc_debug("created new heap %p", heap);
 	}
 
-out:
-	xtrace_lock_unlock(&free_lock);
+	heap->next_abandoned = NULL;
+	_pthread_setspecific_direct(__PTK_XTRACE_MALLOC, heap);
+	return heap;
 };
 
-// must be called with free_lock held
-static bool shrink_fragment(xtrace_memory_fragment_t fragment, size_t new_size) {
-	xtrace_malloc_debug("shrink to %llu bytes requested for fragment of %llu bytes at %p", new_size, xtrace_memory_fragment_size(fragment), fragment->memory);
+static xtrace_slab_t allocate_slab(xtrace_heap_t heap, int size_class) {
+	xtrace_slab_t slab = map_aligned(SLAB_SIZE);
+	if (slab == NULL) {
+		return NULL;
+	}
 
-	// calculate the remaining size if we were to shrink this fragment
-	size_t remaining_size = xtrace_memory_fragment_size(fragment) - new_size;
+	slab->kind = xtrace_memory_kind_slab;
+	slab->size_class = size_class;
+	slab->size = 1ULL << (size_class + SIZE_CLASS_MIN_SHIFT);
+	slab->heap = heap;
+	slab->local_free = NULL;
+	slab->remote_free = NULL;
+	slab->bump = (char*)slab + SLAB_HEADER_SIZE;
+	slab->end = (char*)slab + SLAB_SIZE;
 
-	// if we would have enough space to create another fragment after shrinking this one...
-	if (remaining_size > sizeof(struct xtrace_memory_fragment)) {
-		xtrace_malloc_debug("fragment eligible; shrinking...");
+	slab->next = heap->slabs[size_class];
+	heap->slabs[size_class] = slab;
 
-		// ...shrink it...
-		xtrace_memory_fragment_set_size(fragment, new_size);
+	xtrace_malloc_debug("new slab for %llu-byte objects at %p", slab->size, slab);
 
-		// ...and create the new fragment
-		xtrace_memory_fragment_t new_fragment = (xtrace_memory_fragment_t)(fragment->memory + new_size);
-		xtrace_memory_fragment_init(new_fragment, remaining_size - sizeof(struct xtrace_memory_fragment));
+	return slab;
+};
 
-		// add it to the block list
-		LIST_INSERT_AFTER(fragment, new_fragment, block_link);
+static void* allocate_from_slab(xtrace_slab_t slab) {
+	xtrace_free_object_t object = slab->local_free;
 
-		xtrace_malloc_debug("old fragment shrunk to %llu bytes at %p", xtrace_memory_fragment_size(fragment), fragment->memory);
-		xtrace_malloc_debug("new fragment of %llu bytes created at %p", xtrace_memory_fragment_size(new_fragment), new_fragment->memory);
+	if (object == NULL && __atomic_load_n(&slab->remote_free, __ATOMIC_RELAXED) != NULL) {
+		object = __atomic_exchange_n(&slab->remote_free, NULL, __ATOMIC_ACQUIRE);
+	}
 
-		// insert it into the free list
-		LIST_INSERT_HEAD(&free_list, new_fragment, free_link);
+	if (object != NULL) {
+		slab->local_free = object->next;
+		return object;
+	}
 
-		return true;
-	} else {
-		// otherwise, we don't want to shrink this one to avoid holes in our block
-		xtrace_malloc_debug("fragment ineligible for shrinking (not enough space after it)");
+	if (slab->bump + slab->size <= slab->end) {
+		void* result = slab->bump;
+		slab->bump += slab->size;
+		return result;
 	}
 
-	return false;
+	return NULL;
 };
 
-// must be called with free_lock held
-static bool expand_fragment(xtrace_memory_fragment_t fragment, size_t new_size) {
-	xtrace_malloc_debug("expansion to %llu bytes requested for fragment of %llu bytes at %p", new_size, xtrace_memory_fragment_size(fragment), fragment->memory);
+static void* allocate_from_heap(xtrace_heap_t heap, size_t size) {
+	int size_class = size_class_for(size);
+	xtrace_slab_t first = heap->slabs[size_class];
 
-	size_t available_size = xtrace_memory_fragment_size(fragment);
-	xtrace_memory_fragment_t loop_var = fragment;
-	xtrace_memory_fragment_t end_frag = NULL;
+	for (xtrace_slab_t slab = first, prev = NULL; slab != NULL; prev = slab, slab = slab->next) {
+		void* result = allocate_from_slab(slab);
+		if (result == NULL) {
+			continue;
+		}
 
-	while ((end_frag = LIST_NEXT(loop_var, block_link)) != NULL) {
-		// if the fragment is in use...
-		if (xtrace_memory_fragment_in_use(end_frag)) {
-			// ...we've reached a limit
-			xtrace_malloc_debug("insufficient free fragments for expansion");
-			break;
+		// move the slab to the front so that the next allocation finds it right away
+		if (prev != NULL) {
+			prev->next = slab->next;
+			slab->next = first;
+			heap->slabs[size_class] = slab;
 		}
 
-		available_size += xtrace_memory_fragment_size(end_frag) + sizeof(struct xtrace_memory_fragment);
-		loop_var = end_frag;
+		return result;
+	}
 
-		// if we've got enough...
-		if (available_size >= new_size) {
-			xtrace_malloc_debug("found enough free fragments for expansion");
-			// ...we're done; we don't need to keep looking for more
-			break;
-		}
+	xtrace_slab_t slab = allocate_slab(heap, size_class);
+	if (slab == NULL) {
+		return NULL;
 	}
+	return allocate_from_slab(slab);
+};
 
-	if (end_frag && available_size >= new_size) {
-		xtrace_memory_fragment_t terminating_value = LIST_NEXT(end_frag, block_link);
+static void* allocate_small(size_t size) {
+	xtrace_heap_t heap = current_heap(true);
+	void* result;
 
-		while (LIST_NEXT(fragment, block_link) != terminating_value) {
-			xtrace_memory_fragment_t dying_fragment = LIST_NEXT(fragment, block_link);
+	if (heap == NULL) {
+		return NULL;
+	}
 
-			xtrace_malloc_debug("absorbing fragment of %llu bytes at %p", xtrace_memory_fragment_size(dying_fragment), dying_fragment->memory);
+	if (heap != HEAP_ABANDONED) {
+		return allocate_from_heap(heap, size);
+	}
 
-			// remove the dying fragment from the free list
-			LIST_REMOVE(dying_fragment, free_link);
+	xtrace_lock_lock(&shared_lock);
+	result = allocate_from_heap(&shared_heap, size);
+	xtrace_lock_unlock(&shared_lock);
 
-			// remove the dying fragment from the block list
-			LIST_REMOVE(dying_fragment, block_link);
+	return result;
+};
 
-			// expand the surviving fragment
-			xtrace_memory_fragment_set_size(fragment, xtrace_memory_fragment_size(fragment) + sizeof(struct xtrace_memory_fragment) + xtrace_memory_fragment_size(dying_fragment));
+static void* allocate_large(size_t size) {
+	size_t map_size = round_up(SLAB_HEADER_SIZE + size, PAGE_SIZE_MULTIPLE);
+	xtrace_slab_t header = map_aligned(map_size);
+	if (header == NULL) {
+		return NULL;
+	}
 
-			// `dying_fragment` is now gone
-		}
+	header->kind = xtrace_memory_kind_large;
+	header->size = map_size;
 
-		xtrace_malloc_debug("expanded fragment is %llu bytes at %p; trying to shrink...", xtrace_memory_fragment_size(fragment), fragment->memory);
+	xtrace_malloc_debug("large allocation of %llu bytes at %p", map_size, header);
 
-		// try to shrink it so that we leave space for other possible fragments
-		shrink_fragment(fragment, new_size);
+	return (char*)header + SLAB_HEADER_SIZE;
+};
 
-		xtrace_malloc_debug("final fragment is %llu bytes at %p", xtrace_memory_fragment_size(fragment), fragment->memory);
+// how many bytes can be used at `pointer`
+static size_t usable_size(void* pointer) {
+	xtrace_slab_t slab = xtrace_slab_for_pointer(pointer);
 
-		return true;
+	if (slab->kind == xtrace_memory_kind_large) {
+		return slab->size - SLAB_HEADER_SIZE;
 	}
-
-	xtrace_malloc_debug("ineligible for expansion");
-
-	return false;
+	return slab->size;
 };
 
 //
@@ -418,65 +329,73 @@ void* xtrace_malloc(size_t size) {
 	if (size == 0) {
 		return NULL;
 	}
-	xtrace_memory_fragment_t fragment = allocate_fragment(size);
-	if (fragment == NULL) {
-		return NULL;
+	if (size > (1ULL << SIZE_CLASS_MAX_SHIFT)) {
+		return allocate_large(size);
 	}
-	return fragment->memory;
+	return allocate_small(size);
 };
 
 void xtrace_free(void* pointer) {
 	if (pointer == NULL) {
 		return;
 	}
-	xtrace_memory_fragment_t fragment = __container_of(pointer, struct xtrace_memory_fragment, memory);
-	release_fragment(fragment);
+
+	xtrace_slab_t slab = xtrace_slab_for_pointer(pointer);
+	xtrace_free_object_t object = pointer;
+
+	if (slab->kind == xtrace_memory_kind_large) {
+		xtrace_malloc_debug("unmapping large allocation of %llu bytes at %p", slab->size, slab);
+		_munmap_for_xtrace(slab, slab->size);
+		// and we ignore errors
+		return;
+	}
+
+	if (slab->heap == current_heap(false)) {
+		object->next = slab->local_free;
+		slab->local_free = object;
+		return;
+	}
+
+	object->next = __atomic_load_n(&slab->remote_free, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&slab->remote_free, &object->next, object, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 };
 
 void* xtrace_realloc(void* old_pointer, size_t new_size) {
-	xtrace_memory_fragment_t fragment = __container_of(old_pointer, struct xtrace_memory_fragment, memory);
-	size_t old_size = xtrace_memory_fragment_size(fragment);
-
-	xtrace_lock_lock(&free_lock);
-
-	// if we're shrinking, we can always do that
-	if (new_size < old_size) {
-		// we don't really care if it succeeds or not
-		shrink_fragment(fragment, new_size);
-		goto out;
-	} else if (new_size == old_size) {
-		// likewise, we can always keep it the same
-		goto out;
+	if (old_pointer == NULL) {
+		return xtrace_malloc(new_size);
 	}
 
-	// but otherwise, we're expanding
+	size_t old_size = usable_size(old_pointer);
 
-	// try to see if we can expand the fragment first
-	if (expand_fragment(fragment, new_size)) {
-		// if we expanded it successfully, we're done!
-		goto out;
-	} else {
-		// otherwise, we need to allocate a new fragment
-		xtrace_lock_unlock(&free_lock); // `allocate_fragment` takes the lock, so we need to drop it
-		xtrace_memory_fragment_t new_fragment = allocate_fragment(new_size);
-		if (new_fragment == NULL) {
-			return NULL;
-		}
+	// if it still fits, we can keep it
+	if (new_size <= old_size) {
+		return old_pointer;
+	}
 
-		// copy the old contents to the new fragment
-		memcpy(new_fragment->memory, fragment->memory, old_size);
+	void* new_pointer = xtrace_malloc(new_size);
+	if (new_pointer == NULL) {
+		return NULL;
+	}
+
+	memcpy(new_pointer, old_pointer, old_size);
+	xtrace_free(old_pointer);
 
-		// and release the old fragment
-		release_fragment(fragment);
+	return new_pointer;
+};
 
-		// assign the new pointer to the return variable and we're done!
-		old_pointer = new_fragment->memory;
-		goto out_unlocked;
+void xtrace_malloc_thread_cleanup(void) {
+	xtrace_heap_t heap = current_heap(false);
+	if (heap == NULL || heap == HEAP_ABANDONED) {
+		return;
 	}
 
-out:
-	xtrace_lock_unlock(&free_lock);
+	xtrace_malloc_debug("abandoning heap %p", heap);
+
+	// the thread still makes a few calls after this; those will use the shared heap
+	_pthread_setspecific_direct(__PTK_XTRACE_MALLOC, HEAP_ABANDONED);
 
-out_unlocked:
-	return old_pointer;
+	xtrace_lock_lock(&abandoned_lock);
+	heap->next_abandoned = abandoned_heaps;
+	abandoned_heaps = heap;
+	xtrace_lock_unlock(&abandoned_lock);
 };
@@ -10,6 +10,9 @@ void* xtrace_malloc(size_t size);
 void xtrace_free(void* pointer);
 void* xtrace_realloc(void* old_pointer, size_t new_size);
 
+// gives the calling thread's heap up for reuse by new threads; must be called when a thread is exiting
+void xtrace_malloc_thread_cleanup(void);
+
 XTRACE_DECLARATIONS_END;
 
 #endif // _XTRACE_MALLOC_H_
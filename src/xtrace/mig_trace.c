@@ -1,13 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <mach/mach.h>
 
 #include <darling/emulation/simple.h>
+#include <darling/emulation/ext/for-xtrace.h>
 #include "xtracelib.h"
 #include "mach_trace.h"
 #include "bsd_trace.h"
@@ -15,67 +20,292 @@
 #include "tls.h"
 
 #define XTRACE_MIG_DIR_PATH "/usr/lib/darling/xtrace-mig"
+#define XTRACE_MIG_INDEX_PATH "/usr/lib/darling/xtrace-mig.index"
 
-static size_t subsystems_cnt = 0;
-static struct xtrace_mig_subsystem** subsystems = NULL;
+enum mig_entry_state {
+	MIG_ENTRY_UNLOADED,
+	MIG_ENTRY_QUEUED,
+	MIG_ENTRY_LOADED,
+	MIG_ENTRY_FAILED,
+};
+
+// The index (generated by migcom at build time) tells us which message IDs each
+// subsystem covers and which library its decoders are in, so we only have to load
+// a library once we actually see a message that might belong to it.
+//
+// That happens inside a traced call, though, where calling into dyld could deadlock (the traced
+// thread may be holding one of its locks) or recurse into the trace hooks. So once tracing is enabled,
+// libraries are loaded by a loader thread instead; messages are shown undecoded (by their msgh_id)
+// until their library has been loaded.
+struct mig_entry
+{
+	int base;
+	int routine_cnt;
+	const char* name;
+	const char* lib_name;
+	int state;
+	const struct xtrace_mig_subsystem* subsystem;
+};
+
+static size_t entries_cnt = 0;
+static struct mig_entry* entries = NULL;
 
 static mach_port_name_t host_port;
 
-void xtrace_setup_mig_tracing(void)
+// Set on the loader thread, so that the calls dlopen() makes aren't traced.
+// The count lets us skip looking at the TLS variable at all when there's no loader thread.
+static int loading_cnt = 0;
+DEFINE_XTRACE_TLS_VAR(bool, mig_loading, false, NULL);
+
+// Entry indices are written here for the loader thread; -1 if there's none.
+static int loader_pipe[2] = { -1, -1 };
+// Until then, we're not tracing yet and can load libraries right away.
+static bool loader_started = false;
+
+bool xtrace_mig_loading(void)
 {
-	// This runs before the syscall tracing is enabled, so we can
-	// freely use libSystem and make syscalls.
+	return __atomic_load_n(&loading_cnt, __ATOMIC_RELAXED) != 0 && get_mig_loading();
+}
 
-	host_port = mach_host_self();
+static const struct xtrace_mig_subsystem* load_subsystem(const char* path)
+{
+	void* dylib_handle = dlopen(path, RTLD_LOCAL);
+	if (dylib_handle == NULL)
+	{
+		xtrace_error("xtrace: failed to dlopen %s: %s\n", path, dlerror());
+		return NULL;
+	}
+	const struct xtrace_mig_subsystem* s = (const struct xtrace_mig_subsystem*) dlsym(dylib_handle, "xtrace_mig_subsystem");
+	if (s == NULL)
+		xtrace_error("xtrace: failed to dlsym(%s, \"xtrace_mig_subsystem\"): %s\n", path, dlerror());
+	return s;
+}
+
+static bool read_index(void)
+{
+	FILE* index = fopen(XTRACE_MIG_INDEX_PATH, "r");
+	if (index == NULL)
+		return false;
+
+	fseek(index, 0, SEEK_END);
+	long size = ftell(index);
+	rewind(index);
+
+	// The entries point into this buffer, so it's never freed.
+	char* buffer = malloc(size + 1);
+	size = fread(buffer, 1, size, index);
+	buffer[size] = '\0';
+	fclose(index);
+
+	size_t lines = 0;
+	for (char* p = buffer; *p != '\0'; p++)
+	{
+		if (*p == '\n')
+			lines++;
+	}
+	entries = malloc((lines + 1) * sizeof(struct mig_entry));
+
+	// Each line is "<base> <routine count> <subsystem name> <library name>".
+	for (char* line = buffer; line != NULL && *line != '\0'; )
+	{
+		char* next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+
+		char* fields[4];
+		int fields_cnt = 0;
+		for (char* field = strtok(line, " "); field != NULL && fields_cnt < 4; field = strtok(NULL, " "))
+			fields[fields_cnt++] = field;
+
+		if (fields_cnt == 4)
+		{
+			struct mig_entry* e = &entries[entries_cnt++];
+			e->base = atoi(fields[0]);
+			e->routine_cnt = atoi(fields[1]);
+			e->name = fields[2];
+			e->lib_name = fields[3];
+			e->state = MIG_ENTRY_UNLOADED;
+			e->subsystem = NULL;
+		}
+
+		line = next;
+	}
+
+	return true;
+}
 
+// Without an index, fall back to loading every library there is.
+static void load_all(void)
+{
 	DIR* xtrace_mig_dir = opendir(XTRACE_MIG_DIR_PATH);
 	if (xtrace_mig_dir == NULL)
 	{
 		perror("xtrace: failed to open " XTRACE_MIG_DIR_PATH);
 		return;
 	}
-	// Count the number of files, and allocate this many subsystem pointers;
-	for (struct dirent* dirent; (dirent = readdir(xtrace_mig_dir)) != NULL; subsystems_cnt++);
-	subsystems = malloc(subsystems_cnt * sizeof(struct xtrace_mig_subsystem*));
+	// Count the number of files, and allocate this many entries;
+	size_t files_cnt = 0;
+	for (struct dirent* dirent; (dirent = readdir(xtrace_mig_dir)) != NULL; files_cnt++);
+	entries = malloc(files_cnt * sizeof(struct mig_entry));
 
 	rewinddir(xtrace_mig_dir);
-	for (size_t i = 0; i < subsystems_cnt; i++)
+	for (size_t i = 0; i < files_cnt; i++)
 	{
 		struct dirent* dirent = readdir(xtrace_mig_dir);
 		if (dirent == NULL)
 		{
 			perror("xtrace: readdir");
-			subsystems_cnt = i;
 			break;
 		}
 		if (dirent->d_type != DT_REG)
-		{
-			subsystems[i] = NULL;
 			continue;
-		}
+
 		size_t path_size = strlen(XTRACE_MIG_DIR_PATH) + 1 + strlen(dirent->d_name) + 1;
 		char path[path_size];
 		strcpy(path, XTRACE_MIG_DIR_PATH "/");
 		strcat(path, dirent->d_name);
 
-		void* dylib_handle = dlopen(path, RTLD_LOCAL);
-		if (dylib_handle == NULL)
-		{
-			xtrace_error("xtrace: failed to dlopen %s: %s\n", path, dlerror());
-			subsystems[i] = NULL;
+		const struct xtrace_mig_subsystem* s = load_subsystem(path);
+		if (s == NULL)
 			continue;
-		}
-		subsystems[i] = (struct xtrace_mig_subsystem*) dlsym(dylib_handle, "xtrace_mig_subsystem");
-		if (subsystems[i] == NULL)
-		{
-			xtrace_error("xtrace: failed to dlsym(%s, \"xtrace_mig_subsystem\"): %s\n", path, dlerror());
-			// Leave NULL subsystem in place and continue.
-		}
+
+		struct mig_entry* e = &entries[entries_cnt++];
+		e->base = s->base;
+		e->routine_cnt = s->routine_cnt;
+		e->name = s->name;
+		e->lib_name = NULL;
+		e->state = MIG_ENTRY_LOADED;
+		e->subsystem = s;
 	}
 
 	closedir(xtrace_mig_dir);
 }
 
+void xtrace_setup_mig_tracing(void)
+{
+	// This runs before the syscall tracing is enabled, so we can
+	// freely use libSystem and make syscalls.
+
+	host_port = mach_host_self();
+
+	if (!read_index())
+		load_all();
+}
+
+static void load_entry(struct mig_entry* e)
+{
+	size_t path_size = strlen(XTRACE_MIG_DIR_PATH) + 1 + strlen(e->lib_name) + 1;
+	char path[path_size];
+	strcpy(path, XTRACE_MIG_DIR_PATH "/");
+	strcat(path, e->lib_name);
+
+	e->subsystem = load_subsystem(path);
+	__atomic_store_n(&e->state, e->subsystem != NULL ? MIG_ENTRY_LOADED : MIG_ENTRY_FAILED, __ATOMIC_RELEASE);
+}
+
+static void* loader_thread(void* context)
+{
+	int index;
+
+	set_mig_loading(true);
+
+	// the reads bypass the hooks; everything dlopen() does is skipped thanks to `mig_loading`
+	while (_read_for_xtrace(loader_pipe[0], &index, sizeof(index)) == sizeof(index))
+	{
+		if (index >= 0 && (size_t)index < entries_cnt)
+			load_entry(&entries[index]);
+	}
+
+	return NULL;
+}
+
+void xtrace_mig_start_loader(void)
+{
+	// This runs before the syscall tracing is enabled, too.
+	pthread_t thread;
+	pthread_attr_t attr;
+	bool lazy = false;
+
+	for (size_t i = 0; i < entries_cnt; i++)
+	{
+		if (entries[i].state == MIG_ENTRY_UNLOADED)
+			lazy = true;
+	}
+
+	loader_started = true;
+
+	// without the index, everything has already been loaded
+	if (!lazy)
+		return;
+
+	if (pipe(loader_pipe) != 0 || fcntl(loader_pipe[0], F_SETFD, FD_CLOEXEC) != 0 || fcntl(loader_pipe[1], F_SETFD, FD_CLOEXEC) != 0)
+	{
+		xtrace_error("xtrace: failed to create the MIG loader pipe; MIG messages won't be decoded\n");
+		loader_pipe[0] = loader_pipe[1] = -1;
+		return;
+	}
+
+	__atomic_add_fetch(&loading_cnt, 1, __ATOMIC_RELAXED);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, loader_thread, NULL) != 0)
+	{
+		xtrace_error("xtrace: failed to start the MIG loader thread; MIG messages won't be decoded\n");
+		__atomic_sub_fetch(&loading_cnt, 1, __ATOMIC_RELAXED);
+		close(loader_pipe[0]);
+		close(loader_pipe[1]);
+		loader_pipe[0] = loader_pipe[1] = -1;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void xtrace_mig_postfork_child(void)
+{
+	// the loader thread stayed with the parent; whatever isn't loaded yet stays undecoded here
+	if (loader_pipe[1] >= 0)
+	{
+		_close_for_xtrace(loader_pipe[0]);
+		_close_for_xtrace(loader_pipe[1]);
+		loader_pipe[0] = loader_pipe[1] = -1;
+		__atomic_sub_fetch(&loading_cnt, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// Returns the subsystem for the entry, or NULL if it isn't loaded (yet).
+static const struct xtrace_mig_subsystem* entry_subsystem(struct mig_entry* e)
+{
+	int state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+	int index = e - entries;
+
+	if (state == MIG_ENTRY_LOADED)
+		return e->subsystem;
+	if (state != MIG_ENTRY_UNLOADED)
+		return NULL;
+
+	if (!__atomic_compare_exchange_n(&e->state, &state, MIG_ENTRY_QUEUED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return entry_subsystem(e);
+
+	// nothing is traced yet (e.g. `xtrace --decode`), so we can just load it here
+	if (!loader_started)
+	{
+		load_entry(e);
+		return e->subsystem;
+	}
+
+	if (loader_pipe[1] < 0)
+	{
+		__atomic_store_n(&e->state, MIG_ENTRY_FAILED, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	// this message won't be decoded, but later ones will be
+	if (__write_for_xtrace(loader_pipe[1], &index, sizeof(index)) != sizeof(index))
+		__atomic_store_n(&e->state, MIG_ENTRY_FAILED, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
 DEFINE_XTRACE_TLS_VAR(bool, is_first_arg, false, NULL);
 
 #define BEFORE if (!get_is_first_arg()) xtrace_log(", ")
@@ -231,6 +461,12 @@ static const struct xtrace_mig_callbacks callbacks = {
 	.set_return_code = set_return_code
 };
 
+static int covers(const struct mig_entry* e, mach_msg_id_t id)
+{
+	return (e->base <= id && id < (e->base + e->routine_cnt))
+		|| (e->base + 100 <= id && id < (e->base + 100 + e->routine_cnt));
+}
+
 static const struct xtrace_mig_routine_desc* find_routine(mach_msg_id_t id, const struct xtrace_mig_subsystem* s, int* out_is_reply)
 {
 	if (s == NULL)
@@ -261,17 +497,14 @@ static const struct xtrace_mig_routine_desc* find_routine(mach_msg_id_t id, cons
 	return r;
 }
 
-static int filter(const struct xtrace_mig_subsystem* s, mach_port_name_t request_port)
+static int filter(const struct mig_entry* e, mach_port_name_t request_port)
 {
-	if (s == NULL)
-		return 0;
-
 	// mach_host.defs and job.defs use the same msgids,
 	// so use the request port to distinguish them.
 	if (request_port == bootstrap_port)
-		return strncmp(s->name, "job", 3) == 0;
+		return strncmp(e->name, "job", 3) == 0;
 	if (request_port == host_port)
-		return strncmp(s->name, "host", 4) == 0;
+		return strncmp(e->name, "host", 4) == 0;
 
 	return 1;
 }
@@ -289,30 +522,36 @@ static int find_subsystem(
 	// The reason for doing it like this is that many subsystems are actually
 	// "reply" and "forward" versions of other subsystems/routines, consisting only
 	// of simpleroutines; and we want to find the original ones if possible.
-	for (size_t i = 0; i < subsystems_cnt; i++)
+	for (size_t i = 0; i < entries_cnt; i++)
 	{
-		if (do_filter && !filter(subsystems[i], request_port))
+		if (!covers(&entries[i], id))
+			continue;
+		if (do_filter && !filter(&entries[i], request_port))
 			continue;
 
-		const struct xtrace_mig_routine_desc* r = find_routine(id, subsystems[i], out_is_reply);
+		const struct xtrace_mig_subsystem* s = entry_subsystem(&entries[i]);
+		const struct xtrace_mig_routine_desc* r = find_routine(id, s, out_is_reply);
 		if (r != NULL && r->reply_present)
 		{
-			*out_s = subsystems[i];
+			*out_s = s;
 			*out_r = r;
 			return 1;
 		}
 	}
 
 	// Now, just see if it matches anything.
-	for (size_t i = 0; i < subsystems_cnt; i++)
+	for (size_t i = 0; i < entries_cnt; i++)
 	{
-		if (do_filter && !filter(subsystems[i], request_port))
+		if (!covers(&entries[i], id))
+			continue;
+		if (do_filter && !filter(&entries[i], request_port))
 			continue;
 
-		const struct xtrace_mig_routine_desc* r = find_routine(id, subsystems[i], out_is_reply);
+		const struct xtrace_mig_subsystem* s = entry_subsystem(&entries[i]);
+		const struct xtrace_mig_routine_desc* r = find_routine(id, s, out_is_reply);
 		if (r != NULL)
 		{
-			*out_s = subsystems[i];
+			*out_s = s;
 			*out_r = r;
 			return 1;
 		}
@@ -353,3 +592,31 @@ void xtrace_print_mig_message(const mach_msg_header_t* message, mach_port_name_t
 	else
 		xtrace_log(" ");
 }
+
+int xtrace_find_mig_routine(mach_msg_id_t id, const char** subsystem, const char** routine, int* is_reply)
+{
+	const struct xtrace_mig_subsystem* s;
+	const struct xtrace_mig_routine_desc* r;
+
+	// without a request port to go by (it means nothing outside of the traced process, or it isn't known anymore),
+	// this only skips missing subsystems
+	if (!find_subsystem(id, MACH_PORT_NULL, 1, &s, &r, is_reply))
+		return 0;
+
+	*subsystem = s->name;
+	*routine = r->name;
+	return 1;
+}
+
+int xtrace_print_mig_name(mach_msg_id_t id)
+{
+	const char* subsystem;
+	const char* routine;
+	int is_reply;
+
+	if (!xtrace_find_mig_routine(id, &subsystem, &routine, &is_reply))
+		return 0;
+
+	xtrace_log("%s::%s%s", subsystem, routine, is_reply ? " reply" : "");
+	return 1;
+}
@@ -1,11 +1,20 @@
 #include <mach/message.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void xtrace_setup_mig_tracing(void);
+// starts loading decoder libraries in the background; must be called right before tracing is enabled
+void xtrace_mig_start_loader(void);
+void xtrace_mig_postfork_child(void);
 void xtrace_print_mig_message(const mach_msg_header_t* message, mach_port_name_t request_port);
+int xtrace_find_mig_routine(mach_msg_id_t id, const char** subsystem, const char** routine, int* is_reply);
+int xtrace_print_mig_name(mach_msg_id_t id);
+
+// whether the current thread is loading a MIG decoder library (and so its calls shouldn't be traced)
+bool xtrace_mig_loading(void);
 
 #ifdef __cplusplus
 }
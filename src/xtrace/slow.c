@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <darling/emulation/simple.h>
+
+#include "slow.h"
+#include "xtracelib.h"
+#include "tls.h"
+
+// output is only held back for this many levels of nesting; calls nested deeper than that are always printed
+#define SLOW_MAX_DEPTH 8
+#define SLOW_BUFFER_SIZE 2048
+
+// where output goes while nothing is being held back
+#define CAPTURE_NONE -1
+// the output is for a call that turned out to be fast enough
+#define CAPTURE_DROP -2
+
+uint64_t xtrace_slow_ns = 0;
+
+static char slow_us_string[32] = {0};
+
+struct slow_thread {
+	// depth of the call whose output is being held back, or one of the CAPTURE_* values
+	int capture;
+	// whether the entry output at a depth is still waiting in its buffer
+	bool held[SLOW_MAX_DEPTH];
+	// whether it had to be printed before its call returned, because a slow call nested in it was printed
+	bool printed_early[SLOW_MAX_DEPTH];
+	size_t lengths[SLOW_MAX_DEPTH];
+	char buffers[SLOW_MAX_DEPTH][SLOW_BUFFER_SIZE];
+};
+
+DEFINE_XTRACE_TLS_VAR(struct slow_thread, slow_thread, (struct slow_thread) { .capture = CAPTURE_NONE }, NULL);
+
+void xtrace_slow_setup(const char* slow_us) {
+	uint64_t us = 0;
+
+	if (slow_us == NULL || slow_us[0] == '\0') {
+		return;
+	}
+
+	strlcpy(slow_us_string, slow_us, sizeof(slow_us_string));
+
+	for (const char* ptr = slow_us; *ptr >= '0' && *ptr <= '9'; ++ptr) {
+		us = us * 10 + (*ptr - '0');
+	}
+
+	xtrace_slow_ns = us * 1000;
+};
+
+const char* xtrace_slow_us_string(void) {
+	return slow_us_string;
+};
+
+// prints what was held back for the given depth
+static void print_held(struct slow_thread* thread, int depth) {
+	// xtrace_log() formats into a fixed-size buffer, so print it in pieces
+	for (size_t offset = 0; offset < thread->lengths[depth]; offset += 256) {
+		char piece[257];
+		size_t length = thread->lengths[depth] - offset;
+
+		if (length > 256) {
+			length = 256;
+		}
+		memcpy(piece, &thread->buffers[depth][offset], length);
+		piece[length] = '\0';
+		xtrace_log("%s", piece);
+	}
+
+	thread->held[depth] = false;
+};
+
+// prints the held back entries of the calls a call at the given depth is nested in, outermost first,
+// so that they come before its own output
+static void print_outer(struct slow_thread* thread, int depth) {
+	for (int i = 0; i < depth && i < SLOW_MAX_DEPTH; ++i) {
+		if (!thread->held[i]) {
+			continue;
+		}
+
+		print_held(thread, i);
+		if (thread->lengths[i] == 0 || thread->buffers[i][thread->lengths[i] - 1] != '\n') {
+			xtrace_log("\n");
+		}
+		thread->printed_early[i] = true;
+	}
+};
+
+void xtrace_slow_entry(int depth) {
+	struct slow_thread* thread = get_ptr_slow_thread();
+
+	if (depth >= SLOW_MAX_DEPTH) {
+		// this one is printed right away
+		thread->capture = CAPTURE_NONE;
+		print_outer(thread, depth);
+		return;
+	}
+
+	thread->capture = depth;
+	thread->held[depth] = true;
+	thread->printed_early[depth] = false;
+	thread->lengths[depth] = 0;
+};
+
+bool xtrace_slow_exit(int depth, uint64_t duration, int* force_split) {
+	struct slow_thread* thread = get_ptr_slow_thread();
+
+	thread->capture = CAPTURE_NONE;
+
+	if (depth >= SLOW_MAX_DEPTH) {
+		return true;
+	}
+
+	if (thread->printed_early[depth]) {
+		// the entry is already out, with nested calls after it; the exit has to say again which call it is for
+		*force_split = 1;
+		return true;
+	}
+
+	if (duration < xtrace_slow_ns) {
+		thread->held[depth] = false;
+		thread->capture = CAPTURE_DROP;
+		return false;
+	}
+
+	print_outer(thread, depth);
+	print_held(thread, depth);
+
+	return true;
+};
+
+bool xtrace_slow_capture(const char* format, va_list args) {
+	struct slow_thread* thread = get_ptr_slow_thread();
+	size_t* length;
+	char* buffer;
+
+	if (thread->capture == CAPTURE_NONE) {
+		return false;
+	}
+	if (thread->capture == CAPTURE_DROP) {
+		return true;
+	}
+
+	length = &thread->lengths[thread->capture];
+	buffer = thread->buffers[thread->capture];
+
+	// if it doesn't fit, the rest of the entry just gets cut off
+	if (*length < SLOW_BUFFER_SIZE - 1) {
+		__simple_vsnprintf(buffer + *length, SLOW_BUFFER_SIZE - *length, format, args);
+		*length += __simple_strlen(buffer + *length);
+	}
+
+	return true;
+};
@@ -0,0 +1,36 @@
+#ifndef _XTRACE_SLOW_H_
+#define _XTRACE_SLOW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "base.h"
+
+// slow call mode
+//
+// with XTRACE_SLOW_US, a call is only printed if it took at least that long. since that's only known once it returns,
+// everything printed for a call on its entry is held back in a per-thread buffer until its exit, and then either printed or dropped.
+
+XTRACE_DECLARATIONS_BEGIN;
+
+// the threshold, in nanoseconds; 0 if the mode is off
+extern uint64_t xtrace_slow_ns;
+
+void xtrace_slow_setup(const char* slow_us);
+const char* xtrace_slow_us_string(void);
+
+// starts holding back output for a call entered at the given depth
+void xtrace_slow_entry(int depth);
+
+// stops holding back output for the call at the given depth; if it took long enough, prints what was held back and returns `true`,
+// otherwise the output for the rest of the call's exit is dropped and it returns `false`.
+// the entries of outer calls that are still held back are printed first; if the call's own entry was printed that way
+// (because a slow call nested in it was printed), `*force_split` is set
+bool xtrace_slow_exit(int depth, uint64_t duration, int* force_split);
+
+// called by xtrace_log_v(); returns `true` if the output was held back or dropped
+bool xtrace_slow_capture(const char* format, va_list args);
+
+XTRACE_DECLARATIONS_END;
+
+#endif // _XTRACE_SLOW_H_
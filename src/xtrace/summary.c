@@ -0,0 +1,436 @@
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <mach/message.h>
+#include <mach/mach_time.h>
+#include <darling/emulation/simple.h>
+#include <darling/emulation/ext/for-xtrace.h>
+
+#include "summary.h"
+#include "xtracelib.h"
+#include "bsd_trace.h"
+#include "mach_trace.h"
+#include "mig_trace.h"
+#include "tls.h"
+
+extern int sys_thread_selfid(void);
+
+#define MAX_DEPTH 64
+
+// these match the sizes of the call tables in bsd_trace.cpp and mach_trace.cpp
+#define BSD_CALLS 600
+#define MACH_CALLS 128
+
+// MIG routines are keyed by message ID; a thread rarely talks to more than a handful of them
+#define MIG_SLOTS 128
+
+struct call_stats {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+struct mig_stats {
+	bool used;
+	int32_t id;
+	struct call_stats stats;
+};
+
+struct pending_call {
+	uint64_t start;
+	int type;
+	int nr;
+	bool has_mig;
+	int32_t mig_id;
+};
+
+struct summary_thread {
+	struct summary_thread* next;
+	int tid;
+	int last_depth;
+	struct call_stats bsd[BSD_CALLS];
+	struct call_stats mach[MACH_CALLS];
+	struct mig_stats mig[MIG_SLOTS];
+	// the calls we're currently inside of, indexed by depth
+	struct pending_call pending[MAX_DEPTH];
+};
+
+int xtrace_summary = 0;
+
+static int summary_signal = 0;
+static int summary_printed_on_exit = 0;
+
+// set by the signal handler; the summary is printed by whichever thread enters or leaves a call next
+static int summary_requested = 0;
+
+// every thread's table, including those of threads that have already exited
+static struct summary_thread* summary_threads = NULL;
+
+DEFINE_XTRACE_TLS_VAR(struct summary_thread*, summary_thread, NULL, NULL);
+
+static void summary_signal_handler(int signum) {
+	// printing takes xtrace's output lock (and allocates), so it can't happen here
+	__atomic_store_n(&summary_requested, 1, __ATOMIC_RELAXED);
+};
+
+static void summary_check_requested(void) {
+	if (__atomic_load_n(&summary_requested, __ATOMIC_RELAXED) && __atomic_exchange_n(&summary_requested, 0, __ATOMIC_RELAXED)) {
+		xtrace_summary_print();
+	}
+};
+
+void xtrace_summary_setup(int enable, const char* signal) {
+	xtrace_summary = enable;
+
+	if (!enable) {
+		return;
+	}
+
+	summary_signal = 0;
+	for (const char* ptr = signal; ptr && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+		summary_signal = summary_signal * 10 + (*ptr - '0');
+	}
+
+	if (summary_signal > 0 && summary_signal < NSIG) {
+		// this runs before tracing is enabled, so we can use libSystem
+		struct sigaction action = {0};
+		action.sa_handler = summary_signal_handler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(summary_signal, &action, NULL);
+	} else {
+		summary_signal = 0;
+	}
+};
+
+int xtrace_summary_signal(void) {
+	return summary_signal;
+};
+
+static struct summary_thread* summary_thread_get(void) {
+	struct summary_thread* thread = get_summary_thread();
+
+	if (thread != NULL) {
+		return thread;
+	}
+
+	// mmap'd memory is already zeroed
+	thread = _mmap_for_xtrace(NULL, sizeof(*thread), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if ((unsigned long)thread > (unsigned long)-4096) {
+		xtrace_abort("xtrace: failed to allocate summary table");
+	}
+
+	thread->tid = sys_thread_selfid();
+	thread->next = __atomic_load_n(&summary_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&summary_threads, &thread->next, thread, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	set_summary_thread(thread);
+	return thread;
+};
+
+void xtrace_summary_process_exit(void) {
+	// the process is about to go away; this is our last chance
+	if (__atomic_exchange_n(&summary_printed_on_exit, 1, __ATOMIC_RELAXED) == 0) {
+		xtrace_summary_print();
+	}
+};
+
+void xtrace_summary_entry(int type, int nr, int depth) {
+	struct summary_thread* thread = summary_thread_get();
+
+	summary_check_requested();
+
+	if (depth < 0 || depth >= MAX_DEPTH) {
+		return;
+	}
+
+	thread->last_depth = depth;
+	thread->pending[depth] = (struct pending_call) {
+		.type = type,
+		.nr = nr,
+		.has_mig = false,
+		.start = mach_absolute_time(),
+	};
+};
+
+void xtrace_summary_note_mig(int32_t msgh_id) {
+	struct summary_thread* thread = summary_thread_get();
+	struct pending_call* call = &thread->pending[thread->last_depth];
+
+	call->has_mig = true;
+	call->mig_id = msgh_id;
+};
+
+static void account(struct call_stats* stats, uint64_t duration, bool error) {
+	stats->calls++;
+	if (error)
+		stats->errors++;
+	stats->total_ns += duration;
+	if (duration > stats->max_ns)
+		stats->max_ns = duration;
+};
+
+static struct mig_stats* mig_slot(struct mig_stats* table, size_t size, int32_t id) {
+	size_t index = ((uint32_t)id * 2654435761u) % size;
+
+	for (size_t i = 0; i < size; i++) {
+		struct mig_stats* slot = &table[(index + i) % size];
+
+		if (!slot->used) {
+			slot->used = true;
+			slot->id = id;
+			return slot;
+		}
+
+		if (slot->id == id) {
+			return slot;
+		}
+	}
+
+	// the table is full; the routine just isn't counted
+	return NULL;
+};
+
+void xtrace_summary_exit(int depth, uintptr_t retval) {
+	uint64_t now = mach_absolute_time();
+	struct summary_thread* thread = summary_thread_get();
+	struct pending_call* call;
+	uint64_t duration;
+	bool error;
+
+	if (depth < 0 || depth >= MAX_DEPTH) {
+		return;
+	}
+
+	call = &thread->pending[depth];
+
+	// e.g. fork() returning in the child
+	if (call->start == 0) {
+		return;
+	}
+
+	duration = now - call->start;
+	call->start = 0;
+
+	if (call->type == XTRACE_CALL_BSD) {
+		intptr_t v = (intptr_t)retval;
+		error = v < 0 && v >= -4095;
+
+		if (call->nr >= 0 && call->nr < BSD_CALLS) {
+			account(&thread->bsd[call->nr], duration, error);
+		}
+	} else {
+		error = xtrace_mach_call_failed(call->nr, retval);
+
+		if (call->nr >= 0 && call->nr < MACH_CALLS) {
+			account(&thread->mach[call->nr], duration, error);
+		}
+	}
+
+	if (call->has_mig) {
+		struct mig_stats* slot = mig_slot(thread->mig, MIG_SLOTS, call->mig_id);
+		if (slot) {
+			account(&slot->stats, duration, error);
+		}
+	}
+
+	summary_check_requested();
+};
+
+void xtrace_summary_postfork_child(void) {
+	// the parent's tables stay with the parent; they're simply abandoned here
+	__atomic_store_n(&summary_threads, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&summary_printed_on_exit, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&summary_requested, 0, __ATOMIC_RELAXED);
+	set_summary_thread(NULL);
+};
+
+//
+// printing
+//
+// this runs in the middle of a traced call, so it only uses our own output functions and mmap
+//
+
+struct summary_row {
+	int type;
+	int nr;
+	struct call_stats stats;
+};
+
+// a third kind of row, next to XTRACE_CALL_BSD and XTRACE_CALL_MACH
+#define ROW_MIG 3
+
+static void print_padded(const char* string, int width) {
+	for (int length = __simple_strlen(string); length < width; ++length)
+		xtrace_log(" ");
+	xtrace_log("%s", string);
+};
+
+static void print_number(uint64_t number, int width) {
+	char buffer[32];
+	__simple_snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)number);
+	print_padded(buffer, width);
+};
+
+// like print_number, but takes nanoseconds and prints microseconds with three decimals
+static void print_usec(uint64_t ns, int width) {
+	char buffer[32];
+	uint64_t frac = ns % 1000;
+
+	// __simple_snprintf can't pad numbers
+	__simple_snprintf(buffer, sizeof(buffer), "%llu.%s%s%llu", (unsigned long long)(ns / 1000),
+		frac < 100 ? "0" : "", frac < 10 ? "0" : "", (unsigned long long)frac);
+	print_padded(buffer, width);
+};
+
+static void print_row_name(const struct summary_row* row) {
+	const char* name = NULL;
+	const char* subsystem;
+	const char* routine;
+	int is_reply;
+
+	switch (row->type) {
+		case XTRACE_CALL_BSD:
+			name = xtrace_bsd_call_name(row->nr);
+			if (name)
+				xtrace_log("%s", name);
+			else
+				xtrace_log("bsd %d", row->nr);
+			break;
+		case XTRACE_CALL_MACH:
+			name = xtrace_mach_call_name(row->nr);
+			if (name)
+				xtrace_log("%s", name);
+			else
+				xtrace_log("mach %d", row->nr);
+			break;
+		case ROW_MIG:
+			if (xtrace_find_mig_routine(row->nr, &subsystem, &routine, &is_reply))
+				xtrace_log("%s::%s", subsystem, routine);
+			else
+				xtrace_log("MIG msgh_id %d", row->nr);
+			break;
+	}
+};
+
+static void print_stats(const struct call_stats* stats) {
+	print_number(stats->calls, 10);
+	print_number(stats->errors, 10);
+	print_number(stats->total_ns / 1000, 13);
+	print_usec(stats->calls ? stats->total_ns / stats->calls : 0, 12);
+	print_usec(stats->max_ns, 12);
+	xtrace_log("  ");
+};
+
+static void merge(struct call_stats* into, const struct call_stats* from) {
+	into->calls += from->calls;
+	into->errors += from->errors;
+	into->total_ns += from->total_ns;
+	if (from->max_ns > into->max_ns)
+		into->max_ns = from->max_ns;
+};
+
+static size_t add_row(struct summary_row* rows, size_t count, int type, int nr, const struct call_stats* stats) {
+	if (stats->calls == 0)
+		return count;
+
+	for (size_t i = 0; i < count; i++) {
+		if (rows[i].type == type && rows[i].nr == nr) {
+			merge(&rows[i].stats, stats);
+			return count;
+		}
+	}
+
+	rows[count].type = type;
+	rows[count].nr = nr;
+	rows[count].stats = *stats;
+	return count + 1;
+};
+
+// prints the table for the given thread, or for all threads combined if `only` is NULL
+static void print_table(struct summary_thread* only, struct summary_row* rows) {
+	struct call_stats total = {0};
+	size_t count = 0;
+
+	for (struct summary_thread* thread = __atomic_load_n(&summary_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next) {
+		if (only && thread != only)
+			continue;
+
+		for (int i = 0; i < BSD_CALLS; i++)
+			count = add_row(rows, count, XTRACE_CALL_BSD, i, &thread->bsd[i]);
+		for (int i = 0; i < MACH_CALLS; i++)
+			count = add_row(rows, count, XTRACE_CALL_MACH, i, &thread->mach[i]);
+		for (int i = 0; i < MIG_SLOTS; i++)
+			if (thread->mig[i].used)
+				count = add_row(rows, count, ROW_MIG, thread->mig[i].id, &thread->mig[i].stats);
+	}
+
+	if (count == 0)
+		return;
+
+	// most expensive first
+	for (size_t i = 1; i < count; i++) {
+		struct summary_row row = rows[i];
+		size_t j = i;
+
+		for (; j > 0 && rows[j - 1].stats.total_ns < row.stats.total_ns; j--)
+			rows[j] = rows[j - 1];
+
+		rows[j] = row;
+	}
+
+	if (only)
+		xtrace_log("\nxtrace summary for thread %d:\n", only->tid);
+	else
+		xtrace_log("\nxtrace summary for all threads:\n");
+
+	print_padded("calls", 10);
+	print_padded("errors", 10);
+	print_padded("total (us)", 13);
+	print_padded("mean (us)", 12);
+	print_padded("max (us)", 12);
+	xtrace_log("  call\n");
+
+	for (size_t i = 0; i < count; i++) {
+		print_stats(&rows[i].stats);
+		print_row_name(&rows[i]);
+		xtrace_log("\n");
+
+		// MIG routines are made through mach_msg, so they're already part of the total
+		if (rows[i].type != ROW_MIG)
+			merge(&total, &rows[i].stats);
+	}
+
+	print_stats(&total);
+	xtrace_log("total\n");
+};
+
+void xtrace_summary_print(void) {
+	size_t threads = 0;
+	size_t rows_size;
+	struct summary_row* rows;
+
+	for (struct summary_thread* thread = __atomic_load_n(&summary_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next)
+		++threads;
+
+	if (threads == 0)
+		return;
+
+	rows_size = sizeof(struct summary_row) * (BSD_CALLS + MACH_CALLS + MIG_SLOTS * threads);
+	rows = _mmap_for_xtrace(NULL, rows_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if ((unsigned long)rows > (unsigned long)-4096) {
+		xtrace_error("xtrace: failed to allocate memory for the summary\n");
+		return;
+	}
+
+	for (struct summary_thread* thread = __atomic_load_n(&summary_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next)
+		print_table(thread, rows);
+
+	if (threads > 1)
+		print_table(NULL, rows);
+
+	_munmap_for_xtrace(rows, rows_size);
+};
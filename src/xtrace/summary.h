@@ -0,0 +1,33 @@
+#ifndef _XTRACE_SUMMARY_H_
+#define _XTRACE_SUMMARY_H_
+
+#include <stdint.h>
+#include "base.h"
+
+// summary mode
+//
+// like `strace -c`: calls aren't printed, only counted (along with errors and the time spent in them) in per-thread tables.
+// the tables are printed (per thread and combined, sorted by total time) when the process exits, and after it receives
+// XTRACE_SUMMARY_SIGNAL (by the next thread to enter or leave a call, since printing isn't async-signal-safe).
+
+XTRACE_DECLARATIONS_BEGIN;
+
+extern int xtrace_summary;
+
+void xtrace_summary_setup(int enable, const char* signal);
+int xtrace_summary_signal(void);
+
+void xtrace_summary_entry(int type, int nr, int depth);
+void xtrace_summary_exit(int depth, uintptr_t retval);
+void xtrace_summary_note_mig(int32_t msgh_id);
+
+void xtrace_summary_print(void);
+
+// called on exit(), even if the call itself is filtered out
+void xtrace_summary_process_exit(void);
+
+void xtrace_summary_postfork_child(void);
+
+XTRACE_DECLARATIONS_END;
+
+#endif // _XTRACE_SUMMARY_H_
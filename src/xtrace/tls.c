@@ -27,10 +27,7 @@ struct tls_table {
 };
 
 // since we still need to handle some calls after pthread_terminate is called and libpthread unwinds its TLS right before calling pthread_terminate,
-// we have to use a slightly hackier technique: using one of the system's reserved but unused TLS keys.
-// key 200 seems like a good fit; it's in the reserved region but it's not currently listed in `pthread/tsd_private.h` as being in-use by anything.
-
-#define __PTK_XTRACE_TLS 200
+// we have to use a slightly hackier technique: using one of the system's reserved but unused TLS keys (__PTK_XTRACE_TLS; see tls.h).
 
 // TODO: also perform TLS cleanup for other threads when doing a fork
 
@@ -44,12 +41,14 @@ void xtrace_tls_thread_cleanup(void) {
 	for (size_t i = 0; i < table->size; ++i) {
 		if (table->table[i][2]) {
 			xtrace_tls_debug("destroying value %p for key %p", table->table[i][1], table->table[i][0]);
-			((xtrace_tls_destructor_f)table->table[i][2])(table->table[1]);
+			((xtrace_tls_destructor_f)table->table[i][2])(table->table[i][1]);
 		}
 		xtrace_tls_debug("freeing value %p for key %p", table->table[i][1], table->table[i][0]);
 		xtrace_free(table->table[i][1]);
 	}
 	xtrace_tls_debug("freeing table %p", table);
+	// the thread still makes a few calls after this; make sure they don't find the freed table
+	_pthread_setspecific_direct(__PTK_XTRACE_TLS, NULL);
 	xtrace_free(table);
 };
 
@@ -8,6 +8,13 @@
 
 XTRACE_DECLARATIONS_BEGIN;
 
+// Per-thread state that has to outlive libpthread's own TLS (which it tears down right before pthread_terminate)
+// is kept in TSD slots from the range libpthread reserves for the system. The slots that are taken
+// are listed as __PTK_* in libpthread's private/tsd_private.h (src/external/libpthread); 200 and 201
+// aren't among them. If libpthread ever claims them, these have to move.
+#define __PTK_XTRACE_TLS 200
+#define __PTK_XTRACE_MALLOC 201
+
 typedef void (*xtrace_tls_destructor_f)(void* value);
 
 #define DEFINE_XTRACE_TLS_VAR(type, name, default_value, destructor) \
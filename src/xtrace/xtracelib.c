@@ -10,6 +10,12 @@
 #include "tls.h"
 #include "lock.h"
 #include "malloc.h"
+#include "binary.h"
+#include "summary.h"
+#include "filter.h"
+#include "slow.h"
+#include "control.h"
+#include <mach/mach_time.h>
 #include <limits.h>
 
 #include <darling/emulation/ext/for-xtrace.h>
@@ -64,6 +70,15 @@ void xtrace_setup()
 {
 	xtrace_setup_options();
 	xtrace_setup_mig_tracing();
+
+	// `xtrace --decode` only needs the formatters; nothing gets traced
+	const char* decode_path = getenv("XTRACE_DECODE");
+	if (decode_path != NULL && decode_path[0] != '\0') {
+		exit(xtrace_binary_decode(decode_path) == 0 ? 0 : 1);
+	}
+
+	xtrace_mig_start_loader();
+
 	xtrace_setup_mach();
 	xtrace_setup_bsd();
 	xtrace_setup_misc_hooks();
@@ -132,6 +147,11 @@ static void xtrace_setup_options(void)
 	xtrace_no_color = string_is_truthy(getenv("XTRACE_NO_COLOR"));
 	xtrace_kprintf = string_is_truthy(getenv("XTRACE_KPRINTF"));
 	xtrace_use_per_thread_logfile = string_is_truthy(getenv("XTRACE_LOG_FILE_PER_THREAD"));
+	xtrace_binary_setup(getenv("XTRACE_BINARY"));
+	xtrace_summary_setup(string_is_truthy(getenv("XTRACE_SUMMARY")), getenv("XTRACE_SUMMARY_SIGNAL"));
+	xtrace_filter_setup(getenv("XTRACE_FILTER"), getenv("XTRACE_SAMPLE"), getenv("XTRACE_SAMPLE_US"));
+	xtrace_slow_setup(getenv("XTRACE_SLOW_US"));
+	xtrace_control_setup(string_is_truthy(getenv("XTRACE_DORMANT")), getenv("XTRACE_CONTROL_SIGNAL"), getenv("XTRACE_CONTROL_FILE"));
 
 	if (xtrace_log_file != NULL && xtrace_log_file[0] != '\0') {
 		xtrace_use_logfile = 1;
@@ -268,16 +288,57 @@ struct nested_call_struct {
 	int previous_level;
 	// Call numbers, indexed by current level.
 	int nrs[64];
+	// mach_absolute_time() when each call was entered, indexed by current level.
+	uint64_t start_times[64];
 };
 
 DEFINE_XTRACE_TLS_VAR(struct nested_call_struct, nested_call, (struct nested_call_struct) {0}, NULL);
 
+void xtrace_reset_nested_calls(void)
+{
+	get_ptr_nested_call()->current_level = 0;
+	get_ptr_nested_call()->previous_level = 0;
+}
+
+int xtrace_recording(void)
+{
+	return xtrace_binary || xtrace_summary;
+}
+
+// records the ID of the message a mach_msg call is sending, for the MIG routine it belongs to
+void xtrace_note_mig(int32_t msgh_id)
+{
+	if (xtrace_binary)
+		xtrace_binary_note_mig(msgh_id);
+	if (xtrace_summary)
+		xtrace_summary_note_mig(msgh_id);
+}
+
 void handle_generic_entry(const struct calldef* defs, const char* type, int nr, void* args[])
 {
 	if (xtrace_ignore)
 		return;
 
-	if (get_ptr_nested_call()->previous_level < get_ptr_nested_call()->current_level && !xtrace_split_entry_and_exit)
+	if (xtrace_recording())
+	{
+		int kind = type[0] == 'b' ? XTRACE_CALL_BSD : XTRACE_CALL_MACH;
+		int level = get_ptr_nested_call()->current_level;
+
+		if (xtrace_binary)
+			xtrace_binary_entry(kind, nr, args, level);
+		if (xtrace_summary)
+			xtrace_summary_entry(kind, nr, level);
+
+		get_ptr_nested_call()->previous_level = get_ptr_nested_call()->current_level++;
+		return;
+	}
+
+	if (xtrace_slow_ns != 0)
+	{
+		// The output for any earlier entry without an exit is being held back on its own.
+		xtrace_slow_entry(get_ptr_nested_call()->current_level);
+	}
+	else if (get_ptr_nested_call()->previous_level < get_ptr_nested_call()->current_level && !xtrace_split_entry_and_exit)
 	{
 		// We are after an earlier entry without an exit.
 		xtrace_log("\n");
@@ -300,22 +361,60 @@ void handle_generic_entry(const struct calldef* defs, const char* type, int nr,
 	if (xtrace_split_entry_and_exit)
 		xtrace_log("\n");
 
+	get_ptr_nested_call()->start_times[get_ptr_nested_call()->current_level] = mach_absolute_time();
 	get_ptr_nested_call()->previous_level = get_ptr_nested_call()->current_level++;
 }
 
+// prints the duration in microseconds with three decimals; __simple_printf can't pad numbers
+static void print_duration(uint64_t ns)
+{
+	uint64_t frac = ns % 1000;
+
+	xtrace_set_gray_color();
+	xtrace_log(" (%llu.%s%s%llu us)", (unsigned long long)(ns / 1000),
+		frac < 100 ? "0" : "", frac < 10 ? "0" : "", (unsigned long long)frac);
+	xtrace_reset_color();
+}
+
 
 void handle_generic_exit(const struct calldef* defs, const char* type, uintptr_t retval, int force_split)
 {
+	uint64_t now = mach_absolute_time();
+
 	if (xtrace_ignore)
 		return;
 
-	if (get_ptr_nested_call()->previous_level > get_ptr_nested_call()->current_level)
+	if (get_ptr_nested_call()->current_level <= 0)
+	{
+		// We never saw the entry (e.g. it was made before tracing was started).
+		return;
+	}
+
+	if (xtrace_recording())
+	{
+		get_ptr_nested_call()->previous_level = get_ptr_nested_call()->current_level--;
+
+		if (xtrace_binary)
+			xtrace_binary_exit(get_ptr_nested_call()->current_level, retval);
+		if (xtrace_summary)
+			xtrace_summary_exit(get_ptr_nested_call()->current_level, retval);
+
+		return;
+	}
+
+	if (get_ptr_nested_call()->previous_level > get_ptr_nested_call()->current_level && xtrace_slow_ns == 0)
 	{
 		// We are after an exit, so our call has been split up.
+		// (Not so if we're only printing slow calls; then the entry has been held back, and comes right before this,
+		// unless xtrace_slow_exit() says otherwise.)
 		force_split = 1;
 	}
 	get_ptr_nested_call()->previous_level = get_ptr_nested_call()->current_level--;
 	int nr = get_ptr_nested_call()->nrs[get_ptr_nested_call()->current_level];
+	uint64_t duration = now - get_ptr_nested_call()->start_times[get_ptr_nested_call()->current_level];
+
+	if (xtrace_slow_ns != 0 && !xtrace_slow_exit(get_ptr_nested_call()->current_level, duration, &force_split))
+		return;
 
 	if (xtrace_split_entry_and_exit || force_split)
 	{
@@ -329,12 +428,12 @@ void handle_generic_exit(const struct calldef* defs, const char* type, uintptr_t
 	xtrace_reset_color();
 
 	if (defs[nr].name != NULL && defs[nr].print_retval != NULL)
-	{
 		defs[nr].print_retval(nr, retval);
-		xtrace_log("\n");
-	}
 	else
-		xtrace_log("0x%lx\n", retval);
+		xtrace_log("0x%lx", retval);
+
+	print_duration(duration);
+	xtrace_log("\n");
 }
 
 void xtrace_log(const char* format, ...) {
@@ -386,6 +485,10 @@ static void ensure_logfile(void) {
 };
 
 void xtrace_log_v(const char* format, va_list args) {
+	if (xtrace_slow_ns != 0 && xtrace_slow_capture(format, args)) {
+		return;
+	}
+
 	if (xtrace_kprintf) {
 		char real_format[512] = "xtrace: ";
 		strlcpy(&real_format[0] + (sizeof("xtrace: ") - 1), format, sizeof(real_format) - (sizeof("xtrace: ") - 1));
@@ -429,6 +532,7 @@ void xtrace_abort(const char* message) {
 
 static void xtrace_thread_exit_hook(void) {
 	xtrace_tls_thread_cleanup();
+	xtrace_malloc_thread_cleanup();
 };
 
 static size_t envp_count(const char** envp) {
@@ -524,6 +628,26 @@ static void xtrace_execve_inject_hook(const char*** envp_ptr) {
 	envp_set(envp_ptr, "XTRACE_KPRINTF",              xtrace_kprintf                ? "1" : "0", &allocated);
 	envp_set(envp_ptr, "XTRACE_LOG_FILE_PER_THREAD",  xtrace_use_per_thread_logfile ? "1" : "0", &allocated);
 	envp_set(envp_ptr, "XTRACE_LOG_FILE",             xtrace_use_logfile            ? xtrace_logfile_base : "", &allocated);
+	envp_set(envp_ptr, "XTRACE_BINARY",               xtrace_binary_path_base(), &allocated);
+	envp_set(envp_ptr, "XTRACE_SUMMARY",              xtrace_summary                ? "1" : "0", &allocated);
+	envp_set(envp_ptr, "XTRACE_FILTER",               xtrace_filter_string(), &allocated);
+	envp_set(envp_ptr, "XTRACE_SAMPLE",               xtrace_sample_string(), &allocated);
+	envp_set(envp_ptr, "XTRACE_SAMPLE_US",            xtrace_sample_us_string(), &allocated);
+	envp_set(envp_ptr, "XTRACE_SLOW_US",              xtrace_slow_us_string(), &allocated);
+	envp_set(envp_ptr, "XTRACE_DORMANT",              xtrace_dormant                ? "1" : "0", &allocated);
+	envp_set(envp_ptr, "XTRACE_CONTROL_FILE",         xtrace_control_file_string(), &allocated);
+
+	if (xtrace_summary_signal() != 0) {
+		char signal[16];
+		__simple_snprintf(signal, sizeof(signal), "%d", xtrace_summary_signal());
+		envp_set(envp_ptr, "XTRACE_SUMMARY_SIGNAL", signal, &allocated);
+	}
+
+	if (xtrace_control_signal() != 0) {
+		char signal[16];
+		__simple_snprintf(signal, sizeof(signal), "%d", xtrace_control_signal());
+		envp_set(envp_ptr, "XTRACE_CONTROL_SIGNAL", signal, &allocated);
+	}
 
 	const char* insert_libraries = envp_get(*envp_ptr, "DYLD_INSERT_LIBRARIES");
 	size_t insert_libraries_length = insert_libraries ? strlen(insert_libraries) : 0;
@@ -557,4 +681,15 @@ static void xtrace_postfork_child_hook(void) {
 		}
 		set_xtrace_per_thread_logfile(-1);
 	}
+
+	if (xtrace_binary) {
+		xtrace_binary_postfork_child();
+	}
+
+	if (xtrace_summary) {
+		xtrace_summary_postfork_child();
+	}
+
+	xtrace_mig_postfork_child();
+	xtrace_control_postfork_child();
 };
@@ -3,6 +3,12 @@
 #include <stdint.h>
 #include <darling/emulation/simple.h>
 
+// kinds of calls we trace
+enum {
+	XTRACE_CALL_BSD = 1,
+	XTRACE_CALL_MACH = 2,
+};
+
 struct calldef
 {
 	const char* name;
@@ -17,6 +23,13 @@ extern "C" {
 void handle_generic_entry(const struct calldef* defs, const char* type, int nr, void* args[]);
 void handle_generic_exit(const struct calldef* defs, const char* type, uintptr_t retval, int force_split);
 
+// whether calls are only being recorded (in a binary trace or a summary) instead of printed
+int xtrace_recording(void);
+void xtrace_note_mig(int32_t msgh_id);
+
+// forgets about the calls the current thread is inside of (see control.h)
+void xtrace_reset_nested_calls(void);
+
 extern int xtrace_no_color;
 void xtrace_set_gray_color(void);
 void xtrace_reset_color(void);
@@ -0,0 +1,139 @@
+// Random 4 KiB read IOPS: POSIX AIO at a fixed queue depth vs. synchronous pread
+// Usage: aio_randread [file size in MiB] [queue depth] [seconds]
+#include <aio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 4096
+#define MAX_DEPTH AIO_LISTIO_MAX
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static off_t random_offset(off_t blocks)
+{
+	return (off_t)(arc4random_uniform((uint32_t) blocks)) * BLOCK_SIZE;
+}
+
+int main(int argc, const char** argv)
+{
+	int size_mb = (argc > 1) ? atoi(argv[1]) : 256;
+	int depth = (argc > 2) ? atoi(argv[2]) : MAX_DEPTH;
+	int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+	char path[] = "/tmp/aio_randread.XXXXXX";
+	static char buffers[MAX_DEPTH][BLOCK_SIZE];
+	struct aiocb cbs[MAX_DEPTH];
+	const struct aiocb* list[MAX_DEPTH];
+	off_t blocks = (off_t) size_mb * 1024 * 1024 / BLOCK_SIZE;
+	unsigned long ops;
+	double start, elapsed;
+	int fd, i;
+
+	if (depth < 1 || depth > MAX_DEPTH)
+		depth = MAX_DEPTH;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(path);
+
+	memset(buffers, 0xa5, sizeof(buffers));
+	for (off_t b = 0; b < blocks; b++)
+	{
+		if (write(fd, buffers[0], BLOCK_SIZE) != BLOCK_SIZE)
+		{
+			perror("write");
+			return 1;
+		}
+	}
+	fsync(fd);
+
+	// synchronous baseline
+	ops = 0;
+	start = now();
+	while ((elapsed = now() - start) < seconds)
+	{
+		for (i = 0; i < 256; i++)
+		{
+			if (pread(fd, buffers[0], BLOCK_SIZE, random_offset(blocks)) != BLOCK_SIZE)
+			{
+				perror("pread");
+				return 1;
+			}
+		}
+		ops += 256;
+	}
+	printf("pread:     %10.0f IOPS\n", ops / elapsed);
+
+	// AIO, keeping `depth` requests in flight
+	memset(cbs, 0, sizeof(cbs));
+	for (i = 0; i < depth; i++)
+	{
+		cbs[i].aio_fildes = fd;
+		cbs[i].aio_buf = buffers[i];
+		cbs[i].aio_nbytes = BLOCK_SIZE;
+		cbs[i].aio_offset = random_offset(blocks);
+		list[i] = &cbs[i];
+
+		if (aio_read(&cbs[i]) != 0)
+		{
+			perror("aio_read");
+			return 1;
+		}
+	}
+
+	ops = 0;
+	start = now();
+	while ((elapsed = now() - start) < seconds)
+	{
+		if (aio_suspend(list, depth, NULL) != 0 && errno != EINTR)
+		{
+			perror("aio_suspend");
+			return 1;
+		}
+
+		for (i = 0; i < depth; i++)
+		{
+			int err = aio_error(&cbs[i]);
+			if (err == EINPROGRESS)
+				continue;
+			if (err != 0 || aio_return(&cbs[i]) != BLOCK_SIZE)
+			{
+				fprintf(stderr, "request failed: %s\n", strerror(err));
+				return 1;
+			}
+
+			ops++;
+			cbs[i].aio_offset = random_offset(blocks);
+			if (aio_read(&cbs[i]) != 0)
+			{
+				perror("aio_read");
+				return 1;
+			}
+		}
+	}
+	printf("aio (qd %2d): %8.0f IOPS\n", depth, ops / elapsed);
+
+	for (i = 0; i < depth; i++)
+	{
+		while (aio_error(&cbs[i]) == EINPROGRESS)
+			aio_suspend(&list[i], 1, NULL);
+		aio_return(&cbs[i]);
+	}
+
+	close(fd);
+	return 0;
+}
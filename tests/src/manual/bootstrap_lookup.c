@@ -0,0 +1,101 @@
+// launchd service lookup cost as the number of registered services grows:
+// registers services in batches and times bootstrap_look_up() on hits and misses after each one
+// Usage: bootstrap_lookup [max services] [lookups per step]
+#include <mach/mach.h>
+#include <servers/bootstrap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void service_name(name_t name, int i)
+{
+	snprintf(name, sizeof(name_t), "org.darlinghq.test.bootstrap-lookup.%d.%d", getpid(), i);
+}
+
+static double time_lookups(int registered, int lookups, int miss)
+{
+	double start = now();
+
+	for (int i = 0; i < lookups; i++)
+	{
+		name_t name;
+		mach_port_t port = MACH_PORT_NULL;
+		kern_return_t kr;
+
+		// misses look for names past the registered ones
+		service_name(name, miss ? registered + i : (int)(random() % registered));
+
+		kr = bootstrap_look_up(bootstrap_port, name, &port);
+		if (miss ? (kr != BOOTSTRAP_UNKNOWN_SERVICE) : (kr != KERN_SUCCESS))
+		{
+			fprintf(stderr, "bootstrap_look_up(%s): %s\n", name, bootstrap_strerror(kr));
+			exit(1);
+		}
+		if (port != MACH_PORT_NULL)
+			mach_port_deallocate(mach_task_self(), port);
+	}
+
+	return (now() - start) / lookups * 1e6;
+}
+
+int main(int argc, const char** argv)
+{
+	int max_services = (argc > 1) ? atoi(argv[1]) : 10000;
+	int lookups = (argc > 2) ? atoi(argv[2]) : 2000;
+	int registered = 0;
+
+	if (max_services < 1 || lookups < 1)
+	{
+		fprintf(stderr, "Usage: %s [max services] [lookups per step]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%10s %14s %14s %14s\n", "services", "register (us)", "hit (us)", "miss (us)");
+
+	for (int step = 10; ; step *= 10)
+	{
+		int target = (step < max_services) ? step : max_services;
+		double start = now();
+		int added = target - registered;
+
+		for (; registered < target; registered++)
+		{
+			name_t name;
+			mach_port_t port;
+			kern_return_t kr;
+
+			mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port);
+			mach_port_insert_right(mach_task_self(), port, port, MACH_MSG_TYPE_MAKE_SEND);
+
+			service_name(name, registered);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+			kr = bootstrap_register(bootstrap_port, name, port);
+#pragma clang diagnostic pop
+			if (kr != KERN_SUCCESS)
+			{
+				fprintf(stderr, "bootstrap_register(%s): %s\n", name, bootstrap_strerror(kr));
+				return 1;
+			}
+		}
+
+		printf("%10d %14.2f %14.2f %14.2f\n", registered,
+			(now() - start) / added * 1e6,
+			time_lookups(registered, lookups, 0),
+			time_lookups(registered, lookups, 1));
+
+		if (target == max_services)
+			break;
+	}
+
+	// launchd drops the services once we exit
+	return 0;
+}
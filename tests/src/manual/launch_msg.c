@@ -0,0 +1,75 @@
+// launch_msg() round-trip benchmark: times small requests (GetResourceLimits) and
+// GetJob requests carrying labels of growing size, which launchd answers with an error
+// Usage: launch_msg [round trips per size]
+#include <launch.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// LAUNCH_KEY_GETRESOURCELIMITS, from the private launch_priv.h
+#define GET_RESOURCE_LIMITS "GetResourceLimits"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char* label, launch_data_t msg, int runs)
+{
+	double start = now();
+
+	for (int i = 0; i < runs; i++)
+	{
+		launch_data_t resp = launch_msg(msg);
+		if (resp == NULL)
+		{
+			fprintf(stderr, "launch_msg(%s): %s\n", label, strerror(errno));
+			exit(1);
+		}
+		launch_data_free(resp);
+	}
+
+	printf("%-24s %10.2f us/round trip (%d runs)\n", label, (now() - start) / runs * 1e6, runs);
+}
+
+int main(int argc, const char** argv)
+{
+	int runs = (argc > 1) ? atoi(argv[1]) : 10000;
+	static const size_t label_sizes[] = { 16, 1024, 16 * 1024, 256 * 1024 };
+	launch_data_t msg;
+
+	if (runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [round trips per size]\n", argv[0]);
+		return 1;
+	}
+
+	msg = launch_data_new_string(GET_RESOURCE_LIMITS);
+	report(GET_RESOURCE_LIMITS, msg, runs);
+	launch_data_free(msg);
+
+	for (size_t i = 0; i < sizeof(label_sizes) / sizeof(label_sizes[0]); i++)
+	{
+		char name[32];
+		char* job_label = malloc(label_sizes[i] + 1);
+
+		// no job has this label, so the reply stays small and only the request grows
+		memset(job_label, 'x', label_sizes[i]);
+		job_label[label_sizes[i]] = '\0';
+
+		msg = launch_data_alloc(LAUNCH_DATA_DICTIONARY);
+		launch_data_dict_insert(msg, launch_data_new_string(job_label), LAUNCH_KEY_GETJOB);
+
+		snprintf(name, sizeof(name), "GetJob (%zu byte label)", label_sizes[i]);
+		report(name, msg, (label_sizes[i] > 16 * 1024) ? (runs + 9) / 10 : runs);
+
+		launch_data_free(msg);
+		free(job_label);
+	}
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+// Message round trip latency: two threads bouncing a small message between a pair of ports
+// whose receive rights never leave the task
+// Usage: mach_msg_pingpong [round trips]
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct ping_msg
+{
+	mach_msg_header_t header;
+	int payload[8];
+};
+
+struct ping_rcv
+{
+	struct ping_msg msg;
+	mach_msg_max_trailer_t trailer;
+};
+
+static int rounds;
+static mach_port_t ping, pong;
+
+static double elapsed_ns(uint64_t start)
+{
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (double)(mach_absolute_time() - start) * tb.numer / tb.denom;
+}
+
+static mach_port_t make_port(void)
+{
+	mach_port_t port;
+
+	if (mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port) != KERN_SUCCESS
+		|| mach_port_insert_right(mach_task_self(), port, port, MACH_MSG_TYPE_MAKE_SEND) != KERN_SUCCESS)
+	{
+		fprintf(stderr, "failed to allocate a port\n");
+		exit(1);
+	}
+
+	return port;
+}
+
+static void send_to(mach_port_t port, int i)
+{
+	struct ping_msg msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0),
+			.msgh_size = sizeof(msg),
+			.msgh_remote_port = port,
+			.msgh_id = 1234,
+		},
+	};
+	mach_msg_return_t ret;
+
+	msg.payload[0] = i;
+	ret = mach_msg(&msg.header, MACH_SEND_MSG, sizeof(msg), 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	if (ret != MACH_MSG_SUCCESS)
+	{
+		fprintf(stderr, "send failed: %x\n", ret);
+		exit(1);
+	}
+}
+
+static void receive_from(mach_port_t port, int i)
+{
+	struct ping_rcv rcv;
+	mach_msg_return_t ret;
+
+	ret = mach_msg(&rcv.msg.header, MACH_RCV_MSG, 0, sizeof(rcv), port, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+	if (ret != MACH_MSG_SUCCESS || rcv.msg.header.msgh_id != 1234 || rcv.msg.payload[0] != i)
+	{
+		fprintf(stderr, "receive failed: %x\n", ret);
+		exit(1);
+	}
+}
+
+static void* ponger(void* arg)
+{
+	for (int i = 0; i < rounds; i++)
+	{
+		receive_from(ping, i);
+		send_to(pong, i);
+	}
+	return NULL;
+}
+
+int main(int argc, const char** argv)
+{
+	pthread_t thread;
+	uint64_t start;
+
+	rounds = (argc > 1) ? atoi(argv[1]) : 100000;
+
+	ping = make_port();
+	pong = make_port();
+
+	pthread_create(&thread, NULL, ponger, NULL);
+	start = mach_absolute_time();
+	for (int i = 0; i < rounds; i++)
+	{
+		send_to(ping, i);
+		receive_from(pong, i);
+	}
+	printf("mach_msg: %8.0f ns per round trip\n", elapsed_ns(start) / rounds);
+	pthread_join(thread, NULL);
+
+	mach_port_mod_refs(mach_task_self(), ping, MACH_PORT_RIGHT_RECEIVE, -1);
+	mach_port_mod_refs(mach_task_self(), pong, MACH_PORT_RIGHT_RECEIVE, -1);
+	return 0;
+}
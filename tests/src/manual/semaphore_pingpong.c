@@ -0,0 +1,85 @@
+// Semaphore handoff latency: two threads bouncing between a pair of Mach semaphores
+// (and then a pair of dispatch semaphores, which use them under contention)
+// Usage: semaphore_pingpong [round trips]
+#include <dispatch/dispatch.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int rounds;
+static semaphore_t ping, pong;
+static dispatch_semaphore_t dping, dpong;
+
+static double elapsed_ns(uint64_t start)
+{
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (double)(mach_absolute_time() - start) * tb.numer / tb.denom;
+}
+
+static void* mach_ponger(void* arg)
+{
+	for (int i = 0; i < rounds; i++)
+	{
+		semaphore_wait(ping);
+		semaphore_signal(pong);
+	}
+	return NULL;
+}
+
+static void* dispatch_ponger(void* arg)
+{
+	for (int i = 0; i < rounds; i++)
+	{
+		dispatch_semaphore_wait(dping, DISPATCH_TIME_FOREVER);
+		dispatch_semaphore_signal(dpong);
+	}
+	return NULL;
+}
+
+int main(int argc, const char** argv)
+{
+	pthread_t thread;
+	uint64_t start;
+
+	rounds = (argc > 1) ? atoi(argv[1]) : 100000;
+
+	if (semaphore_create(mach_task_self(), &ping, SYNC_POLICY_FIFO, 0) != KERN_SUCCESS
+		|| semaphore_create(mach_task_self(), &pong, SYNC_POLICY_FIFO, 0) != KERN_SUCCESS)
+	{
+		fprintf(stderr, "semaphore_create failed\n");
+		return 1;
+	}
+
+	pthread_create(&thread, NULL, mach_ponger, NULL);
+	start = mach_absolute_time();
+	for (int i = 0; i < rounds; i++)
+	{
+		semaphore_signal(ping);
+		semaphore_wait(pong);
+	}
+	printf("mach semaphore:     %8.0f ns per round trip\n", elapsed_ns(start) / rounds);
+	pthread_join(thread, NULL);
+
+	semaphore_destroy(mach_task_self(), ping);
+	semaphore_destroy(mach_task_self(), pong);
+
+	dping = dispatch_semaphore_create(0);
+	dpong = dispatch_semaphore_create(0);
+
+	pthread_create(&thread, NULL, dispatch_ponger, NULL);
+	start = mach_absolute_time();
+	for (int i = 0; i < rounds; i++)
+	{
+		dispatch_semaphore_signal(dping);
+		dispatch_semaphore_wait(dpong, DISPATCH_TIME_FOREVER);
+	}
+	printf("dispatch semaphore: %8.0f ns per round trip\n", elapsed_ns(start) / rounds);
+	pthread_join(thread, NULL);
+
+	dispatch_release(dping);
+	dispatch_release(dpong);
+	return 0;
+}
@@ -0,0 +1,83 @@
+// Thread churn: creating and joining threads one after another,
+// then bursts of blocking work items on separate queues, which need a workqueue thread each
+// Usage: thread_create_join [threads]
+#include <dispatch/dispatch.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BURST 32
+
+static double elapsed_ns(uint64_t start)
+{
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (double)(mach_absolute_time() - start) * tb.numer / tb.denom;
+}
+
+static void* thread_body(void* arg)
+{
+	// touch a bit of stack, like any real thread would
+	volatile char buf[8192];
+	buf[0] = buf[sizeof(buf) - 1] = 1;
+	return arg;
+}
+
+int main(int argc, const char** argv)
+{
+	int count = (argc > 1) ? atoi(argv[1]) : 10000;
+	uint64_t start;
+
+	start = mach_absolute_time();
+	for (int i = 0; i < count; i++)
+	{
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, thread_body, NULL) != 0)
+		{
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+		pthread_join(thread, NULL);
+	}
+	printf("pthread create+join: %8.0f ns per thread\n", elapsed_ns(start) / count);
+
+	// every item in a burst blocks until the whole burst has started,
+	// so each burst needs BURST workers at once
+	dispatch_group_t group = dispatch_group_create();
+	int bursts = count / BURST;
+
+	if (bursts == 0)
+		bursts = 1;
+
+	start = mach_absolute_time();
+	for (int i = 0; i < bursts; i++)
+	{
+		dispatch_semaphore_t started = dispatch_semaphore_create(0);
+		dispatch_semaphore_t go = dispatch_semaphore_create(0);
+
+		for (int j = 0; j < BURST; j++)
+		{
+			dispatch_queue_t serial = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+			dispatch_group_async(group, serial, ^{
+				dispatch_semaphore_signal(started);
+				dispatch_semaphore_wait(go, DISPATCH_TIME_FOREVER);
+			});
+			dispatch_release(serial);
+		}
+
+		for (int j = 0; j < BURST; j++)
+			dispatch_semaphore_wait(started, DISPATCH_TIME_FOREVER);
+		for (int j = 0; j < BURST; j++)
+			dispatch_semaphore_signal(go);
+
+		dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+		dispatch_release(started);
+		dispatch_release(go);
+	}
+	printf("workqueue burst:     %8.0f ns per work item\n", elapsed_ns(start) / (bursts * BURST));
+
+	dispatch_release(group);
+	return 0;
+}
@@ -0,0 +1,174 @@
+// xtrace stress test: 64 threads making BSD syscalls and Mach traps at the same time,
+// with threads exiting and being replaced all along (so that xtrace's per-thread state gets recycled)
+// Usage: xtrace [options] xtrace_threads [rounds] > /dev/null
+// It exits with status 0 if every call succeeded, no Mach port was leaked and memory use stayed flat
+// across rounds (i.e. the memory xtrace allocated for exited threads was reused).
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 64
+#define CALLS_PER_THREAD 2000
+
+// how much memory use may grow between the first and the last round
+#define MAX_GROWTH (32 * 1024 * 1024)
+
+static int failures;
+
+static double elapsed_ns(uint64_t start)
+{
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (double)(mach_absolute_time() - start) * tb.numer / tb.denom;
+}
+
+static void fail(const char* what)
+{
+	if (__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED) < 10)
+		fprintf(stderr, "%s failed\n", what);
+}
+
+static mach_msg_type_number_t port_count(void)
+{
+	mach_port_name_array_t names;
+	mach_port_type_array_t types;
+	mach_msg_type_number_t name_count, type_count;
+
+	if (mach_port_names(mach_task_self(), &names, &name_count, &types, &type_count) != KERN_SUCCESS)
+	{
+		fail("mach_port_names");
+		return 0;
+	}
+
+	vm_deallocate(mach_task_self(), (vm_address_t) names, name_count * sizeof(names[0]));
+	vm_deallocate(mach_task_self(), (vm_address_t) types, type_count * sizeof(types[0]));
+	return name_count;
+}
+
+static mach_vm_size_t resident_size(void)
+{
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	mach_task_basic_info_data_t info;
+
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS)
+	{
+		fail("task_info");
+		return 0;
+	}
+	return info.resident_size;
+}
+
+static void* thread_body(void* arg)
+{
+	char path[64];
+	char buf[64] = { 0 };
+
+	snprintf(path, sizeof(path), "/tmp/xtrace_threads.%d.%ld", getpid(), (long) arg);
+
+	for (int i = 0; i < CALLS_PER_THREAD; i++)
+	{
+		switch (i % 4)
+		{
+			case 0:
+				getpid();
+				break;
+			case 1:
+			{
+				int fd = open(path, O_RDWR | O_CREAT, 0600);
+				if (fd < 0)
+				{
+					fail("open");
+					break;
+				}
+				if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+					fail("write");
+				close(fd);
+				break;
+			}
+			case 2:
+			{
+				mach_port_t port;
+				if (mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &port) != KERN_SUCCESS)
+				{
+					fail("mach_port_allocate");
+					break;
+				}
+				// the name only holds a receive right, which mach_port_deallocate() wouldn't release
+				if (mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1) != KERN_SUCCESS)
+					fail("mach_port_mod_refs");
+				break;
+			}
+			case 3:
+			{
+				// a MIG call, so the MIG decoders get used too
+				mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+				task_basic_info_data_t info;
+				if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS)
+					fail("task_info");
+				break;
+			}
+		}
+	}
+
+	unlink(path);
+	return NULL;
+}
+
+int main(int argc, const char** argv)
+{
+	int rounds = (argc > 1) ? atoi(argv[1]) : 8;
+	uint64_t start = mach_absolute_time();
+	mach_msg_type_number_t ports_before = port_count();
+	mach_vm_size_t first_round_size = 0;
+
+	if (rounds < 2)
+	{
+		fprintf(stderr, "Usage: %s [rounds (at least 2)]\n", argv[0]);
+		return 1;
+	}
+
+	for (int round = 0; round < rounds; round++)
+	{
+		pthread_t threads[THREADS];
+
+		for (long i = 0; i < THREADS; i++)
+		{
+			if (pthread_create(&threads[i], NULL, thread_body, (void*) i) != 0)
+			{
+				fprintf(stderr, "pthread_create failed\n");
+				return 1;
+			}
+		}
+		for (int i = 0; i < THREADS; i++)
+			pthread_join(threads[i], NULL);
+
+		if (round == 0)
+			first_round_size = resident_size();
+	}
+
+	fprintf(stderr, "%d threads x %d rounds: %8.0f ns per call\n", THREADS, rounds,
+		elapsed_ns(start) / ((double) THREADS * rounds * CALLS_PER_THREAD));
+
+	if (port_count() > ports_before)
+	{
+		fprintf(stderr, "Mach ports leaked: %u before, %u after\n", ports_before, port_count());
+		return 1;
+	}
+	if (resident_size() > first_round_size + MAX_GROWTH)
+	{
+		fprintf(stderr, "memory use grew from %llu to %llu bytes after the first round\n",
+			(unsigned long long) first_round_size, (unsigned long long) resident_size());
+		return 1;
+	}
+	if (failures != 0)
+	{
+		fprintf(stderr, "%d calls failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
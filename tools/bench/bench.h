@@ -0,0 +1,58 @@
+// Helpers shared by the benchmarks in this directory.
+// Unlike the tests in tests/src, these run on the Linux host and start `darling` themselves.
+// Each one is a single file that's built on its own, e.g.:
+//   cc -O2 -o mldr_launch mldr_launch.c
+#ifndef _BENCH_H
+#define _BENCH_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double bench_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Runs `argv` (looked up in PATH) with its stdin and stdout on /dev/null and returns how long it took.
+// `env` is a NULL-terminated list of "NAME=value" variables to set and "NAME" ones to unset (or NULL).
+// Exits if the command doesn't exit with status 0.
+static double bench_run(const char* const* argv, const char* const* env)
+{
+	double start = bench_now_ms();
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0)
+	{
+		int null_fd = open("/dev/null", O_RDWR);
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+
+		for (; env != NULL && *env != NULL; env++)
+		{
+			if (strchr(*env, '=') != NULL)
+				putenv((char*) *env);
+			else
+				unsetenv(*env);
+		}
+
+		execvp(argv[0], (char* const*) argv);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "%s %s failed\n", argv[0], argv[1]);
+		exit(1);
+	}
+
+	return bench_now_ms() - start;
+}
+
+#endif
@@ -0,0 +1,40 @@
+// darling launcher benchmark: times repeated `darling exec true` (run directly by shellspawn)
+// against `darling shell true` (run through a login shell)
+// Usage: darling_launch [runs] [darling]
+#include "bench.h"
+
+static void report(const char* label, const char* const* argv, int runs)
+{
+	double total = 0, best = 0;
+
+	for (int i = 0; i < runs; i++)
+	{
+		double ms = bench_run(argv, NULL);
+		total += ms;
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+
+	printf("%-20s %8.2f ms avg %8.2f ms min (%d runs)\n", label, total / runs, best, runs);
+}
+
+int main(int argc, const char** argv)
+{
+	int runs = (argc > 1) ? atoi(argv[1]) : 100;
+	const char* darling = (argc > 2) ? argv[2] : "darling";
+	const char* direct[] = { darling, "exec", "true", NULL };
+	const char* shell[] = { darling, "shell", "true", NULL };
+
+	if (runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [runs] [darling]\n", argv[0]);
+		return 1;
+	}
+
+	// make sure the container is up, so that its startup isn't part of the first run
+	bench_run(direct, NULL);
+
+	report("darling exec true", direct, runs);
+	report("darling shell true", shell, runs);
+	return 0;
+}
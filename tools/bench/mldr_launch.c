@@ -0,0 +1,131 @@
+// mldr launch benchmark: times cold and warm starts of a Darwin binary, with and without DARLING_PREFETCH profiles
+// (this is why it runs on the host: it needs to evict files from the host's page cache)
+// Usage: mldr_launch [-n runs] [-d darling] [-e evict-path]... <binary> [args...]
+// e.g.:  mldr_launch -e /usr/local/libexec/darling -e ~/.darling /usr/bin/true
+// Cold starts evict every file under the -e paths from the page cache first; without any -e paths, they drop all caches (which needs root).
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <ftw.h>
+#include "bench.h"
+
+#define MAX_EVICT_PATHS 16
+
+static const char* evict_paths[MAX_EVICT_PATHS];
+static int evict_path_count = 0;
+
+static int evict_file(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	if (type == FTW_F)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+static void evict(void)
+{
+	sync();
+
+	if (evict_path_count == 0)
+	{
+		int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+		if (fd < 0 || write(fd, "3", 1) != 1)
+		{
+			perror("Cannot drop caches (run as root or pass -e)");
+			exit(1);
+		}
+		close(fd);
+		return;
+	}
+
+	for (int i = 0; i < evict_path_count; i++)
+		nftw(evict_paths[i], evict_file, 64, FTW_PHYS);
+}
+
+static double run(const char* darling, const char* mode, char** command, int command_count)
+{
+	char env_arg[64];
+	const char* argv[command_count + 5];
+
+	snprintf(env_arg, sizeof(env_arg), "DARLING_PREFETCH=%s", mode);
+	argv[0] = darling;
+	argv[1] = "shell";
+	argv[2] = "env";
+	argv[3] = env_arg;
+	for (int i = 0; i < command_count; i++)
+		argv[4 + i] = command[i];
+	argv[4 + command_count] = NULL;
+
+	return bench_run(argv, NULL);
+}
+
+static void report(const char* darling, const char* label, const char* mode, bool cold, int runs, char** command, int command_count)
+{
+	double total = 0, best = 0;
+
+	for (int i = 0; i < runs; i++)
+	{
+		double ms;
+
+		if (cold)
+			evict();
+
+		ms = run(darling, mode, command, command_count);
+		total += ms;
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+
+	printf("%-12s %-5s %8.1f ms avg %8.1f ms min\n", label, cold ? "cold" : "warm", total / runs, best);
+}
+
+int main(int argc, char** argv)
+{
+	const char* darling = "darling";
+	int runs = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "+n:d:e:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				runs = atoi(optarg);
+				break;
+			case 'd':
+				darling = optarg;
+				break;
+			case 'e':
+				if (evict_path_count < MAX_EVICT_PATHS)
+					evict_paths[evict_path_count++] = optarg;
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (optind >= argc || runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [-n runs] [-d darling] [-e evict-path]... <binary> [args...]\n", argv[0]);
+		return 1;
+	}
+
+	// make sure the container is up, so that its startup isn't part of the first run
+	run(darling, "0", &argv[optind], argc - optind);
+
+	report(darling, "no prefetch", "0", true, runs, &argv[optind], argc - optind);
+	report(darling, "no prefetch", "0", false, runs, &argv[optind], argc - optind);
+
+	// record the profile from a cold start
+	evict();
+	run(darling, "record", &argv[optind], argc - optind);
+
+	report(darling, "prefetch", "1", true, runs, &argv[optind], argc - optind);
+	report(darling, "prefetch", "1", false, runs, &argv[optind], argc - optind);
+	return 0;
+}
@@ -0,0 +1,39 @@
+// prefix boot benchmark: times `darling shell true` against a prefix that was just shut down,
+// which includes launchd bootstrapping the prefix and launchctl loading its LaunchDaemons
+// Usage: prefix_boot [runs] [darling]
+// It uses the prefix from DPREFIX (or the default one), which must already be set up.
+#include "bench.h"
+
+int main(int argc, const char** argv)
+{
+	int runs = (argc > 1) ? atoi(argv[1]) : 10;
+	const char* darling = (argc > 2) ? argv[2] : "darling";
+	const char* boot[] = { darling, "shell", "true", NULL };
+	const char* shutdown[] = { darling, "shutdown", NULL };
+	double total = 0, best = 0, shutdown_total = 0;
+
+	if (runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [runs] [darling]\n", argv[0]);
+		return 1;
+	}
+
+	// the first boot may still be setting up or updating the prefix, so it isn't counted
+	bench_run(boot, NULL);
+
+	for (int i = 0; i < runs; i++)
+	{
+		double ms;
+
+		shutdown_total += bench_run(shutdown, NULL);
+		ms = bench_run(boot, NULL);
+
+		total += ms;
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+
+	printf("boot+run %8.1f ms avg %8.1f ms min   shutdown %8.1f ms avg (%d runs)\n",
+		total / runs, best, shutdown_total / runs, runs);
+	return 0;
+}
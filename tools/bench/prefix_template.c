@@ -0,0 +1,131 @@
+// prefix creation benchmark: times creating (and starting) a fresh prefix, then shutting it down and deleting it,
+// with and without DPREFIX_TEMPLATE
+// Usage: prefix_template [-n runs] [-d darling] <scratch-dir>
+// The scratch directory should be on the filesystem the template will be used on (reflinks need Btrfs, XFS, ...).
+#define _GNU_SOURCE
+#include <ftw.h>
+#include "bench.h"
+
+static const char* darling = "darling";
+
+static void run(const char* prefix, const char* template, const char* const* args)
+{
+	char prefix_env[4096 + 8], template_env[4096 + 17];
+	const char* env[] = { prefix_env, "DPREFIX_TEMPLATE", NULL };
+	const char* argv[8];
+	int argc = 0;
+
+	argv[argc++] = darling;
+	while (*args != NULL)
+		argv[argc++] = *args++;
+	argv[argc] = NULL;
+
+	snprintf(prefix_env, sizeof(prefix_env), "DPREFIX=%s", prefix);
+	if (template != NULL)
+	{
+		snprintf(template_env, sizeof(template_env), "DPREFIX_TEMPLATE=%s", template);
+		env[1] = template_env;
+	}
+
+	bench_run(argv, env);
+}
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	remove(path);
+	return 0;
+}
+
+static void remove_tree(const char* path)
+{
+	nftw(path, remove_entry, 64, FTW_PHYS | FTW_DEPTH);
+}
+
+static void remove_prefix(const char* prefix)
+{
+	char workdir[4096];
+
+	snprintf(workdir, sizeof(workdir), "%s.workdir", prefix);
+	remove_tree(prefix);
+	remove_tree(workdir);
+}
+
+static void destroy(const char* prefix)
+{
+	static const char* const shutdown[] = { "shutdown", NULL };
+
+	run(prefix, NULL, shutdown);
+	remove_prefix(prefix);
+}
+
+static void report(const char* label, const char* scratch, const char* template, int runs)
+{
+	static const char* const start[] = { "true", NULL };
+	double create_total = 0, destroy_total = 0;
+	char prefix[4096];
+
+	for (int i = 0; i < runs; i++)
+	{
+		double start_ms, created_ms;
+
+		snprintf(prefix, sizeof(prefix), "%s/prefix-%d", scratch, i);
+
+		start_ms = bench_now_ms();
+		run(prefix, template, start);
+		created_ms = bench_now_ms();
+		destroy(prefix);
+
+		create_total += created_ms - start_ms;
+		destroy_total += bench_now_ms() - created_ms;
+	}
+
+	printf("%-10s create+start %8.1f ms avg   shutdown+destroy %8.1f ms avg (%d runs)\n",
+		label, create_total / runs, destroy_total / runs, runs);
+}
+
+int main(int argc, char** argv)
+{
+	char source[4096], template[4096];
+	const char* template_args[] = { "template", template, NULL };
+	static const char* const start[] = { "true", NULL };
+	static const char* const shutdown[] = { "shutdown", NULL };
+	int runs = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				runs = atoi(optarg);
+				break;
+			case 'd':
+				darling = optarg;
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (optind != argc - 1 || runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [-n runs] [-d darling] <scratch-dir>\n", argv[0]);
+		return 1;
+	}
+
+	// set up a prefix the usual way, then make a template of it
+	snprintf(source, sizeof(source), "%s/source", argv[optind]);
+	snprintf(template, sizeof(template), "%s/template", argv[optind]);
+	remove_tree(template);
+
+	run(source, NULL, start);
+	run(source, NULL, shutdown);
+	run(source, NULL, template_args);
+
+	report("empty", argv[optind], NULL, runs);
+	report("template", argv[optind], template, runs);
+
+	remove_prefix(source);
+	remove_tree(template);
+	return 0;
+}